@@ -0,0 +1,324 @@
+/*
+ * checksum.c - Functions for computing image checksums.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_PCLMUL
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/*
+ The CRC32 is the reflected 0xEDB88320 one used by zip and the TL866II+
+ firmware files. The functions below work on the raw register: callers
+ start with 0xFFFFFFFF and invert the final value to get the usual CRC.
+ Large blocks are folded 64 bytes at a time with carry-less multiplies
+ when the CPU has them, the rest goes through slice-by-8 tables.
+ */
+
+static uint32_t crc32_table[8][256];
+static uint16_t crc16_table[256];
+static int tables_ready;
+#ifdef CRC32_PCLMUL
+static int has_pclmul;
+#endif
+
+static void init_tables(void) {
+  uint32_t i, j, c;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) c = (c >> 1) ^ (CRC32_POLYNOMIAL & (-(c & 1)));
+    crc32_table[0][i] = c;
+
+    c = i << 8;
+    for (j = 0; j < 8; j++)
+      c = (c << 1) ^ (c & 0x8000 ? CRC16_POLYNOMIAL : 0);
+    crc16_table[i] = c;
+  }
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      crc32_table[j][i] = (crc32_table[j - 1][i] >> 8) ^
+                          crc32_table[0][crc32_table[j - 1][i] & 0xff];
+
+#ifdef CRC32_PCLMUL
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    has_pclmul = (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+#endif
+  tables_ready = 1;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *data, size_t size) {
+  uint32_t lo, hi;
+
+  while (size >= 8) {
+    lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 |
+                (uint32_t)data[3] << 24);
+    hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+    crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff] ^
+          crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24] ^
+          crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff] ^
+          crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+    data += 8;
+    size -= 8;
+  }
+  while (size--) crc = crc32_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef CRC32_PCLMUL
+/*
+ Fold the data with carry-less multiplies, then reduce to 32 bits with a
+ Barrett reduction. The constants are the bit reflected x^n mod P(x)
+ values of the "Fast CRC Computation Using PCLMULQDQ Instruction" paper.
+ 'size' must be a multiple of 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_pclmul(
+    uint32_t crc, const uint8_t *data, size_t size) {
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x1, x2, x3, x4, t1, t2, t3, t4;
+
+  x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  data += 64;
+  size -= 64;
+
+  // Fold 64 bytes at a time
+  while (size >= 64) {
+    t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, t1),
+                       _mm_loadu_si128((const __m128i *)(data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, t2),
+                       _mm_loadu_si128((const __m128i *)(data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, t3),
+                       _mm_loadu_si128((const __m128i *)(data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, t4),
+                       _mm_loadu_si128((const __m128i *)(data + 0x30)));
+    data += 64;
+    size -= 64;
+  }
+
+  // Fold the four lanes and the remaining 16 byte blocks into one
+  x2 = _mm_xor_si128(x2, _mm_clmulepi64_si128(x1, k3k4, 0x00));
+  x1 = _mm_xor_si128(x2, _mm_clmulepi64_si128(x1, k3k4, 0x11));
+  x3 = _mm_xor_si128(x3, _mm_clmulepi64_si128(x1, k3k4, 0x00));
+  x1 = _mm_xor_si128(x3, _mm_clmulepi64_si128(x1, k3k4, 0x11));
+  x4 = _mm_xor_si128(x4, _mm_clmulepi64_si128(x1, k3k4, 0x00));
+  x1 = _mm_xor_si128(x4, _mm_clmulepi64_si128(x1, k3k4, 0x11));
+  while (size >= 16) {
+    x2 = _mm_loadu_si128((const __m128i *)data);
+    x2 = _mm_xor_si128(x2, _mm_clmulepi64_si128(x1, k3k4, 0x00));
+    x1 = _mm_xor_si128(x2, _mm_clmulepi64_si128(x1, k3k4, 0x11));
+    data += 16;
+    size -= 16;
+  }
+
+  // 128 to 64 bits
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5, 0x00), x2);
+
+  // Barrett reduction to 32 bits
+  x2 = _mm_and_si128(x1, mask);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+  if (!tables_ready) init_tables();
+#ifdef CRC32_PCLMUL
+  if (has_pclmul && size >= 64) {
+    size_t n = size & ~(size_t)15;
+    crc = crc32_pclmul(crc, data, n);
+    data += n;
+    size -= n;
+  }
+#endif
+  return crc32_slice8(crc, data, size);
+}
+
+// CRC16 CCITT, MSB first
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, size_t size) {
+  if (!tables_ready) init_tables();
+  while (size--) crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *data++];
+  return crc;
+}
+
+/* SHA-256, as specified in FIPS 180-4 */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t *state, const uint8_t *block) {
+  uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  size_t i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 |
+           block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  for (; i < 64; i++)
+    w[i] = w[i - 16] + w[i - 7] +
+           (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+           (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+  for (i = 0; i < 64; i++) {
+    t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+         sha256_k[i] + w[i];
+    t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+         ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void sha256_init(sha256_t *sha) {
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                      0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                      0x1f83d9ab, 0x5be0cd19};
+  memcpy(sha->state, initial, sizeof(initial));
+  sha->size = 0;
+}
+
+void sha256_update(sha256_t *sha, const uint8_t *data, size_t size) {
+  size_t used = sha->size & 63, n;
+
+  sha->size += size;
+  if (used) {
+    n = 64 - used < size ? 64 - used : size;
+    memcpy(sha->block + used, data, n);
+    data += n;
+    size -= n;
+    if (used + n < 64) return;
+    sha256_block(sha->state, sha->block);
+  }
+  for (; size >= 64; data += 64, size -= 64) sha256_block(sha->state, data);
+  memcpy(sha->block, data, size);
+}
+
+void sha256_final(sha256_t *sha, uint8_t *digest) {
+  size_t used = sha->size & 63, i;
+  uint64_t bits = sha->size * 8;
+
+  sha->block[used++] = 0x80;
+  if (used > 56) {
+    memset(sha->block + used, 0, 64 - used);
+    sha256_block(sha->state, sha->block);
+    used = 0;
+  }
+  memset(sha->block + used, 0, 56 - used);
+  for (i = 0; i < 8; i++) sha->block[56 + i] = bits >> (56 - i * 8);
+  sha256_block(sha->state, sha->block);
+  for (i = 0; i < 32; i++) digest[i] = sha->state[i / 4] >> (24 - (i & 3) * 8);
+}
+
+/* All the checksums at once */
+
+void checksum_init(checksum_t *checksum) {
+  checksum->size = 0;
+  checksum->crc32 = 0xFFFFFFFF;
+  checksum->crc16 = 0;
+  checksum->sum = 0;
+  sha256_init(&checksum->sha256);
+}
+
+void checksum_update(checksum_t *checksum, const uint8_t *data, size_t size) {
+  size_t i;
+  uint32_t sum = 0;
+
+  for (i = 0; i < size; i++) sum += data[i];
+  checksum->sum += sum;
+  checksum->size += size;
+  checksum->crc32 = crc32_update(checksum->crc32, data, size);
+  checksum->crc16 = crc16_update(checksum->crc16, data, size);
+  sha256_update(&checksum->sha256, data, size);
+}
+
+// Print the checksums, the running values are left untouched
+void checksum_print(checksum_t *checksum, const char *name) {
+  sha256_t sha = checksum->sha256;
+  uint8_t digest[SHA256_SIZE];
+  size_t i;
+
+  sha256_final(&sha, digest);
+  fprintf(stderr,
+          "%s checksums (%llu bytes): CRC32 0x%08X  CRC16 0x%04X  "
+          "Sum8 0x%02X  Sum16 0x%04X\n%s SHA-256: ",
+          name, (unsigned long long)checksum->size, ~checksum->crc32,
+          checksum->crc16, checksum->sum & 0xFF, checksum->sum & 0xFFFF,
+          name);
+  for (i = 0; i < SHA256_SIZE; i++) fprintf(stderr, "%02x", digest[i]);
+  fprintf(stderr, "\n");
+}
@@ -0,0 +1,54 @@
+/*
+ * checksum.h - Definitions and declarations for image checksums.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+#define CRC16_POLYNOMIAL 0x1021
+#define SHA256_SIZE 32
+
+typedef struct sha256 {
+  uint32_t state[8];
+  uint64_t size;
+  uint8_t block[64];
+} sha256_t;
+
+// All the checksums of an image, updated block by block
+typedef struct checksum {
+  uint64_t size;
+  uint32_t crc32;
+  uint16_t crc16;
+  uint32_t sum;  // byte sum, printed as 8 and 16 bit sums
+  sha256_t sha256;
+} checksum_t;
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, size_t size);
+
+void sha256_init(sha256_t *sha);
+void sha256_update(sha256_t *sha, const uint8_t *data, size_t size);
+void sha256_final(sha256_t *sha, uint8_t *digest);
+
+void checksum_init(checksum_t *checksum);
+void checksum_update(checksum_t *checksum, const uint8_t *data, size_t size);
+void checksum_print(checksum_t *checksum, const char *name);
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * compress.c - Transparent gzip and zstd file streams.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "compress.h"
+
+// Custom streams are needed to hook the codecs into a FILE.
+#if defined(__linux__) || defined(__GLIBC__)
+#define HAVE_FOPENCOOKIE
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+#define HAVE_FUNOPEN
+#endif
+
+#define STREAM_BUFFER_SIZE 65536
+
+typedef enum { CODEC_NONE = 0, CODEC_GZIP, CODEC_ZSTD } codec_t;
+
+static const char *codec_names[] = {"plain", "gzip", "zstd"};
+
+// Get the codec from the first bytes of a file
+static codec_t get_codec(uint8_t *magic, size_t size) {
+  if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return CODEC_GZIP;
+  if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+      magic[3] == 0xfd)
+    return CODEC_ZSTD;
+  return CODEC_NONE;
+}
+
+// Get the codec from the file name extension
+static codec_t get_codec_by_name(const char *filename) {
+  const char *ext = strrchr(filename, '.');
+  if (!ext) return CODEC_NONE;
+  if (!strcasecmp(ext, ".gz")) return CODEC_GZIP;
+  if (!strcasecmp(ext, ".zst") || !strcasecmp(ext, ".zstd")) return CODEC_ZSTD;
+  return CODEC_NONE;
+}
+
+// Check if a codec was compiled in
+static int codec_supported(codec_t codec) {
+#if !defined(HAVE_FOPENCOOKIE) && !defined(HAVE_FUNOPEN)
+  return codec == CODEC_NONE;
+#endif
+  switch (codec) {
+    case CODEC_NONE:
+      return 1;
+    case CODEC_GZIP:
+#ifdef HAVE_ZLIB
+      return 1;
+#endif
+      break;
+    case CODEC_ZSTD:
+#ifdef HAVE_ZSTD
+      return 1;
+#endif
+      break;
+  }
+  return 0;
+}
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+
+typedef struct stream {
+  FILE *file;
+  codec_t codec;
+  uint8_t writing;
+  uint8_t eof;
+  uint8_t done;
+  uint8_t *buffer;
+  size_t pos;
+  size_t len;
+#ifdef HAVE_ZLIB
+  z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zd;
+  ZSTD_CStream *zc;
+  size_t zret;  // of the last call that made progress, 0 after a frame
+#endif
+} stream_t;
+
+// Refill the input buffer from the underlying file
+static int stream_fill(stream_t *stream) {
+  if (stream->pos < stream->len || stream->eof) return 0;
+  stream->pos = 0;
+  stream->len = fread(stream->buffer, 1, STREAM_BUFFER_SIZE, stream->file);
+  if (ferror(stream->file)) return -1;
+  if (!stream->len) stream->eof = 1;
+  return 0;
+}
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size) {
+  stream_t *stream = cookie;
+  size_t out = 0;
+
+  while (out < size && !stream->done) {
+    if (stream_fill(stream)) return -1;
+    switch (stream->codec) {
+      case CODEC_NONE: {
+        size_t len = stream->len - stream->pos;
+        if (len > size - out) len = size - out;
+        memcpy(buf + out, stream->buffer + stream->pos, len);
+        stream->pos += len;
+        out += len;
+        if (stream->eof) stream->done = 1;
+        break;
+      }
+#ifdef HAVE_ZLIB
+      case CODEC_GZIP: {
+        size_t last = out;
+        stream->z.next_in = stream->buffer + stream->pos;
+        stream->z.avail_in = stream->len - stream->pos;
+        stream->z.next_out = (uint8_t *)buf + out;
+        stream->z.avail_out = size - out;
+        int ret = inflate(&stream->z, Z_NO_FLUSH);
+        out = size - stream->z.avail_out;
+        stream->pos = stream->len - stream->z.avail_in;
+        if (ret == Z_STREAM_END) {
+          // Concatenated gzip members are allowed
+          if (stream_fill(stream)) return -1;
+          if (stream->eof)
+            stream->done = 1;
+          else
+            inflateReset(&stream->z);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+          fprintf(stderr, "Error: bad gzip stream (%s).\n",
+                  stream->z.msg ? stream->z.msg : "unknown error");
+          return -1;
+        } else if (stream->eof && out == last) {
+          fprintf(stderr, "Error: truncated gzip stream.\n");
+          return -1;
+        }
+        break;
+      }
+#endif
+#ifdef HAVE_ZSTD
+      case CODEC_ZSTD: {
+        ZSTD_inBuffer in = {stream->buffer, stream->len, stream->pos};
+        ZSTD_outBuffer output = {buf, size, out};
+        size_t ret = ZSTD_decompressStream(stream->zd, &output, &in);
+        if (ZSTD_isError(ret)) {
+          fprintf(stderr, "Error: bad zstd stream (%s).\n",
+                  ZSTD_getErrorName(ret));
+          return -1;
+        }
+        // Without input a finished frame reports the next frame header
+        if (in.pos != stream->pos || output.pos != out) stream->zret = ret;
+        stream->pos = in.pos;
+        if (stream->eof && output.pos == out) {
+          // Nothing left to flush, the last frame must be complete
+          if (stream->zret) {
+            fprintf(stderr, "Error: truncated zstd stream.\n");
+            return -1;
+          }
+          stream->done = 1;
+        }
+        out = output.pos;
+        break;
+      }
+#endif
+      default:
+        return -1;
+    }
+  }
+  return out;
+}
+
+// Compress a block of data, flushing or finishing the stream if requested
+static int stream_compress(stream_t *stream, const char *buf, size_t size,
+                           int finish) {
+  size_t pending;
+  do {
+    switch (stream->codec) {
+#ifdef HAVE_ZLIB
+      case CODEC_GZIP: {
+        stream->z.next_in = (uint8_t *)buf;
+        stream->z.avail_in = size;
+        stream->z.next_out = stream->buffer;
+        stream->z.avail_out = STREAM_BUFFER_SIZE;
+        int ret = deflate(&stream->z, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_ERROR) return -1;
+        buf += size - stream->z.avail_in;
+        size = stream->z.avail_in;
+        stream->len = STREAM_BUFFER_SIZE - stream->z.avail_out;
+        pending = finish ? ret != Z_STREAM_END : !stream->z.avail_out;
+        break;
+      }
+#endif
+#ifdef HAVE_ZSTD
+      case CODEC_ZSTD: {
+        ZSTD_inBuffer in = {buf, size, 0};
+        ZSTD_outBuffer out = {stream->buffer, STREAM_BUFFER_SIZE, 0};
+        size_t ret = ZSTD_compressStream2(
+            stream->zc, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(ret)) return -1;
+        buf += in.pos;
+        size -= in.pos;
+        stream->len = out.pos;
+        pending = finish ? ret : out.pos == out.size;
+        break;
+      }
+#endif
+      default:
+        return -1;
+    }
+    if (stream->len &&
+        fwrite(stream->buffer, 1, stream->len, stream->file) != stream->len)
+      return -1;
+  } while (size || pending);
+  return 0;
+}
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t size) {
+  stream_t *stream = cookie;
+  if (stream_compress(stream, buf, size, 0)) {
+    fprintf(stderr, "Error writing the %s stream.\n",
+            codec_names[stream->codec]);
+    return -1;
+  }
+  return size;
+}
+
+static int stream_close(void *cookie) {
+  stream_t *stream = cookie;
+  int ret = 0;
+
+  if (stream->writing && stream_compress(stream, NULL, 0, 1)) {
+    fprintf(stderr, "Error writing the %s stream.\n",
+            codec_names[stream->codec]);
+    ret = -1;
+  }
+#ifdef HAVE_ZLIB
+  if (stream->codec == CODEC_GZIP) {
+    if (stream->writing)
+      deflateEnd(&stream->z);
+    else
+      inflateEnd(&stream->z);
+  }
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_freeDStream(stream->zd);
+  ZSTD_freeCStream(stream->zc);
+#endif
+  if (fclose(stream->file)) ret = -1;
+  free(stream->buffer);
+  free(stream);
+  return ret;
+}
+
+#ifdef HAVE_FUNOPEN
+static int stream_read_fn(void *cookie, char *buf, int size) {
+  return stream_read(cookie, buf, size);
+}
+
+static int stream_write_fn(void *cookie, const char *buf, int size) {
+  return stream_write(cookie, buf, size);
+}
+#endif
+
+// Set up a codec and wrap the stream into a FILE
+static FILE *stream_open(FILE *file, codec_t codec, int writing,
+                         uint8_t *prefix, size_t prefix_size) {
+  stream_t *stream = calloc(1, sizeof(stream_t));
+  FILE *wrapped = NULL;
+
+  if (stream) stream->buffer = malloc(STREAM_BUFFER_SIZE);
+  if (!stream || !stream->buffer) {
+    fprintf(stderr, "Out of memory!\n");
+    goto error;
+  }
+  stream->file = file;
+  stream->codec = codec;
+  stream->writing = writing;
+
+  // The bytes used to detect the codec are fed back first
+  if (prefix_size) memcpy(stream->buffer, prefix, prefix_size);
+  stream->len = prefix_size;
+
+  switch (codec) {
+#ifdef HAVE_ZLIB
+    case CODEC_GZIP:
+      // 15 + 16 writes a gzip header, 15 + 32 detects gzip or zlib
+      if ((writing ? deflateInit2(&stream->z, Z_DEFAULT_COMPRESSION,
+                                  Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+                   : inflateInit2(&stream->z, 15 + 32)) != Z_OK) {
+        fprintf(stderr, "Error initializing zlib.\n");
+        goto error;
+      }
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+      if (writing)
+        stream->zc = ZSTD_createCStream();
+      else
+        stream->zd = ZSTD_createDStream();
+      if (!stream->zc && !stream->zd) {
+        fprintf(stderr, "Error initializing zstd.\n");
+        goto error;
+      }
+      break;
+#endif
+    default:
+      break;
+  }
+
+#ifdef HAVE_FOPENCOOKIE
+  cookie_io_functions_t functions = {writing ? NULL : stream_read,
+                                     writing ? stream_write : NULL, NULL,
+                                     stream_close};
+  wrapped = fopencookie(stream, writing ? "w" : "r", functions);
+#else
+  wrapped = funopen(stream, writing ? NULL : stream_read_fn,
+                    writing ? stream_write_fn : NULL, NULL, stream_close);
+#endif
+  if (wrapped) return wrapped;
+  fprintf(stderr, "Error opening the %s stream.\n", codec_names[codec]);
+
+error:
+  if (stream) {
+#ifdef HAVE_ZSTD
+    ZSTD_freeDStream(stream->zd);
+    ZSTD_freeCStream(stream->zc);
+#endif
+    free(stream->buffer);
+    free(stream);
+  }
+  fclose(file);
+  return NULL;
+}
+#endif
+
+// Open a file for reading.
+// If the file starts with a gzip or zstd magic number the returned stream
+// decompresses it on the fly. An uncompressed file is returned as is; if
+// it can't be rewound, like a pipe, the bytes already read from it are
+// copied to 'peek' (COMPRESS_PEEK_SIZE bytes) and counted in 'peeked'.
+FILE *compress_open_read(FILE *file, int *compressed, uint8_t *peek,
+                         size_t *peeked) {
+  uint8_t magic[COMPRESS_PEEK_SIZE];
+  size_t len = fread(magic, 1, sizeof(magic), file);
+  codec_t codec = get_codec(magic, len);
+
+  *compressed = codec != CODEC_NONE;
+  *peeked = 0;
+  if (!codec_supported(codec)) {
+    fprintf(stderr,
+            "This is a %s compressed file but minipro was built without %s "
+            "support.\n",
+            codec_names[codec], codec_names[codec]);
+    fclose(file);
+    return NULL;
+  }
+
+  // Regular files are simply rewound, the caller keeps the bytes read
+  // from a pipe
+  if (codec == CODEC_NONE) {
+    if (fseek(file, 0, SEEK_SET)) {
+      memcpy(peek, magic, len);
+      *peeked = len;
+    }
+    return file;
+  }
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+  return stream_open(file, codec, 0, magic, len);
+#else
+  fprintf(stderr, "Can't read from a non seekable stream.\n");
+  fclose(file);
+  return NULL;
+#endif
+}
+
+// Wrap a file opened for writing into a compressor picked from the file
+// name extension (.gz, .zst or .zstd).
+FILE *compress_open_write(FILE *file, const char *filename) {
+  codec_t codec = get_codec_by_name(filename);
+  if (codec == CODEC_NONE) return file;
+  if (!codec_supported(codec)) {
+    fprintf(stderr, "Minipro was built without %s support.\n",
+            codec_names[codec]);
+    fclose(file);
+    return NULL;
+  }
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+  return stream_open(file, codec, 1, NULL, 0);
+#else
+  return file;
+#endif
+}
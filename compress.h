@@ -0,0 +1,32 @@
+/*
+ * compress.h - Definitions and declarations for compressed file streams.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Bytes read to find the compression of a file
+#define COMPRESS_PEEK_SIZE 4
+
+// Both functions take ownership of the file and close it on failure.
+FILE *compress_open_read(FILE *file, int *compressed, uint8_t *peek,
+                         size_t *peeked);
+FILE *compress_open_write(FILE *file, const char *filename);
+
+#endif
@@ -16,8 +16,20 @@
  */
 
 #include "database.h"
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef DATABASE_DIR
+#define DATABASE_DIR "/usr/local/share/minipro"
+#endif
 
 fuse_decl_t atmel_lock[] = {
     {.num_fuses = 0,
@@ -205,9 +217,12 @@ gal_config_t gal5_acw[] = {
      .acw_address = 0x10,
      .acw_size = 0x14}};
 
-device_t infoic_devices[] = {
-#include "infoic_devices.h"
-    {.name = NULL},
+device_db_t infoic_db = {
+#include "infoic_db.h"
+};
+
+device_index_t infoic_index = {
+#include "infoic_index.h"
 };
 
 device_t infoic_custom[] = {
@@ -215,9 +230,12 @@ device_t infoic_custom[] = {
     {.name = NULL},
 };
 
-device_t infoic2plus_devices[] = {
-#include "infoic2plus_devices.h"
-    {.name = NULL},
+device_db_t infoic2plus_db = {
+#include "infoic2plus_db.h"
+};
+
+device_index_t infoic2plus_index = {
+#include "infoic2plus_index.h"
 };
 
 device_t infoic2plus_custom[] = {
@@ -243,12 +261,22 @@ pin_map_t *get_pin_map(uint8_t index){
 	return &pin_map_table[index];
 }
 
-device_t *get_device_table(minipro_handle_t *handle) {
-  if (handle->version == MP_TL866IIPLUS) {
-    return &(infoic2plus_devices[0]);
-  }
-
-  return &(infoic_devices[0]);
+// Pins a pin map expects to make contact, bit n for ZIF pin n + 1
+int get_pin_mask(uint8_t index, uint64_t *mask){
+	static uint64_t masks[PIN_MAP_COUNT];
+	static uint8_t ready[PIN_MAP_COUNT];
+	if(index >= PIN_MAP_COUNT)
+		return EXIT_FAILURE;
+	if(!ready[index]){
+		uint64_t pins = 0;
+		for(int i = 0; i < 40; i++)
+			if(pin_map_table[index].mask[i])
+				pins |= 1ULL << i;
+		masks[index] = pins;
+		ready[index] = 1;
+	}
+	*mask = masks[index];
+	return EXIT_SUCCESS;
 }
 
 device_t *get_device_custom(minipro_handle_t *handle) {
@@ -259,37 +287,492 @@ device_t *get_device_custom(minipro_handle_t *handle) {
   return &(infoic_custom[0]);
 }
 
-device_t *get_device_by_name(minipro_handle_t *handle, const char *name) {
+int is_custom_device(minipro_handle_t *handle, device_t *device) {
+  device_t *custom;
+
+  for (custom = get_device_custom(handle); custom[0].name;
+       custom = &(custom[1])) {
+    if (custom == device) return 1;
+  }
+  return 0;
+}
+
+// Case insensitive FNV-1a hash of a device name.
+// Must match name_hash() in dumpic/json_to_devices.py
+static uint32_t name_hash(const char *name, uint32_t seed) {
+  uint32_t hash = 0x811c9dc5 ^ seed;
+  for (; *name; name++) {
+    hash ^= (uint8_t)tolower((uint8_t)*name);
+    hash *= 0x01000193;
+  }
+  return hash;
+}
+
+// A device database file mapped in memory
+typedef struct db_file {
+  int loaded;
+  int valid;
+  device_db_t db;
+  device_index_t index;
+} db_file_t;
+
+static db_file_t db_files[2];
+
+// Check that an array is inside the file and aligned
+static int db_array_ok(db_file_header_t *header, uint32_t offset,
+                       uint32_t count, size_t size) {
+  return !(offset & 7) && offset <= header->size &&
+         count <= (header->size - offset) / size;
+}
+
+// Check a GAL configuration, its UES and ACW fuses follow the fuse array
+static int db_gal_ok(uint8_t *base, db_file_header_t *header,
+                     db_file_config_t *entry) {
+  const uint16_t *acw_bits = (const uint16_t *)(base + entry->data);
+  uint32_t array = entry->fuses_size * entry->row_width;
+  size_t i;
+
+  if (!array || (entry->ues_size && entry->ues_address < array) ||
+      !db_array_ok(header, entry->data, entry->acw_size, sizeof(uint16_t)))
+    return 0;
+  for (i = 0; i < entry->acw_size; i++)
+    if (acw_bits[i] < array) return 0;
+  return 1;
+}
+
+// Build the configurations of a database file
+static void **load_db_configs(uint8_t *base, db_file_header_t *header) {
+  db_file_config_t *entry = (db_file_config_t *)(base + header->configs);
+  fuse_decl_t *fuses;
+  gal_config_t *gal;
+  const char **names;
+  uint32_t *offsets;
+  size_t i, j, count;
+  void **configs = calloc(header->config_count, sizeof(void *));
+
+  if (!configs) return NULL;
+  for (i = 0; i < header->config_count; i++, entry++) {
+    switch (entry->type) {
+      case DB_CONFIG_NONE:
+        break;
+      case DB_CONFIG_FUSES:
+        // Names follow the declaration in the same block
+        count = entry->num_fuses + entry->num_uids + (entry->num_locks & 0x7f);
+        if (!db_array_ok(header, entry->data, count, sizeof(uint32_t)))
+          goto fail;
+        fuses = calloc(1, sizeof(fuse_decl_t) + count * sizeof(char *));
+        if (!fuses) goto fail;
+        configs[i] = fuses;
+        names = (const char **)&fuses[1];
+        offsets = (uint32_t *)(base + entry->data);
+        for (j = 0; j < count; j++) {
+          if (offsets[j] >= header->names_size) goto fail;
+          names[j] = (const char *)base + header->names + offsets[j];
+        }
+        fuses->num_fuses = entry->num_fuses;
+        fuses->num_uids = entry->num_uids;
+        fuses->num_locks = entry->num_locks;
+        fuses->item_size = entry->item_size;
+        fuses->word = entry->word;
+        fuses->erase_num_fuses = entry->erase_num_fuses;
+        fuses->rev_mask = entry->rev_mask;
+        if (entry->num_fuses) fuses->fnames = names;
+        if (entry->num_uids) fuses->unames = names + entry->num_fuses;
+        if (entry->num_locks & 0x7f)
+          fuses->lnames = names + entry->num_fuses + entry->num_uids;
+        break;
+      case DB_CONFIG_GAL:
+        if (!db_gal_ok(base, header, entry)) goto fail;
+        gal = calloc(1, sizeof(gal_config_t));
+        if (!gal) goto fail;
+        configs[i] = gal;
+        gal->fuses_size = entry->fuses_size;
+        gal->row_width = entry->row_width;
+        gal->ues_address = entry->ues_address;
+        gal->ues_size = entry->ues_size;
+        gal->acw_address = entry->acw_address;
+        gal->acw_size = entry->acw_size;
+        gal->acw_bits = (uint16_t *)(base + entry->data);
+        break;
+      default:
+        goto fail;
+    }
+  }
+  return configs;
+
+fail:
+  for (i = 0; i < header->config_count; i++) free(configs[i]);
+  free(configs);
+  return NULL;
+}
+
+/*
+ Map a device database file. The tables are used in place, only the
+ header and the configurations are checked here, the device entries are
+ checked as they are used. Returns EXIT_FAILURE if the file is missing
+ or invalid.
+ */
+static int load_db_file(db_file_t *file, const char *name) {
+#ifdef _WIN32
+  return EXIT_FAILURE;
+#else
+  const char *dir = getenv("MINIPRO_DB_DIR");
+  char path[strlen(dir ? dir : DATABASE_DIR) + strlen(name) + 2];
+  db_file_header_t *header;
+  struct stat st;
+  uint8_t *base;
+  int fd;
+
+  sprintf(path, "%s/%s", dir ? dir : DATABASE_DIR, name);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return EXIT_FAILURE;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(db_file_header_t) ||
+      st.st_size > UINT32_MAX) {
+    close(fd);
+    minipro_log("Invalid database file %s, using the built-in one.\n", path);
+    return EXIT_FAILURE;
+  }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    minipro_log("Can't map the database file %s.\n", path);
+    return EXIT_FAILURE;
+  }
+
+  header = (db_file_header_t *)base;
+  if (memcmp(header->magic, DB_FILE_MAGIC, 4) ||
+      header->version != DB_FILE_VERSION ||
+      header->byte_order != DB_FILE_BYTE_ORDER ||
+      header->size != st.st_size ||
+      header->record_size != sizeof(device_record_t) ||
+      header->config_size != sizeof(db_file_config_t) ||
+      !header->names_size || header->config_count > 256 ||
+      header->sorted_count > header->count ||
+      header->id_count > header->count ||
+      (header->hash_size && !header->buckets) ||
+      !db_array_ok(header, header->names, header->names_size, 1) ||
+      base[header->names + header->names_size - 1] ||
+      !db_array_ok(header, header->name, header->count, sizeof(uint32_t)) ||
+      !db_array_ok(header, header->chip_id, header->count,
+                   sizeof(uint32_t)) ||
+      !db_array_ok(header, header->records, header->count,
+                   sizeof(device_record_t)) ||
+      !db_array_ok(header, header->configs, header->config_count,
+                   sizeof(db_file_config_t)) ||
+      !db_array_ok(header, header->disp, header->buckets,
+                   sizeof(uint32_t)) ||
+      !db_array_ok(header, header->slot, header->hash_size,
+                   sizeof(uint32_t)) ||
+      !db_array_ok(header, header->sorted, header->sorted_count,
+                   sizeof(uint32_t)) ||
+      !db_array_ok(header, header->ids, header->id_count, sizeof(uint32_t)) ||
+      !(file->db.configs = load_db_configs(base, header))) {
+    minipro_log("Invalid database file %s, using the built-in one.\n", path);
+    munmap(base, st.st_size);
+    return EXIT_FAILURE;
+  }
+
+  file->db.count = header->count;
+  file->db.names_size = header->names_size;
+  file->db.names = (const char *)base + header->names;
+  file->db.name = (const uint32_t *)(base + header->name);
+  file->db.chip_id = (const uint32_t *)(base + header->chip_id);
+  file->db.config_count = header->config_count;
+  file->db.records = (const device_record_t *)(base + header->records);
+  file->index.count = header->count;
+  file->index.buckets = header->buckets;
+  file->index.size = header->hash_size;
+  file->index.disp = (const uint32_t *)(base + header->disp);
+  file->index.slot = (const uint32_t *)(base + header->slot);
+  file->index.sorted_count = header->sorted_count;
+  file->index.sorted = (const uint32_t *)(base + header->sorted);
+  file->index.id_count = header->id_count;
+  file->index.ids = (const uint32_t *)(base + header->ids);
+  return EXIT_SUCCESS;
+#endif
+}
+
+// Database file of the handle, NULL to use the built-in table
+static db_file_t *get_db_file(minipro_handle_t *handle) {
+  int plus = handle->version == MP_TL866IIPLUS;
+  db_file_t *file = &db_files[plus];
+
+  if (!file->loaded) {
+    file->loaded = 1;
+    file->valid =
+        !load_db_file(file, plus ? "infoic2plus.mpdb" : "infoic.mpdb");
+  }
+  return file->valid ? file : NULL;
+}
+
+static device_db_t *get_device_db(minipro_handle_t *handle) {
+  db_file_t *file = get_db_file(handle);
+  if (file) return &file->db;
+  if (handle->version == MP_TL866IIPLUS) return &infoic2plus_db;
+  return &infoic_db;
+}
+
+// Index of the device table, NULL if it doesn't match the table
+static device_index_t *get_device_index(minipro_handle_t *handle) {
+  db_file_t *file = get_db_file(handle);
+  device_index_t *index = handle->version == MP_TL866IIPLUS
+                              ? &infoic2plus_index
+                              : &infoic_index;
+  if (file) return &file->index;
+  return index->count == get_device_db(handle)->count ? index : NULL;
+}
+
+// Name of a table entry, entries of database files are checked here
+static inline const char *db_name(device_db_t *db, uint32_t i) {
+  if (i >= db->count || db->name[i] >= db->names_size) return "";
+  return db->names + db->name[i];
+}
+
+static inline uint32_t db_chip_id(device_db_t *db, uint32_t i) {
+  return i < db->count ? db->chip_id[i] : 0;
+}
+
+/*
+ Expand a packed table entry to a device_t or return the cached one.
+ Handles keep pointers to the expanded devices, so they are kept for the
+ process lifetime.
+ */
+static device_t *expand_device(device_db_t *db, uint32_t i) {
+  const device_record_t *record;
   device_t *device;
 
-    for (device = get_device_custom(handle); device[0].name;
-       device = &(device[1])) {
-    if (!strcasecmp(name, device->name)) return (device);
+  if (i >= db->count) return NULL;
+  if (!db->expanded) {
+    db->expanded = calloc(db->count, sizeof(device_t *));
+    if (!db->expanded) return NULL;
+  }
+  if (db->expanded[i]) return db->expanded[i];
+  record = &db->records[i];
+  if (record->config >= db->config_count) return NULL;
+
+  device = malloc(sizeof(device_t));
+  if (!device) return NULL;
+  device->name = db_name(db, i);
+  device->protocol_id = record->protocol_id;
+  device->variant = record->variant;
+  device->read_buffer_size = record->read_buffer_size;
+  device->write_buffer_size = record->write_buffer_size;
+  device->code_memory_size = record->code_memory_size;
+  device->data_memory_size = record->data_memory_size;
+  device->data_memory2_size = record->data_memory2_size;
+  device->chip_id = db->chip_id[i];
+  device->chip_id_bytes_count = record->chip_id_bytes_count;
+  device->opts1 = record->opts1;
+  device->opts2 = record->opts2;
+  device->opts3 = record->opts3;
+  device->opts4 = record->opts4;
+  device->opts5 = record->opts5;
+  device->opts6 = record->opts6;
+  device->opts7 = record->opts7;
+  device->opts8 = record->opts8;
+  device->package_details = record->package_details;
+  device->config = db->configs[record->config];
+  db->expanded[i] = device;
+  return device;
+}
+
+// Search the device table only, custom devices excluded
+device_t *get_table_device_by_name(minipro_handle_t *handle,
+                                   const char *name) {
+  device_db_t *db = get_device_db(handle);
+  device_index_t *index = get_device_index(handle);
+  uint32_t i, slot;
+
+  if (index) {
+    if (!index->size) return NULL;
+    slot = index->disp[name_hash(name, 0) % index->buckets];
+    slot = index->slot[name_hash(name, slot) % index->size];
+    return strcasecmp(name, db_name(db, slot)) ? NULL
+                                               : expand_device(db, slot);
   }
 
-  for (device = get_device_table(handle); device[0].name;
+  // Stale index, fall back to a linear search
+  for (i = 0; i < db->count; i++) {
+    if (!strcasecmp(name, db_name(db, i))) return expand_device(db, i);
+  }
+  return NULL;
+}
+
+device_t *get_device_by_name(minipro_handle_t *handle, const char *name) {
+  device_t *device;
+
+  // Custom devices override the device table
+  for (device = get_device_custom(handle); device[0].name;
        device = &(device[1])) {
     if (!strcasecmp(name, device->name)) return (device);
   }
-  return NULL;
+  return get_table_device_by_name(handle, name);
 }
 
-const char *get_device_from_id(minipro_handle_t *handle, uint32_t id,
-                               uint8_t protocol) {
+static int compare_names(const void *n1, const void *n2) {
+  return strcasecmp(*(const char **)n1, *(const char **)n2);
+}
+
+/*
+ Return the device names sorted case insensitively without duplicates,
+ custom devices included. The list must be freed by the caller.
+ */
+const char **get_device_names(minipro_handle_t *handle, size_t *count) {
   device_t *device;
+  device_db_t *db = get_device_db(handle);
+  device_index_t *index = get_device_index(handle);
+  const char **names, **custom;
+  size_t custom_count = 0, table_count = 0, i, j, k;
+
+  for (device = get_device_custom(handle); device[0].name;
+       device = &(device[1]))
+    custom_count++;
+  table_count = index ? index->sorted_count : db->count;
+
+  names = malloc((table_count + custom_count + 1) * sizeof(char *));
+  custom = malloc((custom_count + 1) * sizeof(char *));
+  if (!names || !custom) {
+    free(names);
+    free(custom);
+    return NULL;
+  }
 
-    for (device = get_device_custom(handle); device[0].name;
+  // Custom devices not overriding a table device
+  custom_count = 0;
+  for (device = get_device_custom(handle); device[0].name;
        device = &(device[1])) {
-    if (device->chip_id == id && device->protocol_id == protocol &&
-        device->chip_id && device->chip_id_bytes_count)
-      return (device->name);
+    if (!get_table_device_by_name(handle, device->name))
+      custom[custom_count++] = device->name;
+  }
+  qsort(custom, custom_count, sizeof(char *), compare_names);
+
+  if (index) {
+    for (i = 0; i < table_count; i++) names[i] = db_name(db, index->sorted[i]);
+  } else {
+    // Stale index, sort the table here
+    for (i = 0; i < table_count; i++) names[i] = db_name(db, i);
+    qsort(names, table_count, sizeof(char *), compare_names);
+  }
+
+  // Merge the custom names from the end
+  i = table_count;
+  j = custom_count;
+  k = table_count + custom_count;
+  while (j) {
+    if (i && strcasecmp(names[i - 1], custom[j - 1]) > 0)
+      names[--k] = names[--i];
+    else
+      names[--k] = custom[--j];
+  }
+  free(custom);
+
+  // Drop the duplicates
+  for (i = j = 0; i < table_count + custom_count; i++) {
+    if (!j || strcasecmp(names[j - 1], names[i])) names[j++] = names[i];
   }
+  *count = j;
+  return names;
+}
+
+// Append a device to a list growing as needed
+static int add_device(device_t ***list, size_t *count, size_t *size,
+                      device_t *device) {
+  device_t **tmp;
+  if (*count == *size) {
+    tmp = realloc(*list, (*size ? *size * 2 : 8) * sizeof(device_t *));
+    if (!tmp) return EXIT_FAILURE;
+    *list = tmp;
+    *size = *size ? *size * 2 : 8;
+  }
+  (*list)[(*count)++] = device;
+  return EXIT_SUCCESS;
+}
+
+static int compare_slots(const void *s1, const void *s2) {
+  uint32_t i1 = *(const uint32_t *)s1, i2 = *(const uint32_t *)s2;
+  return i1 < i2 ? -1 : i1 > i2;
+}
 
-  for (device = get_device_table(handle); device[0].name;
+/*
+ Return all the devices having the given chip id, custom devices first
+ then the device table in table order. Devices without a chip id are
+ never returned. The list must be freed by the caller.
+ */
+device_t **get_devices_by_id(minipro_handle_t *handle, uint32_t id,
+                             size_t *count) {
+  device_t *device;
+  device_db_t *db = get_device_db(handle);
+  device_index_t *index = get_device_index(handle);
+  device_t **list = NULL;
+  uint32_t *slots = NULL;
+  size_t size = 0, first, last, middle, i;
+
+  *count = 0;
+  if (!id) return NULL;
+  for (device = get_device_custom(handle); device[0].name;
        device = &(device[1])) {
-    if (device->chip_id == id && device->protocol_id == protocol &&
-        device->chip_id && device->chip_id_bytes_count)
-      return (device->name);
+    if (device->chip_id == id && device->chip_id_bytes_count &&
+        add_device(&list, count, &size, device))
+      goto fail;
   }
+
+  if (index) {
+    // Binary search the first indexed device with this chip id
+    first = 0;
+    last = index->id_count;
+    while (first < last) {
+      middle = (first + last) / 2;
+      if (db_chip_id(db, index->ids[middle]) < id)
+        first = middle + 1;
+      else
+        last = middle;
+    }
+    for (last = first;
+         last < index->id_count && db_chip_id(db, index->ids[last]) == id;
+         last++)
+      ;
+    if (first == last) return list;
+
+    // Indexed devices are sorted by protocol id, restore the table order
+    slots = malloc((last - first) * sizeof(uint32_t));
+    if (!slots) goto fail;
+    memcpy(slots, &index->ids[first], (last - first) * sizeof(uint32_t));
+    qsort(slots, last - first, sizeof(uint32_t), compare_slots);
+    for (i = 0; i < last - first; i++) {
+      device = expand_device(db, slots[i]);
+      if (!device || add_device(&list, count, &size, device)) goto fail;
+    }
+    free(slots);
+  } else {
+    // Stale index, fall back to a linear search
+    for (i = 0; i < db->count; i++) {
+      if (db->chip_id[i] != id || !db->records[i].chip_id_bytes_count)
+        continue;
+      device = expand_device(db, i);
+      if (!device || add_device(&list, count, &size, device)) goto fail;
+    }
+  }
+  return list;
+
+fail:
+  free(slots);
+  free(list);
+  *count = 0;
   return NULL;
 }
+
+const char *get_device_from_id(minipro_handle_t *handle, uint32_t id,
+                               uint8_t protocol) {
+  const char *name = NULL;
+  size_t i, count;
+  device_t **list = get_devices_by_id(handle, id, &count);
+
+  for (i = 0; i < count; i++) {
+    if (list[i]->protocol_id == protocol) {
+      name = list[i]->name;
+      break;
+    }
+  }
+  free(list);
+  return name;
+}
@@ -45,6 +45,118 @@ typedef struct gal_config {
   uint16_t *acw_bits;    // acw bits order
 } gal_config_t;
 
+// Generated index of a device table.
+// A minimal perfect hash of the device names, the device names sorted
+// case insensitively and the devices having a chip id, sorted by chip id
+// and protocol id.
+typedef struct device_index {
+  uint32_t count;    // entries of the indexed device table
+  uint32_t buckets;  // displacement buckets
+  uint32_t size;     // hash slots
+  const uint32_t *disp;
+  const uint32_t *slot;
+  uint32_t sorted_count;
+  const uint32_t *sorted;
+  uint32_t id_count;
+  const uint32_t *ids;
+} device_index_t;
+
+// Packed device table entry, the device_t fields without the name, the
+// chip id and the config pointer
+typedef struct device_record {
+  uint32_t code_memory_size;
+  uint32_t data_memory_size;
+  uint32_t data_memory2_size;
+  uint32_t opts3;
+  uint32_t opts4;
+  uint32_t opts5;
+  uint32_t opts6;
+  uint32_t opts8;
+  uint32_t package_details;
+  uint16_t read_buffer_size;
+  uint16_t write_buffer_size;
+  uint16_t opts1;
+  uint16_t opts2;
+  uint16_t opts7;
+  uint8_t protocol_id;
+  uint8_t variant;
+  uint8_t chip_id_bytes_count;
+  uint8_t config;  // index in the configs table
+} device_record_t;
+
+// Generated packed device table.
+// Names are stored in a single pool and the fields searched by the
+// lookups in their own arrays. Entries are expanded to a device_t on
+// demand.
+typedef struct device_db {
+  uint32_t count;
+  uint32_t names_size;
+  const char *names;     // NUL separated device names
+  const uint32_t *name;  // name offsets in the pool
+  const uint32_t *chip_id;
+  uint32_t config_count;
+  void **configs;
+  const device_record_t *records;
+  device_t **expanded;  // devices expanded so far, by entry
+} device_db_t;
+
+/*
+ Device database file, generated by dumpic/json_to_devices.py --binary.
+ It holds a packed device table, its index and the configurations used by
+ the devices, and is mapped as is. Offsets are from the start of the file,
+ arrays are 8 bytes aligned and use the host byte order.
+ */
+#define DB_FILE_MAGIC "MPDB"
+#define DB_FILE_VERSION 1
+#define DB_FILE_BYTE_ORDER 0x0102
+
+typedef struct db_file_header {
+  char magic[4];
+  uint16_t version;
+  uint16_t byte_order;  // DB_FILE_BYTE_ORDER in the file byte order
+  uint32_t size;        // file size
+  uint32_t record_size;
+  uint32_t config_size;
+  uint32_t count;
+  uint32_t names;  // names pool, device and configuration names
+  uint32_t names_size;
+  uint32_t name;  // name offsets of the devices
+  uint32_t chip_id;
+  uint32_t records;
+  uint32_t config_count;
+  uint32_t configs;
+  uint32_t buckets;  // device index, see device_index_t
+  uint32_t hash_size;
+  uint32_t disp;
+  uint32_t slot;
+  uint32_t sorted_count;
+  uint32_t sorted;
+  uint32_t id_count;
+  uint32_t ids;
+} db_file_header_t;
+
+enum { DB_CONFIG_NONE, DB_CONFIG_FUSES, DB_CONFIG_GAL };
+
+typedef struct db_file_config {
+  uint32_t type;
+  // fuse_decl_t
+  uint8_t num_fuses;
+  uint8_t num_uids;
+  uint8_t num_locks;
+  uint8_t item_size;
+  uint8_t word;
+  uint8_t erase_num_fuses;
+  uint8_t rev_mask;
+  // gal_config_t
+  uint8_t fuses_size;
+  uint8_t row_width;
+  uint8_t ues_size;
+  uint8_t acw_address;
+  uint8_t acw_size;
+  uint16_t ues_address;
+  uint32_t data;  // fuse, uid and lock name offsets, or the acw bits
+} db_file_config_t;
+
 typedef struct pin_map {
 	uint8_t zero_c;
 	uint8_t zero_t [4];
@@ -52,10 +164,16 @@ typedef struct pin_map {
 } pin_map_t;
 
 pin_map_t *get_pin_map(uint8_t index);
+int get_pin_mask(uint8_t index, uint64_t *mask);
 uint32_t get_pin_count(device_t *device);
-device_t *get_device_table(minipro_handle_t *handle);
 device_t *get_device_custom(minipro_handle_t *handle);
+int is_custom_device(minipro_handle_t *handle, device_t *device);
 device_t *get_device_by_name(minipro_handle_t *handle, const char *name);
+device_t *get_table_device_by_name(minipro_handle_t *handle,
+                                   const char *name);
+const char **get_device_names(minipro_handle_t *handle, size_t *count);
+device_t **get_devices_by_id(minipro_handle_t *handle, uint32_t id,
+                             size_t *count);
 const char *get_device_from_id(minipro_handle_t *handle, uint32_t id,
                                uint8_t protocol);
 #endif
@@ -4,6 +4,8 @@ from __future__ import print_function
 
 import json
 import argparse
+import re
+import struct
 import sys
 
 pic_devid_lookup = {
@@ -1018,7 +1020,7 @@ def print_entry(ic, fd):
         if int(ic['chip_id_bytes_count']) > 0:
             if 'id_shift' not in ic:
                 print('Missing "id_shift" for {}'.format(ic['name']))
-                return
+                return None
             chip_id = pic_devid_lookup[ic['name'].split()[0]] >> ic['id_shift']
 
     print("{", file=fd)
@@ -1043,17 +1045,350 @@ def print_entry(ic, fd):
     if 'fuses' in ic:
         print('\t.fuses = {},'.format(ic['fuses']), file=fd)
     print("},", file=fd)
+    dev = {'name': ic['name'].strip(), 'chip_id': chip_id,
+           'config': ic.get('fuses', 'NULL')}
+    for field, _ in record_fields:
+        if field not in dev:
+            dev[field] = ic.get(field, 0)
+    return dev
+
+# Case insensitive FNV-1a hash, must match name_hash() in database.c
+def name_hash(name, seed):
+    h = 0x811C9DC5 ^ seed
+    for c in bytearray(name.encode('latin-1')):
+        if 0x41 <= c <= 0x5A:
+            c |= 0x20
+        h = ((h ^ c) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+# Build a minimal perfect hash of the device names (hash and displace).
+# Names are first split in buckets, then each bucket, biggest first,
+# gets the first seed which maps all its names to free slots.
+def build_hash(names):
+    keys = []
+    seen = set()
+    for index, name in enumerate(names):
+        # Only the first of names differing in case can be found
+        if name.lower() not in seen:
+            seen.add(name.lower())
+            keys.append((name, index))
+
+    size = len(keys)
+    count = max(1, (size + 3) // 4)
+    buckets = [[] for _ in range(count)]
+    for key in keys:
+        buckets[name_hash(key[0], 0) % count].append(key)
+
+    disp = [0] * count
+    slots = [None] * size
+    for b in sorted(range(count), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        seed = 1
+        while True:
+            pos = [name_hash(name, seed) % size for name, _ in buckets[b]]
+            if len(set(pos)) == len(pos) and all(slots[p] is None for p in pos):
+                break
+            seed += 1
+        disp[b] = seed
+        for (_, index), p in zip(buckets[b], pos):
+            slots[p] = index
+    return disp, slots
+
+# Sort key matching strcasecmp()
+def name_key(name):
+    return bytes(bytearray(c | 0x20 if 0x41 <= c <= 0x5A else c
+                           for c in bytearray(name.encode('latin-1'))))
+
+# Device names sorted case insensitively, only the first of names
+# differing in case is kept
+def build_sorted(names):
+    keys = {}
+    for index, name in enumerate(names):
+        keys.setdefault(name_key(name), index)
+    return [keys[key] for key in sorted(keys)]
+
+def print_array(values, fd):
+    for i in range(0, len(values), 8):
+        print('\t' + ' '.join('{},'.format(v) for v in values[i:i + 8]), file=fd)
+
+# Devices having a chip id sorted by chip id, then protocol id.
+# Equal keys keep the table order.
+def build_ids(devices):
+    ids = [i for i, dev in enumerate(devices)
+           if dev['chip_id'] and dev['chip_id_bytes_count']]
+    return sorted(ids, key=lambda i: (devices[i]['chip_id'],
+                                      devices[i]['protocol_id'], i))
+
+def print_index(devices, fd):
+    names = [dev['name'] for dev in devices]
+    disp, slots = build_hash(names)
+    ids = build_ids(devices)
+    names_sorted = build_sorted(names)
+    print('/* Generated by json_to_devices.py, do not edit. */', file=fd)
+    print('.count = {},'.format(len(names)), file=fd)
+    print('.buckets = {},'.format(len(disp) if slots else 0), file=fd)
+    print('.size = {},'.format(len(slots)), file=fd)
+    print('.disp = (const uint32_t[]){', file=fd)
+    print_array(disp if slots else [0], fd)
+    print('},', file=fd)
+    print('.slot = (const uint32_t[]){', file=fd)
+    print_array(slots if slots else [0], fd)
+    print('},', file=fd)
+    print('.sorted_count = {},'.format(len(names_sorted)), file=fd)
+    print('.sorted = (const uint32_t[]){', file=fd)
+    print_array(names_sorted if names_sorted else [0], fd)
+    print('},', file=fd)
+    print('.id_count = {},'.format(len(ids)), file=fd)
+    print('.ids = (const uint32_t[]){', file=fd)
+    print_array(ids if ids else [0], fd)
+    print('},', file=fd)
+
+# Fields of an already generated devices file
+def read_devices(filename):
+    devices = []
+    with open(filename) as f:
+        for entry in re.findall(r'\{[^{}]*\.name\s*=[^{}]*\}', f.read()):
+            dev = {'name': re.search(r'\.name\s*=\s*"([^"]*)"', entry).group(1),
+                   'chip_id': 0, 'config': 'NULL'}
+            for field, _ in record_fields:
+                dev[field] = 0
+            for field, value in re.findall(r'\.(\w+)\s*=\s*(\w+)', entry):
+                if field == 'config':
+                    dev[field] = value
+                elif field in dev:
+                    dev[field] = int(value, 0)
+            devices.append(dev)
+    return devices
+
+# Packed device table fields and their sizes, widest first to avoid padding.
+# Must match device_record_t in database.h
+record_fields = [
+    ('code_memory_size', 4), ('data_memory_size', 4),
+    ('data_memory2_size', 4), ('opts3', 4), ('opts4', 4), ('opts5', 4),
+    ('opts6', 4), ('opts8', 4), ('package_details', 4),
+    ('read_buffer_size', 2), ('write_buffer_size', 2), ('opts1', 2),
+    ('opts2', 2), ('opts7', 2), ('protocol_id', 1), ('variant', 1),
+    ('chip_id_bytes_count', 1)]
+
+# Packed device table: a pool of the device names, the fields searched by
+# the lookups in their own arrays and the other fields as packed records
+# with an index in a configuration table instead of a pointer.
+def pack_devices(devices):
+    configs = ['NULL']
+    offset = 0
+    offsets = []
+    for dev in devices:
+        if '\\' in dev['name'] or '"' in dev['name']:
+            sys.exit('Unsupported device name: {}'.format(dev['name']))
+        offsets.append(offset)
+        offset += len(dev['name'].encode('latin-1')) + 1
+        if dev['config'] not in configs:
+            configs.append(dev['config'])
+        for field, size in record_fields:
+            if dev[field] >> (8 * size):
+                sys.exit('{} of {} does not fit in {} bytes'.format(
+                    field, dev['name'], size))
+    if len(configs) > 256:
+        sys.exit('Too many device configurations')
+    return configs, offsets, offset
+
+def print_packed(devices, fd):
+    configs, offsets, offset = pack_devices(devices)
+
+    print('/* Generated by json_to_devices.py, do not edit. */', file=fd)
+    print('.count = {},'.format(len(devices)), file=fd)
+    print('.names_size = {},'.format(offset + 1), file=fd)
+    print('.names =', file=fd)
+    for dev in devices:
+        print('\t"{}\\0"'.format(dev['name']), file=fd)
+    print('\t"",', file=fd)
+    print('.name = (const uint32_t[]){', file=fd)
+    print_array(offsets if offsets else [0], fd)
+    print('},', file=fd)
+    print('.chip_id = (const uint32_t[]){', file=fd)
+    print_array(['0x{:X}'.format(dev['chip_id']) for dev in devices] or [0], fd)
+    print('},', file=fd)
+    print('.config_count = {},'.format(len(configs)), file=fd)
+    print('.configs = (void *[]){', file=fd)
+    print('\t' + ', '.join(configs) + ',', file=fd)
+    print('},', file=fd)
+    print('.records = (const device_record_t[]){', file=fd)
+    for dev in devices:
+        values = ['.{} = 0x{:X}'.format(field, dev[field])
+                  for field, _ in record_fields if dev[field]]
+        if dev['config'] != 'NULL':
+            values.append('.config = {}'.format(configs.index(dev['config'])))
+        print('\t{' + ', '.join(values) + '},', file=fd)
+    if not devices:
+        print('\t{0},', file=fd)
+    print('},', file=fd)
+
+# Configurations defined in database.c, name -> (type, fields)
+def read_configs(filename):
+    configs = {}
+    with open(filename) as f:
+        source = f.read()
+    for kind, name, body in re.findall(
+            r'(fuse_decl_t|gal_config_t)\s+(\w+)\[\]\s*=\s*\{\s*\{(.*?)\}\s*\};',
+            source, re.S):
+        fields = {}
+        for field, value in re.findall(
+                r'\.(\w+)\s*=\s*(\([^)]*\)\s*\{[^}]*\}|[^,]+)', body):
+            value = value.strip()
+            if value.startswith('('):
+                items = value[value.index('{') + 1:value.rindex('}')]
+                if 'char' in value:
+                    fields[field] = re.findall(r'"([^"]*)"', items)
+                else:
+                    fields[field] = [int(v, 0) for v in items.replace(',', ' ').split()]
+            elif value == 'NULL':
+                fields[field] = []
+            else:
+                fields[field] = int(value, 0)
+        configs[name] = (kind, fields)
+    return configs
+
+def align8(data):
+    data.extend(bytearray(-len(data) % 8))
+
+# Binary device database, see db_file_header_t in database.h
+def write_binary(devices, config_source, fd):
+    header_fields = ['size', 'record_size', 'config_size', 'count', 'names',
+                     'names_size', 'name', 'chip_id', 'records',
+                     'config_count', 'configs', 'buckets', 'hash_size',
+                     'disp', 'slot', 'sorted_count', 'sorted', 'id_count',
+                     'ids']
+    record_format = '<' + ''.join({4: 'I', 2: 'H', 1: 'B'}[size]
+                                  for _, size in record_fields) + 'B2x'
+    config_format = '<I12BH2xI'
+
+    configs, offsets, offset = pack_devices(devices)
+    definitions = read_configs(config_source)
+    names = bytearray()
+    for dev in devices:
+        names += dev['name'].encode('latin-1') + b'\0'
+
+    # Configuration entries and their data, names go in the pool
+    entries = []
+    config_data = []
+    for config in configs:
+        if config == 'NULL':
+            entries.append((0, [0] * 12, 0, None))
+            continue
+        if config not in definitions:
+            sys.exit('Configuration {} not found in {}'.format(config, config_source))
+        kind, fields = definitions[config]
+        get = lambda field: fields.get(field, 0)
+        if kind == 'fuse_decl_t':
+            strings = []
+            for field, count in (('fnames', get('num_fuses')),
+                                 ('unames', get('num_uids')),
+                                 ('lnames', get('num_locks') & 0x7F)):
+                if len(fields.get(field, [])) != count:
+                    sys.exit('{} of {} should have {} names'.format(field, config, count))
+                strings += fields.get(field, [])
+            data = []
+            for string in strings:
+                data.append(len(names))
+                names += string.encode('latin-1') + b'\0'
+            entries.append((1, [get('num_fuses'), get('num_uids'),
+                                get('num_locks'), get('item_size'),
+                                get('word'), get('erase_num_fuses'),
+                                get('rev_mask'), 0, 0, 0, 0, 0], 0,
+                            struct.pack('<{}I'.format(len(data)), *data)))
+        else:
+            bits = fields.get('acw_bits', [])
+            entries.append((2, [0] * 7 + [get('fuses_size'), get('row_width'),
+                                          get('ues_size'), get('acw_address'),
+                                          get('acw_size')],
+                            get('ues_address'),
+                            struct.pack('<{}H'.format(len(bits)), *bits)))
+    names += b'\0'
+
+    index = {}
+    disp, slots = build_hash([dev['name'] for dev in devices])
+    ids = build_ids(devices)
+    names_sorted = build_sorted([dev['name'] for dev in devices])
+    index['buckets'] = len(disp) if slots else 0
+    index['hash_size'] = len(slots)
+
+    header_size = 8 + 4 * len(header_fields)
+    data = bytearray(header_size)
+    align8(data)
+
+    def section(name, payload):
+        align8(data)
+        index[name] = len(data)
+        data.extend(payload)
+
+    section('names', names)
+    index['names_size'] = len(names)
+    section('name', struct.pack('<{}I'.format(len(offsets)), *offsets))
+    section('chip_id', struct.pack('<{}I'.format(len(devices)),
+                                   *[dev['chip_id'] for dev in devices]))
+    section('records', b''.join(
+        struct.pack(record_format, *([dev[field] for field, _ in record_fields] +
+                                     [configs.index(dev['config'])]))
+        for dev in devices))
+    # Config data first, so the entries can point to it
+    config_offsets = []
+    for entry in entries:
+        if entry[3]:
+            section('config_data', entry[3])
+            config_offsets.append(index['config_data'])
+        else:
+            config_offsets.append(0)
+    section('configs', b''.join(
+        struct.pack(config_format, entry[0], *(entry[1] + [entry[2], offset]))
+        for entry, offset in zip(entries, config_offsets)))
+    section('disp', struct.pack('<{}I'.format(len(disp)), *disp) if slots else b'')
+    section('slot', struct.pack('<{}I'.format(len(slots)), *slots))
+    section('sorted', struct.pack('<{}I'.format(len(names_sorted)), *names_sorted))
+    section('ids', struct.pack('<{}I'.format(len(ids)), *ids))
+    align8(data)
+
+    index.update({'size': len(data), 'count': len(devices),
+                  'record_size': struct.calcsize(record_format),
+                  'config_size': struct.calcsize(config_format),
+                  'config_count': len(configs),
+                  'sorted_count': len(names_sorted), 'id_count': len(ids)})
+    data[0:header_size] = struct.pack('<4sHH{}I'.format(len(header_fields)),
+                                      b'MPDB', 1, 0x0102,
+                                      *[index[field] for field in header_fields])
+    fd.write(data)
 
 def main():
     chips = set()
     dups = 0
 
     parser = argparse.ArgumentParser()
-    parser.add_argument("--json", dest="json", help="JSON dump of InfoIC(2Plus).dll", required=True)
+    parser.add_argument("--json", dest="json", help="JSON dump of InfoIC(2Plus).dll")
     parser.add_argument("--output", dest="output", help="Output filename", type=argparse.FileType('w'), default=sys.stdout)
+    parser.add_argument("--index", dest="index", help="Device index output filename", type=argparse.FileType('w'))
+    parser.add_argument("--packed", dest="packed", help="Packed device table output filename", type=argparse.FileType('w'))
+    parser.add_argument("--binary", dest="binary", help="Device database file output filename", type=argparse.FileType('wb'))
+    parser.add_argument("--configs", dest="configs", help="database.c defining the device configurations, needed by --binary")
+    parser.add_argument("--devices", dest="devices", help="Generate only the index, packed table or database file of an existing devices file")
 
     args = parser.parse_args()
 
+    if args.binary and not args.configs:
+        parser.error("--binary requires --configs")
+    if args.devices:
+        if not args.index and not args.packed and not args.binary:
+            parser.error("--devices requires --index, --packed or --binary")
+        devices = read_devices(args.devices)
+        if args.index:
+            print_index(devices, args.index)
+        if args.packed:
+            print_packed(devices, args.packed)
+        if args.binary:
+            write_binary(devices, args.configs, args.binary)
+        return
+    if not args.json:
+        parser.error("--json is required")
+
     with open(args.json) as f:
         json_database = json.load(f)
 
@@ -1077,6 +1412,7 @@ def main():
 
 /* Note, this file really isn't copyrightable. */
 '''.format(args.output.name), file=args.output)
+    devices = []
     for mf in json_database:
         for ic in mf['ics']:
             if ic['name'] in chips:
@@ -1084,8 +1420,16 @@ def main():
                 dups += 1
             else:
                 chips.add(ic["name"])
-                print_entry(ic, args.output);
+                dev = print_entry(ic, args.output)
+                if dev:
+                    devices.append(dev)
     print("{} duplicates found".format(dups), file=sys.stderr)
+    if args.index:
+        print_index(devices, args.index)
+    if args.packed:
+        print_packed(devices, args.packed)
+    if args.binary:
+        write_binary(devices, args.configs, args.binary)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,174 @@
+/*
+ * elf.c - Functions for dealing with ELF executable files.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "elf.h"
+#include "minipro.h"
+
+#define EI_NIDENT 16
+#define EI_CLASS 4
+#define EI_DATA 5
+#define EI_VERSION 6
+
+#define ELFCLASS32 1
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ELFDATA2MSB 2
+#define EV_CURRENT 1
+
+#define ELF32_HEADER_SIZE 52
+#define ELF64_HEADER_SIZE 64
+#define ELF32_PHDR_SIZE 32
+#define ELF64_PHDR_SIZE 56
+
+#define PT_LOAD 1
+
+typedef struct {
+  uint32_t type;
+  uint64_t offset;
+  uint64_t paddr;
+  uint64_t filesz;
+} phdr_t;
+
+// Load an unsigned integer of up to 8 bytes
+static uint64_t load_elf_int(uint8_t *buffer, size_t size, uint8_t endianness) {
+  uint64_t result = 0;
+  size_t i;
+  for (i = 0; i < size; i++) {
+    if (endianness == MP_LITTLE_ENDIAN)
+      result |= (uint64_t)buffer[i] << (i * 8);
+    else
+      result = (result << 8) | buffer[i];
+  }
+  return result;
+}
+
+// Parse a program header
+static void parse_phdr(uint8_t *phdr, uint8_t elf_class, uint8_t endianness,
+                       phdr_t *ph) {
+  ph->type = load_elf_int(phdr, 4, endianness);
+  if (elf_class == ELFCLASS32) {
+    ph->offset = load_elf_int(phdr + 4, 4, endianness);
+    ph->paddr = load_elf_int(phdr + 12, 4, endianness);
+    ph->filesz = load_elf_int(phdr + 16, 4, endianness);
+  } else {
+    ph->offset = load_elf_int(phdr + 8, 8, endianness);
+    ph->paddr = load_elf_int(phdr + 24, 8, endianness);
+    ph->filesz = load_elf_int(phdr + 32, 8, endianness);
+  }
+}
+
+// Read an ELF file.
+// Every PT_LOAD segment is pushed through the pipeline at its physical
+// (load) address.
+int read_elf_file(uint8_t *buffer, size_t file_size, pipeline_t *pipeline) {
+  uint64_t phoff;
+  size_t phentsize, phnum, i;
+  uint8_t endianness;
+  phdr_t ph;
+
+  // Check the magic number
+  if (file_size < EI_NIDENT || memcmp(buffer, "\177ELF", 4)) return NOT_ELF;
+
+  uint8_t elf_class = buffer[EI_CLASS];
+  switch (buffer[EI_DATA]) {
+    case ELFDATA2LSB:
+      endianness = MP_LITTLE_ENDIAN;
+      break;
+    case ELFDATA2MSB:
+      endianness = MP_BIG_ENDIAN;
+      break;
+    default:
+      fprintf(stderr, "Error: unknown ELF data encoding.\n");
+      return EXIT_FAILURE;
+  }
+  if (buffer[EI_VERSION] != EV_CURRENT) {
+    fprintf(stderr, "Error: unknown ELF version.\n");
+    return EXIT_FAILURE;
+  }
+
+  // Get the program header table location
+  switch (elf_class) {
+    case ELFCLASS32:
+      if (file_size < ELF32_HEADER_SIZE) {
+        fprintf(stderr, "Error: truncated ELF header.\n");
+        return EXIT_FAILURE;
+      }
+      phoff = load_elf_int(buffer + 28, 4, endianness);
+      phentsize = load_elf_int(buffer + 42, 2, endianness);
+      phnum = load_elf_int(buffer + 44, 2, endianness);
+      if (phnum && phentsize < ELF32_PHDR_SIZE) {
+        fprintf(stderr, "Error: bad ELF program header size.\n");
+        return EXIT_FAILURE;
+      }
+      break;
+    case ELFCLASS64:
+      if (file_size < ELF64_HEADER_SIZE) {
+        fprintf(stderr, "Error: truncated ELF header.\n");
+        return EXIT_FAILURE;
+      }
+      phoff = load_elf_int(buffer + 32, 8, endianness);
+      phentsize = load_elf_int(buffer + 54, 2, endianness);
+      phnum = load_elf_int(buffer + 56, 2, endianness);
+      if (phnum && phentsize < ELF64_PHDR_SIZE) {
+        fprintf(stderr, "Error: bad ELF program header size.\n");
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      fprintf(stderr, "Error: unknown ELF class.\n");
+      return EXIT_FAILURE;
+  }
+
+  if (!phnum) {
+    fprintf(stderr, "Error: this ELF file has no program headers.\n");
+    return EXIT_FAILURE;
+  }
+  if (phoff > file_size || phnum * phentsize > file_size - phoff) {
+    fprintf(stderr, "Error: truncated ELF program header table.\n");
+    return EXIT_FAILURE;
+  }
+
+  size_t loaded = 0;
+  for (i = 0; i < phnum; i++) {
+    parse_phdr(buffer + phoff + i * phentsize, elf_class, endianness, &ph);
+    if (ph.type != PT_LOAD || !ph.filesz) continue;
+
+    if (ph.offset > file_size || ph.filesz > file_size - ph.offset) {
+      fprintf(stderr, "Error: ELF segment %u is truncated.\n", (unsigned)i);
+      return EXIT_FAILURE;
+    }
+    if (ph.filesz > UINT32_MAX + 1ULL ||
+        ph.paddr > UINT32_MAX + 1ULL - ph.filesz) {
+      fprintf(stderr, "Error: ELF segment %u is out of range.\n", (unsigned)i);
+      return EXIT_FAILURE;
+    }
+
+    if (pipeline_put(pipeline, ph.paddr, buffer + ph.offset, ph.filesz))
+      return EXIT_FAILURE;
+    loaded++;
+  }
+
+  if (!loaded) {
+    fprintf(stderr, "Error: this ELF file has no loadable data.\n");
+    return EXIT_FAILURE;
+  }
+  return ELF_FORMAT;
+}
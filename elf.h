@@ -0,0 +1,30 @@
+/*
+ * elf.h - Definitions and declarations for dealing with
+ * ELF executable files.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef ELF_H_
+#define ELF_H_
+
+#include <stdint.h>
+#include "pipeline.h"
+
+#define ELF_FORMAT 0
+#define NOT_ELF -1
+
+int read_elf_file(uint8_t *buffer, size_t file_size, pipeline_t *pipeline);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * fuseconf.c - Functions for dealing with fuse configuration files.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fuseconf.h"
+
+/*
+ A fuse configuration file has one 'name = 0xvalue' line per fuse, user id
+ or lock byte, as written by read_fuses(). Values following a '[device]'
+ line only apply to that device and override the ones set before the
+ first section, so one file can hold the fuses of several devices.
+ Names are case insensitive, empty lines and lines starting with '#' or
+ ';' are ignored.
+ */
+
+// Strip the leading and trailing blanks of a string
+static char *trim(char *s) {
+  char *end;
+  while (isspace((uint8_t)*s)) s++;
+  end = s + strlen(s);
+  while (end > s && isspace((uint8_t)end[-1])) end--;
+  *end = 0;
+  return s;
+}
+
+// Compare the device then the name, values for all devices first
+static int compare_keys(const void *v1, const void *v2) {
+  const fuse_value_t *k1 = v1, *k2 = v2;
+  if (k1->device != k2->device) {
+    if (!k1->device) return -1;
+    if (!k2->device) return 1;
+    int ret = strcasecmp(k1->device, k2->device);
+    if (ret) return ret;
+  }
+  return strcasecmp(k1->name, k2->name);
+}
+
+// Same as compare_keys, keeping the file order of equal keys
+static int compare_values(const void *v1, const void *v2) {
+  int ret = compare_keys(v1, v2);
+  if (ret) return ret;
+  return ((const fuse_value_t *)v1)->line - ((const fuse_value_t *)v2)->line;
+}
+
+/*
+ Parse a NUL terminated configuration file. The buffer is modified and
+ must be kept until the configuration is freed.
+ */
+int read_fuse_config(char *buffer, fuse_config_t *config) {
+  char *line, *next, *end, *name, *value;
+  const char *device = NULL;
+  fuse_value_t *tmp;
+  unsigned long number;
+  size_t i, size = 0;
+  int line_number = 0;
+
+  config->count = 0;
+  config->values = NULL;
+  for (line = buffer; line; line = next) {
+    line_number++;
+    next = strchr(line, '\n');
+    if (next) *next++ = 0;
+    line = trim(line);
+    if (!*line || *line == '#' || *line == ';') continue;
+
+    if (*line == '[') {
+      end = strchr(line, ']');
+      if (!end || end[1]) {
+        fprintf(stderr, "Config line %d: invalid device section.\n",
+                line_number);
+        goto fail;
+      }
+      *end = 0;
+      device = trim(line + 1);
+      if (!*device) {
+        fprintf(stderr, "Config line %d: empty device name.\n", line_number);
+        goto fail;
+      }
+      continue;
+    }
+
+    value = strchr(line, '=');
+    if (!value) {
+      fprintf(stderr, "Config line %d: missing '='.\n", line_number);
+      goto fail;
+    }
+    *value++ = 0;
+    name = trim(line);
+    end = strpbrk(value, "#;");
+    if (end) *end = 0;
+    value = trim(value);
+    if (!*name) {
+      fprintf(stderr, "Config line %d: missing name.\n", line_number);
+      goto fail;
+    }
+
+    errno = 0;
+    number = 0;
+    if (!strncasecmp(value, "0x", 2) && isxdigit((uint8_t)value[2]))
+      number = strtoul(value + 2, &end, 16);
+    else
+      end = value;
+    if (end == value || *end || errno || number > UINT32_MAX) {
+      fprintf(stderr, "Config line %d: invalid %s value '%s'.\n", line_number,
+              name, value);
+      goto fail;
+    }
+
+    if (config->count == size) {
+      tmp = realloc(config->values,
+                    (size ? size * 2 : 16) * sizeof(fuse_value_t));
+      if (!tmp) {
+        fprintf(stderr, "Out of memory!\n");
+        goto fail;
+      }
+      config->values = tmp;
+      size = size ? size * 2 : 16;
+    }
+    config->values[config->count].device = device;
+    config->values[config->count].name = name;
+    config->values[config->count].value = number;
+    config->values[config->count].line = line_number;
+    config->count++;
+  }
+
+  qsort(config->values, config->count, sizeof(fuse_value_t), compare_values);
+  for (i = 1; i < config->count; i++) {
+    if (!compare_keys(&config->values[i - 1], &config->values[i])) {
+      fprintf(stderr, "Config line %d: %s already set on line %d.\n",
+              config->values[i].line, config->values[i].name,
+              config->values[i - 1].line);
+      goto fail;
+    }
+  }
+  return EXIT_SUCCESS;
+
+fail:
+  free_fuse_config(config);
+  return EXIT_FAILURE;
+}
+
+// Get a value of a device, its section first then the common values
+int get_fuse_config_value(fuse_config_t *config, const char *device,
+                          const char *name, uint32_t *value) {
+  fuse_value_t key = {.device = device, .name = name}, *found;
+
+  found = bsearch(&key, config->values, config->count, sizeof(fuse_value_t),
+                  compare_keys);
+  if (!found) {
+    key.device = NULL;
+    found = bsearch(&key, config->values, config->count,
+                    sizeof(fuse_value_t), compare_keys);
+  }
+  if (!found) return EXIT_FAILURE;
+  *value = found->value;
+  return EXIT_SUCCESS;
+}
+
+static int is_fuse_name(fuse_decl_t *fuses, const char *name) {
+  size_t i;
+  for (i = 0; i < fuses->num_fuses; i++)
+    if (!strcasecmp(fuses->fnames[i], name)) return 1;
+  for (i = 0; i < fuses->num_uids; i++)
+    if (!strcasecmp(fuses->unames[i], name)) return 1;
+  for (i = 0; i < (fuses->num_locks & 0x7f); i++)
+    if (!strcasecmp(fuses->lnames[i], name)) return 1;
+  return 0;
+}
+
+// Check that all the values of a device are set and that no value
+// applying to it is unknown, before anything is written
+int check_fuse_config(fuse_config_t *config, const char *device,
+                      fuse_decl_t *fuses) {
+  const char **names[] = {fuses->fnames, fuses->unames, fuses->lnames};
+  size_t counts[] = {fuses->num_fuses, fuses->num_uids,
+                     fuses->num_locks & 0x7f};
+  fuse_value_t *value;
+  uint32_t unused;
+  size_t i, j;
+
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < counts[i]; j++) {
+      if (get_fuse_config_value(config, device, names[i][j], &unused)) {
+        fprintf(stderr, "Could not read config %s value.\n", names[i][j]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  for (i = 0; i < config->count; i++) {
+    value = &config->values[i];
+    if (value->device && strcasecmp(value->device, device)) continue;
+    if (!is_fuse_name(fuses, value->name)) {
+      fprintf(stderr, "Config line %d: %s has no %s.\n", value->line, device,
+              value->name);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+void free_fuse_config(fuse_config_t *config) {
+  free(config->values);
+  config->values = NULL;
+  config->count = 0;
+}
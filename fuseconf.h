@@ -0,0 +1,45 @@
+/*
+ * fuseconf.h - Definitions and declarations for fuse configuration files.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef FUSECONF_H_
+#define FUSECONF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+
+typedef struct fuse_value {
+  const char *device;  // section name, NULL for all the devices
+  const char *name;
+  uint32_t value;
+  int line;
+} fuse_value_t;
+
+// Parsed fuse configuration file, values sorted by device then name
+typedef struct fuse_config {
+  size_t count;
+  fuse_value_t *values;
+} fuse_config_t;
+
+int read_fuse_config(char *buffer, fuse_config_t *config);
+int check_fuse_config(fuse_config_t *config, const char *device,
+                      fuse_decl_t *fuses);
+int get_fuse_config_value(fuse_config_t *config, const char *device,
+                          const char *name, uint32_t *value);
+void free_fuse_config(fuse_config_t *config);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * gal.c - Functions for packing GAL fuse maps to device rows.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gal.h"
+
+/*
+ The GAL fuse array is stored column major in the JEDEC file: fuse
+ 'fuses_size * j + i' is bit 'j' of device row 'i'. Converting between the
+ two layouts is a bit matrix transpose, done here in 8x8 blocks.
+ Device rows are sent MSB first, row_width / 8 + 1 bytes each.
+ */
+
+// Cached plans, one per device configuration
+static gal_plan_t *plans;
+
+// Reverse the bit order of a byte
+static inline uint8_t rev8(uint8_t b) {
+  b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+  b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+  b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+  return b;
+}
+
+// Transpose an 8x8 bit matrix, bit 'c' of byte 'r' to bit 'r' of byte 'c'
+static inline uint64_t transpose8(uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+  x ^= t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+  x ^= t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+  x ^= t ^ (t << 28);
+  return x;
+}
+
+// Get up to 8 fuses starting at 'fuse', first fuse in bit 0
+static inline uint8_t get_fuses(uint64_t *fuses, size_t fuse, size_t count) {
+  size_t shift = fuse & 63;
+  uint64_t value = fuses[fuse >> 6] >> shift;
+  if (shift + count > 64) value |= fuses[(fuse >> 6) + 1] << (64 - shift);
+  return value & ((1U << count) - 1);
+}
+
+// Store up to 8 fuses starting at 'fuse', first fuse in bit 0
+static inline void put_fuses(uint64_t *fuses, size_t fuse, uint8_t value,
+                             size_t count) {
+  size_t shift = fuse & 63;
+  uint64_t mask = (1U << count) - 1;
+  uint64_t bits = value & mask;
+  fuses[fuse >> 6] = (fuses[fuse >> 6] & ~(mask << shift)) | (bits << shift);
+  if (shift + count > 64)
+    fuses[(fuse >> 6) + 1] =
+        (fuses[(fuse >> 6) + 1] & ~(mask >> (64 - shift))) |
+        (bits >> (64 - shift));
+}
+
+// Build the plan of a device configuration or return the cached one
+gal_plan_t *gal_get_plan(gal_config_t *config) {
+  gal_plan_t *plan;
+  size_t i, count;
+
+  for (plan = plans; plan; plan = plan->next)
+    if (plan->config == config) return plan;
+
+  // Split the ACW bits order in runs of consecutive fuses
+  count = 0;
+  for (i = 0; i < config->acw_size; i++)
+    if (!i || config->acw_bits[i] != config->acw_bits[i - 1] + 1) count++;
+
+  plan = calloc(1, sizeof(gal_plan_t));
+  if (!plan) return NULL;
+  plan->acw = calloc(count ? count : 1, sizeof(gal_run_t));
+  if (!plan->acw) {
+    free(plan);
+    return NULL;
+  }
+
+  count = 0;
+  for (i = 0; i < config->acw_size; i++) {
+    if (!i || config->acw_bits[i] != config->acw_bits[i - 1] + 1) {
+      plan->acw[count].fuse = config->acw_bits[i];
+      plan->acw[count].bit = i;
+      count++;
+    }
+    plan->acw[count - 1].size++;
+  }
+
+  plan->config = config;
+  plan->row_bytes = config->row_width / 8 + 1;
+  plan->ues.fuse = config->ues_address;
+  plan->ues.bit = 0;
+  plan->ues.size = config->ues_size;
+  plan->acw_count = count;
+
+  plan->fuse_count = config->fuses_size * config->row_width;
+  if (plan->fuse_count < (size_t)config->ues_address + config->ues_size)
+    plan->fuse_count = config->ues_address + config->ues_size;
+  for (i = 0; i < config->acw_size; i++)
+    if (plan->fuse_count <= config->acw_bits[i])
+      plan->fuse_count = config->acw_bits[i] + 1;
+  plan->next = plans;
+  plans = plan;
+  return plan;
+}
+
+// Convert the fuse array to device rows
+void gal_pack_array(gal_plan_t *plan, uint64_t *fuses, uint8_t *rows) {
+  gal_config_t *config = plan->config;
+  size_t i, j, k, ni, nj;
+  uint64_t x;
+
+  memset(rows, 0, config->fuses_size * plan->row_bytes);
+  for (i = 0; i < config->fuses_size; i += 8) {
+    ni = config->fuses_size - i < 8 ? config->fuses_size - i : 8;
+    for (j = 0; j < config->row_width; j += 8) {
+      nj = config->row_width - j < 8 ? config->row_width - j : 8;
+
+      // Columns j..j+7 of the array go in reverse order to make them MSB
+      // first once transposed
+      x = 0;
+      for (k = 0; k < nj; k++)
+        x |= (uint64_t)get_fuses(fuses, config->fuses_size * (j + k) + i, ni)
+             << (8 * (7 - k));
+      x = transpose8(x);
+      for (k = 0; k < ni; k++)
+        rows[(i + k) * plan->row_bytes + j / 8] = x >> (8 * k);
+    }
+  }
+}
+
+/*
+ Convert 'count' device rows starting at row 'first' to the fuse array.
+ 'first' must be a multiple of 8, so rows can be converted in stripes as
+ they are read.
+ */
+void gal_unpack_array(gal_plan_t *plan, uint8_t *rows, size_t first,
+                      size_t count, uint64_t *fuses) {
+  gal_config_t *config = plan->config;
+  size_t i, j, k, ni, nj, last;
+  uint64_t x;
+
+  last = first + count < config->fuses_size ? first + count
+                                            : config->fuses_size;
+  for (i = first; i < last; i += 8) {
+    ni = last - i < 8 ? last - i : 8;
+    for (j = 0; j < config->row_width; j += 8) {
+      nj = config->row_width - j < 8 ? config->row_width - j : 8;
+
+      x = 0;
+      for (k = 0; k < ni; k++)
+        x |= (uint64_t)rows[(i + k) * plan->row_bytes + j / 8] << (8 * k);
+      x = transpose8(x);
+      for (k = 0; k < nj; k++)
+        put_fuses(fuses, config->fuses_size * (j + k) + i,
+                  x >> (8 * (7 - k)), ni);
+    }
+  }
+}
+
+// Copy fuse runs to a zeroed device row
+void gal_pack_runs(gal_run_t *runs, size_t count, uint64_t *fuses,
+                   uint8_t *row) {
+  size_t i, offset, n, bit, shift;
+  uint8_t value;
+
+  for (i = 0; i < count; i++) {
+    for (offset = 0; offset < runs[i].size; offset += n) {
+      n = runs[i].size - offset < 8 ? runs[i].size - offset : 8;
+      value = rev8(get_fuses(fuses, runs[i].fuse + offset, n));
+      bit = runs[i].bit + offset;
+      shift = bit & 7;
+      row[bit / 8] |= value >> shift;
+      if (shift + n > 8) row[bit / 8 + 1] |= value << (8 - shift);
+    }
+  }
+}
+
+// Copy a device row to fuse runs
+void gal_unpack_runs(gal_run_t *runs, size_t count, uint8_t *row,
+                     uint64_t *fuses) {
+  size_t i, offset, n, bit, shift;
+  uint8_t value;
+
+  for (i = 0; i < count; i++) {
+    for (offset = 0; offset < runs[i].size; offset += n) {
+      n = runs[i].size - offset < 8 ? runs[i].size - offset : 8;
+      bit = runs[i].bit + offset;
+      shift = bit & 7;
+      value = row[bit / 8] << shift;
+      if (shift + n > 8) value |= row[bit / 8 + 1] >> (8 - shift);
+      value &= 0xff << (8 - n);
+      put_fuses(fuses, runs[i].fuse + offset, rev8(value), n);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ * gal.h - Definitions and declarations for GAL fuse map packing.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef GAL_H_
+#define GAL_H_
+
+#include <stdint.h>
+#include "database.h"
+
+// A run of consecutive fuses mapped to consecutive bits of a device row
+typedef struct gal_run {
+  uint16_t fuse;
+  uint16_t bit;
+  uint16_t size;
+} gal_run_t;
+
+// Precomputed packing plan of a GAL device
+typedef struct gal_plan {
+  gal_config_t *config;
+  size_t row_bytes;   // bytes of a fuse array row in device format
+  size_t fuse_count;  // fuses needed to hold the whole map
+  gal_run_t ues;
+  size_t acw_count;
+  gal_run_t *acw;
+  struct gal_plan *next;
+} gal_plan_t;
+
+gal_plan_t *gal_get_plan(gal_config_t *config);
+void gal_pack_array(gal_plan_t *plan, uint64_t *fuses, uint8_t *rows);
+void gal_unpack_array(gal_plan_t *plan, uint8_t *rows, size_t first,
+                      size_t count, uint64_t *fuses);
+void gal_pack_runs(gal_run_t *runs, size_t count, uint64_t *fuses,
+                   uint8_t *row);
+void gal_unpack_runs(gal_run_t *runs, size_t count, uint8_t *row,
+                     uint64_t *fuses);
+
+#endif
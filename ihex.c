@@ -132,13 +132,13 @@ static int write_record(FILE *file, record_t *record) {
   return EXIT_SUCCESS;
 }
 
-// Read an Intel hex file
-int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size) {
+// Read an Intel hex file.
+// Data records are pushed through the pipeline.
+int read_hex_file(uint8_t *buffer, pipeline_t *pipeline) {
   uint32_t line = 0, uba = 0;
   record_t rec;
   uint8_t eof = 0;
 
-  size_t chip_size = *size;
   while (buffer) {
     // Skip empty lines
     line++;
@@ -167,13 +167,9 @@ int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size) {
         }
         switch (rec.type) {
           case IHEX_DATA:
-            // If file data size is bigger than chip size
-            // update the new size
-            if (chip_size >= uba + rec.address + rec.count)
-              // copy record data
-              memcpy(&(data[uba + rec.address]), rec.data, rec.count);
-            else
-              *size = (uba + rec.address + rec.count);
+            if (pipeline_put(pipeline, uba + rec.address, rec.data,
+                             rec.count))
+              return EXIT_FAILURE;
             break;
           case IHEX_EOF:
             if (eof) {
@@ -215,50 +211,76 @@ int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size) {
   return INTEL_HEX_FORMAT;
 }
 
-// Write an Intel hex file
-int write_hex_file(FILE *file, uint8_t *data, size_t size) {
+// Write an extended linear address record
+static int write_ela(FILE *file, uint16_t uba) {
   record_t rec;
-  uint16_t address = 0;
-  uint16_t uba = 0;
-  size_t len;
+  rec.type = IHEX_ELA;
+  rec.count = 0x02;
+  rec.address = 0x00;
+  rec.data[0] = (uint8_t)(uba >> 8);
+  rec.data[1] = (uint8_t)uba;
+  return write_record(file, &rec);
+}
 
-  // if size > 64K insert an extended linear address record
-  memset(rec.data, 0x00, sizeof(rec.data));
-  if (size > 65536) {
-    rec.type = IHEX_ELA;
-    rec.count = 0x02;
-    rec.address = 0x00;
-    write_record(file, &rec);
-  }
+// Start an Intel hex file.
+// If size > 64K an extended linear address record is inserted first.
+int hex_writer_begin(hex_writer_t *writer, FILE *file, size_t size,
+                     size_t record_size) {
+  writer->file = file;
+  writer->record_size = record_size ? record_size : ROW_SIZE;
+  writer->uba = 0;
+  if (size > 65536) return write_ela(file, 0);
+  return EXIT_SUCCESS;
+}
+
+// Write a block of data as hex records.
+// Records are aligned to the record size and never cross a 64K boundary.
+int hex_writer_put(void *context, uint32_t address, uint8_t *data,
+                   size_t size) {
+  hex_writer_t *writer = context;
+  record_t rec;
+  size_t len;
 
   while (size) {
-    // Write data
-    len = (size > ROW_SIZE ? ROW_SIZE : size);
+    // Insert an extended linear address record
+    if (address >> 16 != writer->uba) {
+      writer->uba = address >> 16;
+      write_ela(writer->file, writer->uba);
+    }
+    len = writer->record_size - address % writer->record_size;
+    if (len > 0x10000 - (address & 0xFFFF))
+      len = 0x10000 - (address & 0xFFFF);
+    if (len > size) len = size;
     rec.type = IHEX_DATA;
     rec.count = len;
     rec.address = address;
     memcpy(rec.data, data, len);
-    write_record(file, &rec);
-    data += ROW_SIZE;
+    write_record(writer->file, &rec);
+    data += len;
     size -= len;
-    address += ROW_SIZE;
-
-    // Insert an extended linear address record
-    if (!address && size) {
-      uba++;
-      rec.type = IHEX_ELA;
-      rec.count = 0x02;
-      rec.address = 0x00;
-      rec.data[0] = (uint8_t)uba << 8;
-      rec.data[1] = (uint8_t)uba;
-      write_record(file, &rec);
-    }
+    address += len;
   }
+  return EXIT_SUCCESS;
+}
 
-  // Insert EOF record
+// Insert the EOF record
+int hex_writer_end(hex_writer_t *writer) {
+  record_t rec;
   rec.type = IHEX_EOF;
   rec.count = 0x00;
   rec.address = 0x00;
-  write_record(file, &rec);
+  write_record(writer->file, &rec);
+  if (ferror(writer->file)) {
+    fprintf(stderr, "Error writing the output file.\n");
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
+
+// Write an Intel hex file
+int write_hex_file(FILE *file, uint8_t *data, size_t size) {
+  hex_writer_t writer;
+  if (hex_writer_begin(&writer, file, size, ROW_SIZE)) return EXIT_FAILURE;
+  if (hex_writer_put(&writer, 0, data, size)) return EXIT_FAILURE;
+  return hex_writer_end(&writer);
+}
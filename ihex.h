@@ -20,11 +20,24 @@
 #define IHEX_H_
 
 #include <stdint.h>
+#include "pipeline.h"
 
 #define INTEL_HEX_FORMAT 0
 #define NOT_IHEX -1
 
-int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size);
+// Record based Intel hex writer
+typedef struct hex_writer {
+  FILE *file;
+  size_t record_size;
+  uint32_t uba;
+} hex_writer_t;
+
+int read_hex_file(uint8_t *buffer, pipeline_t *pipeline);
 int write_hex_file(FILE *file, uint8_t *data, size_t size);
+int hex_writer_begin(hex_writer_t *writer, FILE *file, size_t size,
+                     size_t record_size);
+int hex_writer_put(void *context, uint32_t address, uint8_t *data,
+                   size_t size);
+int hex_writer_end(hex_writer_t *writer);
 
 #endif
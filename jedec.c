@@ -17,6 +17,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,7 +28,7 @@
 #define STX 0x02
 #define ETX 0x03
 #define JED_MIN_SIZE 8
-#define JED_MAX_SIZE 1048576
+#define JED_CHUNK_SIZE 4096
 #define ROW_SIZE 40
 #define DELIMITER '*'
 
@@ -43,20 +44,87 @@ static int parse_uint32(const char *buffer, uint32_t *value, char **pEnd,
   if (p_end == buffer) return BAD_FORMAT;
   return errno;
 }
+
 /*
- This function will parse the numeric value of the given command.
- If found, will return the parsed value and a pointer after the last character
- parsed.
+ Parse the numeric value of a header field which may appear only once.
+ A malformed value is ignored until the first valid token was found.
  */
-static int parse_token(const char *buffer, const char *token_name,
-                       size_t token_size, uint32_t *value, char **pEnd,
-                       uint8_t radix) {
-  // Compare the first 'token_size' characters ignoring case.
-  if (strncasecmp(buffer, token_name, token_size)) return TOKEN_NOT_FOUND;
-
-  // If found parse the numeric value next to it
-  if (!parse_uint32(buffer + token_size, value, pEnd, radix)) return NO_ERROR;
-  return BAD_FORMAT;
+static int parse_field(const char *buffer, uint32_t *value, uint8_t *is_set,
+                       uint8_t *valid_token, uint8_t radix) {
+  if (parse_uint32(buffer, value, NULL, radix))
+    return *valid_token ? BAD_FORMAT : TOKEN_NOT_FOUND;
+  if (*is_set) return BAD_FORMAT;
+  *is_set = 1;
+  *valid_token = 1;
+  return NO_ERROR;
+}
+
+// Load eight characters as a little endian word
+static inline uint64_t load_chars(const char *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+// Store 'count' fuse bits starting at 'address'
+static inline void store_fuses(uint64_t *fuses, uint32_t address,
+                               uint64_t bits, uint32_t count) {
+  uint32_t shift = address & 63;
+  uint64_t mask = count == 64 ? ~(uint64_t)0 : ((uint64_t)1 << count) - 1;
+
+  fuses[address >> 6] = (fuses[address >> 6] & ~(mask << shift)) |
+                        (bits << shift);
+  if (shift + count > 64) {
+    fuses[(address >> 6) + 1] =
+        (fuses[(address >> 6) + 1] & ~(mask >> (64 - shift))) |
+        (bits >> (64 - shift));
+  }
+}
+
+/*
+ Parse the fuse digits of a 'L' field up to the delimiter.
+ Some jed files have fuses divided on several lines.
+ So we need to skip line breaks characters and extract only valid
+ digits. For example: L0000<CR><LF>
+ 1111111111111111111111111111111111111111<CR><LF>
+ 1111111111111111111111110111111111011101<CR><LF>
+ 0000000000000000000000000000000000000000*<CR><LF>
+ We need to parse each line to get the entire 120 bits row.
+ Runs of eight '0'/'1' digits are converted at once.
+ */
+static int parse_fuses(char *p_next, char *p_end, uint32_t address,
+                       jedec_t *jedec) {
+  uint64_t word;
+
+  while (*p_next != DELIMITER) {
+    if (p_end - p_next >= 8 && jedec->QF - address >= 8) {
+      word = load_chars(p_next);
+      if ((word & 0xfefefefefefefefeULL) == 0x3030303030303030ULL) {
+        // Gather the low bit of each digit into one byte, first digit first
+        word = ((word & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+        store_fuses(jedec->fuses, address, word, 8);
+        address += 8;
+        p_next += 8;
+        continue;
+      }
+    }
+
+    if (p_next >= p_end) return BAD_FORMAT;
+    if (*p_next == '0' || *p_next == '1') {
+      if (address >= jedec->QF) return BAD_FORMAT;
+      if (*p_next == '1')
+        SET_FUSE(jedec->fuses, address);
+      else
+        CLEAR_FUSE(jedec->fuses, address);
+      address++;
+    } else if (!iscntrl(*p_next) && *p_next != ' ')
+      return BAD_FORMAT;
+    p_next++;
+  }
+  return NO_ERROR;
 }
 
 /*
@@ -64,207 +132,169 @@ static int parse_token(const char *buffer, const char *token_name,
  Supported commands: QP, QF, F, G, L, C
  It was adapted for most horrible formated jedec files i have found.
  */
-static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec,
-                        uint16_t *checksum) {
+static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec) {
   // some state machine helpers
   uint8_t is_QP_set = 0;
   uint8_t is_QF_set = 0;
   uint8_t is_F_set = 0;
   uint8_t is_G_set = 0;
   uint8_t is_C_set = 0;
-  uint8_t is_initialized = 0;
   uint8_t valid_token = 0;
 
   uint32_t parsed_value;
   uint16_t file_checksum;
-  size_t current_offset, stx_offset, stx_count, etx_count;
-  char *p_token, *p_next;
-
-  current_offset = 0;
-  stx_count = 0;
-  etx_count = 0;
-
-  // short file analysis, search for STX offset.
-  while (current_offset < buffer_size) {
-    if (buffer[current_offset] == STX) {
-      stx_count++;
-      stx_offset = current_offset;  // save the STX offset found
-    }
-    if (buffer[current_offset] == ETX) etx_count++;
-    if (stx_count > 1 || etx_count > 1)
-      return BAD_FORMAT;  // Failed, must be a binary file
-    current_offset++;
-  }
-
-  current_offset = stx_offset;  // save the STX offset for latter usage
-  if (!stx_count || !etx_count) return BAD_FORMAT;  // No STX or ETX found
+  size_t current_offset, stx_offset, etx_offset;
+  char *p_token, *p_next, *p_stx, *p_etx;
+  int ret;
+
+  // short file analysis, search for the STX and ETX offsets.
+  p_stx = memchr(buffer, STX, buffer_size);
+  p_etx = memchr(buffer, ETX, buffer_size);
+  if (!p_stx || !p_etx) return BAD_FORMAT;  // No STX or ETX found
+  stx_offset = p_stx - buffer;
+  etx_offset = p_etx - buffer;
+
+  // Failed, must be a binary file
+  if (memchr(p_stx + 1, STX, buffer_size - stx_offset - 1) ||
+      memchr(p_etx + 1, ETX, buffer_size - etx_offset - 1))
+    return BAD_FORMAT;
+  if (etx_offset < stx_offset) return BAD_FORMAT;
 
-  // Search for ETX offset, compute the file checksum.
+  // Compute the file checksum.
   file_checksum = 0;
-  while (current_offset < buffer_size) {
+  for (current_offset = stx_offset; current_offset <= etx_offset;
+       current_offset++)
     file_checksum += buffer[current_offset];
-    if (buffer[current_offset] == ETX) break;
-    current_offset++;
-  }
 
   // Parse the file checksum
-  if (parse_uint32(&buffer[current_offset + 1], &parsed_value, &p_next, 16))
+  if (parse_uint32(&buffer[etx_offset + 1], &parsed_value, &p_next, 16))
     return BAD_FORMAT;
 
   // The checksum must have 4 hex digits
-  if (p_next - &buffer[current_offset + 1] != 4) return BAD_FORMAT;
+  if (p_next - &buffer[etx_offset + 1] != 4) return BAD_FORMAT;
 
   // Store both parsed and calculated file checksums.
   jedec->decl_file_checksum = parsed_value;
   jedec->calc_file_checksum = file_checksum;
 
   // Parse each token in the buffer starting with STX offset.
-  p_token = buffer + stx_offset;
+  p_token = p_stx;
   while (p_token) {
-    // Skip empty tokens
-    if (!*p_token) continue;
-
     // Skip non printable characters but ETX
     while (!isalpha(*p_token) && *p_token != ETX) p_token++;
 
     // Exit the loop if the ETX character is found
     if (*p_token == ETX) break;
 
-    // Parse QP token
-    switch (parse_token(p_token, "QP", 2, &parsed_value, NULL, 10)) {
-      case NO_ERROR:
-        if (!is_QP_set) {
-          jedec->QP = parsed_value;
-          is_QP_set = 1;
-          valid_token = 1;
-        } else
-          return BAD_FORMAT;
+    // Dispatch on the first letter, unknown tokens are skipped
+    ret = NO_ERROR;
+    switch (toupper(*p_token)) {
+      case 'Q':
+        if (toupper(p_token[1]) == 'P') {
+          ret = parse_field(p_token + 2, &parsed_value, &is_QP_set,
+                            &valid_token, 10);
+          if (ret == NO_ERROR) jedec->QP = parsed_value;
+        } else if (toupper(p_token[1]) == 'F') {
+          ret = parse_field(p_token + 2, &parsed_value, &is_QF_set,
+                            &valid_token, 10);
+          if (ret == NO_ERROR) jedec->QF = parsed_value;
+        }
         break;
-      case BAD_FORMAT:
-        if (!valid_token) break;
-        return BAD_FORMAT;
-    }
-
-    // Parse QF token
-    switch (parse_token(p_token, "QF", 2, &parsed_value, NULL, 10)) {
-      case NO_ERROR:
-        if (!is_QF_set) {
-          jedec->QF = parsed_value;
-          is_QF_set = 1;
-          valid_token = 1;
-        } else
-          return BAD_FORMAT;
+      case 'G':
+        ret = parse_field(p_token + 1, &parsed_value, &is_G_set, &valid_token,
+                          10);
+        if (ret == NO_ERROR) jedec->G = parsed_value;
         break;
-      case BAD_FORMAT:
-        if (!valid_token) break;
-        return BAD_FORMAT;
-    }
-
-    // Parse G token
-    switch (parse_token(p_token, "G", 1, &parsed_value, NULL, 10)) {
-      case NO_ERROR:
-        if (!is_G_set) {
-          jedec->G = parsed_value;
-          is_G_set = 1;
-          valid_token = 1;
-        } else
-          return BAD_FORMAT;
+      case 'F':
+        ret = parse_field(p_token + 1, &parsed_value, &is_F_set, &valid_token,
+                          10);
+        if (ret == NO_ERROR) jedec->F = parsed_value;
         break;
-      case BAD_FORMAT:
-        if (!valid_token) break;
-        return BAD_FORMAT;
-    }
-
-    // Parse F token
-    switch (parse_token(p_token, "F", 1, &parsed_value, NULL, 10)) {
-      case NO_ERROR:
-        if (!is_F_set) {
-          jedec->F = parsed_value;
-          is_F_set = 1;
-          valid_token = 1;
-        } else
-          return BAD_FORMAT;
+      case 'C':
+        ret = parse_field(p_token + 1, &parsed_value, &is_C_set, &valid_token,
+                          16);
+        if (ret == NO_ERROR) jedec->C = parsed_value;
         break;
-      case BAD_FORMAT:
-        if (!valid_token) break;
-        return BAD_FORMAT;
-    }
-
-    // Parse C token
-    switch (parse_token(p_token, "C", 1, &parsed_value, NULL, 16)) {
-      case NO_ERROR:
-        if (!is_C_set) {
-          jedec->C = parsed_value;
-          is_C_set = 1;
-          valid_token = 1;
-        } else
+      case 'L':
+        if (parse_uint32(p_token + 1, &parsed_value, &p_next, 10))
           return BAD_FORMAT;
-        break;
-      case BAD_FORMAT:
-        if (!valid_token) break;
-        return BAD_FORMAT;
-    }
 
-    // Parse L token
-    switch (parse_token(p_token, "L", 1, &parsed_value, &p_next, 10)) {
-      case NO_ERROR:
         // No 'L' allowed after C token or 'L' without a valid header
-        if (is_C_set || !valid_token || !is_QF_set) return BAD_FORMAT;
+        if (is_C_set || !valid_token || !is_QF_set || !jedec->QF)
+          return BAD_FORMAT;
+        if (parsed_value >= jedec->QF) return BAD_FORMAT;
 
-        if (!is_initialized) {
+        if (!jedec->fuses) {
           /*
            On first 'L' token found allocate buffer and clear it
            with the default 'F' value.
            If no 'F' default fuse value is set then the default will be 0.
            */
-          jedec->fuses = malloc(jedec->QF);
-          if (!jedec->fuses) {
-            return MEMORY_ERROR;
-          }
-          memset(jedec->fuses, is_F_set ? (jedec->F == 0 ? 0x00 : 0x01) : 0,
-                 (jedec->QF));
-          is_initialized = 1;
-          *checksum = 0;
-        }
-
-        /*
-         Some jed files have fuses divided on several lines.
-         So we need to skip line breaks characters and extract only valid
-         digits. For example: L0000<CR><LF>
-         1111111111111111111111111111111111111111<CR><LF>
-         1111111111111111111111110111111111011101<CR><LF>
-         0000000000000000000000000000000000000000*<CR><LF>
-         We need to parse each line to get the entire 120 bits row.
-         */
-        while (*p_next != DELIMITER) {
-          if (!iscntrl(*p_next) && *p_next != ' ' && *p_next != '0' &&
-              *p_next != '1')
-            return BAD_FORMAT;
-
-          if (*p_next == '0' || *p_next == '1') {
-            jedec->fuses[parsed_value] = 0;
-            if (*p_next == '1') {
-              jedec->fuses[parsed_value] = 1;
-              (*checksum) += (0x01 << (parsed_value & 0x07));
-            }
-            parsed_value++;
-          }
-          p_next++;
+          jedec->fuses =
+              alloc_fuses(jedec->QF, is_F_set ? (jedec->F != 0) : 0);
+          if (!jedec->fuses) return MEMORY_ERROR;
         }
+        ret = parse_fuses(p_next, p_etx, parsed_value, jedec);
         break;
-      case BAD_FORMAT:
-        return BAD_FORMAT;
     }
-    p_token = strchr(p_token, DELIMITER);
+    if (ret == BAD_FORMAT || ret == MEMORY_ERROR) return ret;
+
+    p_token = memchr(p_token, DELIMITER, p_etx - p_token);
     if (p_token) p_token++;  // Skip the delimiter character
   }
   return NO_ERROR;
 }
 
+// Allocate a fuses bitset with all fuses set to 'value'
+uint64_t *alloc_fuses(size_t count, uint8_t value) {
+  size_t words = FUSE_WORDS(count);
+  uint64_t *fuses = malloc((words ? words : 1) * sizeof(uint64_t));
+  if (!fuses) return NULL;
+
+  memset(fuses, value ? 0xff : 0x00, words * sizeof(uint64_t));
+  // Keep the unused bits of the last word cleared
+  if (value && (count & 63)) fuses[words - 1] = ((uint64_t)1 << (count & 63)) - 1;
+  return fuses;
+}
+
+/*
+ Calculate the JEDEC fuses checksum.
+ This is the 16 bit sum of the fuses taken as bytes, first fuse in the
+ least significant bit. With fuses stored LSB first these are just the
+ bytes of each word, so they are summed eight at a time.
+ */
+uint16_t fuse_checksum(uint64_t *fuses, size_t count) {
+  size_t i, words = FUSE_WORDS(count);
+  uint64_t word;
+  uint16_t checksum = 0;
+
+  for (i = 0; i < words; i++) {
+    word = fuses[i];
+    if (i == words - 1 && (count & 63))
+      word &= ((uint64_t)1 << (count & 63)) - 1;
+    // Add byte pairs into four 16 bit lanes, then fold the lanes
+    word = (word & 0x00ff00ff00ff00ffULL) + ((word >> 8) & 0x00ff00ff00ff00ffULL);
+    checksum += (word * 0x0001000100010001ULL) >> 48;
+  }
+  return checksum;
+}
+
+// Compare two fuses bitsets, return the first mismatched fuse or -1
+int compare_fuses(uint64_t *f1, uint64_t *f2, size_t count) {
+  size_t i, words = FUSE_WORDS(count);
+  uint64_t diff;
+
+  for (i = 0; i < words; i++) {
+    diff = f1[i] ^ f2[i];
+    if (i == words - 1 && (count & 63))
+      diff &= ((uint64_t)1 << (count & 63)) - 1;
+    if (diff) return i * 64 + __builtin_ctzll(diff);
+  }
+  return -1;
+}
+
 // JEDEC file parser
 int read_jedec_file(char *buffer, size_t size, jedec_t *jedec) {
-  uint16_t checksum;
-
   // Check for size limits
   if (size < JED_MIN_SIZE) {
     free(buffer);
@@ -272,9 +302,12 @@ int read_jedec_file(char *buffer, size_t size, jedec_t *jedec) {
     return EXIT_FAILURE;
   }
 
-  switch (parse_tokens(buffer, size, jedec, &checksum)) {
+  jedec->fuses = NULL;
+  switch (parse_tokens(buffer, size, jedec)) {
     case BAD_FORMAT:
       fprintf(stderr, "JED file format error!\n");
+      free(jedec->fuses);
+      jedec->fuses = NULL;
       free(buffer);
       return EXIT_FAILURE;
     case MEMORY_ERROR:
@@ -285,51 +318,108 @@ int read_jedec_file(char *buffer, size_t size, jedec_t *jedec) {
       break;
   }
 
-  jedec->fuse_checksum = checksum;
+  if (jedec->fuses) jedec->fuse_checksum = fuse_checksum(jedec->fuses, jedec->QF);
   return EXIT_SUCCESS;
 }
 
+// Buffered JEDEC output, the file checksum is computed on the fly
+typedef struct jed_writer {
+  FILE *file;
+  size_t count;
+  uint16_t checksum;
+  int error;
+  char buffer[JED_CHUNK_SIZE];
+} jed_writer_t;
+
+// Bit to ASCII expansion of a fuse byte, first fuse first
+static char fuse_chars[256][8];
+
+static void jed_flush(jed_writer_t *writer) {
+  if (writer->count && !writer->error &&
+      fwrite(writer->buffer, 1, writer->count, writer->file) != writer->count)
+    writer->error = 1;
+  writer->count = 0;
+}
+
+static void jed_puts(jed_writer_t *writer, const char *str, size_t size) {
+  size_t i;
+  for (i = 0; i < size; i++) writer->checksum += str[i];
+  while (size) {
+    if (writer->count == JED_CHUNK_SIZE) jed_flush(writer);
+    i = JED_CHUNK_SIZE - writer->count;
+    if (i > size) i = size;
+    memcpy(writer->buffer + writer->count, str, i);
+    writer->count += i;
+    str += i;
+    size -= i;
+  }
+}
+
+static void jed_printf(jed_writer_t *writer, const char *format, ...) {
+  char line[128];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (size > 0)
+    jed_puts(writer, line,
+             (size_t)size < sizeof(line) ? (size_t)size : sizeof(line) - 1);
+}
+
 // JEDEC file writer
 int write_jedec_file(FILE *file, jedec_t *jedec) {
-  uint16_t fuse_checksum = 0, file_checksum = 0;
-  size_t i;
+  uint16_t checksum = 0;
+  uint8_t fuse_byte;
+  size_t i, j, n;
+  char row[ROW_SIZE];
 
-  char *buffer = malloc(JED_MAX_SIZE);
-  if (!buffer) {
+  jed_writer_t *writer = malloc(sizeof(jed_writer_t));
+  if (!writer) {
     fprintf(stderr, "Out of memory!\n");
     return EXIT_FAILURE;
   }
-  char *p_buff = buffer;
+  writer->file = file;
+  writer->count = 0;
+  writer->checksum = 0;
+  writer->error = 0;
+
+  if (!fuse_chars[0][0]) {
+    for (i = 0; i < 256; i++)
+      for (j = 0; j < 8; j++) fuse_chars[i][j] = (i >> j) & 1 ? '1' : '0';
+  }
 
   if (jedec->device_name == NULL) jedec->device_name = "Unknown";
 
   // Print jedec header
-  p_buff +=
-      sprintf(p_buff,
-              "%c\r\nDevice: %s\r\n\r\nNOTE: Written by Minipro open source"
-              " software v%s*\r\n\r\nQP%u*\r\nQF%u*\r\nF%u*\r\nG%u*\r\n\r\n",
-              STX, jedec->device_name, VERSION, jedec->QP, jedec->QF, jedec->F,
-              jedec->G);
-
-  // Print fuses
-  for (i = 0; i < jedec->QF; i++) {
-    if ((i % ROW_SIZE) == 0)
-      p_buff += sprintf(p_buff, "%sL%04u ",
-                        i ? (i % ROW_SIZE ? "" : "*\r\n") : "", (uint32_t)i);
-    p_buff += sprintf(p_buff, "%c", jedec->fuses[i] == 1 ? '1' : '0');
-    fuse_checksum += jedec->fuses[i] == 1 ? (0x01 << (i & 0x07)) : 0;
+  jed_printf(writer, "%c\r\nDevice: ", STX);
+  jed_puts(writer, jedec->device_name, strlen(jedec->device_name));
+  jed_printf(writer,
+             "\r\n\r\nNOTE: Written by Minipro open source"
+             " software v%s*\r\n\r\nQP%u*\r\nQF%u*\r\nF%u*\r\nG%u*\r\n\r\n",
+             VERSION, jedec->QP, jedec->QF, jedec->F, jedec->G);
+
+  // Print fuses, a row is a whole number of fuse bytes
+  for (i = 0; i < jedec->QF; i += ROW_SIZE) {
+    jed_printf(writer, "%sL%04u ", i ? "*\r\n" : "", (uint32_t)i);
+    n = jedec->QF - i < ROW_SIZE ? jedec->QF - i : ROW_SIZE;
+    for (j = 0; j < n; j += 8) {
+      fuse_byte = jedec->fuses[(i + j) >> 6] >> ((i + j) & 63);
+      if (n - j < 8) fuse_byte &= (1 << (n - j)) - 1;
+      checksum += fuse_byte;
+      memcpy(row + j, fuse_chars[fuse_byte], 8);
+    }
+    jed_puts(writer, row, n);
   }
 
   // Print fuses checksum and ETX character
-  p_buff += sprintf(p_buff, "*\r\nC%04X*\r\n%c", fuse_checksum, ETX);
+  jed_printf(writer, "*\r\nC%04X*\r\n%c", checksum, ETX);
 
-  // Calculate the file checksum
-  for(i = 0; i < p_buff - buffer; i++)
-	  file_checksum += buffer[i];
+  // The file checksum is not part of itself
+  jed_printf(writer, "%04X\r\n", writer->checksum);
+  jed_flush(writer);
 
-  sprintf(p_buff, "%04X\r\n", file_checksum);
-
-  fputs(buffer, file);
-  free(buffer);
-  return EXIT_SUCCESS;
+  int ret = writer->error ? EXIT_FAILURE : EXIT_SUCCESS;
+  if (ret) fprintf(stderr, "Error writing the file.\n");
+  free(writer);
+  return ret;
 }
@@ -20,21 +20,32 @@
 #define JEDEC_H_
 
 #include <stdint.h>
+#include <stdio.h>
+
+// Fuses are stored as a bitset, fuse n is bit (n % 64) of word (n / 64)
+#define FUSE_WORDS(count) (((size_t)(count) + 63) / 64)
+#define GET_FUSE(fuses, n) (((fuses)[(n) >> 6] >> ((n) & 63)) & 1)
+#define SET_FUSE(fuses, n) ((fuses)[(n) >> 6] |= (uint64_t)1 << ((n) & 63))
+#define CLEAR_FUSE(fuses, n) \
+  ((fuses)[(n) >> 6] &= ~((uint64_t)1 << ((n) & 63)))
 
 typedef struct jedec_s {
   const char *device_name;      // Device name
   uint8_t F;                    // Unlisted fuses value (0-1)
   uint8_t G;                    // Security Fuse
-  uint16_t QF;                  // How many fuses in the JEDEC file are
+  uint32_t QF;                  // How many fuses in the JEDEC file are
   uint8_t QP;                   // Number of pins
   uint16_t C;                   // declared fuses checksum
   uint16_t fuse_checksum;       // calculated fuses checksum
   uint16_t calc_file_checksum;  // calculated file checksum
   uint16_t decl_file_checksum;  // declared file checksum
-  uint8_t *fuses;               // Fuses array
+  uint64_t *fuses;              // Fuses bitset
 } jedec_t;
 
 int read_jedec_file(char *buffer, size_t size, jedec_t *jedec);
 int write_jedec_file(FILE *file, jedec_t *jedec);
+uint64_t *alloc_fuses(size_t count, uint8_t value);
+uint16_t fuse_checksum(uint64_t *fuses, size_t count);
+int compare_fuses(uint64_t *f1, uint64_t *f2, size_t count);
 
 #endif /* JEDEC_H_ */
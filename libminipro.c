@@ -0,0 +1,849 @@
+/*
+ * libminipro.c - Programming operations and the library interface.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "database.h"
+#include "gal.h"
+#include "jedec.h"
+#include "libminipro.h"
+#include "minipro.h"
+#include "report.h"
+
+// The device tables cache what they look up and aren't thread safe
+pthread_mutex_t database_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Callbacks get an update at least this often, in microseconds
+#define PROGRESS_INTERVAL 100000
+
+/*
+ Where the messages and progress of the current thread go. Each gang
+ station and each library handle runs on a thread of its own, so the
+ low level code doesn't need to be passed a context.
+ */
+static __thread struct {
+  mp_progress_cb progress;
+  mp_log_cb log;
+  void *context;
+  int percent;  // last percentage shown, -1 at the start of an operation
+  struct timeval shown;  // when it was shown
+} output = {NULL, NULL, NULL, -1, {0, 0}};
+
+static pthread_once_t tty_once = PTHREAD_ONCE_INIT;
+static int stderr_tty;
+
+static void check_tty(void) {
+  stderr_tty = isatty(fileno(stderr));
+}
+
+void minipro_set_output(mp_progress_cb progress, mp_log_cb log,
+                        void *context) {
+  output.progress = progress;
+  output.log = log;
+  output.context = context;
+  output.percent = -1;
+}
+
+void minipro_log(const char *fmt, ...) {
+  char buffer[256], *message = buffer;
+  va_list args, copy;
+  int len;
+
+  va_start(args, fmt);
+  if (!output.log) {
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    return;
+  }
+  va_copy(copy, args);
+  len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+  if (len >= (int)sizeof(buffer)) {
+    message = malloc(len + 1);
+    if (message)
+      vsnprintf(message, len + 1, fmt, copy);
+    else
+      message = buffer;
+  }
+  va_end(copy);
+  va_end(args);
+  if (len >= 0) output.log(output.context, message);
+  if (message != buffer) free(message);
+}
+
+/*
+ Report 'done' steps of 'total' while an operation runs. This is called
+ for every block, so it returns early unless the percentage changed or,
+ for a callback, the interval went by. Without a callback the progress
+ is only drawn on a terminal.
+ */
+void minipro_progress(const char *operation, size_t done, size_t total) {
+  struct timeval now;
+  char name[64];
+  size_t i, len = 0;
+  int percent;
+
+  if (!output.progress) {
+    pthread_once(&tty_once, check_tty);
+    if (!stderr_tty) return;
+  }
+  percent = total ? (int)(done * 100 / total) : 0;
+  if (!done) output.percent = -1;
+  if (percent == output.percent) {
+    if (!output.progress) return;
+    gettimeofday(&now, NULL);
+    if ((now.tv_sec - output.shown.tv_sec) * 1000000 +
+            (now.tv_usec - output.shown.tv_usec) <
+        PROGRESS_INTERVAL)
+      return;
+  } else if (output.progress)
+    gettimeofday(&now, NULL);
+  output.percent = percent;
+
+  if (!output.progress) {
+    fprintf(stderr, "\r\e[K%s%2d%%", operation, percent);
+    fflush(stderr);
+    return;
+  }
+  output.shown = now;
+
+  // Pass the bare name, without the dots and padding of the status line
+  for (i = 0; operation[i] && len < sizeof(name) - 1; i++)
+    if (operation[i] != ' ' || (len && name[len - 1] != ' '))
+      name[len++] = operation[i];
+  while (len && (name[len - 1] == ' ' || name[len - 1] == '.')) len--;
+  name[len] = 0;
+  output.progress(output.context, name, done, total);
+}
+
+// Close the status line of an operation with its result
+void minipro_progress_end(const char *operation, size_t total,
+                          const char *result) {
+  // The last update always gets through
+  output.percent = -1;
+  if (output.progress)
+    minipro_progress(operation, total, total);
+  else {
+    pthread_once(&tty_once, check_tty);
+    if (stderr_tty) fprintf(stderr, "\r\e[K");
+  }
+  output.percent = -1;
+  minipro_log("%s\n", result);
+}
+
+/* Programming operations */
+// Copy the bytes outside the segments of a sparse image from src to dst
+// so that only the populated ranges are compared.
+void copy_gaps(uint8_t *dst, uint8_t *src, size_t size,
+               segment_list_t *segments) {
+  size_t i, address = 0;
+  if (!segments || !segments->count) return;
+  for (i = 0; i < segments->count; i++) {
+    memcpy(dst + address, src + address,
+           segments->segment[i].address - address);
+    address = segments->segment[i].address + segments->segment[i].size;
+  }
+  if (address < size) memcpy(dst + address, src + address, size - address);
+}
+
+int compare_memory(uint8_t *s1, uint8_t *s2, size_t size, uint8_t *c1,
+                   uint8_t *c2) {
+  size_t i;
+  for (i = 0; i < size; i++) {
+    if (s1[i] != s2[i]) {
+      *c1 = s1[i];
+      *c2 = s2[i];
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* RAM-centric IO operations */
+int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
+                  size_t size, segment_list_t *segments, pipeline_t *pipeline,
+                  checksum_t *checksum) {
+  char status_msg[64], result[64];
+  char *name = type == MP_CODE ? "Code" : "Data";
+  sprintf(status_msg, "Reading %s...  ", name);
+
+  size_t blocks_count = size / handle->device->read_buffer_size;
+  if (size % handle->device->read_buffer_size) blocks_count++;
+
+  struct timeval begin, end;
+  gettimeofday(&begin, NULL);
+  uint32_t address;
+  size_t i, len = handle->device->read_buffer_size;
+  for (i = 0; i < blocks_count; i++) {
+    minipro_progress(status_msg, i, blocks_count);
+    // Translating address to protocol-specific
+    address = i * handle->device->read_buffer_size;
+    if ((handle->device->opts4 & MP_DATA_BUS_WIDTH) && type == MP_CODE)
+      address = address >> 1;
+
+    // Last block
+    if ((i + 1) * len > size) len = size % len;
+
+    // Skip blocks with no data in a sparse image
+    if (!in_segments(segments, i * handle->device->read_buffer_size, len))
+      continue;
+    if (minipro_read_block(handle, type, address,
+                           buf + i * handle->device->read_buffer_size, len))
+      return EXIT_FAILURE;
+
+    // Convert the block on the fly
+    if (pipeline && pipeline_put(pipeline, i * handle->device->read_buffer_size,
+                                 buf + i * handle->device->read_buffer_size,
+                                 len))
+      return EXIT_FAILURE;
+    if (checksum)
+      checksum_update(checksum, buf + i * handle->device->read_buffer_size,
+                      len);
+    report_data(handle, buf + i * handle->device->read_buffer_size, len);
+
+    uint8_t ovc;
+    if (minipro_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
+    if (ovc) {
+      minipro_log("\nOvercurrent protection!\007\n");
+      return EXIT_FAILURE;
+    }
+  }
+  gettimeofday(&end, NULL);
+  sprintf(result, "Reading %s...  %.2fSec  OK", name,
+          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+              (double)(end.tv_sec - begin.tv_sec));
+  minipro_progress_end(status_msg, blocks_count, result);
+  return EXIT_SUCCESS;
+}
+
+int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
+                   size_t size, segment_list_t *segments,
+                   checksum_t *checksum) {
+  char status_msg[64], result[64];
+  char *name = type == MP_CODE ? "Code" : "Data";
+  sprintf(status_msg, "Writing  %s...  ", name);
+
+  size_t blocks_count = size / handle->device->write_buffer_size;
+  if (size % handle->device->write_buffer_size) blocks_count++;
+
+  struct timeval begin, end;
+  gettimeofday(&begin, NULL);
+  minipro_status_t status;
+  size_t i, len = handle->device->write_buffer_size;
+  uint32_t address;
+  for (i = 0; i < blocks_count; i++) {
+    minipro_progress(status_msg, i, blocks_count);
+    // Translating address to protocol-specific
+    address = i * len;
+    if ((handle->device->opts4 & MP_DATA_BUS_WIDTH) && type == MP_CODE)
+      address = address >> 1;
+
+    // Last block
+    if ((i + 1) * len > size) len = size % len;
+
+    // Skip blocks with no data in a sparse image
+    if (!in_segments(segments, i * handle->device->write_buffer_size, len))
+      continue;
+    if (minipro_write_block(handle, type, address,
+                            buffer + i * handle->device->write_buffer_size,
+                            len))
+      return EXIT_FAILURE;
+    if (checksum)
+      checksum_update(checksum,
+                      buffer + i * handle->device->write_buffer_size, len);
+    report_data(handle, buffer + i * handle->device->write_buffer_size, len);
+
+    uint8_t ovc = 0;
+    if (minipro_get_ovc_status(handle, &status, &ovc)) return EXIT_FAILURE;
+    if (ovc) {
+      minipro_log("\nOvercurrent protection!\007\n");
+      return EXIT_FAILURE;
+    }
+    if (status.error && ! handle->cmdopts->no_verify) {
+      if (minipro_end_transaction(handle)) return EXIT_FAILURE;
+      minipro_log(
+          "\nVerification failed at address 0x%04X: File=0x%02X, "
+          "Device=0x%02X\n",
+          status.address,
+          status.c2 & (WORD_SIZE(handle->device) == 1 ? 0xFF : 0xFFFF),
+          status.c1 & (WORD_SIZE(handle->device) == 1 ? 0xFF : 0xFFFF));
+      return EXIT_FAILURE;
+    }
+  }
+  gettimeofday(&end, NULL);
+  sprintf(result, "Writing %s...  %.2fSec  OK", name,
+          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+              (double)(end.tv_sec - begin.tv_sec));
+  minipro_progress_end(status_msg, blocks_count, result);
+  return EXIT_SUCCESS;
+}
+
+// Progress of a jedec row batch
+typedef struct jedec_progress {
+  char *status_msg;
+  size_t count;
+  gal_plan_t *plan;  // set to unpack the array rows as they are read
+  uint8_t *rows;
+  uint64_t *fuses;
+} jedec_progress_t;
+
+static void jedec_row_done(void *context, size_t index) {
+  jedec_progress_t *progress = context;
+  size_t fuses_size, first;
+
+  // Unpack each stripe of 8 rows while the next ones are transferred
+  if (progress->plan) {
+    fuses_size = progress->plan->config->fuses_size;
+    if (index < fuses_size && ((index & 7) == 7 || index == fuses_size - 1)) {
+      first = index & ~(size_t)7;
+      gal_unpack_array(progress->plan, progress->rows, first,
+                       index - first + 1, progress->fuses);
+    }
+  }
+  minipro_progress(progress->status_msg, index + 1, progress->count);
+}
+
+// Set the fuse array rows followed by the UES and ACW rows
+static void jedec_rows(gal_plan_t *plan, uint8_t *rows, uint8_t *ues,
+                       uint8_t *acw, jedec_row_t *list) {
+  gal_config_t *config = plan->config;
+  size_t i;
+
+  for (i = 0; i < config->fuses_size; i++) {
+    list[i].buffer = rows + i * plan->row_bytes;
+    list[i].row = i;
+    list[i].size = config->row_width;
+  }
+  list[i].buffer = ues;
+  list[i].row = i;
+  list[i].size = config->ues_size;
+  list[i + 1].buffer = acw;
+  list[i + 1].row = config->acw_address;
+  list[i + 1].size = config->acw_size;
+}
+
+// Account the rows of a batch to the phase being reported
+static void report_rows(minipro_handle_t *handle, jedec_row_t *list,
+                        size_t count) {
+  size_t i;
+  for (i = 0; i < count; i++)
+    report_data(handle, list[i].buffer, list[i].size / 8 + 1);
+}
+
+// Read PLD device
+int read_jedec(minipro_handle_t *handle, jedec_t *jedec) {
+  struct timeval begin, end;
+  gettimeofday(&begin, NULL);
+
+  char status_msg[64], result[64];
+  sprintf(status_msg, "Reading device... ");
+  uint8_t ues[32], acw[32];
+  gal_config_t *config = (gal_config_t *)handle->device->config;
+  gal_plan_t *plan = gal_get_plan(config);
+  if (!plan) {
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+  if (jedec->QF < plan->fuse_count) {
+    minipro_log("The fuse map is too small for this device!\n");
+    return EXIT_FAILURE;
+  }
+
+  uint8_t ovc = 0;
+  if (minipro_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
+  if (ovc) {
+    minipro_log("\nOvercurrent protection!\007\n");
+    return EXIT_FAILURE;
+  }
+
+  uint8_t *rows = malloc(config->fuses_size * plan->row_bytes);
+  jedec_row_t *list = malloc((config->fuses_size + 2) * sizeof(jedec_row_t));
+  if (!rows || !list) {
+    free(rows);
+    free(list);
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Read the fuse array, UES and ACW rows in one batch
+  memset(jedec->fuses, 0, FUSE_WORDS(jedec->QF) * sizeof(uint64_t));
+  jedec_rows(plan, rows, ues, acw, list);
+  jedec_progress_t progress = {status_msg, config->fuses_size + 2, plan, rows,
+                               jedec->fuses};
+  int ret = minipro_read_jedec_rows(handle, list, config->fuses_size + 2,
+                                    jedec_row_done, &progress);
+  if (!ret) report_rows(handle, list, config->fuses_size + 2);
+  free(list);
+  free(rows);
+  if (ret) return EXIT_FAILURE;
+  gal_unpack_runs(&plan->ues, 1, ues, jedec->fuses);
+  gal_unpack_runs(plan->acw, plan->acw_count, acw, jedec->fuses);
+
+  gettimeofday(&end, NULL);
+  sprintf(result, "Reading device...  %.2fSec  OK",
+          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+              (double)(end.tv_sec - begin.tv_sec));
+  minipro_progress_end(status_msg, config->fuses_size + 2, result);
+  return EXIT_SUCCESS;
+}
+
+// Write PLD device
+int write_jedec(minipro_handle_t *handle, jedec_t *jedec) {
+  struct timeval begin, end;
+  gettimeofday(&begin, NULL);
+
+  char status_msg[64], result[64];
+  sprintf(status_msg, "Writing jedec file... ");
+  uint8_t ues[32], acw[32];
+  gal_config_t *config = (gal_config_t *)handle->device->config;
+  gal_plan_t *plan = gal_get_plan(config);
+  if (!plan) {
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+  if (jedec->QF < plan->fuse_count) {
+    minipro_log("The fuse map is too small for this device!\n");
+    return EXIT_FAILURE;
+  }
+
+  uint8_t ovc = 0;
+  if (minipro_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
+  if (ovc) {
+    minipro_log("\nOvercurrent protection!\007\n");
+    return EXIT_FAILURE;
+  }
+
+  // Building the rows
+  uint8_t *rows = malloc(config->fuses_size * plan->row_bytes);
+  jedec_row_t *list = malloc((config->fuses_size + 2) * sizeof(jedec_row_t));
+  if (!rows || !list) {
+    free(rows);
+    free(list);
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+  gal_pack_array(plan, jedec->fuses, rows);
+  memset(ues, 0, sizeof(ues));
+  gal_pack_runs(&plan->ues, 1, jedec->fuses, ues);
+  memset(acw, 0, sizeof(acw));
+  gal_pack_runs(plan->acw, plan->acw_count, jedec->fuses, acw);
+
+  // Write the fuse array, UES and ACW rows in one batch
+  jedec_rows(plan, rows, ues, acw, list);
+  jedec_progress_t progress = {status_msg, config->fuses_size + 2, NULL, NULL,
+                               NULL};
+  int ret = minipro_write_jedec_rows(handle, list, config->fuses_size + 2,
+                                     jedec_row_done, &progress);
+  if (!ret) report_rows(handle, list, config->fuses_size + 2);
+  free(list);
+  free(rows);
+  if (ret) return EXIT_FAILURE;
+
+  gettimeofday(&end, NULL);
+  sprintf(result, "Writing jedec file...  %.2fSec  OK",
+          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+              (double)(end.tv_sec - begin.tv_sec));
+  minipro_progress_end(status_msg, config->fuses_size + 2, result);
+  return EXIT_SUCCESS;
+}
+
+int erase_device(minipro_handle_t *handle) {
+  struct timeval begin, end;
+  if (handle->cmdopts->no_erase == 0 &&
+      (handle->device->opts4 &
+       MP_ERASE_MASK))  // Not all chips can be erased...
+  {
+    minipro_log("Erasing... ");
+    fflush(stderr);
+    gettimeofday(&begin, NULL);
+    report_phase_t phase;
+    report_begin(handle, &phase, "erase");
+    if (report_end(handle, &phase, minipro_erase(handle)))
+      return EXIT_FAILURE;
+    gettimeofday(&end, NULL);
+    minipro_log("%.2fSec OK\n",
+                (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+                (double)(end.tv_sec - begin.tv_sec));
+  }
+  return EXIT_SUCCESS;
+}
+
+//Helper function to check for pld devices
+int is_pld(uint8_t protocol_id) {
+  switch (protocol_id) {
+    case PLD_PROTOCOL_16V8:
+    case PLD_PROTOCOL_20V8:
+    case PLD_PROTOCOL_22V10:
+    case PLD_PROTOCOL2_16V8:
+    case PLD_PROTOCOL2_20V8:
+    case PLD_PROTOCOL2_22V10:
+      return 1;
+  }
+  return 0;
+}
+
+// Build the tables filled on first use while still single threaded
+void build_device_tables(minipro_handle_t *handle) {
+  uint64_t mask;
+
+  crc32_update(0, NULL, 0);
+  get_pin_mask(handle->device->opts8 & 0xFF, &mask);
+  if (is_pld(handle->device->protocol_id) && handle->device->config)
+    gal_get_plan(handle->device->config);
+}
+
+/* Library interface */
+struct mp_handle {
+  minipro_handle_t *handle;
+  cmdopts_t cmdopts;
+  device_t device;
+  int selected;
+  mp_progress_cb progress;
+  mp_log_cb log;
+  void *context;
+};
+
+// Route the output of the calling thread to the handle while in a call
+static void enter(mp_handle_t *mp) {
+  minipro_set_output(mp->progress, mp->log, mp->context);
+}
+
+static int leave(int ret) {
+  minipro_set_output(NULL, NULL, NULL);
+  return ret;
+}
+
+int mp_open(const char *programmer, mp_progress_cb progress, mp_log_cb log,
+            void *context, mp_handle_t **mp) {
+  *mp = calloc(1, sizeof(mp_handle_t));
+  if (!*mp) return EXIT_FAILURE;
+  (*mp)->progress = progress;
+  (*mp)->log = log;
+  (*mp)->context = context;
+  enter(*mp);
+
+  (*mp)->handle = minipro_open(programmer, NULL);
+  if (!(*mp)->handle) {
+    free(*mp);
+    *mp = NULL;
+    return leave(EXIT_FAILURE);
+  }
+  if ((*mp)->handle->status == MP_STATUS_BOOTLOADER) {
+    minipro_log("%s is in bootloader mode!\n", (*mp)->handle->model);
+    minipro_close((*mp)->handle);
+    free(*mp);
+    *mp = NULL;
+    return leave(EXIT_FAILURE);
+  }
+  (*mp)->handle->cmdopts = &(*mp)->cmdopts;
+  return leave(EXIT_SUCCESS);
+}
+
+void mp_close(mp_handle_t *mp) {
+  if (!mp) return;
+  enter(mp);
+  minipro_close(mp->handle);
+  leave(EXIT_SUCCESS);
+  free(mp);
+}
+
+void mp_set_callbacks(mp_handle_t *mp, mp_progress_cb progress, mp_log_cb log,
+                      void *context) {
+  mp->progress = progress;
+  mp->log = log;
+  mp->context = context;
+}
+
+void mp_get_info(mp_handle_t *mp, mp_info_t *info) {
+  info->model = mp->handle->model;
+  info->firmware = mp->handle->firmware_str;
+  info->serial_number = mp->handle->serial_number;
+  info->path = mp->handle->path;
+}
+
+int mp_select_device(mp_handle_t *mp, const char *name) {
+  minipro_handle_t *handle = mp->handle;
+  device_t *found;
+  uint8_t status;
+
+  enter(mp);
+  mp->selected = 0;
+  pthread_mutex_lock(&database_lock);
+  found = get_device_by_name(handle, name);
+  if (found) {
+    mp->device = *found;
+    handle->device = &mp->device;
+    build_device_tables(handle);
+  }
+  pthread_mutex_unlock(&database_lock);
+  if (!found) {
+    minipro_log("Device %s not found!\n", name);
+    return leave(EXIT_FAILURE);
+  }
+  if (!is_pld(mp->device.protocol_id) &&
+      (!mp->device.read_buffer_size || !mp->device.protocol_id)) {
+    minipro_log("Unsupported device!\n");
+    return leave(EXIT_FAILURE);
+  }
+
+  switch (mp->device.package_details & ADAPTER_MASK) {
+    case TSOP48_ADAPTER:
+    case SOP44_ADAPTER:
+    case SOP56_ADAPTER:
+      if (minipro_unlock_tsop48(handle, &status)) return leave(EXIT_FAILURE);
+      minipro_end_transaction(handle);
+      if (status == MP_TSOP48_TYPE_NONE) {
+        minipro_log("TSOP adapter not found!\n");
+        return leave(EXIT_FAILURE);
+      }
+      break;
+  }
+
+  // Chips that can only be programmed via ICSP
+  handle->icsp = 0;
+  if ((mp->device.package_details & ICSP_MASK) &&
+      !(mp->device.package_details & PIN_COUNT_MASK))
+    handle->icsp = MP_ICSP_ENABLE | MP_ICSP_VCC;
+  mp->selected = 1;
+  return leave(EXIT_SUCCESS);
+}
+
+// Check that a memory of the selected device can take a buffer
+static int get_memory(mp_handle_t *mp, enum mp_memory memory, size_t size,
+                      uint8_t *type, size_t *memory_size) {
+  if (!mp->selected) {
+    minipro_log("No device selected!\n");
+    return EXIT_FAILURE;
+  }
+  if (is_pld(mp->device.protocol_id)) {
+    minipro_log("PLD devices can't be accessed as a memory buffer.\n");
+    return EXIT_FAILURE;
+  }
+  *type = memory == MP_MEMORY_DATA ? MP_DATA : MP_CODE;
+  *memory_size = memory == MP_MEMORY_DATA ? mp->device.data_memory_size
+                                          : mp->device.code_memory_size;
+  if (!*memory_size) {
+    minipro_log("No %s section found.\n",
+                memory == MP_MEMORY_DATA ? "data" : "code");
+    return EXIT_FAILURE;
+  }
+  if (size > *memory_size) {
+    minipro_log("The buffer is larger than the %s memory.\n",
+                memory == MP_MEMORY_DATA ? "data" : "code");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int mp_get_memory_size(mp_handle_t *mp, enum mp_memory memory, size_t *size) {
+  uint8_t type;
+  int ret;
+
+  enter(mp);
+  ret = get_memory(mp, memory, 0, &type, size);
+  return leave(ret);
+}
+
+int mp_read_chip_id(mp_handle_t *mp, uint32_t *id, uint32_t *expected) {
+  minipro_handle_t *handle = mp->handle;
+  uint8_t id_type;
+  int ret;
+
+  enter(mp);
+  if (!mp->selected) {
+    minipro_log("No device selected!\n");
+    return leave(EXIT_FAILURE);
+  }
+  if (!mp->device.chip_id_bytes_count || !mp->device.chip_id) {
+    minipro_log("%s has no chip ID.\n", mp->device.name);
+    return leave(EXIT_FAILURE);
+  }
+  if (minipro_begin_transaction(handle)) return leave(EXIT_FAILURE);
+  ret = minipro_get_chip_id(handle, &id_type, id);
+  if (minipro_end_transaction(handle)) ret = EXIT_FAILURE;
+  if (expected) *expected = mp->device.chip_id;
+  return leave(ret);
+}
+
+// Size rounded up to whole blocks. The programmers always transfer a
+// whole block, the last one of a shorter buffer included.
+static size_t whole_blocks(size_t size, size_t block) {
+  return block ? (size + block - 1) / block * block : size;
+}
+
+// Read a memory into a buffer with room for the last block
+static uint8_t *read_memory(mp_handle_t *mp, uint8_t type, size_t size) {
+  uint8_t *data = malloc(whole_blocks(size, mp->device.read_buffer_size));
+
+  if (!data) {
+    minipro_log("Out of memory!\n");
+    return NULL;
+  }
+  if (minipro_begin_transaction(mp->handle) ||
+      read_page_ram(mp->handle, data, type, size, NULL, NULL, NULL)) {
+    minipro_end_transaction(mp->handle);
+    free(data);
+    return NULL;
+  }
+  if (minipro_end_transaction(mp->handle)) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+// Compare a memory against a buffer, 'address' gets the first mismatch
+static int compare_with(mp_handle_t *mp, uint8_t type, const uint8_t *buffer,
+                        size_t size, size_t *address) {
+  uint8_t *data, c1, c2;
+  int idx;
+
+  data = read_memory(mp, type, size);
+  if (!data) return EXIT_FAILURE;
+  idx = compare_memory((uint8_t *)buffer, data, size, &c1, &c2);
+  free(data);
+  if (idx == -1) return EXIT_SUCCESS;
+  if (address) *address = idx;
+  minipro_log("Verification failed at address 0x%04X: File=0x%02X, "
+              "Device=0x%02X\n",
+              idx, c1, c2);
+  return EXIT_FAILURE;
+}
+
+int mp_read(mp_handle_t *mp, enum mp_memory memory, uint8_t *buffer,
+            size_t size) {
+  size_t memory_size;
+  uint8_t type, *data;
+
+  enter(mp);
+  if (get_memory(mp, memory, size, &type, &memory_size))
+    return leave(EXIT_FAILURE);
+  data = read_memory(mp, type, size);
+  if (!data) return leave(EXIT_FAILURE);
+  memcpy(buffer, data, size);
+  free(data);
+  return leave(EXIT_SUCCESS);
+}
+
+int mp_write(mp_handle_t *mp, enum mp_memory memory, const uint8_t *buffer,
+             size_t size, unsigned int flags) {
+  minipro_handle_t *handle = mp->handle;
+  size_t memory_size, padded;
+  uint8_t type, *data;
+  int ret = EXIT_FAILURE;
+
+  enter(mp);
+  if (get_memory(mp, memory, size, &type, &memory_size))
+    return leave(EXIT_FAILURE);
+  padded = whole_blocks(size, mp->device.write_buffer_size);
+  data = malloc(padded);
+  if (!data) {
+    minipro_log("Out of memory!\n");
+    return leave(EXIT_FAILURE);
+  }
+  memcpy(data, buffer, size);
+  memset(data + size, 0xFF, padded - size);
+  mp->cmdopts.no_erase = (flags & MP_WRITE_NO_ERASE) != 0;
+  mp->cmdopts.no_verify = (flags & MP_WRITE_NO_VERIFY) != 0;
+
+  if (minipro_begin_transaction(handle)) goto free;
+  if (erase_device(handle)) goto end;
+  // We must reset the transaction after the erase
+  if (minipro_end_transaction(handle) || minipro_begin_transaction(handle))
+    goto end;
+  if (!(flags & MP_WRITE_NO_PROTECT_OFF) &&
+      (mp->device.opts4 & MP_PROTECT_MASK)) {
+    if (minipro_protect_off(handle)) goto end;
+    minipro_log("Protect off...OK\n");
+  }
+  if (write_page_ram(handle, data, type, size, NULL, NULL)) goto end;
+  if (minipro_end_transaction(handle)) goto free;
+
+  if (!(flags & MP_WRITE_NO_VERIFY)) {
+    if (compare_with(mp, type, buffer, size, NULL)) goto free;
+    minipro_log("Verification OK\n");
+  }
+  if (!(flags & MP_WRITE_NO_PROTECT_ON) &&
+      (mp->device.opts4 & MP_PROTECT_MASK)) {
+    minipro_log("Protect on...");
+    if (minipro_begin_transaction(handle)) goto free;
+    if (minipro_protect_on(handle)) goto end;
+    if (minipro_end_transaction(handle)) goto free;
+    minipro_log("OK\n");
+  }
+  ret = EXIT_SUCCESS;
+  goto free;
+
+end:
+  minipro_end_transaction(handle);
+free:
+  free(data);
+  return leave(ret);
+}
+
+int mp_verify(mp_handle_t *mp, enum mp_memory memory, const uint8_t *buffer,
+              size_t size, size_t *address) {
+  size_t memory_size;
+  uint8_t type;
+
+  enter(mp);
+  if (get_memory(mp, memory, size, &type, &memory_size))
+    return leave(EXIT_FAILURE);
+  return leave(compare_with(mp, type, buffer, size, address));
+}
+
+int mp_blank_check(mp_handle_t *mp, enum mp_memory memory, size_t *address) {
+  size_t memory_size, i;
+  uint8_t type, *data;
+
+  enter(mp);
+  if (get_memory(mp, memory, 0, &type, &memory_size))
+    return leave(EXIT_FAILURE);
+  data = read_memory(mp, type, memory_size);
+  if (!data) return leave(EXIT_FAILURE);
+  for (i = 0; i < memory_size; i++)
+    if (data[i] != 0xFF) break;
+  free(data);
+  if (i == memory_size) return leave(EXIT_SUCCESS);
+  if (address) *address = i;
+  minipro_log("%s memory section is not blank.\n", type ? "Data" : "Code");
+  return leave(EXIT_FAILURE);
+}
+
+int mp_erase(mp_handle_t *mp) {
+  int ret;
+
+  enter(mp);
+  if (!mp->selected) {
+    minipro_log("No device selected!\n");
+    return leave(EXIT_FAILURE);
+  }
+  if (!(mp->device.opts4 & MP_ERASE_MASK)) {
+    minipro_log("%s can't be erased.\n", mp->device.name);
+    return leave(EXIT_FAILURE);
+  }
+  mp->cmdopts.no_erase = 0;
+  if (minipro_begin_transaction(mp->handle)) return leave(EXIT_FAILURE);
+  ret = erase_device(mp->handle);
+  if (minipro_end_transaction(mp->handle)) ret = EXIT_FAILURE;
+  return leave(ret);
+}
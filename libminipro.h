@@ -0,0 +1,100 @@
+/*
+ * libminipro.h - Library interface to drive the programmers in-process.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef LIBMINIPRO_H_
+#define LIBMINIPRO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The library is built with hidden visibility, only these are exported
+#if defined(__GNUC__) && !defined(_WIN32)
+#define MP_API __attribute__((visibility("default")))
+#else
+#define MP_API
+#endif
+
+/*
+ The functions return EXIT_SUCCESS or EXIT_FAILURE, the reason of a
+ failure is passed to the log callback. Each handle may be used by one
+ thread at a time, different handles from different threads at once.
+ */
+typedef struct mp_handle mp_handle_t;
+
+/*
+ Called with the steps done out of the total while an operation runs,
+ each time the percentage changes and at least every 100ms, then once
+ with done equal to total when the operation completes.
+ */
+typedef void (*mp_progress_cb)(void *context, const char *operation,
+                               size_t done, size_t total);
+// Called with the messages otherwise printed on stderr, lines may come
+// in several pieces
+typedef void (*mp_log_cb)(void *context, const char *message);
+
+enum mp_memory { MP_MEMORY_CODE, MP_MEMORY_DATA };
+
+// Flags of mp_write()
+#define MP_WRITE_NO_ERASE 0x01
+#define MP_WRITE_NO_VERIFY 0x02
+#define MP_WRITE_NO_PROTECT_OFF 0x04
+#define MP_WRITE_NO_PROTECT_ON 0x08
+
+typedef struct mp_info {
+  const char *model;
+  const char *firmware;
+  const char *serial_number;
+  const char *path;
+} mp_info_t;
+
+/*
+ Open a programmer by serial number or USB path, the first free one if
+ NULL. The callbacks may be NULL to print on stderr.
+ */
+MP_API int mp_open(const char *programmer, mp_progress_cb progress,
+                   mp_log_cb log, void *context, mp_handle_t **mp);
+MP_API void mp_close(mp_handle_t *mp);
+// Replace the callbacks given to mp_open()
+MP_API void mp_set_callbacks(mp_handle_t *mp, mp_progress_cb progress,
+                             mp_log_cb log, void *context);
+MP_API void mp_get_info(mp_handle_t *mp, mp_info_t *info);
+
+MP_API int mp_select_device(mp_handle_t *mp, const char *name);
+MP_API int mp_get_memory_size(mp_handle_t *mp, enum mp_memory memory,
+                              size_t *size);
+MP_API int mp_read_chip_id(mp_handle_t *mp, uint32_t *id, uint32_t *expected);
+
+// The buffers start at address 0 and may be shorter than the memory
+MP_API int mp_read(mp_handle_t *mp, enum mp_memory memory, uint8_t *buffer,
+                   size_t size);
+MP_API int mp_write(mp_handle_t *mp, enum mp_memory memory,
+                    const uint8_t *buffer, size_t size, unsigned int flags);
+MP_API int mp_verify(mp_handle_t *mp, enum mp_memory memory,
+                     const uint8_t *buffer, size_t size, size_t *address);
+MP_API int mp_blank_check(mp_handle_t *mp, enum mp_memory memory,
+                          size_t *address);
+MP_API int mp_erase(mp_handle_t *mp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,7 +19,9 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -28,12 +30,23 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
+#include "checksum.h"
+#include "compress.h"
 #include "database.h"
+#include "elf.h"
+#include "fuseconf.h"
+#include "gal.h"
 #include "jedec.h"
 #include "ihex.h"
 #include "srec.h"
 #include "minipro.h"
+#include "report.h"
+#include "serial.h"
 #include "version.h"
 
 #ifdef _WIN32
@@ -50,6 +63,54 @@
 
 #define READ_BUFFER_SIZE 65536
 
+// Options of the job to run, the others are only for the command line
+#define JOB_OPTIONS "ezZEbuPvxykr:w:m:p:c:o:iIsSDf:T:"
+
+#define DAEMON_REQUEST_SIZE 65536
+#define DAEMON_MAX_ARGS 256
+
+// Microseconds between two chip checks of a looping gang station
+#define CHIP_POLL_INTERVAL 200000
+
+enum {
+  OPT_PROGRAMMER = 256,
+  OPT_GANG,
+  OPT_LOOP,
+  OPT_DAEMON,
+  OPT_SERIAL,
+  OPT_SERIAL_LOG,
+  OPT_JSON
+};
+
+static const struct option long_options[] = {
+    {"programmer", required_argument, NULL, OPT_PROGRAMMER},
+    {"gang", no_argument, NULL, OPT_GANG},
+    {"loop", no_argument, NULL, OPT_LOOP},
+    {"daemon", required_argument, NULL, OPT_DAEMON},
+    {"serial", required_argument, NULL, OPT_SERIAL},
+    {"serial-log", required_argument, NULL, OPT_SERIAL_LOG},
+    {"json", no_argument, NULL, OPT_JSON},
+    {NULL, 0, NULL, 0}};
+
+// A file read and parsed once, shared read-only by the gang stations
+typedef struct shared_image {
+  uint8_t *file;  // raw file contents, NUL terminated
+  size_t file_size;
+  uint8_t *data;  // parsed code or data page, NULL if none
+  uint8_t type;
+  size_t size;        // page size
+  size_t image_size;  // image size found by open_file
+  segment_list_t segments;
+  jedec_t jedec;  // parsed JED file of a PLD
+} shared_image_t;
+
+// Set by Ctrl-C to stop looping gang stations or the daemon
+static volatile sig_atomic_t stop_requested;
+
+// Serial fields given on the command line, shared by the gang stations
+static serial_t serial;
+static pthread_mutex_t serial_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 const char *get_voltage(minipro_handle_t*, uint8_t, uint8_t);
 
@@ -92,6 +153,8 @@ void print_help_and_exit(char *progname) {
       "options:\n"
       "	-l		List all supported devices\n"
       "	-L <search>	List devices like this\n"
+      "	-q <type>	List devices without a programmer attached\n"
+      "			Possible values: tl866a, tl866ii\n"
       "	-d <device>	Show device information\n"
       "	-D		Just read the chip ID\n"
       "	-r <filename>	Read memory\n"
@@ -99,11 +162,20 @@ void print_help_and_exit(char *progname) {
       "	-m <filename>	Verify memory\n"
       "	-f <format>	Specify file format\n"
       "			Possible values: ihex, srec\n"
+      "	-T <transform>	Transform the image between file and chip\n"
+      "			For multiple transforms use -T for each one,\n"
+      "			they are applied in the order given\n"
+      "			Possible values: offset=<n>, crop=<start>:<end>\n"
+      "			fill=<byte>[:<start>:<end>], unfill=<byte>[:<min>]\n"
+      "			swap[=<2|4|8>], split=<n>:<offset>[:<width>]\n"
+      "			obs=<n> (bytes per ihex/srec output record)\n"
       "	-b		Blank check. Optionally, you can use -c\n"
       "			to specify a memory type\n"
       "	-a <type>	Autodetect SPI 25xx devices\n"
       "			Possible values: 8, 16\n"
-      "	-z		Check for bad pin contact\n"
+      "	-z		Check for bad pin contact, done before\n"
+      "			writing on the TL866II+ anyway\n"
+      "	-Z		Do NOT check for bad pin contact before writing\n"
       "	-e 		Do NOT erase device\n"
       "	-E 		Just erase device\n"
       "	-u 		Do NOT disable write-protect\n"
@@ -129,23 +201,47 @@ void print_help_and_exit(char *progname) {
       "			(can't combine with -s)\n"
       "	-x		Do NOT attempt to read ID (only valid in read mode)\n"
       "	-y		Do NOT error on ID mismatch\n"
+      "	-k		Print the checksums of the data read,\n"
+      "			written or verified\n"
       "	-V		Show version information\n"
       "	-t		Start hardware check\n"
       "	-F <filename>	Update firmware (should be update.dat)\n"
+      "	--programmer <serial|path>\n"
+      "			Use the programmer with this serial number or\n"
+      "			USB path, 'help' to list the attached ones\n"
+      "			With --gang, a comma separated list of them\n"
+      "	--gang		Run the job on all the free programmers at once,\n"
+      "			or on those given with --programmer\n"
+      "	--loop		Run the job again each time the chip is swapped,\n"
+      "			until interrupted. With --gang, on each station\n"
+      "	--daemon <socket>\n"
+      "			Keep the programmer open and run the jobs sent\n"
+      "			to this Unix socket, see the manual page\n"
+      "	--serial <offset>:<width>:<format>:<source>\n"
+      "			Patch a value of its own into each chip written,\n"
+      "			or skip it when verifying. For several fields\n"
+      "			use --serial for each one\n"
+      "			Possible formats: le, be, dec, hex, bytes\n"
+      "			Possible sources: counter=<first>[+<step>],\n"
+      "			list=<filename>\n"
+      "	--serial-log <filename>\n"
+      "			Append the values given to each chip to a file\n"
+      "	--json		Print a JSON line on stdout for each phase of\n"
+      "			the job, with its timing and USB transfers\n"
       "	-h		Show help (this text)\n";
   fprintf(stderr, usage, VERSION, basename(progname));
   exit(EXIT_SUCCESS);
 }
 
-minipro_handle_t *get_handle(const char *device_name) {
+minipro_handle_t *get_handle(const char *programmer, const char *device_name) {
   minipro_handle_t *handle = malloc(sizeof(minipro_handle_t));
   if (handle == NULL) {
     fprintf(stderr, "Out of memory!\n");
     return NULL;
   }
 
-  if (!(minipro_get_devices_count(MP_TL866A) +
-        minipro_get_devices_count(MP_TL866IIPLUS))) {
+  if (!programmer && !(minipro_get_devices_count(MP_TL866A) +
+                        minipro_get_devices_count(MP_TL866IIPLUS))) {
     fprintf(stderr,
             "No TL866 device found. Which database do you want to display?\n1) "
             "TL866A\n2) TL866II+\n3) Abort\n");
@@ -173,7 +269,7 @@ minipro_handle_t *get_handle(const char *device_name) {
       }
     }
   } else {
-    minipro_handle_t *tmp = minipro_open(device_name);
+    minipro_handle_t *tmp = minipro_open(programmer, device_name);
     if (!tmp) {
       free(handle);
       return NULL;
@@ -187,8 +283,20 @@ minipro_handle_t *get_handle(const char *device_name) {
   return handle;
 }
 
-void print_devices_and_exit(const char *device_name) {
-  minipro_handle_t *handle = get_handle(NULL);
+void print_devices_and_exit(const char *device_name, cmdopts_t *cmdopts) {
+  minipro_handle_t *handle;
+
+  // The database of the given programmer version is used without any USB
+  // access if specified.
+  if (cmdopts->version) {
+    handle = calloc(1, sizeof(minipro_handle_t));
+    if (!handle) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(EXIT_FAILURE);
+    }
+    handle->version = cmdopts->version;
+  } else
+    handle = get_handle(cmdopts->programmer, NULL);
   if (!handle) exit(EXIT_FAILURE);
 
   // If less is available under windows use it, otherwise just use more.
@@ -215,39 +323,19 @@ void print_devices_and_exit(const char *device_name) {
     dup2(fileno(pager), STDOUT_FILENO);
   }
 
-  device_t *device;
-  device_t *deviceo;
-  device_t *devicet;
-
-  // Show custom devices without overrides
-  for (deviceo = get_device_custom(handle); deviceo[0].name;
-
-       deviceo = &(deviceo[1])) {
-    devicet = deviceo;
-
-    for (device = get_device_table(handle); device[0].name;
-
-         device = &(device[1])) {
-      if (!strcasecmp(deviceo->name, device->name)) {
-        devicet = NULL;  // Skip if existing
-        break;
-      }
-    }
-
-    if (devicet &&
-        (device_name == NULL || STRCASESTR(devicet->name, device_name))) {
-      fprintf(stdout, "%s\n", devicet->name);
-    }
+  // Show the devices sorted by name, custom devices included
+  size_t i, count;
+  const char **names = get_device_names(handle, &count);
+  if (!names) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(EXIT_FAILURE);
   }
-
-  // Show devices.
-  for (device = get_device_table(handle); device[0].name;
-
-       device = &(device[1])) {
-    if (device_name == NULL || STRCASESTR(device->name, device_name)) {
-      fprintf(stdout, "%s\n", device->name);
+  for (i = 0; i < count; i++) {
+    if (device_name == NULL || STRCASESTR(names[i], device_name)) {
+      fprintf(stdout, "%s\n", names[i]);
     }
   }
+  free(names);
 
   if (pager) {
     close(STDOUT_FILENO);
@@ -258,8 +346,8 @@ void print_devices_and_exit(const char *device_name) {
   exit(EXIT_SUCCESS);
 }
 
-void print_device_info_and_exit(const char *device_name) {
-  minipro_handle_t *handle = get_handle(device_name);
+void print_device_info_and_exit(const char *device_name, cmdopts_t *cmdopts) {
+  minipro_handle_t *handle = get_handle(cmdopts->programmer, device_name);
   if (!handle) exit(EXIT_FAILURE);
 
   fprintf(stderr, "Name: %s\n", handle->device->name);
@@ -391,13 +479,13 @@ int set_voltage(minipro_handle_t *handle, char *value, int *target,
 // Parse and set programming options for both TL866A/CS and TL866II+
 int parse_options(minipro_handle_t *handle, int argc, char **argv) {
   uint32_t v;
-  char c, *p_end, option[64], value[64];
-  int vpp = -1, vcc = -1, vdd = -1, pulse_delay = -1;
+  char *p_end, option[64], value[64];
+  int c, vpp = -1, vcc = -1, vdd = -1, pulse_delay = -1;
 
   // Parse options first
   optind = 1;
   opterr = 0;
-  while ((c = getopt(argc, argv, "o:")) != -1) {
+  while ((c = getopt_long(argc, argv, "o:", long_options, NULL)) != -1) {
     switch (c) {
       case 'o':
         if (sscanf(optarg, "%[^=]=%[^=]", option, value) != 2)
@@ -465,8 +553,41 @@ int parse_options(minipro_handle_t *handle, int argc, char **argv) {
   return EXIT_SUCCESS;
 }
 
-void hardware_check_and_exit() {
-  minipro_handle_t *handle = minipro_open(NULL);
+// Open a programmer for a job, timed as the open phase
+static minipro_handle_t *open_programmer(const char *programmer,
+                                         const char *device_name) {
+  report_phase_t phase;
+  report_begin(NULL, &phase, "open");
+  minipro_handle_t *handle = minipro_open(programmer, device_name);
+  report_end(handle, &phase, handle ? EXIT_SUCCESS : EXIT_FAILURE);
+  return handle;
+}
+
+// List the attached programmers, their USB path first
+void print_programmers_and_exit() {
+  minipro_handle_t *handle;
+  usb_device_t *devices;
+  int i, count = usb_list_devices(&devices);
+
+  if (count < 0) exit(EXIT_FAILURE);
+  if (!count) fprintf(stderr, "No programmer found.\n");
+  for (i = 0; i < count; i++) {
+    handle = minipro_open(devices[i].path, NULL);
+    if (handle) {
+      printf("%-16s %-8s %-8s %s\n", devices[i].path, handle->model,
+             handle->firmware_str, handle->serial_number);
+      minipro_close(handle);
+    } else {
+      printf("%-16s %-8s unavailable\n", devices[i].path,
+             devices[i].version == MP_TL866IIPLUS ? "TL866II+" : "TL866A");
+    }
+  }
+  free(devices);
+  exit(EXIT_SUCCESS);
+}
+
+void hardware_check_and_exit(cmdopts_t *cmdopts) {
+  minipro_handle_t *handle = minipro_open(cmdopts->programmer, NULL);
   if (!handle) {
     exit(EXIT_FAILURE);
   }
@@ -482,8 +603,8 @@ void hardware_check_and_exit() {
   exit(ret);
 }
 
-void firmware_update_and_exit(const char *firmware) {
-  minipro_handle_t *handle = minipro_open(NULL);
+void firmware_update_and_exit(const char *firmware, cmdopts_t *cmdopts) {
+  minipro_handle_t *handle = minipro_open(cmdopts->programmer, NULL);
   if (!handle) {
     exit(EXIT_FAILURE);
   }
@@ -497,7 +618,7 @@ void firmware_update_and_exit(const char *firmware) {
 
 // Autodetect 25xx SPI devices
 void spi_autodetect_and_exit(uint8_t package_type, cmdopts_t *cmdopts) {
-  minipro_handle_t *handle = minipro_open(NULL);
+  minipro_handle_t *handle = minipro_open(cmdopts->programmer, NULL);
   if (!handle) {
     exit(EXIT_FAILURE);
   }
@@ -525,146 +646,200 @@ void spi_autodetect_and_exit(uint8_t package_type, cmdopts_t *cmdopts) {
   if (minipro_spi_autodetect(handle, package_type >> 4, &chip_id))
     exit(EXIT_FAILURE);
 
-  device_t *device;
-  device_t *deviceo;
-  device_t *devicet;
+  device_t **devices;
+  size_t i, count;
 
   fprintf(stderr, "Autodetecting device (ID:0x%04X)\n", chip_id);
 
-  // Show custom devices without overrides
-  for (deviceo = get_device_custom(handle); deviceo[0].name;
+  // Custom devices come first, those overriding a device are skipped
+  devices = get_devices_by_id(handle, chip_id, &count);
+  for (i = 0; i < count; i++) {
+    if (get_pin_count(devices[i]) != package_type) continue;
+    if (is_custom_device(handle, devices[i]) &&
+        get_table_device_by_name(handle, devices[i]->name))
+      continue;
+    fprintf(stderr, "%s\n", devices[i]->name);
+    n++;
+  }
+  free(devices);
 
-       deviceo = &(deviceo[1])) {
-    devicet = deviceo;
+  fprintf(stderr, "%u device(s) found.\n", n);
 
-    for (device = get_device_table(handle); device[0].name;
+  minipro_close(handle);
+  exit(EXIT_SUCCESS);
+}
 
-         device = &(device[1])) {
-      if (!strcasecmp(deviceo->name, device->name)) {
-        devicet = NULL;  // Skip if existing
-        break;
+// Parse an option of the job itself, -1 if it isn't one
+static int parse_job_option(int c, cmdopts_t *cmdopts) {
+  switch (c) {
+    case 'e':
+      cmdopts->no_erase = 1;  // 1= do not erase
+      break;
+
+    case 'u':
+      cmdopts->no_protect_off = 1;  // 1= do not disable write protect
+      break;
+
+    case 'P':
+      cmdopts->no_protect_on = 1;  // 1= do not enable write protect
+      break;
+
+    case 'v':
+      cmdopts->no_verify = 1;  // 1= do not verify
+      break;
+
+    case 'x':
+      cmdopts->idcheck_skip = 1;  // 1= do not test id at all
+      break;
+
+    case 'y':
+      cmdopts->idcheck_continue = 1;  // 1= do not stop on id mismatch
+      break;
+
+    case 'k':
+      cmdopts->checksum = 1;  // 1= print the image checksums
+      break;
+
+    case 'z':
+      cmdopts->pincheck = 1;  // 1= Check for bad pin contact
+      break;
+
+    case 'Z':
+      cmdopts->pincheck_skip = 1;  // 1= do not check pin contact on write
+      break;
+
+    case 'p':
+      cmdopts->device = optarg;
+      break;
+
+    case 'c':
+      if (!strcasecmp(optarg, "code")) cmdopts->page = CODE;
+      if (!strcasecmp(optarg, "data")) cmdopts->page = DATA;
+      if (!strcasecmp(optarg, "config")) cmdopts->page = CONFIG;
+      if (!cmdopts->page) {
+        fprintf(stderr, "Unknown memory type\n");
+        return EXIT_FAILURE;
       }
-    }
+      break;
 
-    if (devicet && devicet->chip_id_bytes_count &&
-        devicet->chip_id == chip_id && get_pin_count(devicet) == package_type) {
-      fprintf(stderr, "%s\n", devicet->name);
-      n++;
-    }
-  }
+    case 'f':
+      if (!strcasecmp(optarg, "ihex")) cmdopts->format = IHEX;
+      if (!strcasecmp(optarg, "srec")) cmdopts->format = SREC;
+      if (!cmdopts->format) {
+        fprintf(stderr, "Unknown file format\n");
+        return EXIT_FAILURE;
+      }
+      break;
 
-  // Show devices.
-  for (device = get_device_table(handle); device[0].name;
+    case 'r':
+      cmdopts->action = READ;
+      cmdopts->filename = optarg;
+      break;
 
-       device = &(device[1])) {
-    if (device->chip_id_bytes_count && device->chip_id == chip_id &&
-        get_pin_count(device) == package_type) {
-      fprintf(stderr, "%s\n", device->name);
-      n++;
-    }
-  }
+    case 'w':
+      cmdopts->action = WRITE;
+      cmdopts->filename = optarg;
+      break;
 
-  fprintf(stderr, "%u device(s) found.\n", n);
+    case 'm':
+      cmdopts->action = VERIFY;
+      cmdopts->filename = optarg;
+      break;
 
-  minipro_close(handle);
-  exit(EXIT_SUCCESS);
-}
+    case 'E':
+      cmdopts->action = ERASE;
+      break;
 
-void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts) {
-  char c;
-  uint8_t package_type = 0;
-  memset(cmdopts, 0, sizeof(cmdopts_t));
+    case 'b':
+      cmdopts->action = BLANK_CHECK;
+      break;
 
-  while ((c = getopt(argc, argv, "lL:d:ea:zEbuPvxyr:w:m:p:c:o:iIsSVhDtf:F:")) != -1) {
-    switch (c) {
-      case 'l':
-        print_devices_and_exit(NULL);
-        break;
+    case 'i':
+      cmdopts->icsp = MP_ICSP_ENABLE | MP_ICSP_VCC;
+      break;
 
-      case 'L':
-        print_devices_and_exit(optarg);
-        break;
-        break;
+    case 'I':
+      cmdopts->icsp = MP_ICSP_ENABLE;
+      break;
 
-      case 'd':
-        print_device_info_and_exit(optarg);
-        break;
+    case 'S':
+      cmdopts->size_nowarn = 1;
+      cmdopts->size_error = 1;
+      break;
 
-      case 'e':
-        cmdopts->no_erase = 1;  // 1= do not erase
-        break;
+    case 's':
+      cmdopts->size_error = 1;
+      break;
 
-      case 'u':
-        cmdopts->no_protect_off = 1;  // 1= do not disable write protect
-        break;
+    case 'D':
+      cmdopts->idcheck_only = 1;
+      break;
 
-      case 'P':
-        cmdopts->no_protect_on = 1;  // 1= do not enable write protect
-        break;
+    case 'T':
+      if (pipeline_parse(&cmdopts->pipeline, optarg)) return EXIT_FAILURE;
+      break;
 
-      case 'v':
-        cmdopts->no_verify = 1;  // 1= do not verify
-        break;
+    /*
+     * Only check if the syntax is correct here.
+     * The actual parsing of each 'o' option is done after the programmer
+     * version is known.
+     */
+    case 'o':
+      break;
 
-      case 'x':
-        cmdopts->idcheck_skip = 1;  // 1= do not test id at all
-        break;
+    default:
+      return -1;
+  }
+  return EXIT_SUCCESS;
+}
 
-      case 'y':
-        cmdopts->idcheck_continue = 1;  // 1= do not stop on id mismatch
-        break;
+void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts) {
+  int c;
+  uint8_t package_type = 0;
+  uint8_t list = 0, hardware_check = 0;
+  const char *list_name = NULL, *info_name = NULL, *firmware = NULL;
+  memset(cmdopts, 0, sizeof(cmdopts_t));
 
-      case 'z':
-        cmdopts->pincheck = 1;  // 1= Check for bad pin contact
-        break;
+  // The actions opening a programmer are deferred so that --programmer
+  // may be given in any order
+  while ((c = getopt_long(argc, argv,
+                          "lL:q:d:a:VhtF:" JOB_OPTIONS, long_options,
+                          NULL)) != -1) {
+    switch (parse_job_option(c, cmdopts)) {
+      case EXIT_SUCCESS:
+        if (c == 'p' && !strcasecmp(optarg, "help")) list = 1;
+        continue;
+      case EXIT_FAILURE:
+        exit(EXIT_FAILURE);
+    }
 
-      case 'p':
-        if (!strcasecmp(optarg, "help")) print_devices_and_exit(NULL);
-        cmdopts->device = optarg;
+    switch (c) {
+      // Listing is deferred so that -q may be given in any order
+      case 'l':
+        list = 1;
         break;
 
-      case 'c':
-        if (!strcasecmp(optarg, "code")) cmdopts->page = CODE;
-        if (!strcasecmp(optarg, "data")) cmdopts->page = DATA;
-        if (!strcasecmp(optarg, "config")) cmdopts->page = CONFIG;
-        if (!cmdopts->page) {
-          fprintf(stderr, "Unknown memory type\n");
-          exit(EXIT_FAILURE);
-        }
+      case 'L':
+        list = 1;
+        list_name = optarg;
         break;
 
-      case 'f':
-        if (!strcasecmp(optarg, "ihex")) cmdopts->format = IHEX;
-        if (!strcasecmp(optarg, "srec")) cmdopts->format = SREC;
-        if (!cmdopts->format) {
-          fprintf(stderr, "Unknown file format\n");
+      case 'q':
+        if (!strcasecmp(optarg, "tl866a") || !strcasecmp(optarg, "tl866cs"))
+          cmdopts->version = MP_TL866A;
+        else if (!strcasecmp(optarg, "tl866ii") ||
+                 !strcasecmp(optarg, "tl866ii+"))
+          cmdopts->version = MP_TL866IIPLUS;
+        else {
+          fprintf(stderr, "Unknown programmer type\n");
           exit(EXIT_FAILURE);
         }
         break;
 
-      case 'r':
-        cmdopts->action = READ;
-        cmdopts->filename = optarg;
-        break;
-
-      case 'w':
-        cmdopts->action = WRITE;
-        cmdopts->filename = optarg;
-        break;
-
-      case 'm':
-        cmdopts->action = VERIFY;
-        cmdopts->filename = optarg;
+      case 'd':
+        info_name = optarg;
         break;
 
-      case 'E':
-    	  cmdopts->action = ERASE;
-    	  break;
-
-      case 'b':
-    	  cmdopts->action = BLANK_CHECK;
-    	  break;
-
       case 'a':
         if (!strcasecmp(optarg, "8"))
           package_type = 8;
@@ -676,362 +851,146 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts) {
         }
         break;
 
-      case 'i':
-        cmdopts->icsp = MP_ICSP_ENABLE | MP_ICSP_VCC;
+      case 'h':
+        print_help_and_exit(argv[0]);
         break;
 
-      case 'I':
-        cmdopts->icsp = MP_ICSP_ENABLE;
+      case 'V':
+        print_version_and_exit();
         break;
 
-      case 'S':
-        cmdopts->size_nowarn = 1;
-        cmdopts->size_error = 1;
+      case 't':
+        hardware_check = 1;
         break;
 
-      case 's':
-        cmdopts->size_error = 1;
+      case 'F':
+        firmware = optarg;
         break;
 
-      case 'D':
-        cmdopts->idcheck_only = 1;
+      case OPT_PROGRAMMER:
+        cmdopts->programmer = optarg;
         break;
 
+      case OPT_GANG:
+        cmdopts->gang = 1;
+        break;
 
-      case 'h':
-        print_help_and_exit(argv[0]);
+      case OPT_LOOP:
+        cmdopts->loop = 1;
         break;
 
-      case 'V':
-        print_version_and_exit();
+      case OPT_DAEMON:
+        cmdopts->daemon = optarg;
         break;
 
-      case 't':
-        hardware_check_and_exit();
+      case OPT_SERIAL:
+        if (serial_add_field(&serial, optarg)) exit(EXIT_FAILURE);
+        cmdopts->serial = &serial;
         break;
 
-      /*
-       * Only check if the syntax is correct here.
-       * The actual parsing of each 'o' option is done after the programmer
-       * version is known.
-       */
-      case 'o':
+      case OPT_SERIAL_LOG:
+        if (serial.log) fclose(serial.log);
+        if (serial_open_log(&serial, optarg)) exit(EXIT_FAILURE);
         break;
-      case 'F':
-        firmware_update_and_exit(optarg);
+
+      case OPT_JSON:
+        report_open(stdout);
         break;
+
       default:
         print_help_and_exit(argv[0]);
         break;
     }
   }
 
+  if (cmdopts->programmer && !strcasecmp(cmdopts->programmer, "help"))
+    print_programmers_and_exit();
+  if (info_name) print_device_info_and_exit(info_name, cmdopts);
+  if (hardware_check) hardware_check_and_exit(cmdopts);
+  if (firmware) firmware_update_and_exit(firmware, cmdopts);
+  if (list) print_devices_and_exit(list_name, cmdopts);
   if (package_type) spi_autodetect_and_exit(package_type, cmdopts);
 }
 
-// Search for config name in buffer.
-int get_config_value(const char *buffer, const char *name, uint32_t *value) {
-  char *cur, *eol, *val;
-  char num[128];
-  for (;;) {
-    cur = STRCASESTR(buffer, name);  // find the line
-    if (cur == NULL) return EXIT_FAILURE;
-    eol = STRCASESTR(cur, (char *)"\n");  // find the end of line
-    if (cur == NULL) return EXIT_FAILURE;
-    cur =
-        STRCASESTR(cur, (char *)"=");  // find the '=' sign in the current line
-    if (cur == NULL) return EXIT_FAILURE;
-    cur = STRCASESTR(cur, (char *)"0x");  // find the value in the current line
-    if (cur == NULL) return EXIT_FAILURE;
-    val = num;
-    cur += 2;  // Advances the pointer to the first numeric character
-    while (cur < eol) {
-      if (isxdigit(*cur++))  // check for hex digit
-      {
-        *val++ = *(cur - 1);  // put it in the buffer
+// Check that the options make up a job to run
+static int check_job(cmdopts_t *cmdopts) {
+  // Check if a file name is required
+  switch (cmdopts->action) {
+    case READ:
+    case WRITE:
+    case VERIFY:
+      if (!cmdopts->filename && !cmdopts->idcheck_only) {
+        fprintf(stderr, "A file name is required for this action.\n");
+        return EXIT_FAILURE;
       }
-    }
-    // here we reached the end of line
-    *val = 0;        // insert null terminated string char
-    if (val == num)  // if no numeric value found exit with error
       break;
-    else {
-      *value = strtol((char *)num, NULL, 16);  // convert value
-      return EXIT_SUCCESS;
-    }
-  }
-  return EXIT_FAILURE;
-}
-
-void update_status(char *status_msg, char *fmt, ...) {
-  va_list args;
-  va_start(args, fmt);
-  fprintf(stderr, "\r\e[K%s", status_msg);
-  vfprintf(stderr, fmt, args);
-  fflush(stderr);
-  va_end(args);
-}
-
-int compare_memory(uint8_t *s1, uint8_t *s2, size_t size, uint8_t *c1,
-                   uint8_t *c2) {
-  size_t i;
-  for (i = 0; i < size; i++) {
-    if (s1[i] != s2[i]) {
-      *c1 = s1[i];
-      *c2 = s2[i];
-      return i;
-    }
-  }
-  return -1;
-}
-
-/* RAM-centric IO operations */
-int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
-                  size_t size) {
-  char status_msg[64];
-  char *name = type == MP_CODE ? "Code" : "Data";
-  sprintf(status_msg, "Reading %s...  ", name);
-
-  size_t blocks_count = size / handle->device->read_buffer_size;
-  if (size % handle->device->read_buffer_size) blocks_count++;
-
-  struct timeval begin, end;
-  gettimeofday(&begin, NULL);
-  uint32_t address;
-  size_t i, len = handle->device->read_buffer_size;
-  for (i = 0; i < blocks_count; i++) {
-    update_status(status_msg, "%2d%%", i * 100 / blocks_count);
-    // Translating address to protocol-specific
-    address = i * handle->device->read_buffer_size;
-    if ((handle->device->opts4 & MP_DATA_BUS_WIDTH) && type == MP_CODE)
-      address = address >> 1;
-
-    // Last block
-    if ((i + 1) * len > size) len = size % len;
-    if (minipro_read_block(handle, type, address,
-                           buf + i * handle->device->read_buffer_size, len))
-      return EXIT_FAILURE;
-
-    uint8_t ovc;
-    if (minipro_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
-    if (ovc) {
-      fprintf(stderr, "\nOvercurrent protection!\007\n");
-      return EXIT_FAILURE;
-    }
-  }
-  gettimeofday(&end, NULL);
-  sprintf(status_msg, "Reading %s...  %.2fSec  OK", name,
-          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-              (double)(end.tv_sec - begin.tv_sec));
-  update_status(status_msg, "\n");
-  return EXIT_SUCCESS;
-}
-
-int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
-                   size_t size) {
-  char status_msg[64];
-  char *name = type == MP_CODE ? "Code" : "Data";
-  sprintf(status_msg, "Writing  %s...  ", name);
-
-  size_t blocks_count = size / handle->device->write_buffer_size;
-  if (size % handle->device->write_buffer_size) blocks_count++;
-
-  struct timeval begin, end;
-  gettimeofday(&begin, NULL);
-  minipro_status_t status;
-  size_t i, len = handle->device->write_buffer_size;
-  uint32_t address;
-  for (i = 0; i < blocks_count; i++) {
-    update_status(status_msg, "%2d%%", i * 100 / blocks_count);
-    // Translating address to protocol-specific
-    address = i * len;
-    if ((handle->device->opts4 & MP_DATA_BUS_WIDTH) && type == MP_CODE)
-      address = address >> 1;
-
-    // Last block
-    if ((i + 1) * len > size) len = size % len;
-    if (minipro_write_block(handle, type, address,
-                            buffer + i * handle->device->write_buffer_size,
-                            len))
-      return EXIT_FAILURE;
-
-    uint8_t ovc = 0;
-    if (minipro_get_ovc_status(handle, &status, &ovc)) return EXIT_FAILURE;
-    if (ovc) {
-      fprintf(stderr, "\nOvercurrent protection!\007\n");
-      return EXIT_FAILURE;
-    }
-    if (status.error && ! handle->cmdopts->no_verify) {
-      if (minipro_end_transaction(handle)) return EXIT_FAILURE;
-      fprintf(stderr,
-              "\nVerification failed at address 0x%04X: File=0x%02X, "
-              "Device=0x%02X\n",
-              status.address,
-              status.c2 & (WORD_SIZE(handle->device) == 1 ? 0xFF : 0xFFFF),
-              status.c1 & (WORD_SIZE(handle->device) == 1 ? 0xFF : 0xFFFF));
-      return EXIT_FAILURE;
-    }
+    default:
+      break;
   }
-  gettimeofday(&end, NULL);
-  sprintf(status_msg, "Writing %s...  %.2fSec  OK", name,
-          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-              (double)(end.tv_sec - begin.tv_sec));
-  update_status(status_msg, "\n");
-  return EXIT_SUCCESS;
-}
-
-// Read PLD device
-int read_jedec(minipro_handle_t *handle, jedec_t *jedec) {
-  size_t i, j;
-  struct timeval begin, end;
-  gettimeofday(&begin, NULL);
 
-  char status_msg[64];
-  sprintf(status_msg, "Reading device... ");
-  uint8_t buffer[32];
-  gal_config_t *config = (gal_config_t *)handle->device->config;
-
-  uint8_t ovc = 0;
-  if (minipro_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
-  if (ovc) {
-    fprintf(stderr, "\nOvercurrent protection!\007\n");
+  // Check if a device name is required
+  if (!cmdopts->device) {
+    fprintf(stderr, "Device required. Use -p <device> to specify a device.\n");
     return EXIT_FAILURE;
   }
 
-  // Read fuses
-  memset(jedec->fuses, 0, jedec->QF);
-  for (i = 0; i < config->fuses_size; i++) {
-    if (minipro_read_jedec_row(handle, buffer, i, config->row_width))
-      return EXIT_FAILURE;
-    // Unpacking the row
-    for (j = 0; j < config->row_width; j++) {
-      if (buffer[j / 8] & (0x80 >> (j & 0x07)))
-        jedec->fuses[config->fuses_size * j + i] = 1;
-    }
-    update_status(status_msg, "%2d%%", i * 100 / config->fuses_size);
-  }
-
-  // Read user electronic signature (UES)
-  if (minipro_read_jedec_row(handle, buffer, i, config->ues_size))
+  // don't permit skipping the ID read in write/erase-mode or ID only mode
+  if ((cmdopts->action == WRITE || cmdopts->action == ERASE ||
+       cmdopts->idcheck_only) &&
+      cmdopts->idcheck_skip) {
+    fprintf(stderr,
+            "Skipping the ID check is not permitted for this action.\n");
     return EXIT_FAILURE;
-  for (j = 0; j < config->ues_size; j++) {
-    if (buffer[j / 8] & (0x80 >> (j & 0x07)))
-      jedec->fuses[config->ues_address + j] = 1;
   }
 
-  // Read architecture control word (ACW)
-  if (minipro_read_jedec_row(handle, buffer, config->acw_address,
-                             config->acw_size))
+  // Exit if no action is supplied
+  if (cmdopts->action == NO_ACTION && !cmdopts->idcheck_only &&
+      !cmdopts->pincheck) {
+    fprintf(stderr, "No action to perform.\n");
     return EXIT_FAILURE;
-  for (i = 0; i < config->acw_size; i++) {
-    if (buffer[i / 8] & (0x80 >> (i & 0x07)))
-      jedec->fuses[config->acw_bits[i]] = 1;
   }
-
-  gettimeofday(&end, NULL);
-  sprintf(status_msg, "Reading device...  %.2fSec  OK",
-          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-              (double)(end.tv_sec - begin.tv_sec));
-  update_status(status_msg, "\n");
   return EXIT_SUCCESS;
 }
 
-// Write PLD device
-int write_jedec(minipro_handle_t *handle, jedec_t *jedec) {
-  size_t i, j;
-  struct timeval begin, end;
-  gettimeofday(&begin, NULL);
-
-  char status_msg[64];
-  sprintf(status_msg, "Writing jedec file... ");
-  uint8_t buffer[32];
-  gal_config_t *config = (gal_config_t *)handle->device->config;
-
-  uint8_t ovc = 0;
-  if (minipro_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
-  if (ovc) {
-    fprintf(stderr, "\nOvercurrent protection!\007\n");
-    return EXIT_FAILURE;
-  }
-
-  // Write fuses
-  for (i = 0; i < config->fuses_size; i++) {
-    memset(buffer, 0, sizeof(buffer));
-    // Building a row
-    for (j = 0; j < config->row_width; j++) {
-      if (jedec->fuses[config->fuses_size * j + i] == 1)
-        buffer[j / 8] |= (0x80 >> (j & 0x07));
-    }
-    update_status(status_msg, "%2d%%", i * 100 / config->fuses_size);
-    if (minipro_write_jedec_row(handle, buffer, i, config->row_width))
-      return EXIT_FAILURE;
-  }
-
-  // Write user electronic signature (UES)
-  memset(buffer, 0, sizeof(buffer));
-  for (j = 0; j < config->ues_size; j++) {
-    if (jedec->fuses[config->ues_address + j] == 1)
-      buffer[j / 8] |= (0x80 >> (j & 0x07));
-  }
-  if (minipro_write_jedec_row(handle, buffer, i, config->ues_size))
-    return EXIT_FAILURE;
-
-  // Write architecture control word (ACW)
-  memset(buffer, 0, sizeof(buffer));
-  for (i = 0; i < config->acw_size; i++) {
-    if (jedec->fuses[config->acw_bits[i]] == 1)
-      buffer[i / 8] |= (0x80 >> (i & 0x07));
-  }
-
-  if (minipro_write_jedec_row(handle, buffer, config->acw_address,
-                              config->acw_size))
-    return EXIT_FAILURE;
-
-  gettimeofday(&end, NULL);
-  sprintf(status_msg, "Writing jedec file...  %.2fSec  OK",
-          (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-              (double)(end.tv_sec - begin.tv_sec));
-  update_status(status_msg, "\n");
-  return EXIT_SUCCESS;
+// Connect a pipeline to a chip sized memory image, recording the ranges
+// written in segments if not NULL
+void begin_image(pipeline_t *pipeline, image_t *image, uint8_t *data,
+                 size_t size, segment_list_t *segments) {
+  image->data = data;
+  image->size = size;
+  image->end = 0;
+  image->segments = segments;
+  if (segments) memset(segments, 0, sizeof(segment_list_t));
+  pipeline_begin(pipeline, size, image_sink, image);
 }
 
-int erase_device(minipro_handle_t *handle) {
-  struct timeval begin, end;
-  if (handle->cmdopts->no_erase == 0 &&
-      (handle->device->opts4 &
-       MP_ERASE_MASK))  // Not all chips can be erased...
-  {
-    fprintf(stderr, "Erasing... ");
-    fflush(stderr);
-    gettimeofday(&begin, NULL);
-    if (minipro_erase(handle)) return EXIT_FAILURE;
-    gettimeofday(&end, NULL);
-    fprintf(stderr, "%.2fSec OK\n",
-            (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-                (double)(end.tv_sec - begin.tv_sec));
-  }
+// Flush the pipeline and return the size of the image.
+// Data beyond the chip size makes the image bigger than the chip.
+int end_image(pipeline_t *pipeline, image_t *image, size_t *file_size) {
+  if (pipeline_end(pipeline)) return EXIT_FAILURE;
+  *file_size = image->end > image->size ? image->end : image->size;
   return EXIT_SUCCESS;
 }
 
-//Helper function to check for pld devices
-int is_pld(uint8_t protocol_id) {
-  switch (protocol_id) {
-    case PLD_PROTOCOL_16V8:
-    case PLD_PROTOCOL_20V8:
-    case PLD_PROTOCOL_22V10:
-    case PLD_PROTOCOL2_16V8:
-    case PLD_PROTOCOL2_20V8:
-    case PLD_PROTOCOL2_22V10:
-      return 1;
-  }
-  return 0;
-}
-
-// Opens a physical file or a pipe if the pipe character is specified
-int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size) {
+// Read the whole file or pipe into a newly allocated buffer.
+// The buffer is NUL terminated so text parsers can't run past its end.
+int read_file(minipro_handle_t *handle, uint8_t **data, size_t *size) {
+  shared_image_t *image = handle->cmdopts->image;
   FILE *file;
   struct stat st;
 
+  // Gang stations get a copy of the file read once by load_image()
+  if (image && image->file) {
+    *data = malloc(image->file_size + 1);
+    if (!*data) {
+      fprintf(stderr, "Out of memory!\n");
+      return EXIT_FAILURE;
+    }
+    memcpy(*data, image->file, image->file_size + 1);
+    *size = image->file_size;
+    return EXIT_SUCCESS;
+  }
+
   // Check if we are dealing with a pipe.
   if (handle->cmdopts->is_pipe) {
     file = stdin;
@@ -1048,27 +1007,36 @@ int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size) {
     }
   }
 
+  // Compressed files are decompressed on the fly.
+  // Their uncompressed size is unknown so they are read like a pipe.
+  uint8_t peek[COMPRESS_PEEK_SIZE];
+  size_t peeked;
+  int compressed;
+  file = compress_open_read(file, &compressed, peek, &peeked);
+  if (!file) return EXIT_FAILURE;
+  if (compressed) st.st_size = 0;
+
   // Allocate a zero initialized buffer.
   // If the file size is unknown (pipe) a default size will be used.
-  uint8_t *buffer = calloc(st.st_size ? st.st_size : READ_BUFFER_SIZE, 1);
+  uint8_t *buffer =
+      calloc(st.st_size ? (size_t)st.st_size + 1 : READ_BUFFER_SIZE + 1, 1);
   if (!buffer) {
     fclose(file);
     fprintf(stderr, "Out of memory!\n");
     return EXIT_FAILURE;
   }
 
-  // Try to read the whole file.
+  // Try to read the whole file, after the bytes a pipe already gave.
   // If we are reading from stdin  data will be read in small chunks of 64K
   // each untill EOF.
-  size_t br = 0;
-  size_t sz = READ_BUFFER_SIZE;
+  size_t br = peeked;
+  size_t sz = READ_BUFFER_SIZE + 1;
+  memcpy(buffer, peek, peeked);
   if (!st.st_size) {
-    size_t ch;
     uint8_t *tmp;
     while (br < UINT32_MAX) {
-      ch = fread(buffer + br, 1, READ_BUFFER_SIZE, file);
-      br += ch;
-      if (ch != READ_BUFFER_SIZE) break;
+      br += fread(buffer + br, 1, sz - 1 - br, file);
+      if (br != sz - 1) break;
       sz += READ_BUFFER_SIZE;
       tmp = realloc(buffer, sz);
       if (!tmp) {
@@ -1080,8 +1048,14 @@ int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size) {
       buffer = tmp;
     }
   } else
-    br = fread(buffer, 1, st.st_size, file);
+    br += fread(buffer + br, 1, st.st_size - br, file);
 
+  if (ferror(file)) {
+    fprintf(stderr, "Error reading the file.\n");
+    fclose(file);
+    free(buffer);
+    return EXIT_FAILURE;
+  }
   fclose(file);
   if(!br){
 	  fprintf(stderr, "No data to read.\n");
@@ -1089,37 +1063,70 @@ int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size) {
 	  return EXIT_FAILURE;
   }
 
-  // If we are dealing with a jed file just return the data.
-  if (is_pld(handle->device->protocol_id)) {
-    memcpy(data, buffer, br);
-    free(buffer);
-    *file_size = br;
-    return EXIT_SUCCESS;
+  buffer[br] = 0;
+  *data = buffer;
+  *size = br;
+  return EXIT_SUCCESS;
+}
+
+// Opens a physical file or a pipe if the pipe character is specified.
+// If segments is not NULL it receives the populated ranges of an ELF
+// image; other files leave it empty, meaning the whole image. The file
+// data is passed through the pipeline if one is given.
+int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size,
+              segment_list_t *segments, pipeline_t *pipeline) {
+  segment_list_t image_segments;
+  pipeline_t raw_pipeline;
+  image_t image;
+
+  if (!segments) segments = &image_segments;
+  memset(segments, 0, sizeof(segment_list_t));
+  if (!pipeline) {
+    memset(&raw_pipeline, 0, sizeof(raw_pipeline));
+    pipeline = &raw_pipeline;
   }
 
+  uint8_t *buffer;
+  size_t br;
+  if (read_file(handle, &buffer, &br)) return EXIT_FAILURE;
+
   size_t chip_size = *file_size;
-  *file_size = br;
 
-  // Probe for an Intel hex file
-  size_t hex_size = chip_size;
-  int ret = read_hex_file(buffer, data, &hex_size);
+  // Probe for an ELF file
+  begin_image(pipeline, &image, data, chip_size, segments);
+  int ret = read_elf_file(buffer, br, pipeline);
   switch (ret) {
-    case NOT_IHEX:
+    case NOT_ELF:
       break;
     case EXIT_FAILURE:
       free(buffer);
       return EXIT_FAILURE;
       break;
-    case INTEL_HEX_FORMAT:
-      *file_size = hex_size;
+    case ELF_FORMAT:
+      fprintf(stderr, "Found ELF file.\n");
+      free(buffer);
+      return end_image(pipeline, &image, file_size);
+  }
+
+  // Probe for an Intel hex file
+  begin_image(pipeline, &image, data, chip_size, NULL);
+  ret = read_hex_file(buffer, pipeline);
+  switch (ret) {
+    case NOT_IHEX:
+      break;
+    case EXIT_FAILURE:
+      free(buffer);
+      return EXIT_FAILURE;
+      break;
+    case INTEL_HEX_FORMAT:
       fprintf(stderr, "Found Intel hex file.\n");
       free(buffer);
-      return EXIT_SUCCESS;
+      return end_image(pipeline, &image, file_size);
   }
 
   // Probe for a Motorola srec file
-  hex_size = chip_size;
-  ret = read_srec_file(buffer, data, &hex_size);
+  begin_image(pipeline, &image, data, chip_size, NULL);
+  ret = read_srec_file(buffer, pipeline);
   switch (ret) {
     case NOT_SREC:
       break;
@@ -1128,10 +1135,9 @@ int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size) {
       return EXIT_FAILURE;
       break;
     case SREC_FORMAT:
-      *file_size = hex_size;
       fprintf(stderr, "Found Motorola S-Record file.\n");
       free(buffer);
-      return EXIT_SUCCESS;
+      return end_image(pipeline, &image, file_size);
   }
 
   if (handle->cmdopts->format == IHEX) {
@@ -1144,26 +1150,32 @@ int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size) {
     free(buffer);
     return EXIT_FAILURE;
   }
+
   // This must be a binary file
-  memcpy(data, buffer, chip_size);
+  begin_image(pipeline, &image, data, chip_size, NULL);
+  ret = pipeline_put(pipeline, 0, buffer, br) || pipeline_end(pipeline);
   free(buffer);
+  if (ret) return EXIT_FAILURE;
+  *file_size = image.end;
   return EXIT_SUCCESS;
 }
 
 // Open a JED file
 int open_jed_file(minipro_handle_t *handle, jedec_t *jedec) {
-  char *buffer = calloc(READ_BUFFER_SIZE, 1);
-  if (!buffer) {
-    fprintf(stderr, "Out of memory!\n");
-    return EXIT_FAILURE;
-  }
-
-  size_t file_size = handle->device->code_memory_size;
-  if (open_file(handle, (uint8_t*)buffer, &file_size)) {
-    free(buffer);
-    return EXIT_FAILURE;
+  shared_image_t *image = handle->cmdopts->image;
+  uint8_t *buffer;
+  size_t file_size;
+
+  if (image && image->jedec.fuses) {
+    *jedec = image->jedec;
+    jedec->fuses = alloc_fuses(jedec->QF, 0);
+    if (!jedec->fuses) return EXIT_FAILURE;
+    memcpy(jedec->fuses, image->jedec.fuses,
+           FUSE_WORDS(jedec->QF) * sizeof(uint64_t));
+    return EXIT_SUCCESS;
   }
-  if (read_jedec_file(buffer, file_size, jedec)) return EXIT_FAILURE;
+  if (read_file(handle, &buffer, &file_size)) return EXIT_FAILURE;
+  if (read_jedec_file((char *)buffer, file_size, jedec)) return EXIT_FAILURE;
   if (jedec->fuses == NULL) {
     fprintf(stderr, "This file has no fuses (L) declaration!\n");
     free(buffer);
@@ -1200,10 +1212,27 @@ FILE *get_file(minipro_handle_t *handle) {
       perror("");
       return NULL;
     }
+    // Compress on the fly if the file name asks for it
+    file = compress_open_write(file, handle->cmdopts->filename);
   }
   return file;
 }
 
+// Get a page image from the file, parsed once if it was preloaded
+static int load_page(minipro_handle_t *handle, uint8_t *data, uint8_t type,
+                     size_t *file_size, segment_list_t *segments) {
+  shared_image_t *image = handle->cmdopts->image;
+  if (image && image->data && image->type == type &&
+      image->size == *file_size) {
+    memcpy(data, image->data, image->size);
+    *file_size = image->image_size;
+    *segments = image->segments;
+    return EXIT_SUCCESS;
+  }
+  return open_file(handle, data, file_size, segments,
+                   &handle->cmdopts->pipeline);
+}
+
 /* Wrappers for operating with files */
 int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
   // Allocate the buffer and clear it with default value
@@ -1213,16 +1242,17 @@ int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
     return EXIT_FAILURE;
   }
 
+  int ret = EXIT_FAILURE;
   memset(file_data, 0xFF, size);
   size_t file_size = size;
-  if (open_file(handle, file_data, &file_size)) return EXIT_FAILURE;
+  segment_list_t segments;
+  if (load_page(handle, file_data, type, &file_size, &segments)) goto free;
   if (file_size != size) {
     if (!handle->cmdopts->size_error) {
       fprintf(stderr,
               "Incorrect file size: %" PRI_SIZET " (needed %" PRI_SIZET ")\n",
               file_size, size);
-      free(file_data);
-      return EXIT_FAILURE;
+      goto free;
     } else if (handle->cmdopts->size_nowarn == 0)
       fprintf(stderr,
               "Warning: Incorrect file size: %" PRI_SIZET " (needed %" PRI_SIZET
@@ -1230,61 +1260,77 @@ int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
               file_size, size);
   }
 
+  // The template was loaded once, patch the values of this chip in
+  if (handle->serial_unit &&
+      serial_apply(handle->cmdopts->serial, handle->serial_unit, file_data,
+                   size, &segments))
+    goto free;
+
   // Perform an erase first
-  if (erase_device(handle)) return EXIT_FAILURE;
+  if (erase_device(handle)) goto free;
   // We must reset the transaction after the erase
-  if (minipro_end_transaction(handle)) return EXIT_FAILURE;
-  if (minipro_begin_transaction(handle)) return EXIT_FAILURE;
+  if (minipro_end_transaction(handle)) goto free;
+  if (minipro_begin_transaction(handle)) goto free;
 
+  report_phase_t phase;
   if (handle->cmdopts->no_protect_off == 0 &&
       (handle->device->opts4 & MP_PROTECT_MASK)) {
-    if(minipro_protect_off(handle)){
-    	free(file_data);
-    	return EXIT_FAILURE;
-    }
+    report_begin(handle, &phase, "protect_off");
+    if (report_end(handle, &phase, minipro_protect_off(handle))) goto free;
     fprintf(stderr, "Protect off...OK\n");
   }
 
-  if (write_page_ram(handle, file_data, type, size)) {
-    free(file_data);
-    return EXIT_FAILURE;
-  }
+  checksum_t checksum;
+  checksum_init(&checksum);
+  report_begin(handle, &phase, "write");
+  if (report_end(handle, &phase,
+                 write_page_ram(handle, file_data, type, size, &segments,
+                                handle->cmdopts->checksum ? &checksum
+                                                          : NULL)))
+    goto free;
+  if (handle->cmdopts->checksum)
+    checksum_print(&checksum, type == MP_CODE ? "Code" : "Data");
 
   // Verify if data was written ok
   if (handle->cmdopts->no_verify == 0) {
     // We must reset the transaction for VCC verify to have effect
-    if (minipro_end_transaction(handle)) return EXIT_FAILURE;
-    if (minipro_begin_transaction(handle)) return EXIT_FAILURE;
+    if (minipro_end_transaction(handle)) goto free;
+    if (minipro_begin_transaction(handle)) goto free;
 
     uint8_t *chip_data = malloc(size + 128);
     if (!chip_data) {
       fprintf(stderr, "Out of memory\n");
-      free(file_data);
-      return EXIT_FAILURE;
+      goto free;
     }
-    if (read_page_ram(handle, chip_data, type, size)) {
-      free(file_data);
+    report_begin(handle, &phase, "verify");
+    if (read_page_ram(handle, chip_data, type, size, &segments, NULL,
+                      NULL)) {
+      report_end(handle, &phase, EXIT_FAILURE);
       free(chip_data);
-      return EXIT_FAILURE;
+      goto free;
     }
+    copy_gaps(chip_data, file_data, size, &segments);
 
     uint8_t c1, c2;
     int idx = compare_memory(file_data, chip_data, size, &c1, &c2);
     free(chip_data);
+    report_end(handle, &phase, idx == -1 ? EXIT_SUCCESS : EXIT_FAILURE);
 
     if (idx != -1) {
       fprintf(
           stderr,
           "Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
           idx, c1, c2);
-      return EXIT_FAILURE;
+      goto free;
     } else {
       fprintf(stderr, "Verification OK\n");
     }
   }
+  ret = EXIT_SUCCESS;
 
+free:
   free(file_data);
-  return EXIT_SUCCESS;
+  return ret;
 }
 
 int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
@@ -1298,8 +1344,40 @@ int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
     return EXIT_FAILURE;
   }
 
+  // The chip data is converted to the output format while it is read
+  pipeline_t *pipeline = &handle->cmdopts->pipeline;
+  hex_writer_t hex_writer;
+  srec_writer_t srec_writer;
+  bin_writer_t bin_writer;
+  int ret;
+
+  switch (handle->cmdopts->format) {
+    case IHEX:
+      ret = hex_writer_begin(&hex_writer, file, size, pipeline->record_size);
+      pipeline_begin(pipeline, size, hex_writer_put, &hex_writer);
+      break;
+    case SREC:
+      ret = srec_writer_begin(&srec_writer, file, pipeline->record_size);
+      pipeline_begin(pipeline, size, srec_writer_put, &srec_writer);
+      break;
+    default:
+      memset(&bin_writer, 0, sizeof(bin_writer));
+      bin_writer.file = file;
+      ret = EXIT_SUCCESS;
+      pipeline_begin(pipeline, size, bin_writer_put, &bin_writer);
+  }
+
+  checksum_t checksum;
+  checksum_init(&checksum);
   memset(buffer, 0xFF, size);
-  if (read_page_ram(handle, buffer, type, size)) {
+  report_phase_t phase;
+  report_begin(handle, &phase, "read");
+  if (ret ||
+      report_end(handle, &phase,
+                 read_page_ram(handle, buffer, type, size, NULL, pipeline,
+                               handle->cmdopts->checksum ? &checksum
+                                                         : NULL)) ||
+      pipeline_end(pipeline)) {
     fclose(file);
     free(buffer);
     return EXIT_FAILURE;
@@ -1307,28 +1385,26 @@ int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
 
   switch (handle->cmdopts->format) {
     case IHEX:
-      if (write_hex_file(file, buffer, size)) {
-        fclose(file);
-        return EXIT_FAILURE;
-      }
+      ret = hex_writer_end(&hex_writer);
       break;
     case SREC:
-      if (write_srec_file(file, buffer, size)) {
-        fclose(file);
-        return EXIT_FAILURE;
-      }
+      ret = srec_writer_end(&srec_writer);
       break;
     default:
-      fwrite(buffer, 1, size, file);
+      break;
   }
 
-  fclose(file);
+  // Closing a compressed stream writes its last block
+  if (fclose(file)) ret = EXIT_FAILURE;
   free(buffer);
-  return EXIT_SUCCESS;
+  if (!ret && handle->cmdopts->checksum)
+    checksum_print(&checksum, type == MP_CODE ? "Code" : "Data");
+  return ret;
 }
 
 int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
   uint8_t *file_data;
+  segment_list_t segments;
 
   char *name = type == MP_CODE ? "Code" : "Data";
   if (handle->cmdopts->filename) {
@@ -1341,7 +1417,10 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
 
     memset(file_data, 0xFF, size);
     size_t file_size = size;
-    if (open_file(handle, file_data, &file_size)) return EXIT_FAILURE;
+    if (load_page(handle, file_data, type, &file_size, &segments)) {
+      free(file_data);
+      return EXIT_FAILURE;
+    }
 
     if (file_size != size) {
       if (!handle->cmdopts->size_error) {
@@ -1361,7 +1440,12 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
   // Blank check
   else {
     file_data = malloc(size);
+    if (!file_data) {
+      fprintf(stderr, "Out of memory!\n");
+      return EXIT_FAILURE;
+    }
     memset(file_data, 0xFF, size);
+    memset(&segments, 0, sizeof(segments));
   }
 
   /* Downloading data from chip*/
@@ -1371,17 +1455,34 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size) {
     free(file_data);
     return EXIT_FAILURE;
   }
-  if (read_page_ram(handle, chip_data, type, size)) {
+  checksum_t checksum;
+  checksum_init(&checksum);
+  report_phase_t phase;
+  report_begin(handle, &phase,
+               handle->cmdopts->filename ? "verify" : "blank_check");
+  if (read_page_ram(handle, chip_data, type, size, &segments, NULL,
+                    handle->cmdopts->checksum ? &checksum : NULL)) {
+    report_end(handle, &phase, EXIT_FAILURE);
     free(file_data);
     free(chip_data);
     return EXIT_FAILURE;
   }
+  copy_gaps(chip_data, file_data, size, &segments);
+
+  // The serial fields differ from chip to chip, only the rest of the
+  // template is compared
+  if (handle->cmdopts->serial && handle->cmdopts->filename) {
+    serial_mask(handle->cmdopts->serial, file_data, chip_data, size);
+    serial_print_found(handle->cmdopts->serial, chip_data, size);
+  }
 
   uint8_t c1, c2;
   int idx = compare_memory(file_data, chip_data, size, &c1, &c2);
+  report_end(handle, &phase, idx == -1 ? EXIT_SUCCESS : EXIT_FAILURE);
 
   free(file_data);
   free(chip_data);
+  if (handle->cmdopts->checksum) checksum_print(&checksum, name);
 
   if (idx != -1) {
     if (handle->cmdopts->filename) {
@@ -1422,14 +1523,11 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
   fflush(stderr);
   gettimeofday(&begin, NULL);
 
-  fuses->num_locks &= 0x7f;
+  uint8_t num_locks = fuses->num_locks & 0x7f;
   // Atmel microcontrollers workaround
-  uint8_t items;
-  if (!fuses->word) {
-    items = fuses->num_fuses;
-    fuses->word = 1;
-  } else
-    items = fuses->item_size / fuses->word;
+  uint8_t word = fuses->word ? fuses->word : 1;
+  uint8_t items =
+      fuses->word ? fuses->item_size / fuses->word : fuses->num_fuses;
 
   if (fuses->num_fuses > 0) {
     if (minipro_read_fuses(handle, MP_FUSE_CFG,
@@ -1439,10 +1537,9 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
       return EXIT_FAILURE;
     }
     for (i = 0; i < fuses->num_fuses; i++) {
-      uint32_t value =
-          load_int(&(buffer[i * fuses->word]), fuses->word, MP_LITTLE_ENDIAN);
+      uint32_t value = load_int(&(buffer[i * word]), word, MP_LITTLE_ENDIAN);
       sprintf(config + strlen(config),
-              fuses->word == 1 ? "%s = 0x%02x\n" : "%s = 0x%04x\n",
+              word == 1 ? "%s = 0x%02x\n" : "%s = 0x%04x\n",
               fuses->fnames[i], value);
     }
   }
@@ -1453,25 +1550,22 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
       return EXIT_FAILURE;
     }
     for (i = 0; i < fuses->num_uids; i++) {
-      uint32_t value =
-          load_int(&(buffer[i * fuses->word]), fuses->word, MP_LITTLE_ENDIAN);
+      uint32_t value = load_int(&(buffer[i * word]), word, MP_LITTLE_ENDIAN);
       sprintf(config + strlen(config),
-              fuses->word == 1 ? "%s = 0x%02x\n" : "%s = 0x%04x\n",
+              word == 1 ? "%s = 0x%02x\n" : "%s = 0x%04x\n",
               fuses->unames[i], value);
     }
   }
-  if (fuses->num_locks > 0) {
-    if (minipro_read_fuses(handle, MP_FUSE_LOCK,
-                           fuses->num_locks * fuses->item_size,
-                           fuses->item_size / fuses->word, buffer)) {
+  if (num_locks > 0) {
+    if (minipro_read_fuses(handle, MP_FUSE_LOCK, num_locks * fuses->item_size,
+                           fuses->item_size / word, buffer)) {
       fclose(file);
       return EXIT_FAILURE;
     }
-    for (i = 0; i < fuses->num_locks; i++) {
-      uint32_t value =
-          load_int(&(buffer[i * fuses->word]), fuses->word, MP_LITTLE_ENDIAN);
+    for (i = 0; i < num_locks; i++) {
+      uint32_t value = load_int(&(buffer[i * word]), word, MP_LITTLE_ENDIAN);
       sprintf(config + strlen(config),
-              fuses->word == 1 ? "%s = 0x%02x\n" : "%s = 0x%04x\n",
+              word == 1 ? "%s = 0x%02x\n" : "%s = 0x%04x\n",
               fuses->lnames[i], value);
     }
   }
@@ -1481,42 +1575,64 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
               (double)(end.tv_sec - begin.tv_sec));
 
   fputs(config, file);
-  fclose(file);
+  if (fclose(file)) return EXIT_FAILURE;
   return EXIT_SUCCESS;
 }
 
-int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
+// Read and check the fuse configuration file of the device
+static int load_fuse_config(minipro_handle_t *handle, fuse_decl_t *fuses,
+                            char **buffer, fuse_config_t *config) {
+  size_t size;
+
+  if (read_file(handle, (uint8_t **)buffer, &size)) return EXIT_FAILURE;
+  if (read_fuse_config(*buffer, config)) {
+    free(*buffer);
+    return EXIT_FAILURE;
+  }
+  if (check_fuse_config(config, handle->device->name, fuses)) {
+    free_fuse_config(config);
+    free(*buffer);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Pack the configured values of a group of fuses, user ids or lock bytes
+static int get_fuse_values(minipro_handle_t *handle, fuse_config_t *config,
+                           const char **names, size_t count, uint8_t word,
+                           uint8_t *buffer) {
+  uint32_t value;
   size_t i;
+
+  for (i = 0; i < count; i++) {
+    if (get_fuse_config_value(config, handle->device->name, names[i],
+                              &value)) {
+      fprintf(stderr, "Could not read config %s value.\n", names[i]);
+      return EXIT_FAILURE;
+    }
+    format_int(&(buffer[i * word]), value, word, MP_LITTLE_ENDIAN);
+  }
+  return EXIT_SUCCESS;
+}
+
+static int write_fuse_values(minipro_handle_t *handle, fuse_decl_t *fuses,
+                             fuse_config_t *config) {
   uint8_t wbuffer[64], vbuffer[64];
-  char config[1024];
-  uint32_t value;
   struct timeval begin, end;
 
-  memset(config, 0, sizeof(config));
-  size_t file_size = sizeof(config);
-  if (open_file(handle, (uint8_t *)config, &file_size)) return EXIT_FAILURE;
-
   fprintf(stderr, "Writing fuses... ");
   fflush(stderr);
 
   // Atmel microcontrollers workaround
-  uint8_t items;
-  if (!fuses->word) {
-    items = fuses->num_fuses;
-    fuses->word = 1;
-  } else
-    items = fuses->item_size / fuses->word;
+  uint8_t word = fuses->word ? fuses->word : 1;
+  uint8_t items =
+      fuses->word ? fuses->item_size / fuses->word : fuses->num_fuses;
 
   gettimeofday(&begin, NULL);
   if (fuses->num_fuses > 0) {
-    for (i = 0; i < fuses->num_fuses; i++) {
-      if (get_config_value(config, fuses->fnames[i], &value) == EXIT_FAILURE) {
-        fprintf(stderr, "Could not read config %s value.\n", fuses->fnames[i]);
-        return EXIT_FAILURE;
-      }
-      format_int(&(wbuffer[i * fuses->word]), value, fuses->word,
-                 MP_LITTLE_ENDIAN);
-    }
+    if (get_fuse_values(handle, config, fuses->fnames, fuses->num_fuses,
+                        word, wbuffer))
+      return EXIT_FAILURE;
     if (minipro_write_fuses(handle, MP_FUSE_CFG,
                             fuses->num_fuses * fuses->item_size, items,
                             wbuffer))
@@ -1530,21 +1646,16 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
   }
 
   if (fuses->num_uids > 0) {
-    for (i = 0; i < fuses->num_uids; i++) {
-      if (get_config_value(config, fuses->unames[i], &value) == EXIT_FAILURE) {
-        fprintf(stderr, "Could not read config %s value.\n", fuses->unames[i]);
-        return EXIT_FAILURE;
-      }
-      format_int(&(wbuffer[i * fuses->word]), value, fuses->word,
-                 MP_LITTLE_ENDIAN);
-    }
+    if (get_fuse_values(handle, config, fuses->unames, fuses->num_uids,
+                        word, wbuffer))
+      return EXIT_FAILURE;
     if (minipro_write_fuses(handle, MP_FUSE_USER,
                             fuses->num_uids * fuses->item_size,
-                            fuses->item_size / fuses->word, wbuffer))
+                            fuses->item_size / word, wbuffer))
       return EXIT_FAILURE;
     if (minipro_read_fuses(handle, MP_FUSE_USER,
                            fuses->num_uids * fuses->item_size,
-                           fuses->item_size / fuses->word, vbuffer))
+                           fuses->item_size / word, vbuffer))
       return EXIT_FAILURE;
     if (memcmp(wbuffer, vbuffer, fuses->num_uids * fuses->item_size)) {
       fprintf(stderr, "\nUser ID verify error!\n");
@@ -1552,21 +1663,16 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
   }
 
   if (fuses->num_locks > 0) {
-    for (i = 0; i < fuses->num_locks; i++) {
-      if (get_config_value(config, fuses->lnames[i], &value) == EXIT_FAILURE) {
-        fprintf(stderr, "Could not read config %s value.\n", fuses->lnames[i]);
-        return EXIT_FAILURE;
-      }
-      format_int(&(wbuffer[i * fuses->word]), value, fuses->word,
-                 MP_LITTLE_ENDIAN);
-    }
+    if (get_fuse_values(handle, config, fuses->lnames, fuses->num_locks,
+                        word, wbuffer))
+      return EXIT_FAILURE;
     if (minipro_write_fuses(handle, MP_FUSE_LOCK,
                             fuses->num_locks * fuses->item_size,
-                            fuses->item_size / fuses->word, wbuffer))
+                            fuses->item_size / word, wbuffer))
       return EXIT_FAILURE;
     if (minipro_read_fuses(handle, MP_FUSE_LOCK,
                            fuses->num_locks * fuses->item_size,
-                           fuses->item_size / fuses->word, vbuffer))
+                           fuses->item_size / word, vbuffer))
       return EXIT_FAILURE;
     if (memcmp(wbuffer, vbuffer, fuses->num_locks * fuses->item_size)) {
       fprintf(stderr, "\nLock bytes verify error!\n");
@@ -1579,6 +1685,90 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
   return EXIT_SUCCESS;
 }
 
+int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
+  fuse_config_t config;
+  char *buffer;
+  int ret;
+
+  if (load_fuse_config(handle, fuses, &buffer, &config)) return EXIT_FAILURE;
+  ret = write_fuse_values(handle, fuses, &config);
+  free_fuse_config(&config);
+  free(buffer);
+  return ret;
+}
+
+static int verify_fuse_values(minipro_handle_t *handle, fuse_decl_t *fuses,
+                              fuse_config_t *config) {
+  uint8_t wbuffer[64], vbuffer[64];
+  int ret = EXIT_SUCCESS;
+
+  // Atmel microcontrollers workaround
+  uint8_t word = fuses->word ? fuses->word : 1;
+  uint8_t items =
+      fuses->word ? fuses->item_size / fuses->word : fuses->num_fuses;
+
+  if (fuses->num_fuses > 0) {
+    if (get_fuse_values(handle, config, fuses->fnames, fuses->num_fuses,
+                        word, wbuffer))
+      return EXIT_FAILURE;
+    if (minipro_read_fuses(handle, MP_FUSE_CFG,
+                           fuses->num_fuses * fuses->item_size, items, vbuffer))
+      return EXIT_FAILURE;
+    if (memcmp(wbuffer, vbuffer, fuses->num_fuses * fuses->item_size)) {
+      fprintf(stderr, "Fuse bits verification error!\n");
+      ret = EXIT_FAILURE;
+    } else
+      fprintf(stderr, "Fuse bits verification OK.\n");
+  }
+
+  if (fuses->num_uids > 0) {
+    if (get_fuse_values(handle, config, fuses->unames, fuses->num_uids,
+                        word, wbuffer))
+      return EXIT_FAILURE;
+    if (minipro_read_fuses(handle, MP_FUSE_USER,
+                           fuses->num_uids * fuses->item_size,
+                           fuses->item_size / word, vbuffer))
+      return EXIT_FAILURE;
+    if (memcmp(wbuffer, vbuffer, fuses->num_uids * fuses->item_size)) {
+      fprintf(stderr, "User ID verification error!\n");
+      ret = EXIT_FAILURE;
+    } else
+      fprintf(stderr, "User ID verification OK.\n");
+  }
+
+  if (fuses->num_locks > 0) {
+    if (get_fuse_values(handle, config, fuses->lnames, fuses->num_locks,
+                        word, wbuffer))
+      return EXIT_FAILURE;
+    if (minipro_read_fuses(handle, MP_FUSE_LOCK,
+                           fuses->num_locks * fuses->item_size,
+                           fuses->item_size / word, vbuffer))
+      return EXIT_FAILURE;
+    if (memcmp(wbuffer, vbuffer, fuses->num_locks * fuses->item_size)) {
+      fprintf(stderr, "Lock bits verification error!\n");
+      ret = EXIT_FAILURE;
+    } else
+      fprintf(stderr, "Lock bits verification OK.\n");
+  }
+  return ret;
+}
+
+int verify_fuses(minipro_handle_t *handle, fuse_decl_t *fuses) {
+  fuse_config_t config;
+  char *buffer;
+  int ret;
+
+  if (load_fuse_config(handle, fuses, &buffer, &config)) return EXIT_FAILURE;
+  ret = minipro_begin_transaction(handle);
+  if (!ret) {
+    ret = verify_fuse_values(handle, fuses, &config);
+    if (minipro_end_transaction(handle)) ret = EXIT_FAILURE;
+  }
+  free_fuse_config(&config);
+  free(buffer);
+  return ret;
+}
+
 /* Higher-level logic */
 int action_read(minipro_handle_t *handle) {
   jedec_t jedec;
@@ -1623,18 +1813,19 @@ int action_read(minipro_handle_t *handle) {
       fprintf(stderr, "Unknown fuse size!\n");
       return EXIT_FAILURE;
     }
-    jedec.fuses = malloc(jedec.QF);
+    jedec.fuses = alloc_fuses(jedec.QF, 0);
     if (!jedec.fuses) {
       fprintf(stderr, "Out of memory\n");
       return EXIT_FAILURE;
     }
-    memset(jedec.fuses, 0, jedec.QF);
     jedec.F = 0;
     jedec.G = 0;
     jedec.QP = get_pin_count(handle->device);
     jedec.device_name = handle->device->name;
 
-    if (read_jedec(handle, &jedec)) {
+    report_phase_t phase;
+    report_begin(handle, &phase, "read");
+    if (report_end(handle, &phase, read_jedec(handle, &jedec))) {
       free(jedec.fuses);
       return EXIT_FAILURE;
     }
@@ -1646,7 +1837,7 @@ int action_read(minipro_handle_t *handle) {
       return EXIT_FAILURE;
     }
     free(jedec.fuses);
-    fclose(file);
+    if (fclose(file)) return EXIT_FAILURE;
   } else {
     // No GAL device
     if (handle->cmdopts->page == UNSPECIFIED) {
@@ -1687,6 +1878,7 @@ int action_read(minipro_handle_t *handle) {
 int action_write(minipro_handle_t *handle) {
   jedec_t wjedec, rjedec;
   struct timeval begin, end;
+  report_phase_t phase;
 
   if (is_pld(handle->device->protocol_id)) {
     if (open_jed_file(handle, &wjedec)) return EXIT_FAILURE;
@@ -1702,7 +1894,8 @@ int action_write(minipro_handle_t *handle) {
       free(wjedec.fuses);
       return EXIT_FAILURE;
     }
-    if (write_jedec(handle, &wjedec)) {
+    report_begin(handle, &phase, "write");
+    if (report_end(handle, &phase, write_jedec(handle, &wjedec))) {
       free(wjedec.fuses);
       return EXIT_FAILURE;
     }
@@ -1713,7 +1906,7 @@ int action_write(minipro_handle_t *handle) {
     if (handle->cmdopts->no_verify == 0) {
       rjedec.QF = wjedec.QF;
       rjedec.F = wjedec.F;
-      rjedec.fuses = malloc(rjedec.QF);
+      rjedec.fuses = alloc_fuses(rjedec.QF, 0);
       if (!rjedec.fuses) {
         free(wjedec.fuses);
         return EXIT_FAILURE;
@@ -1724,26 +1917,30 @@ int action_write(minipro_handle_t *handle) {
         free(rjedec.fuses);
         return EXIT_FAILURE;
       }
+      report_begin(handle, &phase, "verify");
       if (read_jedec(handle, &rjedec)) {
+        report_end(handle, &phase, EXIT_FAILURE);
         free(wjedec.fuses);
         free(rjedec.fuses);
         return EXIT_FAILURE;
       }
       if (minipro_end_transaction(handle)) {
+        report_end(handle, &phase, EXIT_FAILURE);
         free(wjedec.fuses);
         free(rjedec.fuses);
         return EXIT_FAILURE;
       }
-      uint8_t c1, c2;
-      int address =
-          compare_memory(wjedec.fuses, rjedec.fuses, wjedec.QF, &c1, &c2);
+      int address = compare_fuses(wjedec.fuses, rjedec.fuses, wjedec.QF);
+      report_end(handle, &phase, address == -1 ? EXIT_SUCCESS : EXIT_FAILURE);
 
       if (address != -1) {
         fprintf(stderr,
                 "Verification failed at address 0x%04X: File=0x%02X, "
                 "Device=0x%02X\n",
-                address, c1, c2);
+                address, (uint8_t)GET_FUSE(wjedec.fuses, address),
+                (uint8_t)GET_FUSE(rjedec.fuses, address));
         free(rjedec.fuses);
+        free(wjedec.fuses);
         return EXIT_FAILURE;
       } else {
         fprintf(stderr, "Verification OK\n");
@@ -1756,10 +1953,13 @@ int action_write(minipro_handle_t *handle) {
       fprintf(stderr, "Writing lock bit... ");
       fflush(stderr);
       gettimeofday(&begin, NULL);
-      if (minipro_begin_transaction(handle)) return EXIT_FAILURE;
-      if (minipro_write_fuses(handle, MP_FUSE_LOCK, 0, 0, NULL))
+      report_begin(handle, &phase, "protect_on");
+      if (report_end(handle, &phase,
+                     minipro_begin_transaction(handle) ||
+                         minipro_write_fuses(handle, MP_FUSE_LOCK, 0, 0,
+                                             NULL) ||
+                         minipro_end_transaction(handle)))
         return EXIT_FAILURE;
-      if (minipro_end_transaction(handle)) return EXIT_FAILURE;
       gettimeofday(&end, NULL);
       fprintf(stderr, "%.2fSec OK\n",
               (double)(end.tv_usec - begin.tv_usec) / 1000000 +
@@ -1798,7 +1998,9 @@ int action_write(minipro_handle_t *handle) {
         (handle->device->opts4 & MP_PROTECT_MASK)) {
       fprintf(stderr, "Protect on...");
       fflush(stderr);
-      if (minipro_protect_on(handle)) return EXIT_FAILURE;
+      report_begin(handle, &phase, "protect_on");
+      if (report_end(handle, &phase, minipro_protect_on(handle)))
+        return EXIT_FAILURE;
       fprintf(stderr, "OK\n");
     }
   }
@@ -1817,8 +2019,11 @@ int action_verify(minipro_handle_t *handle) {
     else {
       wjedec.QF = handle->device->code_memory_size;
       wjedec.F = 0x01;
-      wjedec.fuses = malloc(wjedec.QF);
-      memset(wjedec.fuses, 0x01, wjedec.QF);
+      wjedec.fuses = alloc_fuses(wjedec.QF, 1);
+      if (!wjedec.fuses) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+      }
     }
 
     if (minipro_begin_transaction(handle)) {
@@ -1828,7 +2033,7 @@ int action_verify(minipro_handle_t *handle) {
 
     rjedec.QF = wjedec.QF;
     rjedec.F = wjedec.F;
-    rjedec.fuses = malloc(rjedec.QF);
+    rjedec.fuses = alloc_fuses(rjedec.QF, 0);
     if (!rjedec.fuses) {
       free(wjedec.fuses);
       return EXIT_FAILURE;
@@ -1849,20 +2054,20 @@ int action_verify(minipro_handle_t *handle) {
       free(rjedec.fuses);
       return EXIT_FAILURE;
     }
-    uint8_t c1, c2;
-    int address =
-        compare_memory(wjedec.fuses, rjedec.fuses, wjedec.QF, &c1, &c2);
+    int address = compare_fuses(wjedec.fuses, rjedec.fuses, wjedec.QF);
 
     if (address != -1) {
       if (handle->cmdopts->filename) {
         fprintf(stderr,
                 "Verification failed at address 0x%04X: File=0x%02X, "
                 "Device=0x%02X\n",
-                address, c1, c2);
+                address, (uint8_t)GET_FUSE(wjedec.fuses, address),
+                (uint8_t)GET_FUSE(rjedec.fuses, address));
       } else {
         fprintf(stderr, "This device is not blank.\n");
       }
       free(rjedec.fuses);
+      free(wjedec.fuses);
       return EXIT_FAILURE;
     } else {
       if (handle->cmdopts->filename) {
@@ -1913,95 +2118,779 @@ int action_verify(minipro_handle_t *handle) {
 
     if (handle->cmdopts->filename && handle->device->config &&
         handle->cmdopts->page == CONFIG) {
-      uint8_t wbuffer[64], vbuffer[64];
-      uint32_t value;
-      size_t i;
-      char config[1024];
+      if (verify_fuses(handle, handle->device->config)) ret = EXIT_FAILURE;
+    }
+  }
+  return ret;
+  }
 
-      memset(config, 0, sizeof(config));
-      size_t file_size = sizeof(config);
-      if (open_file(handle, (uint8_t *)config, &file_size)) return EXIT_FAILURE;
+// Write a chip with the next values of the serial fields
+static int write_serialized(minipro_handle_t *handle) {
+  serial_t *serial = handle->cmdopts->serial;
+  serial_unit_t unit;
+  int ret;
 
-      if (minipro_begin_transaction(handle)) return EXIT_FAILURE;
+  pthread_mutex_lock(&serial_lock);
+  ret = serial_take(serial, &unit);
+  pthread_mutex_unlock(&serial_lock);
+  if (ret) return EXIT_FAILURE;
+  serial_print(serial, &unit);
 
-      fuse_decl_t *fuses = ((fuse_decl_t *)handle->device->config);
-      // Atmel microcontrollers workaround
-      uint8_t items;
-      if (!fuses->word) {
-        items = fuses->num_fuses;
-        fuses->word = 1;
-      } else
-        items = fuses->item_size / fuses->word;
-
-      if (fuses->num_fuses > 0) {
-        for (i = 0; i < fuses->num_fuses; i++) {
-          if (get_config_value(config, fuses->fnames[i], &value) ==
-              EXIT_FAILURE) {
-            fprintf(stderr, "Could not read config %s value.\n",
-                    fuses->fnames[i]);
-            return EXIT_FAILURE;
-          }
-          format_int(&(wbuffer[i * fuses->word]), value, fuses->word,
-                     MP_LITTLE_ENDIAN);
-        }
-        if (minipro_read_fuses(handle, MP_FUSE_CFG,
-                               fuses->num_fuses * fuses->item_size, items,
-                               vbuffer))
-          return EXIT_FAILURE;
-        if (memcmp(wbuffer, vbuffer, fuses->num_fuses * fuses->item_size)) {
-          fprintf(stderr, "Fuse bits verification error!\n");
-          ret = EXIT_FAILURE;
-        } else
-          fprintf(stderr, "Fuse bits verification OK.\n");
+  handle->serial_unit = &unit;
+  ret = action_write(handle);
+  handle->serial_unit = NULL;
+
+  // A failed chip may hold the values already, they aren't given again
+  pthread_mutex_lock(&serial_lock);
+  serial_log(serial, &unit, handle->serial_number, handle->device->name, ret);
+  pthread_mutex_unlock(&serial_lock);
+  return ret;
+}
+
+// Run the job of the command line on an open programmer
+static int run_job(minipro_handle_t *handle) {
+  cmdopts_t *cmdopts = handle->cmdopts;
+
+  if (cmdopts->serial &&
+      (is_pld(handle->device->protocol_id) || cmdopts->page == CONFIG)) {
+    fprintf(stderr, "Serial fields only go in code or data memory.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (cmdopts->pincheck) {
+    if (handle->version == MP_TL866IIPLUS && !cmdopts->icsp) {
+      if (minipro_pin_test(handle)) {
+        minipro_end_transaction(handle);
+        return EXIT_FAILURE;
       }
+    } else
+      fprintf(stderr, "Pin test is not supported.\n");
+    if (cmdopts->action == NO_ACTION && !cmdopts->idcheck_only)
+      return EXIT_SUCCESS;
+  }
 
-      if (fuses->num_uids > 0) {
-        for (i = 0; i < fuses->num_uids; i++) {
-          if (get_config_value(config, fuses->unames[i], &value) ==
-              EXIT_FAILURE) {
-            fprintf(stderr, "Could not read config %s value.\n",
-                    fuses->unames[i]);
-            return EXIT_FAILURE;
-          }
-          format_int(&(wbuffer[i * fuses->word]), value, fuses->word,
-                     MP_LITTLE_ENDIAN);
-        }
-        if (minipro_read_fuses(handle, MP_FUSE_USER,
-                               fuses->num_uids * fuses->item_size,
-                               fuses->item_size / fuses->word, vbuffer))
+  // Check for GAL/PLD
+  if (!is_pld(handle->device->protocol_id) &&
+      (!handle->device->read_buffer_size || !handle->device->protocol_id)) {
+    fprintf(stderr, "Unsupported device!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Unlocking the TSOP48 adapter (if applicable)
+  uint8_t status;
+  switch (handle->device->package_details & ADAPTER_MASK) {
+    case TSOP48_ADAPTER:
+    case SOP44_ADAPTER:
+    case SOP56_ADAPTER:
+      if (minipro_unlock_tsop48(handle, &status)) return EXIT_FAILURE;
+      switch (status) {
+        case MP_TSOP48_TYPE_V3:
+          fprintf(stderr, "Found TSOP adapter V3\n");
+          break;
+        case MP_TSOP48_TYPE_NONE:
+          minipro_end_transaction(handle);  // We need this to turn off the
+                                            // power on the ZIF socket.
+          fprintf(stderr, "TSOP adapter not found!\n");
           return EXIT_FAILURE;
-        if (memcmp(wbuffer, vbuffer, fuses->num_uids * fuses->item_size)) {
-          fprintf(stderr, "User ID verification error!\n");
-          ret = EXIT_FAILURE;
-        } else
-          fprintf(stderr, "User ID verification OK.\n");
+        case MP_TSOP48_TYPE_V0:
+          fprintf(stderr, "Found TSOP adapter V0\n");
+          break;
+        case MP_TSOP48_TYPE_FAKE1:
+        case MP_TSOP48_TYPE_FAKE2:
+          fprintf(stderr, "Fake TSOP adapter found!\n");
+          break;
       }
+      minipro_end_transaction(handle);
+      break;
+  }
 
-      if (fuses->num_locks > 0) {
-        for (i = 0; i < fuses->num_locks; i++) {
-          if (get_config_value(config, fuses->lnames[i], &value) ==
-              EXIT_FAILURE) {
-            fprintf(stderr, "Could not read config %s value.\n",
-                    fuses->lnames[i]);
-            return EXIT_FAILURE;
-          }
-          format_int(&(wbuffer[i * fuses->word]), value, fuses->word,
-                     MP_LITTLE_ENDIAN);
+  // Activate ICSP if the chip can only be programmed via ICSP.
+  handle->icsp = 0;
+  if ((handle->device->package_details & ICSP_MASK) &&
+      ((handle->device->package_details & PIN_COUNT_MASK) == 0)) {
+    handle->icsp = MP_ICSP_ENABLE | MP_ICSP_VCC;
+  } else if (handle->device->package_details & ICSP_MASK)
+    handle->icsp = cmdopts->icsp;
+  if (handle->icsp) fprintf(stderr, "Activating ICSP...\n");
+
+  // Catch a bad pin contact before the chip gets erased
+  if (cmdopts->action == WRITE && !cmdopts->pincheck && !handle->icsp &&
+      handle->minipro_pin_contact) {
+    uint64_t mask;
+    if (cmdopts->pincheck_skip)
+      fprintf(stderr, "WARNING: skipping the pin contact test\n");
+    else if (get_pin_mask(handle->device->opts8 & 0xFF, &mask))
+      fprintf(stderr, "No pin map for %s, skipping the pin test.\n",
+              handle->device->name);
+    else if (minipro_pin_test(handle))
+      return EXIT_FAILURE;
+  }
+
+  uint8_t id_type;
+  // Verifying Chip ID (if applicable)
+  if (cmdopts->idcheck_skip) {
+    fprintf(stderr, "WARNING: skipping Chip ID test\n");
+  } else if ((handle->device->chip_id_bytes_count &&
+              handle->device->chip_id) &&
+             (handle->device->opts4 & MP_ID_MASK)) {
+    uint32_t chip_id;
+    report_phase_t phase;
+    report_begin(handle, &phase, "id_check");
+    if (minipro_begin_transaction(handle) ||
+        minipro_get_chip_id(handle, &id_type, &chip_id) ||
+        minipro_end_transaction(handle))
+      return report_end(handle, &phase, EXIT_FAILURE);
+    uint32_t chip_id_temp = chip_id;
+    uint8_t shift = 0;
+    /* The id_type will tell us the Chip ID type. There are 5 types */
+    uint32_t ok = 0;
+    switch (id_type) {
+      case MP_ID_TYPE1:  // 1-3 bytes ID
+      case MP_ID_TYPE2:  // 4 bytes ID
+      case MP_ID_TYPE5:  // 3 bytes ID, this ID type is returning from 25 SPI
+                         // series.
+        ok = (chip_id == handle->device->chip_id);
+        if (ok) {
+          fprintf(stderr, "Chip ID OK: 0x%04X\n", chip_id);
         }
-        if (minipro_read_fuses(handle, MP_FUSE_LOCK,
-                               fuses->num_locks * fuses->item_size,
-                               fuses->item_size / fuses->word, vbuffer))
-          return EXIT_FAILURE;
-        if (memcmp(wbuffer, vbuffer, fuses->num_locks * fuses->item_size)) {
-          fprintf(stderr, "Lock bits verification error!\n");
-          ret = EXIT_FAILURE;
-        } else
-          fprintf(stderr, "Lock bits verification OK.\n");
+        break;
+      case MP_ID_TYPE3:  // Microchip controllers with 5 bit revision number.
+        ok = (handle->device->chip_id >> 5 ==
+              (chip_id >> 5));  // Throw the chip revision (last 5 bits).
+        if (ok) {
+          fprintf(stderr, "Chip ID OK: 0x%04X Rev.0x%02X\n", chip_id >> 5,
+                  chip_id & 0x1F);
+        }
+        chip_id >>= 5;
+        chip_id_temp = chip_id << 5;
+        shift = 5;
+        break;
+      case MP_ID_TYPE4:  // Microchip controllers with 4-5 bit revision
+                         // number.
+        ok = (handle->device->chip_id >>
+                  ((fuse_decl_t *)handle->device->config)->rev_mask ==
+              (chip_id >> ((fuse_decl_t *)handle->device->config)
+                              ->rev_mask));  // Throw the chip revision (last
+                                             // rev_mask bits).
+        if (ok) {
+          fprintf(
+              stderr, "Chip ID OK: 0x%04X Rev.0x%02X\n", chip_id,
+              chip_id & ~(0xFF >>
+                          ((fuse_decl_t *)handle->device->config)->rev_mask));
+        }
+        chip_id >>= ((fuse_decl_t *)handle->device->config)->rev_mask;
+        chip_id_temp = chip_id
+                       << ((fuse_decl_t *)handle->device->config)->rev_mask;
+        shift = ((fuse_decl_t *)handle->device->config)->rev_mask;
+        break;
+    }
+    report_chip_id(handle, chip_id_temp, handle->device->chip_id);
+    report_end(handle, &phase, ok ? EXIT_SUCCESS : EXIT_FAILURE);
+
+    if (cmdopts->idcheck_only && ok) {
+      return EXIT_SUCCESS;
+    }
+
+    if (!ok) {
+      pthread_mutex_lock(&database_lock);
+      const char *name = get_device_from_id(handle, chip_id_temp,
+                                            handle->device->protocol_id);
+      pthread_mutex_unlock(&database_lock);
+      if (cmdopts->idcheck_only) {
+        fprintf(stderr,
+                "Chip ID mismatch: expected 0x%04X, got 0x%04X (%s)\n",
+                handle->device->chip_id >> shift, chip_id_temp >> shift,
+                name ? name : "unknown");
+        return EXIT_FAILURE;
+      }
+      if (cmdopts->idcheck_continue) {
+        fprintf(
+            stderr,
+            "WARNING: Chip ID mismatch: expected 0x%04X, got 0x%04X (%s)\n",
+            handle->device->chip_id >> shift, chip_id_temp >> shift,
+            name ? name : "unknown");
+      } else {
+        fprintf(
+            stderr,
+            "Invalid Chip ID: expected 0x%04X, got 0x%04X (%s)\n(use '-y' "
+            "to continue anyway at your own risk)\n",
+            handle->device->chip_id >> shift, chip_id_temp,
+            name ? name : "unknown");
+        return EXIT_FAILURE;
       }
     }
+  } else if (cmdopts->idcheck_only) {
+    fprintf(stderr, "This chip doesn't have a chip id!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Performing requested action
+  switch (cmdopts->action) {
+    case READ:
+      return action_read(handle);
+    case WRITE:
+      if (cmdopts->serial) return write_serialized(handle);
+      return action_write(handle);
+    case VERIFY:
+    case BLANK_CHECK:
+      return action_verify(handle);
+    case ERASE:
+      if (!(handle->device->opts4 & MP_ERASE_MASK)) {
+        fprintf(stderr, "This chip can't be erased!\n");
+        return EXIT_FAILURE;
+      }
+      if (minipro_begin_transaction(handle)) return EXIT_FAILURE;
+      return erase_device(handle);
+    default:
+      return EXIT_FAILURE;
   }
+}
+
+/*
+ Gang mode runs the job on several programmers at once, each station on
+ its own thread with its own USB handle. The device is looked up and the
+ file is parsed once before the stations start, then shared read-only.
+ --loop without --gang runs the same way with a single station, keeping
+ the programmer, device and image from one chip to the next.
+ */
+typedef struct station {
+  minipro_handle_t *handle;
+  pthread_t thread;
+  int started;
+  int quiet;  // leave the progress out, other stations share stderr
+  unsigned int passed;
+  unsigned int failed;
+} station_t;
+
+/*
+ Read and parse the file of a write or verify once. The stations copy
+ it instead of reading the file again, which also lets them share a
+ file piped to stdin.
+ */
+static int load_image(minipro_handle_t *handle, shared_image_t *image) {
+  cmdopts_t *cmdopts = handle->cmdopts;
+  uint8_t type = MP_CODE;
+  size_t size = 0;
+
+  memset(image, 0, sizeof(shared_image_t));
+  if (!cmdopts->filename ||
+      (cmdopts->action != WRITE && cmdopts->action != VERIFY))
+    return EXIT_SUCCESS;
+  if (read_file(handle, &image->file, &image->file_size))
+    return EXIT_FAILURE;
+  cmdopts->image = image;
+
+  if (is_pld(handle->device->protocol_id))
+    return open_jed_file(handle, &image->jedec);
+  switch (cmdopts->page) {
+    case UNSPECIFIED:
+    case CODE:
+      size = handle->device->code_memory_size;
+      break;
+    case DATA:
+      type = MP_DATA;
+      size = handle->device->data_memory_size;
+      break;
+    default:
+      break;
+  }
+  if (!size) return EXIT_SUCCESS;
+
+  image->data = malloc(size);
+  if (!image->data) {
+    fprintf(stderr, "Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+  memset(image->data, 0xFF, size);
+  image->image_size = size;
+  if (open_file(handle, image->data, &image->image_size, &image->segments,
+                &cmdopts->pipeline))
+    return EXIT_FAILURE;
+  image->type = type;
+  image->size = size;
+  return EXIT_SUCCESS;
+}
+
+static void free_image(shared_image_t *image) {
+  free(image->file);
+  free(image->data);
+  free(image->jedec.fuses);
+}
+
+static void request_stop(int signum) {
+  (void)signum;
+  stop_requested = 1;
+}
+
+// Wait until the chip of a station is removed, or a new one is seated
+static int wait_chip(minipro_handle_t *handle, int seated) {
+  int present, count = 0;
+
+  // A new chip must be seen twice in a row, not while being seated
+  while (!stop_requested) {
+    if (minipro_chip_present(handle, &present)) return EXIT_FAILURE;
+    count = present == seated ? count + 1 : 0;
+    if (count == (seated ? 2 : 1)) return EXIT_SUCCESS;
+    usleep(CHIP_POLL_INTERVAL);
+  }
+  return EXIT_FAILURE;
+}
+
+static void no_progress(void *context, const char *operation, size_t done,
+                        size_t total) {
+  (void)context;
+  (void)operation;
+  (void)done;
+  (void)total;
+}
+
+static void *run_station(void *arg) {
+  station_t *station = arg;
+  minipro_handle_t *handle = station->handle;
+  int ret;
+
+  if (station->quiet) minipro_set_output(no_progress, NULL, NULL);
+  do {
+    ret = run_job(handle);
+    if (minipro_end_transaction(handle)) ret = EXIT_FAILURE;
+    if (ret)
+      station->failed++;
+    else
+      station->passed++;
+    if (handle->cmdopts->loop)
+      fprintf(stderr, "%s: chip %u %s, swap it to restart.\n", handle->path,
+              station->passed + station->failed, ret ? "FAILED" : "OK");
+  } while (handle->cmdopts->loop && !wait_chip(handle, 0) &&
+           !wait_chip(handle, 1));
+  return NULL;
+}
+
+// Open the programmers given with --programmer, or all the free ones
+static int open_stations(cmdopts_t *cmdopts, station_t **stations,
+                         size_t *count) {
+  minipro_handle_t *handle;
+  usb_device_t *devices = NULL;
+  char *list = NULL, *name;
+  size_t size = 1;
+  int i, found = 0;
+
+  // Without --gang, --loop runs on one programmer like a normal job
+  if (cmdopts->gang && cmdopts->programmer) {
+    list = strdup(cmdopts->programmer);
+    if (!list) {
+      fprintf(stderr, "Out of memory!\n");
+      return EXIT_FAILURE;
+    }
+    for (name = list; *name; name++)
+      if (*name == ',') size++;
+  } else if (cmdopts->gang) {
+    found = usb_list_devices(&devices);
+    if (found < 0) return EXIT_FAILURE;
+    size = found;
+  }
+
+  *count = 0;
+  *stations = calloc(size ? size : 1, sizeof(station_t));
+  if (!*stations) {
+    fprintf(stderr, "Out of memory!\n");
+    free(list);
+    free(devices);
+    return EXIT_FAILURE;
+  }
+
+  if (!cmdopts->gang) {
+    handle = open_programmer(cmdopts->programmer, NULL);
+    if (handle) (*stations)[(*count)++].handle = handle;
+  } else if (list) {
+    for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+      handle = open_programmer(name, NULL);
+      if (!handle) break;
+      (*stations)[(*count)++].handle = handle;
+    }
+    // Every programmer asked for must be there
+    if (name) {
+      for (i = 0; i < (int)*count; i++) minipro_close((*stations)[i].handle);
+      *count = 0;
+    }
+  } else {
+    // Programmers in use by another process are left out
+    for (i = 0; i < found; i++) {
+      handle = open_programmer(devices[i].path, NULL);
+      if (handle) (*stations)[(*count)++].handle = handle;
+    }
+    if (!*count) fprintf(stderr, "No free programmer found!\n");
+  }
+  free(list);
+  free(devices);
+  if (*count) return EXIT_SUCCESS;
+  free(*stations);
+  return EXIT_FAILURE;
+}
+
+static int run_gang(cmdopts_t *cmdopts, int argc, char **argv) {
+  station_t *stations;
+  shared_image_t image;
+  minipro_handle_t *handle;
+  device_t *device;
+  size_t count, i;
+  unsigned int passed = 0, failed = 0;
+  int present, ret = EXIT_FAILURE;
+
+  if (cmdopts->action == READ) {
+    fprintf(stderr, "Reading is not supported in gang or loop mode.\n");
+    return EXIT_FAILURE;
+  }
+  if (open_stations(cmdopts, &stations, &count)) return EXIT_FAILURE;
+  memset(&image, 0, sizeof(image));
+
+  for (i = 0; i < count; i++) {
+    handle = stations[i].handle;
+    fprintf(stderr, "%s: ", handle->path);
+    minipro_print_system_info(handle);
+    if (handle->status == MP_STATUS_BOOTLOADER) {
+      fprintf(stderr, "in bootloader mode!\nExiting...\n");
+      goto close;
+    }
+    // The device tables differ between the two models
+    if ((handle->version == MP_TL866IIPLUS) !=
+        (stations[0].handle->version == MP_TL866IIPLUS)) {
+      fprintf(stderr, "Programmers of different models can't be ganged.\n");
+      goto close;
+    }
+  }
+
+  // Look up the device and parse the options once for all the stations
+  handle = stations[0].handle;
+  device = get_device_by_name(handle, cmdopts->device);
+  if (!device) {
+    fprintf(stderr, "Device %s not found!\n", cmdopts->device);
+    goto close;
+  }
+  for (i = 0; i < count; i++) {
+    stations[i].handle->device = device;
+    stations[i].handle->cmdopts = cmdopts;
+  }
+  if (parse_options(handle, argc, argv)) {
+    fprintf(stderr, "Invalid option '%s'\n", optarg);
+    goto close;
+  }
+  if (load_image(handle, &image)) goto close;
+  build_device_tables(handle);
+
+  if (cmdopts->loop) {
+    if (minipro_chip_present(handle, &present)) goto close;
+    signal(SIGINT, request_stop);
+    fprintf(stderr, "Swap a chip to run its job again, Ctrl-C to stop.\n");
+  }
+
+  for (i = 0; i < count; i++) {
+    // The progress of several stations at once would be unreadable
+    stations[i].quiet = count > 1;
+    if (pthread_create(&stations[i].thread, NULL, run_station, &stations[i])) {
+      fprintf(stderr, "%s: could not start the station!\n",
+              stations[i].handle->path);
+      stations[i].failed++;
+    } else
+      stations[i].started = 1;
+  }
+  for (i = 0; i < count; i++)
+    if (stations[i].started) pthread_join(stations[i].thread, NULL);
+
+  fprintf(stderr, "\n%s report:\n", cmdopts->gang ? "Gang" : "Loop");
+  for (i = 0; i < count; i++) {
+    handle = stations[i].handle;
+    if (cmdopts->loop)
+      fprintf(stderr, "  %-16s %u OK, %u FAILED  %s\n", handle->path,
+              stations[i].passed, stations[i].failed, handle->serial_number);
+    else
+      fprintf(stderr, "  %-16s %-8s %s\n", handle->path,
+              stations[i].failed ? "FAILED" : "OK", handle->serial_number);
+    passed += stations[i].passed;
+    failed += stations[i].failed;
+  }
+  fprintf(stderr, "Total: %u OK, %u FAILED\n", passed, failed);
+  ret = failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+close:
+  free_image(&image);
+  for (i = 0; i < count; i++) minipro_close(stations[i].handle);
+  free(stations);
+  return ret;
+}
+
+#ifndef _WIN32
+/*
+ Daemon mode keeps the programmer open and serves jobs on a Unix domain
+ socket, one job per connection. The client sends the options of the job
+ one argument per line, ending with an empty line. It gets back what the
+ job prints on stderr, progress included, then an 'exit: <n>' line with
+ the exit status of the job. The file of the last write or verify stays
+ parsed and is only parsed again when its contents or the options change.
+ */
+typedef struct image_cache {
+  shared_image_t image;
+  char *key;  // the arguments of the job which loaded it
+} image_cache_t;
+
+// Read the arguments of a job into argv[1..], NULL terminated
+static int read_job(int client, char *buffer, char **argv, int *argc) {
+  char *line, *end;
+  size_t size = 0;
+  ssize_t n;
+
+  buffer[0] = 0;
+  while (buffer[0] != '\n' && !strstr(buffer, "\n\n")) {
+    if (size == DAEMON_REQUEST_SIZE - 1) {
+      fprintf(stderr, "Job request too long!\n");
+      return EXIT_FAILURE;
+    }
+    n = read(client, buffer + size, DAEMON_REQUEST_SIZE - 1 - size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      fprintf(stderr, "Incomplete job request!\n");
+      return EXIT_FAILURE;
+    }
+    size += n;
+    buffer[size] = 0;
+  }
+
+  *argc = 1;
+  for (line = buffer; *line != '\n'; line = end + 1) {
+    if (*argc == DAEMON_MAX_ARGS - 1) {
+      fprintf(stderr, "Too many job arguments!\n");
+      return EXIT_FAILURE;
+    }
+    end = strchr(line, '\n');
+    *end = 0;
+    argv[(*argc)++] = line;
+  }
+  argv[*argc] = NULL;
+  return EXIT_SUCCESS;
+}
+
+// Parse the options of a job, those of the command line only are refused
+static int parse_job(int argc, char **argv, cmdopts_t *cmdopts) {
+  int c, ret = EXIT_SUCCESS;
+
+  memset(cmdopts, 0, sizeof(cmdopts_t));
+  // Zero makes getopt forget the arguments of the previous job
+  optind = 0;
+  opterr = 1;
+  while ((c = getopt_long(argc, argv, JOB_OPTIONS, NULL, NULL)) != -1)
+    if (!ret && parse_job_option(c, cmdopts)) ret = EXIT_FAILURE;
+  if (ret) return EXIT_FAILURE;
+  if (optind < argc) {
+    fprintf(stderr, "Unexpected argument '%s'\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  if (cmdopts->filename && !strcmp(cmdopts->filename, "-")) {
+    fprintf(stderr, "Jobs can't use stdin or stdout.\n");
+    return EXIT_FAILURE;
+  }
+  return check_job(cmdopts);
+}
+
+// Load the file of a job, unless the last one loaded the same file
+static int load_cached_image(minipro_handle_t *handle, int argc, char **argv,
+                             image_cache_t *cache) {
+  uint8_t *file;
+  size_t file_size, size = 1;
+  char *key;
+  int i, ret;
+
+  // Reading the file is cheap, it's parsing it which is skipped
+  if (read_file(handle, &file, &file_size)) return EXIT_FAILURE;
+  for (i = 1; i < argc; i++) size += strlen(argv[i]) + 1;
+  key = malloc(size);
+  if (!key) {
+    fprintf(stderr, "Out of memory!\n");
+    free(file);
+    return EXIT_FAILURE;
+  }
+  key[0] = 0;
+  for (i = 1; i < argc; i++) {
+    strcat(key, argv[i]);
+    strcat(key, "\n");
+  }
+
+  if (cache->key && !strcmp(cache->key, key) &&
+      cache->image.file_size == file_size &&
+      !memcmp(cache->image.file, file, file_size)) {
+    handle->cmdopts->image = &cache->image;
+    free(key);
+    free(file);
+    return EXIT_SUCCESS;
+  }
+
+  free(file);
+  free_image(&cache->image);
+  free(cache->key);
+  cache->key = NULL;
+  ret = load_image(handle, &cache->image);
+  if (ret) {
+    free_image(&cache->image);
+    memset(&cache->image, 0, sizeof(shared_image_t));
+    handle->cmdopts->image = NULL;
+    free(key);
+  } else
+    cache->key = key;
   return ret;
+}
+
+static int run_daemon_job(minipro_handle_t *handle, int argc, char **argv,
+                          image_cache_t *cache) {
+  cmdopts_t cmdopts;
+  device_t *found, device;
+  int ret;
+
+  if (parse_job(argc, argv, &cmdopts)) return EXIT_FAILURE;
+
+  // The options of a job may change the voltages, keep the table intact
+  pthread_mutex_lock(&database_lock);
+  found = get_device_by_name(handle, cmdopts.device);
+  pthread_mutex_unlock(&database_lock);
+  if (!found) {
+    fprintf(stderr, "Device %s not found!\n", cmdopts.device);
+    return EXIT_FAILURE;
   }
+  device = *found;
+  handle->device = &device;
+  handle->cmdopts = &cmdopts;
+
+  ret = EXIT_FAILURE;
+  if (parse_options(handle, argc, argv))
+    fprintf(stderr, "Invalid option '%s'\n", optarg);
+  else if (!cmdopts.filename ||
+           (cmdopts.action != WRITE && cmdopts.action != VERIFY) ||
+           !load_cached_image(handle, argc, argv, cache)) {
+    ret = run_job(handle);
+    if (minipro_end_transaction(handle)) ret = EXIT_FAILURE;
+  }
+  handle->device = NULL;
+  handle->cmdopts = NULL;
+  return ret;
+}
+
+// Progress lines sent to the client, which isn't a terminal
+static void daemon_progress(void *context, const char *operation,
+                            size_t done, size_t total) {
+  (void)context;
+  fprintf(stderr, "progress: %s %" PRI_SIZET "/%" PRI_SIZET "\n", operation,
+          done, total);
+}
+
+// Create the listening socket, replacing one left by a killed daemon
+static int open_daemon_socket(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  int sock;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (!lstat(path, &st)) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "%s exists and is not a socket.\n", path);
+      return -1;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock >= 0 && !connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+      fprintf(stderr, "A daemon is already listening on %s\n", path);
+      close(sock);
+      return -1;
+    }
+    if (sock >= 0) close(sock);
+    unlink(path);
+  }
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+    return -1;
+  }
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(sock, SOMAXCONN)) {
+    fprintf(stderr, "Could not listen on %s: %s\n", path, strerror(errno));
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+static int run_daemon(cmdopts_t *cmdopts) {
+  static char buffer[DAEMON_REQUEST_SIZE];
+  char *argv[DAEMON_MAX_ARGS] = {"minipro"};
+  struct sigaction action;
+  image_cache_t cache;
+  minipro_handle_t *handle;
+  unsigned int jobs = 0;
+  int sock, client, log, argc, ret;
+
+  if (cmdopts->action != NO_ACTION || cmdopts->device || cmdopts->gang ||
+      cmdopts->loop) {
+    fprintf(stderr, "Jobs are given to the daemon, not with --daemon.\n");
+    return EXIT_FAILURE;
+  }
+  handle = open_programmer(cmdopts->programmer, NULL);
+  if (!handle) return EXIT_FAILURE;
+  minipro_print_system_info(handle);
+  if (handle->status == MP_STATUS_BOOTLOADER) {
+    fprintf(stderr, "in bootloader mode!\nExiting...\n");
+    minipro_close(handle);
+    return EXIT_FAILURE;
+  }
+  sock = open_daemon_socket(cmdopts->daemon);
+  log = dup(STDERR_FILENO);
+  if (sock < 0 || log < 0) {
+    if (sock >= 0) close(sock);
+    minipro_close(handle);
+    return EXIT_FAILURE;
+  }
+
+  // Ctrl-C or SIGTERM stop the daemon once the running job is done, and
+  // a client going away mustn't kill it
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  memset(&cache, 0, sizeof(cache));
+  minipro_set_output(daemon_progress, NULL, NULL);
+  fprintf(stderr, "Waiting for jobs on %s\n", cmdopts->daemon);
+
+  while (!stop_requested) {
+    client = accept(sock, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Could not accept a job: %s\n", strerror(errno));
+      break;
+    }
+
+    // The job reports to the client as it would to the terminal
+    dup2(client, STDERR_FILENO);
+    ret = read_job(client, buffer, argv, &argc);
+    if (!ret) ret = run_daemon_job(handle, argc, argv, &cache);
+    fprintf(stderr, "exit: %d\n", ret);
+    dup2(log, STDERR_FILENO);
+    close(client);
+    fprintf(stderr, "Job %u: %s\n", ++jobs, ret ? "FAILED" : "OK");
+  }
+
+  fprintf(stderr, "Stopped after %u job(s).\n", jobs);
+  close(sock);
+  close(log);
+  unlink(cmdopts->daemon);
+  free_image(&cache.image);
+  free(cache.key);
+  minipro_close(handle);
+  return EXIT_SUCCESS;
+}
+#endif
 
   int main(int argc, char **argv) {
 #ifdef _WIN32
@@ -2011,48 +2900,33 @@ int action_verify(minipro_handle_t *handle) {
     cmdopts_t cmdopts;
     parse_cmdline(argc, argv, &cmdopts);
 
-    // Check if a file name is required
-    switch (cmdopts.action) {
-      case READ:
-      case WRITE:
-      case VERIFY:
-        if (!cmdopts.filename && !cmdopts.idcheck_only) {
-          fprintf(stderr, "A file name is required for this action.\n");
-          print_help_and_exit(argv[0]);
-        }
-        break;
-      default:
-        break;
-    }
-
-    // Check if a device name is required
-    if (!cmdopts.device) {
-      fprintf(stderr,
-              "Device required. Use -p <device> to specify a device.\n");
-      print_help_and_exit(argv[0]);
-    }
-
-    // don't permit skipping the ID read in write/erase-mode or ID only mode
-    if ((cmdopts.action == WRITE || cmdopts.action == ERASE ||
-         cmdopts.idcheck_only) &&
-        cmdopts.idcheck_skip) {
-      fprintf(stderr,
-              "Skipping the ID check is not permitted for this action.\n");
-      print_help_and_exit(argv[0]);
+    if (cmdopts.daemon) {
+#ifdef _WIN32
+      fprintf(stderr, "Daemon mode is not supported on Windows.\n");
+      return EXIT_FAILURE;
+#else
+      return run_daemon(&cmdopts);
+#endif
     }
-
-    // Exit if no action is supplied
-    if (cmdopts.action == NO_ACTION && !cmdopts.idcheck_only &&
-        !cmdopts.pincheck) {
-      fprintf(stderr, "No action to perform.\n");
+    if (check_job(&cmdopts)) print_help_and_exit(argv[0]);
+    if (cmdopts.serial && cmdopts.action != WRITE &&
+        cmdopts.action != VERIFY) {
+      fprintf(stderr, "--serial can only be used to write or verify.\n");
       print_help_and_exit(argv[0]);
     }
 
     // Set the pipe flag
     if (cmdopts.filename)
     	cmdopts.is_pipe = (!strcmp(cmdopts.filename, "-"));
+    if (report_enabled() && cmdopts.is_pipe && cmdopts.action == READ) {
+      fprintf(stderr, "--json can't be used when reading to stdout.\n");
+      return EXIT_FAILURE;
+    }
 
-    minipro_handle_t *handle = minipro_open(cmdopts.device);
+    if (cmdopts.gang || cmdopts.loop) return run_gang(&cmdopts, argc, argv);
+
+    minipro_handle_t *handle =
+        open_programmer(cmdopts.programmer, cmdopts.device);
     if (!handle) {
       return EXIT_FAILURE;
     }
@@ -2073,205 +2947,8 @@ int action_verify(minipro_handle_t *handle) {
       exit(EXIT_FAILURE);
     }
 
-    if (cmdopts.pincheck) {
-      if (handle->version == MP_TL866IIPLUS && !cmdopts.icsp) {
-        if (minipro_pin_test(handle)) {
-          minipro_end_transaction(handle);
-          minipro_close(handle);
-          return EXIT_FAILURE;
-        }
-      } else
-        fprintf(stderr, "Pin test is not supported.\n");
-      if (cmdopts.action == NO_ACTION && !cmdopts.idcheck_only)
-        return EXIT_SUCCESS;
-    }
-
-    // Check for GAL/PLD
-    if (!is_pld(handle->device->protocol_id) &&
-        (!handle->device->read_buffer_size || !handle->device->protocol_id)) {
-      minipro_close(handle);
-      fprintf(stderr, "Unsupported device!\n");
-      return EXIT_FAILURE;
-    }
-
-    // Unlocking the TSOP48 adapter (if applicable)
-    uint8_t status;
-    switch (handle->device->package_details & ADAPTER_MASK) {
-      case TSOP48_ADAPTER:
-      case SOP44_ADAPTER:
-      case SOP56_ADAPTER:
-        if (minipro_unlock_tsop48(handle, &status)) {
-          minipro_close(handle);
-          return EXIT_FAILURE;
-        }
-        switch (status) {
-          case MP_TSOP48_TYPE_V3:
-            fprintf(stderr, "Found TSOP adapter V3\n");
-            break;
-          case MP_TSOP48_TYPE_NONE:
-            minipro_end_transaction(handle);  // We need this to turn off the
-                                              // power on the ZIF socket.
-            minipro_close(handle);
-            fprintf(stderr, "TSOP adapter not found!\n");
-            return EXIT_FAILURE;
-          case MP_TSOP48_TYPE_V0:
-            fprintf(stderr, "Found TSOP adapter V0\n");
-            break;
-          case MP_TSOP48_TYPE_FAKE1:
-          case MP_TSOP48_TYPE_FAKE2:
-            fprintf(stderr, "Fake TSOP adapter found!\n");
-            break;
-        }
-        minipro_end_transaction(handle);
-        break;
-    }
-
-    // Activate ICSP if the chip can only be programmed via ICSP.
-    handle->icsp = 0;
-    if ((handle->device->package_details & ICSP_MASK) &&
-        ((handle->device->package_details & PIN_COUNT_MASK) == 0)) {
-      handle->icsp = MP_ICSP_ENABLE | MP_ICSP_VCC;
-    } else if (handle->device->package_details & ICSP_MASK)
-      handle->icsp = cmdopts.icsp;
-    if (handle->icsp) fprintf(stderr, "Activating ICSP...\n");
-
-    uint8_t id_type;
-    // Verifying Chip ID (if applicable)
-    if (cmdopts.idcheck_skip) {
-      fprintf(stderr, "WARNING: skipping Chip ID test\n");
-    } else if ((handle->device->chip_id_bytes_count &&
-                handle->device->chip_id) &&
-               (handle->device->opts4 & MP_ID_MASK)) {
-      if (minipro_begin_transaction(handle)) {
-        minipro_close(handle);
-        return EXIT_FAILURE;
-      }
-      uint32_t chip_id;
-      if (minipro_get_chip_id(handle, &id_type, &chip_id)) {
-        minipro_close(handle);
-        return EXIT_FAILURE;
-      }
-      if (minipro_end_transaction(handle)) {
-        minipro_close(handle);
-        return EXIT_FAILURE;
-      }
-      uint32_t chip_id_temp = chip_id;
-      uint8_t shift = 0;
-      /* The id_type will tell us the Chip ID type. There are 5 types */
-      uint32_t ok = 0;
-      switch (id_type) {
-        case MP_ID_TYPE1:  // 1-3 bytes ID
-        case MP_ID_TYPE2:  // 4 bytes ID
-        case MP_ID_TYPE5:  // 3 bytes ID, this ID type is returning from 25 SPI
-                           // series.
-          ok = (chip_id == handle->device->chip_id);
-          if (ok) {
-            fprintf(stderr, "Chip ID OK: 0x%04X\n", chip_id);
-          }
-          break;
-        case MP_ID_TYPE3:  // Microchip controllers with 5 bit revision number.
-          ok = (handle->device->chip_id >> 5 ==
-                (chip_id >> 5));  // Throw the chip revision (last 5 bits).
-          if (ok) {
-            fprintf(stderr, "Chip ID OK: 0x%04X Rev.0x%02X\n", chip_id >> 5,
-                    chip_id & 0x1F);
-          }
-          chip_id >>= 5;
-          chip_id_temp = chip_id << 5;
-          shift = 5;
-          break;
-        case MP_ID_TYPE4:  // Microchip controllers with 4-5 bit revision
-                           // number.
-          ok = (handle->device->chip_id >>
-                    ((fuse_decl_t *)handle->device->config)->rev_mask ==
-                (chip_id >> ((fuse_decl_t *)handle->device->config)
-                                ->rev_mask));  // Throw the chip revision (last
-                                               // rev_mask bits).
-          if (ok) {
-            fprintf(
-                stderr, "Chip ID OK: 0x%04X Rev.0x%02X\n", chip_id,
-                chip_id & ~(0xFF >>
-                            ((fuse_decl_t *)handle->device->config)->rev_mask));
-          }
-          chip_id >>= ((fuse_decl_t *)handle->device->config)->rev_mask;
-          chip_id_temp = chip_id
-                         << ((fuse_decl_t *)handle->device->config)->rev_mask;
-          shift = ((fuse_decl_t *)handle->device->config)->rev_mask;
-          break;
-      }
-
-      if (cmdopts.idcheck_only && ok) {
-        minipro_close(handle);
-        return EXIT_SUCCESS;
-      }
-
-      if (!ok) {
-        const char *name = get_device_from_id(handle, chip_id_temp,
-                                              handle->device->protocol_id);
-        if (cmdopts.idcheck_only) {
-          fprintf(stderr,
-                  "Chip ID mismatch: expected 0x%04X, got 0x%04X (%s)\n",
-                  handle->device->chip_id >> shift, chip_id_temp >> shift,
-                  name ? name : "unknown");
-          minipro_close(handle);
-          return EXIT_FAILURE;
-        }
-        if (cmdopts.idcheck_continue) {
-          fprintf(
-              stderr,
-              "WARNING: Chip ID mismatch: expected 0x%04X, got 0x%04X (%s)\n",
-              handle->device->chip_id >> shift, chip_id_temp >> shift,
-              name ? name : "unknown");
-        } else {
-          fprintf(
-              stderr,
-              "Invalid Chip ID: expected 0x%04X, got 0x%04X (%s)\n(use '-y' "
-              "to continue anyway at your own risk)\n",
-              handle->device->chip_id >> shift, chip_id_temp,
-              name ? name : "unknown");
-          minipro_close(handle);
-          return EXIT_FAILURE;
-        }
-      }
-    } else if (cmdopts.idcheck_only) {
-      minipro_close(handle);
-      fprintf(stderr, "This chip doesn't have a chip id!\n");
-      return EXIT_FAILURE;
-    }
-
-    // Performing requested action
-    int ret;
-    switch (cmdopts.action) {
-      case READ:
-        ret = action_read(handle);
-        break;
-      case WRITE:
-        ret = action_write(handle);
-        break;
-      case VERIFY:
-      case BLANK_CHECK:
-        ret = action_verify(handle);
-        break;
-      case ERASE:
-        if (!(handle->device->opts4 & MP_ERASE_MASK)) {
-          fprintf(stderr, "This chip can't be erased!\n");
-          return EXIT_FAILURE;
-        }
-        if (minipro_begin_transaction(handle)) {
-          minipro_close(handle);
-          return EXIT_FAILURE;
-        }
-        ret = erase_device(handle);
-        break;
-      default:
-        ret = EXIT_FAILURE;
-        break;
-    }
-
-    if (minipro_end_transaction(handle)) {
-      minipro_close(handle);
-      return EXIT_FAILURE;
-    }
+    int ret = run_job(handle);
+    if (minipro_end_transaction(handle)) ret = EXIT_FAILURE;
     minipro_close(handle);
     return ret;
 }
@@ -31,7 +31,6 @@
 #define TL866A_RESET 0xFF
 #define TL866IIPLUS_RESET 0x3F
 
-#define CRC32_POLYNOMIAL 0xEDB88320
 
 
 void format_int(uint8_t *out, uint32_t in, size_t size, uint8_t endianness) {
@@ -53,33 +52,26 @@ uint32_t load_int(uint8_t *buffer, size_t size, uint8_t endianness) {
   return result;
 }
 
-// Simple crc32
-uint32_t crc32(uint8_t *data, size_t size, uint32_t initial) {
-  uint32_t i, j, crc;
-  crc = initial;
-  for (i = 0; i < size; i++) {
-    crc = crc ^ data[i];
-    for (j = 0; j < 8; j++)
-      crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & (-(crc & 1)));
-  }
-  return crc;
-}
-
-minipro_handle_t *minipro_open(const char *device_name) {
-  minipro_handle_t *handle = malloc(sizeof(minipro_handle_t));
+// Open the programmer at a USB path, the first free one if NULL
+static minipro_handle_t *open_programmer(const char *path) {
+  minipro_handle_t *handle = calloc(1, sizeof(minipro_handle_t));
   if (handle == NULL) {
-    fprintf(stderr, "Out of memory!\n");
+    minipro_log("Out of memory!\n");
     return NULL;
   }
 
-  handle->usb_handle = usb_open();
+  handle->usb_handle = usb_open(path);
   if (!handle->usb_handle) {
     free(handle);
     return NULL;
   }
+  usb_get_path(handle->usb_handle, handle->path);
 
   minipro_report_info_t info;
-  if (minipro_get_system_info(handle, &info)) return NULL;
+  if (minipro_get_system_info(handle, &info)) {
+    minipro_close(handle);
+    return NULL;
+  }
 
   switch (info.device_version) {
     case MP_TL866A:
@@ -91,7 +83,7 @@ minipro_handle_t *minipro_open(const char *device_name) {
           break;
         default:
           minipro_close(handle);
-          fprintf(stderr, "\nUnknown device status!\nExiting...\n");
+          minipro_log("\nUnknown device status!\nExiting...\n");
           return NULL;
       }
       handle->model = info.device_version == MP_TL866A ? "TL866A" : "TL866CS";
@@ -111,10 +103,10 @@ minipro_handle_t *minipro_open(const char *device_name) {
       handle->minipro_erase = tl866a_erase;
       handle->minipro_unlock_tsop48 = tl866a_unlock_tsop48;
       handle->minipro_hardware_check = tl866a_hardware_check;
-      handle->minipro_read_jedec_row = tl866a_read_jedec_row;
-      handle->minipro_write_jedec_row = tl866a_write_jedec_row;
+      handle->minipro_read_jedec_rows = tl866a_read_jedec_rows;
+      handle->minipro_write_jedec_rows = tl866a_write_jedec_rows;
       handle->minipro_firmware_update = tl866a_firmware_update;
-      handle->minipro_pin_test = NULL;
+      handle->minipro_pin_contact = NULL;
       break;
     case MP_TL866IIPLUS:
       handle->status = info.firmware_version_minor == 0 ? MP_STATUS_BOOTLOADER
@@ -136,14 +128,14 @@ minipro_handle_t *minipro_open(const char *device_name) {
       handle->minipro_get_ovc_status = tl866iiplus_get_ovc_status;
       handle->minipro_unlock_tsop48 = tl866iiplus_unlock_tsop48;
       handle->minipro_hardware_check = tl866iiplus_hardware_check;
-      handle->minipro_read_jedec_row = tl866iiplus_read_jedec_row;
-      handle->minipro_write_jedec_row = tl866iiplus_write_jedec_row;
+      handle->minipro_read_jedec_rows = tl866iiplus_read_jedec_rows;
+      handle->minipro_write_jedec_rows = tl866iiplus_write_jedec_rows;
       handle->minipro_firmware_update = tl866iiplus_firmware_update;
-      handle->minipro_pin_test = tl866iiplus_pin_test;
+      handle->minipro_pin_contact = tl866iiplus_pin_contact;
       break;
     default:
       minipro_close(handle);
-      fprintf(stderr, "Unknown programmer model!\n");
+      minipro_log("Unknown programmer model!\n");
       return NULL;
   }
 
@@ -152,12 +144,56 @@ minipro_handle_t *minipro_open(const char *device_name) {
   sprintf(handle->firmware_str, "%02d.%d.%d", info.hardware_version,
           info.firmware_version_major, info.firmware_version_minor);
   handle->version = info.device_version;
+  return handle;
+}
+
+// Compare a serial number ignoring the case and the trailing blanks
+static int serial_matches(const char *serial, const char *name) {
+  size_t size = strlen(serial);
+  while (size && (serial[size - 1] == ' ' || (uint8_t)serial[size - 1] == 0xff))
+    size--;
+  return strlen(name) == size && !strncasecmp(serial, name, size);
+}
+
+/*
+ Open a programmer selected by USB path or serial number, the first one
+ not in use by another process if programmer is NULL.
+ */
+minipro_handle_t *minipro_open(const char *programmer,
+                               const char *device_name) {
+  minipro_handle_t *handle = NULL;
+  usb_device_t *devices;
+  int i, count;
+
+  if (!programmer) {
+    handle = open_programmer(NULL);
+  } else {
+    count = usb_list_devices(&devices);
+    if (count < 0) return NULL;
+    for (i = 0; i < count; i++)
+      if (!strcmp(devices[i].path, programmer)) break;
+    if (i < count) {
+      handle = open_programmer(programmer);
+    } else {
+      // The serial number is only known once a programmer is opened
+      for (i = 0; i < count && !handle; i++) {
+        handle = open_programmer(devices[i].path);
+        if (handle && !serial_matches(handle->serial_number, programmer)) {
+          minipro_close(handle);
+          handle = NULL;
+        }
+      }
+      if (!handle) minipro_log("Programmer %s not found!\n", programmer);
+    }
+    free(devices);
+  }
+  if (!handle) return NULL;
 
   if (device_name != NULL) {
     handle->device = get_device_by_name(handle, device_name);
     if (handle->device == NULL) {
       minipro_close(handle);
-      fprintf(stderr, "Device %s not found!\n", device_name);
+      minipro_log("Device %s not found!\n", device_name);
       return NULL;
     }
   }
@@ -169,7 +205,22 @@ void minipro_close(minipro_handle_t *handle) {
   free(handle);
 }
 
-// Reset TL866 device
+// Check whether a programmer is attached at a USB path
+static int programmer_attached(const char *path) {
+  usb_device_t *devices;
+  int i, count = usb_list_devices(&devices);
+
+  if (count < 0) return 0;
+  for (i = 0; i < count; i++)
+    if (!strcmp(devices[i].path, path)) break;
+  free(devices);
+  return i < count;
+}
+
+/*
+ Reset TL866 device. The programmer is followed by its USB path, so that
+ the other programmers attached can keep on working meanwhile.
+ */
 int minipro_reset(minipro_handle_t *handle) {
   uint8_t msg[8];
   uint8_t version = handle->version;
@@ -184,7 +235,7 @@ int minipro_reset(minipro_handle_t *handle) {
   do {
     wait--;
     usleep(100000);
-  } while (minipro_get_devices_count(version) && wait);
+  } while (programmer_attached(handle->path) && wait);
   if (!wait) {
     return EXIT_FAILURE;
   }
@@ -193,7 +244,7 @@ int minipro_reset(minipro_handle_t *handle) {
   do {
     wait--;
     usleep(100000);
-  } while (!minipro_get_devices_count(version) && wait);
+  } while (!programmer_attached(handle->path) && wait);
   if (!wait) {
     return EXIT_FAILURE;
   }
@@ -216,25 +267,25 @@ void minipro_print_system_info(minipro_handle_t *handle) {
   }
 
   if (handle->status == MP_STATUS_BOOTLOADER) {
-    fprintf(stderr, "Found %s ", handle->model);
+    minipro_log("Found %s ", handle->model);
     return;
   }
 
-  fprintf(stderr, "Found %s %s (%#03x)\n", handle->model, handle->firmware_str,
-          handle->firmware);
+  minipro_log("Found %s %s (%#03x)\n", handle->model, handle->firmware_str,
+              handle->firmware);
 
   if (handle->firmware < expected_firmware) {
-    fprintf(stderr, "Warning: Firmware is out of date.\n");
-    fprintf(stderr, "  Expected  %s (%#03x)\n", expected_firmware_str,
-            expected_firmware);
-    fprintf(stderr, "  Found     %s (%#03x)\n", handle->firmware_str,
-            handle->firmware);
+    minipro_log("Warning: Firmware is out of date.\n");
+    minipro_log("  Expected  %s (%#03x)\n", expected_firmware_str,
+                expected_firmware);
+    minipro_log("  Found     %s (%#03x)\n", handle->firmware_str,
+                handle->firmware);
   } else if (handle->firmware > expected_firmware) {
-    fprintf(stderr, "Warning: Firmware is newer than expected.\n");
-    fprintf(stderr, "  Expected  %s (%#03x)\n", expected_firmware_str,
-            expected_firmware);
-    fprintf(stderr, "  Found     %s (%#03x)\n", handle->firmware_str,
-            handle->firmware);
+    minipro_log("Warning: Firmware is newer than expected.\n");
+    minipro_log("  Expected  %s (%#03x)\n", expected_firmware_str,
+                expected_firmware);
+    minipro_log("  Found     %s (%#03x)\n", handle->firmware_str,
+                handle->firmware);
   }
   // fprintf(stderr, "Device code:%s\nSerial code:%s\n", handle->device_code,
   // handle->serial_number);
@@ -267,8 +318,7 @@ int minipro_get_system_info(minipro_handle_t *handle,
       info->hardware_version = msg[39];
       break;
     default:
-      minipro_close(handle);
-      fprintf(stderr, "Unknown Device!");
+      minipro_log("Unknown Device!\n");
       return EXIT_FAILURE;
   }
   return EXIT_SUCCESS;
@@ -280,7 +330,7 @@ int minipro_begin_transaction(minipro_handle_t *handle) {
   if (handle->minipro_begin_transaction) {
     return handle->minipro_begin_transaction(handle);
   } else {
-    fprintf(stderr, "%s: begin_transaction not implemented\n", handle->model);
+    minipro_log("%s: begin_transaction not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -291,7 +341,7 @@ int minipro_end_transaction(minipro_handle_t *handle) {
   if (handle->minipro_end_transaction) {
     return handle->minipro_end_transaction(handle);
   } else {
-    fprintf(stderr, "%s: end_transaction not implemented\n", handle->model);
+    minipro_log("%s: end_transaction not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -302,7 +352,7 @@ int minipro_protect_off(minipro_handle_t *handle) {
   if (handle->minipro_protect_off) {
     return handle->minipro_protect_off(handle);
   } else {
-    fprintf(stderr, "%s: protect_off not implemented\n", handle->model);
+    minipro_log("%s: protect_off not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -313,7 +363,7 @@ int minipro_protect_on(minipro_handle_t *handle) {
   if (handle->minipro_protect_on) {
     return handle->minipro_protect_on(handle);
   } else {
-    fprintf(stderr, "%s: protect_on not implemented\n", handle->model);
+    minipro_log("%s: protect_on not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -329,7 +379,7 @@ int minipro_get_ovc_status(minipro_handle_t *handle, minipro_status_t *status,
   if (handle->minipro_get_ovc_status) {
     return handle->minipro_get_ovc_status(handle, status, ovc);
   }
-  fprintf(stderr, "%s: get_ovc_status not implemented\n", handle->model);
+  minipro_log("%s: get_ovc_status not implemented\n", handle->model);
   return EXIT_FAILURE;
 }
 
@@ -339,7 +389,7 @@ int minipro_erase(minipro_handle_t *handle) {
   if (handle->minipro_erase) {
     return handle->minipro_erase(handle);
   }
-  fprintf(stderr, "%s: erase not implemented\n", handle->model);
+  minipro_log("%s: erase not implemented\n", handle->model);
   return EXIT_FAILURE;
 }
 
@@ -350,7 +400,7 @@ int minipro_read_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
   if (handle->minipro_read_block) {
     return handle->minipro_read_block(handle, type, addr, buffer, len);
   } else {
-    fprintf(stderr, "%s: read_block not implemented\n", handle->model);
+    minipro_log("%s: read_block not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -362,7 +412,7 @@ int minipro_write_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
   if (handle->minipro_write_block) {
     return handle->minipro_write_block(handle, type, addr, buffer, len);
   } else {
-    fprintf(stderr, "%s: write_block not implemented\n", handle->model);
+    minipro_log("%s: write_block not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -375,7 +425,7 @@ int minipro_get_chip_id(minipro_handle_t *handle, uint8_t *type,
   if (handle->minipro_get_chip_id) {
     return handle->minipro_get_chip_id(handle, type, device_id);
   }
-  fprintf(stderr, "%s: get_chip_id not implemented\n", handle->model);
+  minipro_log("%s: get_chip_id not implemented\n", handle->model);
   return EXIT_FAILURE;
 }
 
@@ -385,7 +435,7 @@ int minipro_spi_autodetect(minipro_handle_t *handle, uint8_t type,
   if (handle->minipro_spi_autodetect) {
     return handle->minipro_spi_autodetect(handle, type, device_id);
   }
-  fprintf(stderr, "%s: spi_autodetect not implemented\n", handle->model);
+  minipro_log("%s: spi_autodetect not implemented\n", handle->model);
   return EXIT_FAILURE;
 }
 
@@ -397,7 +447,7 @@ int minipro_read_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
     return handle->minipro_read_fuses(handle, type, length, items_count,
                                       buffer);
   } else {
-    fprintf(stderr, "%s: read_fuses not implemented\n", handle->model);
+    minipro_log("%s: read_fuses not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -410,33 +460,96 @@ int minipro_write_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
     return handle->minipro_write_fuses(handle, type, length, items_count,
                                        buffer);
   } else {
-    fprintf(stderr, "%s: write_fuses not implemented\n", handle->model);
+    minipro_log("%s: write_fuses not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
 
-int minipro_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                            uint8_t row, size_t size) {
+int minipro_write_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                             size_t count, jedec_row_cb done, void *context) {
   assert(handle != NULL);
-  if (handle->minipro_write_jedec_row) {
-    return handle->minipro_write_jedec_row(handle, buffer, row, size);
+  if (handle->minipro_write_jedec_rows) {
+    return handle->minipro_write_jedec_rows(handle, rows, count, done,
+                                            context);
   } else {
-    fprintf(stderr, "%s: write jedec row not implemented\n", handle->model);
+    minipro_log("%s: write jedec row not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
 
-int minipro_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                           uint8_t row, size_t size) {
+int minipro_read_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                            size_t count, jedec_row_cb done, void *context) {
   assert(handle != NULL);
-  if (handle->minipro_write_jedec_row) {
-    return handle->minipro_read_jedec_row(handle, buffer, row, size);
+  if (handle->minipro_read_jedec_rows) {
+    return handle->minipro_read_jedec_rows(handle, rows, count, done,
+                                           context);
   } else {
-    fprintf(stderr, "%s: read jedec row not implemented\n", handle->model);
+    minipro_log("%s: read jedec row not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
 
+// Rows sent before waiting for the first response. The programmers handle
+// the messages one at a time, a few queued ones are enough to hide the USB
+// round trips.
+#define JEDEC_QUEUE_DEPTH 4
+
+// Rows of a batch and the caller's callback
+typedef struct jedec_batch {
+  jedec_row_t *rows;
+  msg_exchange_t *exchanges;
+  jedec_row_cb done;
+  void *context;
+} jedec_batch_t;
+
+static void jedec_row_done(void *context, size_t index) {
+  jedec_batch_t *batch = context;
+  if (batch->exchanges[index].response)
+    memcpy(batch->rows[index].buffer, batch->exchanges[index].response,
+           batch->rows[index].size / 8 + 1);
+  if (batch->done) batch->done(batch->context, index);
+}
+
+/*
+ Send the read or write messages of PLD rows queued, built by the model
+ specific 'build'. A read row gets a response of up to 'response_size'
+ bytes, the row data at its start; only a reply short of the row is an
+ error.
+ */
+int minipro_jedec_batch(minipro_handle_t *handle, jedec_row_t *rows,
+                        size_t count, int write, size_t response_size,
+                        jedec_msg_cb build, jedec_row_cb done, void *context) {
+  jedec_batch_t batch = {rows, NULL, done, context};
+  size_t i, size = 64 + response_size;
+  uint8_t *msg, *msgs;
+  int ret;
+
+  batch.exchanges = calloc(count, sizeof(msg_exchange_t));
+  msgs = calloc(count, size);
+  if (!batch.exchanges || !msgs) {
+    free(batch.exchanges);
+    free(msgs);
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < count; i++) {
+    msg = msgs + i * size;
+    batch.exchanges[i].command = msg;
+    batch.exchanges[i].command_size = build(handle, &rows[i], write, msg);
+    if (!write) {
+      batch.exchanges[i].response = msg + 64;
+      batch.exchanges[i].response_size = response_size;
+      batch.exchanges[i].response_min = rows[i].size / 8 + 1;
+    }
+  }
+  ret = msg_batch(handle->usb_handle, batch.exchanges, count,
+                  JEDEC_QUEUE_DEPTH, jedec_row_done, &batch);
+  free(batch.exchanges);
+  free(msgs);
+  return ret;
+}
+
 // Unlocking the TSOP48 adapter.
 int minipro_unlock_tsop48(minipro_handle_t *handle, uint8_t *status) {
   assert(handle != NULL);
@@ -444,7 +557,7 @@ int minipro_unlock_tsop48(minipro_handle_t *handle, uint8_t *status) {
   if (handle->minipro_unlock_tsop48) {
     return handle->minipro_unlock_tsop48(handle, status);
   }
-  fprintf(stderr, "%s: unlock_tsop48 not implemented\n", handle->model);
+  minipro_log("%s: unlock_tsop48 not implemented\n", handle->model);
   return EXIT_FAILURE;
 }
 
@@ -455,7 +568,7 @@ int minipro_hardware_check(minipro_handle_t *handle) {
   if (handle->minipro_hardware_check) {
     return handle->minipro_hardware_check(handle);
   } else {
-    fprintf(stderr, "%s: hardware_check not implemented\n", handle->model);
+    minipro_log("%s: hardware_check not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
@@ -465,18 +578,82 @@ int minipro_firmware_update(minipro_handle_t *handle, const char *firmware) {
   if (handle->minipro_firmware_update) {
     return handle->minipro_firmware_update(handle, firmware);
   } else {
-    fprintf(stderr, "%s: firmware update not implemented\n", handle->model);
+    minipro_log("%s: firmware update not implemented\n", handle->model);
   }
   return EXIT_FAILURE;
 }
 
+// Pins of the selected device expected to make contact and those which don't
+static int pin_contact(minipro_handle_t *handle, uint64_t *expected,
+                       uint64_t *missing) {
+  uint64_t contact;
+
+  assert(handle != NULL);
+  if (!handle->minipro_pin_contact) {
+    minipro_log("%s: pin test not implemented\n", handle->model);
+    return EXIT_FAILURE;
+  }
+  if (get_pin_mask(handle->device->opts8 & 0xFF, expected)) {
+    minipro_log("No pin map for %s!\n", handle->device->name);
+    return EXIT_FAILURE;
+  }
+  if (handle->minipro_pin_contact(handle, &contact)) return EXIT_FAILURE;
+  *missing = *expected & ~contact;
+  return EXIT_SUCCESS;
+}
+
 // Pin contact test
 int minipro_pin_test(minipro_handle_t *handle) {
-	  assert(handle != NULL);
-	  if (handle->minipro_pin_test) {
-	    return handle->minipro_pin_test(handle);
-	  } else {
-	    fprintf(stderr, "%s: pin test not implemented\n", handle->model);
-	  }
-	  return EXIT_FAILURE;
+  uint64_t expected, missing;
+
+  if (pin_contact(handle, &expected, &missing)) return EXIT_FAILURE;
+  if (!missing) {
+    minipro_log("Pin test passed.\n");
+    return EXIT_SUCCESS;
+  }
+  if (missing == expected) {
+    minipro_log("No chip found in the ZIF socket!\n");
+    return EXIT_FAILURE;
+  }
+  for (uint32_t i = 0; i < 40; i++) {
+    if (missing & (1ULL << i))
+      minipro_log("Bad contact on pin:%u\n", i + 1);
+  }
+  return EXIT_FAILURE;
+}
+
+/*
+ Tell whether a chip is seated, any of its pins making contact. Without
+ a pin contact test, as on the TL866A/CS or through ICSP, the chip ID is
+ read instead: it reads as all zeros or all ones without a chip.
+ */
+int minipro_chip_present(minipro_handle_t *handle, int *present) {
+  device_t *device = handle->device;
+  uint64_t expected = 0, missing;
+  uint32_t id, ones;
+  uint8_t type;
+
+  if (handle->minipro_pin_contact && !handle->icsp &&
+      !(handle->cmdopts && handle->cmdopts->icsp))
+    get_pin_mask(device->opts8 & 0xFF, &expected);
+  if (expected) {
+    if (pin_contact(handle, &expected, &missing)) return EXIT_FAILURE;
+    *present = missing != expected;
+    return EXIT_SUCCESS;
+  }
+
+  if (!handle->minipro_get_chip_id || !device->chip_id_bytes_count ||
+      !device->chip_id || !(device->opts4 & MP_ID_MASK)) {
+    minipro_log("Chip presence can't be detected for %s.\n", device->name);
+    return EXIT_FAILURE;
+  }
+  if (minipro_begin_transaction(handle) ||
+      minipro_get_chip_id(handle, &type, &id) ||
+      minipro_end_transaction(handle))
+    return EXIT_FAILURE;
+  ones = device->chip_id_bytes_count < 4
+             ? (1U << (device->chip_id_bytes_count * 8)) - 1
+             : 0xFFFFFFFF;
+  *present = id && (id & ones) != ones;
+  return EXIT_SUCCESS;
 }
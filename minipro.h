@@ -18,8 +18,14 @@
 #ifndef __MINIPRO_H
 #define __MINIPRO_H
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "checksum.h"
+#include "jedec.h"
+#include "libminipro.h"
+#include "pipeline.h"
+#include "usb.h"
 
 #define MP_TL866A 1
 #define MP_TL866CS 2
@@ -128,6 +134,10 @@ typedef struct minipro_status {
   uint32_t c2;
 } minipro_status_t;
 
+struct shared_image;
+struct serial;
+struct serial_unit;
+
 typedef struct cmdopts_s {
   char *filename;
   char *device;
@@ -145,14 +155,35 @@ typedef struct cmdopts_s {
   uint8_t idcheck_continue;
   uint8_t idcheck_only;
   uint8_t pincheck;
+  uint8_t pincheck_skip;
+  uint8_t checksum;
   uint8_t is_pipe;
+  uint8_t version;   // Database selected with -q, 0 to ask the programmer
+  char *programmer;  // Serial number or USB path given with --programmer
+  uint8_t gang;      // Run the job on several programmers at once
+  uint8_t loop;      // Run the job again each time the chip is swapped
+  char *daemon;      // Socket to serve jobs on with --daemon
+  struct serial *serial;  // Fields given a value of their own per chip
+  pipeline_t pipeline;
+  struct shared_image *image;  // File loaded once for all gang stations
 } cmdopts_t;
 
+// A row of a PLD fuse map, 'size' bits long
+typedef struct jedec_row {
+  uint8_t *buffer;
+  uint8_t row;
+  size_t size;
+} jedec_row_t;
+
+// Called in order as each row of a batch is transferred
+typedef void (*jedec_row_cb)(void *context, size_t index);
+
 typedef struct minipro_handle {
   char *model;
   char firmware_str[16];
   char device_code[9];
   char serial_number[25];
+  char path[USB_PATH_SIZE];  // USB path, kept across resets
   uint32_t firmware;
   uint8_t status;
   uint8_t version;
@@ -162,6 +193,8 @@ typedef struct minipro_handle {
 
   void *usb_handle;
   cmdopts_t *cmdopts;
+  struct serial_unit *serial_unit;  // Values for the chip being written
+  struct report_phase *phase;       // Phase being reported, NULL if none
 
   int (*minipro_begin_transaction)(struct minipro_handle *);
   int (*minipro_end_transaction)(struct minipro_handle *);
@@ -182,14 +215,19 @@ typedef struct minipro_handle {
   int (*minipro_erase)(struct minipro_handle *);
   int (*minipro_unlock_tsop48)(struct minipro_handle *, uint8_t *);
   int (*minipro_hardware_check)(struct minipro_handle *);
-  int (*minipro_write_jedec_row)(struct minipro_handle *, uint8_t *, uint8_t,
-                                 size_t);
-  int (*minipro_read_jedec_row)(struct minipro_handle *, uint8_t *, uint8_t,
-                                size_t);
+  int (*minipro_write_jedec_rows)(struct minipro_handle *, jedec_row_t *,
+                                  size_t, jedec_row_cb, void *);
+  int (*minipro_read_jedec_rows)(struct minipro_handle *, jedec_row_t *,
+                                 size_t, jedec_row_cb, void *);
   int (*minipro_firmware_update)(struct minipro_handle *, const char *);
-  int (*minipro_pin_test)(struct minipro_handle *);
+  int (*minipro_pin_contact)(struct minipro_handle *, uint64_t *);
 } minipro_handle_t;
 
+// Build the read or write message of a PLD row in a 64 byte buffer,
+// returning its size
+typedef size_t (*jedec_msg_cb)(minipro_handle_t *handle, jedec_row_t *row,
+                               int write, uint8_t *msg);
+
 typedef struct minipro_report_info {
   uint8_t echo;
   uint8_t device_status;
@@ -211,7 +249,6 @@ uint32_t load_int(uint8_t *buffer, size_t size, uint8_t endianness);
 int minipro_get_system_info(minipro_handle_t *handle,
                             minipro_report_info_t *info);
 void minipro_print_system_info(minipro_handle_t *handle);
-uint32_t crc32(uint8_t *data, size_t size, uint32_t initial);
 int minipro_reset(minipro_handle_t *handle);
 int minipro_get_devices_count(uint8_t version);
 
@@ -223,7 +260,8 @@ int minipro_get_devices_count(uint8_t version);
  * the higher logic routines to exit cleanly leaving the device in a clean
  * state.
  */
-minipro_handle_t *minipro_open(const char *device_name);
+minipro_handle_t *minipro_open(const char *programmer,
+                               const char *device_name);
 void minipro_close(minipro_handle_t *handle);
 int minipro_begin_transaction(minipro_handle_t *handle);
 int minipro_end_transaction(minipro_handle_t *handle);
@@ -243,14 +281,44 @@ int minipro_read_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
                        uint8_t items_count, uint8_t *buffer);
 int minipro_write_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
                         uint8_t items_count, uint8_t *buffer);
-int minipro_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                            uint8_t row, size_t size);
-int minipro_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                           uint8_t row, size_t size);
+int minipro_write_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                             size_t count, jedec_row_cb done, void *context);
+int minipro_read_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                            size_t count, jedec_row_cb done, void *context);
 int minipro_erase(minipro_handle_t *handle);
 int minipro_unlock_tsop48(minipro_handle_t *handle, uint8_t *status);
 int minipro_hardware_check(minipro_handle_t *handle);
 int minipro_firmware_update(minipro_handle_t *handle, const char *firmware);
 int minipro_pin_test(minipro_handle_t *handle);
+int minipro_chip_present(minipro_handle_t *handle, int *present);
+int minipro_jedec_batch(minipro_handle_t *handle, jedec_row_t *rows,
+                        size_t count, int write, size_t response_size,
+                        jedec_msg_cb build, jedec_row_cb done, void *context);
+
+// Output of the calling thread, stderr unless callbacks are set
+void minipro_set_output(mp_progress_cb progress, mp_log_cb log,
+                        void *context);
+void minipro_log(const char *fmt, ...);
+void minipro_progress(const char *operation, size_t done, size_t total);
+void minipro_progress_end(const char *operation, size_t total,
+                          const char *result);
+
+// Programming operations
+extern pthread_mutex_t database_lock;
+void build_device_tables(minipro_handle_t *handle);
+int is_pld(uint8_t protocol_id);
+int erase_device(minipro_handle_t *handle);
+void copy_gaps(uint8_t *dst, uint8_t *src, size_t size,
+               segment_list_t *segments);
+int compare_memory(uint8_t *s1, uint8_t *s2, size_t size, uint8_t *c1,
+                   uint8_t *c2);
+int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
+                  size_t size, segment_list_t *segments, pipeline_t *pipeline,
+                  checksum_t *checksum);
+int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
+                   size_t size, segment_list_t *segments,
+                   checksum_t *checksum);
+int read_jedec(minipro_handle_t *handle, jedec_t *jedec);
+int write_jedec(minipro_handle_t *handle, jedec_t *jedec);
 
 #endif
@@ -0,0 +1,459 @@
+/*
+ * pipeline.c - Image transform pipeline between the file parsers/writers
+ * and the chip memory.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "pipeline.h"
+
+#define MAX_ADDRESS 0x100000000LL
+#define MAX_ARGS 3
+
+// Parse a colon separated list of numbers
+static int parse_args(char *args, int64_t *values) {
+  char *p_end;
+  int count = 0;
+
+  if (!args) return 0;
+  while (count < MAX_ARGS) {
+    errno = 0;
+    values[count++] = strtoll(args, &p_end, 0);
+    if (p_end == args || errno) return -1;
+    if (*p_end == '\0') return count;
+    if (*p_end != ':') return -1;
+    args = p_end + 1;
+  }
+  return -1;
+}
+
+static int is_name(char *spec, size_t len, const char *name) {
+  return len == strlen(name) && !strncasecmp(spec, name, len);
+}
+
+// Parse a transform specification and append it to the pipeline.
+// The syntax is name[=arg[:arg...]]
+int pipeline_parse(pipeline_t *pipeline, char *spec) {
+  int64_t v[MAX_ARGS];
+  stage_t stage;
+
+  char *args = strchr(spec, '=');
+  size_t len = args ? (size_t)(args - spec) : strlen(spec);
+  int n = parse_args(args ? args + 1 : NULL, v);
+  if (n < 0) goto bad;
+
+  memset(&stage, 0, sizeof(stage));
+  if (is_name(spec, len, "obs")) {
+    // Output block size is a writer setting, not a stage
+    if (n != 1 || v[0] < 1 || v[0] > MAX_RECORD_SIZE) goto bad;
+    pipeline->record_size = v[0];
+    return EXIT_SUCCESS;
+  } else if (is_name(spec, len, "offset")) {
+    if (n != 1 || v[0] <= -MAX_ADDRESS || v[0] >= MAX_ADDRESS) goto bad;
+    stage.type = STAGE_OFFSET;
+    stage.offset = v[0];
+  } else if (is_name(spec, len, "crop")) {
+    if (n != 2 || v[0] < 0 || v[1] <= v[0] || v[1] >= MAX_ADDRESS) goto bad;
+    stage.type = STAGE_CROP;
+    stage.start = v[0];
+    stage.end = v[1];
+  } else if (is_name(spec, len, "fill")) {
+    if ((n != 1 && n != 3) || v[0] < 0 || v[0] > 0xff) goto bad;
+    if (n == 3 && (v[1] < 0 || v[2] <= v[1] || v[2] >= MAX_ADDRESS))
+      goto bad;
+    stage.type = STAGE_FILL;
+    stage.value = v[0];
+    if (n == 3) {
+      stage.start = v[1];
+      stage.end = v[2];
+    }
+  } else if (is_name(spec, len, "unfill")) {
+    if (n < 1 || n > 2 || v[0] < 0 || v[0] > 0xff) goto bad;
+    if (n == 2 && (v[1] < 1 || v[1] >= MAX_ADDRESS)) goto bad;
+    stage.type = STAGE_UNFILL;
+    stage.value = v[0];
+    stage.count = n == 2 ? v[1] : 1;
+  } else if (is_name(spec, len, "swap")) {
+    if (n > 1) goto bad;
+    stage.type = STAGE_SWAP;
+    stage.count = n ? v[0] : 2;
+    if (stage.count != 2 && stage.count != 4 && stage.count != 8) goto bad;
+  } else if (is_name(spec, len, "split")) {
+    if (n < 2 || v[0] < 2 || v[0] > PIPELINE_CHUNK || v[1] < 0 ||
+        v[1] >= MAX_ADDRESS)
+      goto bad;
+    stage.type = STAGE_SPLIT;
+    stage.count = v[0];
+    stage.start = v[1];
+    stage.width = n == 3 ? v[2] : 1;
+    if (n == 3 && (v[2] < 1 || v[2] >= v[0])) goto bad;
+  } else
+    goto bad;
+
+  if (pipeline->count == MAX_STAGES) {
+    fprintf(stderr, "Too many transforms (maximum %u).\n", MAX_STAGES);
+    return EXIT_FAILURE;
+  }
+  pipeline->stage[pipeline->count++] = stage;
+  return EXIT_SUCCESS;
+
+bad:
+  fprintf(stderr, "Invalid transform: %s\n", spec);
+  return EXIT_FAILURE;
+}
+
+// Reset the stage states and connect the pipeline to a sink.
+// The size is the default range of the fill stage.
+void pipeline_begin(pipeline_t *pipeline, size_t size, pipeline_sink_t sink,
+                    void *context) {
+  size_t i;
+  for (i = 0; i < pipeline->count; i++) {
+    pipeline->stage[i].position = pipeline->stage[i].start;
+    pipeline->stage[i].pending = 0;
+  }
+  pipeline->size = size;
+  pipeline->sink = sink;
+  pipeline->context = context;
+}
+
+static int stage_put(pipeline_t *pipeline, size_t index, int64_t address,
+                     uint8_t *data, size_t size);
+
+// Push a run of identical bytes to a stage
+static int put_value(pipeline_t *pipeline, size_t index, int64_t address,
+                     uint8_t value, size_t size) {
+  uint8_t buffer[PIPELINE_CHUNK];
+  size_t len;
+
+  memset(buffer, value, size < PIPELINE_CHUNK ? size : PIPELINE_CHUNK);
+  while (size) {
+    len = size < PIPELINE_CHUNK ? size : PIPELINE_CHUNK;
+    if (stage_put(pipeline, index, address, buffer, len)) return EXIT_FAILURE;
+    address += len;
+    size -= len;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Fill the gap between the last record and this one
+static int fill_put(pipeline_t *pipeline, size_t index, int64_t address,
+                    uint8_t *data, size_t size) {
+  stage_t *stage = &pipeline->stage[index];
+  int64_t end = stage->end ? stage->end : (int64_t)pipeline->size;
+
+  if (address > stage->position && stage->position < end) {
+    if (put_value(pipeline, index + 1, stage->position, stage->value,
+                  (address < end ? address : end) - stage->position))
+      return EXIT_FAILURE;
+  }
+  if (address + (int64_t)size > stage->position)
+    stage->position = address + size;
+  return stage_put(pipeline, index + 1, address, data, size);
+}
+
+// Drop runs of at least 'count' bytes equal to 'value'.
+// A run touching the end of a record is held back until the next record
+// shows where it ends.
+static int unfill_put(pipeline_t *pipeline, size_t index, int64_t address,
+                      uint8_t *data, size_t size) {
+  stage_t *stage = &pipeline->stage[index];
+  size_t i = 0, j, start = 0, stop = size;
+
+  if (stage->pending) {
+    if (address == stage->pending_address + (int64_t)stage->pending) {
+      while (i < size && data[i] == stage->value) i++;
+      if (i == size) {
+        stage->pending += size;
+        return EXIT_SUCCESS;
+      }
+      if (stage->pending + i >= stage->count)
+        start = i;
+      else if (put_value(pipeline, index + 1, stage->pending_address,
+                         stage->value, stage->pending))
+        return EXIT_FAILURE;
+    } else if (stage->pending < stage->count &&
+               put_value(pipeline, index + 1, stage->pending_address,
+                         stage->value, stage->pending))
+      return EXIT_FAILURE;
+    stage->pending = 0;
+  }
+
+  while (i < size) {
+    if (data[i] != stage->value) {
+      i++;
+      continue;
+    }
+    for (j = i; j < size && data[j] == stage->value; j++)
+      ;
+    if (j == size) {
+      stage->pending_address = address + i;
+      stage->pending = j - i;
+      stop = i;
+      break;
+    }
+    if (j - i >= stage->count) {
+      if (i > start && stage_put(pipeline, index + 1, address + start,
+                                 data + start, i - start))
+        return EXIT_FAILURE;
+      start = j;
+    }
+    i = j;
+  }
+
+  if (stop > start)
+    return stage_put(pipeline, index + 1, address + start, data + start,
+                     stop - start);
+  return EXIT_SUCCESS;
+}
+
+// Swap the bytes of each 'count' wide word.
+// Partial words at the record edges are moved one byte at a time.
+static int swap_put(pipeline_t *pipeline, size_t index, int64_t address,
+                    uint8_t *data, size_t size) {
+  uint8_t buffer[PIPELINE_CHUNK];
+  int64_t mask = pipeline->stage[index].count - 1;
+  int64_t end = address + size;
+  int64_t first = (address + mask) & ~mask;
+  int64_t last = end & ~mask;
+  int64_t a;
+
+  if (first >= last) first = last = end;
+  for (a = address; a < first; a++)
+    if (stage_put(pipeline, index + 1, a ^ mask, &data[a - address], 1))
+      return EXIT_FAILURE;
+  if (last > first) {
+    for (a = first; a < last; a++)
+      buffer[a - first] = data[(a ^ mask) - address];
+    if (stage_put(pipeline, index + 1, first, buffer, last - first))
+      return EXIT_FAILURE;
+  }
+  for (a = last; a < end; a++)
+    if (stage_put(pipeline, index + 1, a ^ mask, &data[a - address], 1))
+      return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+// Keep 'width' bytes out of every 'count' starting at 'start' and pack them.
+// The kept bytes of a record are always contiguous in the output.
+static int split_put(pipeline_t *pipeline, size_t index, int64_t address,
+                     uint8_t *data, size_t size) {
+  uint8_t buffer[PIPELINE_CHUNK];
+  stage_t *stage = &pipeline->stage[index];
+  int64_t a, output = -1;
+  size_t i, len = 0;
+
+  for (i = 0; i < size; i++) {
+    a = address + i - stage->start;
+    if (a < 0 || a % stage->count >= stage->width) continue;
+    if (output < 0) output = a / stage->count * stage->width + a % stage->count;
+    buffer[len++] = data[i];
+  }
+  if (!len) return EXIT_SUCCESS;
+  return stage_put(pipeline, index + 1, output, buffer, len);
+}
+
+static int stage_put(pipeline_t *pipeline, size_t index, int64_t address,
+                     uint8_t *data, size_t size) {
+  stage_t *stage = &pipeline->stage[index];
+  int64_t skip;
+
+  if (index == pipeline->count)
+    return pipeline->sink(pipeline->context, address, data, size);
+
+  switch (stage->type) {
+    case STAGE_OFFSET:
+      address += stage->offset;
+      if (address < 0) {
+        if ((int64_t)size <= -address) return EXIT_SUCCESS;
+        data -= address;
+        size += address;
+        address = 0;
+      }
+      if (address >= MAX_ADDRESS) return EXIT_SUCCESS;
+      if (address + (int64_t)size > MAX_ADDRESS) size = MAX_ADDRESS - address;
+      break;
+    case STAGE_CROP:
+      if (address >= stage->end || address + (int64_t)size <= stage->start)
+        return EXIT_SUCCESS;
+      skip = address < stage->start ? stage->start - address : 0;
+      data += skip;
+      size -= skip;
+      address += skip;
+      if (address + (int64_t)size > stage->end) size = stage->end - address;
+      break;
+    case STAGE_FILL:
+      return fill_put(pipeline, index, address, data, size);
+    case STAGE_UNFILL:
+      return unfill_put(pipeline, index, address, data, size);
+    case STAGE_SWAP:
+      return swap_put(pipeline, index, address, data, size);
+    case STAGE_SPLIT:
+      return split_put(pipeline, index, address, data, size);
+  }
+  return stage_put(pipeline, index + 1, address, data, size);
+}
+
+// Push a record through the pipeline
+int pipeline_put(pipeline_t *pipeline, uint32_t address, uint8_t *data,
+                 size_t size) {
+  int64_t a = address;
+  size_t len;
+
+  if (!pipeline->count)
+    return pipeline->sink(pipeline->context, address, data, size);
+
+  // Feed the stages in chunks so their buffers stay bounded
+  while (size) {
+    len = PIPELINE_CHUNK - (a % PIPELINE_CHUNK);
+    if (len > size) len = size;
+    if (stage_put(pipeline, 0, a, data, len)) return EXIT_FAILURE;
+    a += len;
+    data += len;
+    size -= len;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Flush the data held back by the stages
+int pipeline_end(pipeline_t *pipeline) {
+  size_t i;
+  int64_t end;
+
+  for (i = 0; i < pipeline->count; i++) {
+    stage_t *stage = &pipeline->stage[i];
+    switch (stage->type) {
+      case STAGE_FILL:
+        end = stage->end ? stage->end : (int64_t)pipeline->size;
+        if (stage->position < end &&
+            put_value(pipeline, i + 1, stage->position, stage->value,
+                      end - stage->position))
+          return EXIT_FAILURE;
+        stage->position = end;
+        break;
+      case STAGE_UNFILL:
+        if (stage->pending && stage->pending < stage->count &&
+            put_value(pipeline, i + 1, stage->pending_address, stage->value,
+                      stage->pending))
+          return EXIT_FAILURE;
+        stage->pending = 0;
+        break;
+      default:
+        break;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// Copy a record into a memory image.
+// Data beyond the image is dropped but its end address is recorded.
+int image_sink(void *context, uint32_t address, uint8_t *data, size_t size) {
+  image_t *image = context;
+  size_t end = (size_t)address + size;
+
+  if (end > image->end) image->end = end;
+  if (address >= image->size) return EXIT_SUCCESS;
+  if (end > image->size) size = image->size - address;
+  memcpy(image->data + address, data, size);
+  if (image->segments) add_segment(image->segments, address, size);
+  return EXIT_SUCCESS;
+}
+
+// Write a record to a raw binary file.
+// Gaps are padded with 0xFF and the file is only seeked when going back.
+int bin_writer_put(void *context, uint32_t address, uint8_t *data,
+                   size_t size) {
+  bin_writer_t *writer = context;
+  uint8_t buffer[PIPELINE_CHUNK];
+  size_t len;
+
+  if (address != writer->position) {
+    size_t position = address <= writer->end ? address : writer->end;
+    if (position != writer->position &&
+        fseek(writer->file, position, SEEK_SET)) {
+      fprintf(stderr, "Can't seek in the output file.\n");
+      return EXIT_FAILURE;
+    }
+    writer->position = position;
+  }
+
+  memset(buffer, 0xFF, sizeof(buffer));
+  while (writer->position < address) {
+    len = address - writer->position;
+    if (len > sizeof(buffer)) len = sizeof(buffer);
+    if (fwrite(buffer, 1, len, writer->file) != len) goto error;
+    writer->position += len;
+  }
+
+  if (fwrite(data, 1, size, writer->file) != size) goto error;
+  writer->position += size;
+  if (writer->position > writer->end) writer->end = writer->position;
+  return EXIT_SUCCESS;
+
+error:
+  fprintf(stderr, "Error writing the output file.\n");
+  return EXIT_FAILURE;
+}
+
+// Add an address range to a segment list, merging overlapping or adjacent
+// ranges. If the list overflows it falls back to the whole image.
+void add_segment(segment_list_t *list, uint32_t address, uint32_t size) {
+  size_t i, j;
+  uint32_t end = address + size;
+
+  if (!size || list->overflow) return;
+  for (i = 0; i < list->count; i++) {
+    segment_t *s = &list->segment[i];
+    if (address <= s->address + s->size && end >= s->address) {
+      // Grow this segment and absorb the ones it now touches
+      if (s->address < address) address = s->address;
+      if (s->address + s->size > end) end = s->address + s->size;
+      for (j = i + 1; j < list->count; j++)
+        list->segment[j - 1] = list->segment[j];
+      list->count--;
+      add_segment(list, address, end - address);
+      return;
+    }
+  }
+
+  if (list->count == MAX_SEGMENTS) {
+    list->count = 0;
+    list->overflow = 1;
+    return;
+  }
+
+  // Keep the list sorted by address
+  for (i = list->count; i > 0 && list->segment[i - 1].address > address; i--)
+    list->segment[i] = list->segment[i - 1];
+  list->segment[i].address = address;
+  list->segment[i].size = size;
+  list->count++;
+}
+
+// Check if an address range overlaps any segment of the list
+int in_segments(segment_list_t *list, uint32_t address, size_t size) {
+  size_t i;
+  if (!list || !list->count) return 1;
+  for (i = 0; i < list->count; i++) {
+    if (address < list->segment[i].address + list->segment[i].size &&
+        address + size > list->segment[i].address)
+      return 1;
+  }
+  return 0;
+}
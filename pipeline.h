@@ -0,0 +1,110 @@
+/*
+ * pipeline.h - Definitions and declarations for the image transform
+ * pipeline.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MAX_SEGMENTS 64
+#define MAX_STAGES 16
+#define PIPELINE_CHUNK 4096
+#define MAX_RECORD_SIZE 250
+
+// Populated address ranges of a sparse image.
+// An empty list means the whole image is populated.
+typedef struct segment {
+  uint32_t address;
+  uint32_t size;
+} segment_t;
+
+typedef struct segment_list {
+  size_t count;
+  uint8_t overflow;
+  segment_t segment[MAX_SEGMENTS];
+} segment_list_t;
+
+// Receives the records coming out of the last stage
+typedef int (*pipeline_sink_t)(void *context, uint32_t address, uint8_t *data,
+                               size_t size);
+
+typedef enum {
+  STAGE_OFFSET = 0,
+  STAGE_CROP,
+  STAGE_FILL,
+  STAGE_UNFILL,
+  STAGE_SWAP,
+  STAGE_SPLIT
+} stage_type_t;
+
+typedef struct stage {
+  stage_type_t type;
+  uint8_t value;
+  int64_t offset;
+  uint32_t start;
+  uint32_t end;
+  uint32_t count;
+  uint32_t width;
+
+  // Runtime state
+  int64_t position;
+  int64_t pending_address;
+  size_t pending;
+} stage_t;
+
+typedef struct pipeline {
+  size_t count;
+  stage_t stage[MAX_STAGES];
+  size_t record_size;
+
+  size_t size;
+  pipeline_sink_t sink;
+  void *context;
+} pipeline_t;
+
+// A chip sized memory image used as a pipeline sink
+typedef struct image {
+  uint8_t *data;
+  size_t size;
+  size_t end;
+  segment_list_t *segments;
+} image_t;
+
+// A raw binary file used as a pipeline sink
+typedef struct bin_writer {
+  FILE *file;
+  size_t position;
+  size_t end;
+} bin_writer_t;
+
+int pipeline_parse(pipeline_t *pipeline, char *spec);
+void pipeline_begin(pipeline_t *pipeline, size_t size, pipeline_sink_t sink,
+                    void *context);
+int pipeline_put(pipeline_t *pipeline, uint32_t address, uint8_t *data,
+                 size_t size);
+int pipeline_end(pipeline_t *pipeline);
+
+int image_sink(void *context, uint32_t address, uint8_t *data, size_t size);
+int bin_writer_put(void *context, uint32_t address, uint8_t *data,
+                   size_t size);
+
+void add_segment(segment_list_t *list, uint32_t address, uint32_t size);
+int in_segments(segment_list_t *list, uint32_t address, size_t size);
+
+#endif
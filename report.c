@@ -0,0 +1,167 @@
+/*
+ * report.c - JSON lines describing each phase of a job.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+#include "minipro.h"
+#include "report.h"
+
+/*
+ One event is written per phase, with its monotonic start and end times
+ in seconds, the bytes and blocks transferred, the USB transfers and
+ retries it took and the CRC32 of its data. The gang stations share the
+ file, so a line is written at once under the lock.
+ */
+static FILE *report_file;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Send the events to a file, NULL to turn them off
+void report_open(FILE *file) {
+  report_file = file;
+}
+
+int report_enabled(void) {
+  return report_file != NULL;
+}
+
+/*
+ Print a string as JSON, null for NULL. The USB descriptors are not
+ guaranteed to be UTF-8, so bytes above 0x7F are escaped as the Latin-1
+ characters they would be, which keeps the line valid JSON.
+ */
+void report_string(FILE *file, const char *s) {
+  const uint8_t *c = (const uint8_t *)s;
+
+  if (!s) {
+    fputs("null", file);
+    return;
+  }
+  fputc('"', file);
+  for (; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(file, "\\%c", *c);
+    else if (*c < 0x20 || *c > 0x7F)
+      fprintf(file, "\\u%04x", *c);
+    else
+      fputc(*c, file);
+  }
+  fputc('"', file);
+}
+
+// Open a JSON object on a line of its own, NULL when the events are off
+FILE *report_line_begin(void) {
+  if (!report_file) return NULL;
+  pthread_mutex_lock(&report_lock);
+  fputc('{', report_file);
+  return report_file;
+}
+
+// Close the object of report_line_begin()
+void report_line_end(void) {
+  fputs("}\n", report_file);
+  fflush(report_file);
+  pthread_mutex_unlock(&report_lock);
+}
+
+static double seconds(struct timespec *time) {
+  return time->tv_sec + time->tv_nsec / 1e9;
+}
+
+void report_begin(minipro_handle_t *handle, report_phase_t *phase,
+                  const char *name) {
+  memset(phase, 0, sizeof(report_phase_t));
+  if (!report_file) return;
+  phase->name = name;
+  phase->crc32 = 0xFFFFFFFF;
+  // The open phase has no programmer yet, it counts from zero
+  if (handle) {
+    usb_get_counters(handle->usb_handle, &phase->counters);
+    handle->phase = phase;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &phase->start);
+}
+
+// Account a block transferred by the phase running on a programmer
+void report_data(minipro_handle_t *handle, const uint8_t *data,
+                 size_t size) {
+  report_phase_t *phase = handle->phase;
+
+  if (!phase) return;
+  phase->bytes += size;
+  phase->blocks++;
+  phase->crc32 = crc32_update(phase->crc32, data, size);
+}
+
+void report_chip_id(minipro_handle_t *handle, uint32_t chip_id,
+                    uint32_t expected_id) {
+  report_phase_t *phase = handle->phase;
+
+  if (!phase) return;
+  phase->has_id = 1;
+  phase->chip_id = chip_id;
+  phase->expected_id = expected_id;
+}
+
+// Write the event of a phase, passing its result through
+int report_end(minipro_handle_t *handle, report_phase_t *phase, int ret) {
+  struct timespec end;
+  usb_counters_t counters = {0, 0};
+  double elapsed;
+
+  if (!phase->name) return ret;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (handle) {
+    if (handle->phase == phase) handle->phase = NULL;
+    usb_get_counters(handle->usb_handle, &counters);
+  }
+  elapsed = seconds(&end) - seconds(&phase->start);
+
+  report_line_begin();
+  fprintf(report_file, "\"phase\":\"%s\",\"programmer\":", phase->name);
+  report_string(report_file, handle ? handle->model : NULL);
+  fprintf(report_file, ",\"serial\":");
+  report_string(report_file, handle ? handle->serial_number : NULL);
+  fprintf(report_file, ",\"path\":");
+  report_string(report_file, handle ? handle->path : NULL);
+  fprintf(report_file, ",\"device\":");
+  report_string(report_file,
+                handle && handle->device ? handle->device->name : NULL);
+  fprintf(report_file,
+          ",\"result\":\"%s\",\"start\":%.6f,\"end\":%.6f,"
+          "\"seconds\":%.6f,\"bytes\":%llu,\"blocks\":%llu,"
+          "\"bytes_per_second\":%.0f,\"usb_transfers\":%llu,"
+          "\"usb_retries\":%llu",
+          ret ? "failed" : "ok", seconds(&phase->start), seconds(&end),
+          elapsed, (unsigned long long)phase->bytes,
+          (unsigned long long)phase->blocks,
+          elapsed > 0 ? phase->bytes / elapsed : 0.0,
+          (unsigned long long)(counters.transfers -
+                               phase->counters.transfers),
+          (unsigned long long)(counters.retries - phase->counters.retries));
+  if (phase->bytes)
+    fprintf(report_file, ",\"crc32\":\"0x%08X\"", ~phase->crc32);
+  if (phase->has_id)
+    fprintf(report_file, ",\"chip_id\":\"0x%04X\",\"expected_id\":\"0x%04X\"",
+            phase->chip_id, phase->expected_id);
+  report_line_end();
+  return ret;
+}
@@ -0,0 +1,54 @@
+/*
+ * report.h - Definitions and declarations for the JSON phase events.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "usb.h"
+
+struct minipro_handle;
+
+// A phase of a job being timed, such as erase or write
+typedef struct report_phase {
+  const char *name;  // NULL when the events are off
+  struct timespec start;
+  usb_counters_t counters;  // at the start
+  uint64_t bytes;
+  uint64_t blocks;
+  uint32_t crc32;
+  uint8_t has_id;
+  uint32_t chip_id;
+  uint32_t expected_id;
+} report_phase_t;
+
+void report_open(FILE *file);
+int report_enabled(void);
+void report_string(FILE *file, const char *s);
+FILE *report_line_begin(void);
+void report_line_end(void);
+void report_begin(struct minipro_handle *handle, report_phase_t *phase,
+                  const char *name);
+void report_data(struct minipro_handle *handle, const uint8_t *data,
+                 size_t size);
+void report_chip_id(struct minipro_handle *handle, uint32_t chip_id,
+                    uint32_t expected_id);
+int report_end(struct minipro_handle *handle, report_phase_t *phase, int ret);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ * serial.c - Functions for patching per chip serial numbers into images.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "serial.h"
+
+/*
+ A serial field is given as <offset>:<width>:<format>:<source>. The
+ format tells how the value is stored in the chip: 'le' or 'be' for a
+ binary number, least or most significant byte first, 'dec' or 'hex' for
+ ASCII digits padded with zeros to the width, 'bytes' for raw bytes
+ written as hex digits in a list. The source is 'counter=<first>[+<step>]'
+ for a number counting up from chip to chip, or 'list=<file>' for the
+ values of a file, one per line, used in order. Empty lines and lines
+ starting with '#' are skipped.
+ */
+
+static const char *format_names[] = {"le", "be", "dec", "hex", "bytes"};
+
+static int parse_number(const char *s, uint64_t *value) {
+  char *end;
+
+  if (!isdigit((uint8_t)*s)) return EXIT_FAILURE;
+  errno = 0;
+  *value = strtoull(s, &end, 0);
+  return *end || errno ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int read_list(serial_field_t *field, const char *name) {
+  FILE *file;
+  long size;
+
+  file = fopen(name, "rb");
+  if (!file) {
+    fprintf(stderr, "Could not open serial list %s: %s\n", name,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET)) {
+    fprintf(stderr, "Could not read serial list %s\n", name);
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+  field->list = malloc(size + 1);
+  if (!field->list) {
+    fprintf(stderr, "Out of memory!\n");
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+  if (fread(field->list, 1, size, file) != (size_t)size) {
+    fprintf(stderr, "Could not read serial list %s\n", name);
+    free(field->list);
+    field->list = NULL;
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+  fclose(file);
+  field->list[size] = 0;
+  field->list_name = name;
+  field->next = field->list;
+  return EXIT_SUCCESS;
+}
+
+// Parse a field given with --serial, the string must be kept
+int serial_add_field(serial_t *serial, const char *spec) {
+  serial_field_t *field;
+  char buffer[64], *width_name, *format_name, *step;
+  const char *source;
+  uint64_t offset, width;
+  size_t i;
+
+  if (serial->count == MAX_SERIAL_FIELDS) {
+    fprintf(stderr, "Too many serial fields, %d at most.\n",
+            MAX_SERIAL_FIELDS);
+    return EXIT_FAILURE;
+  }
+  field = &serial->field[serial->count];
+  memset(field, 0, sizeof(serial_field_t));
+
+  // The source may hold a file name with colons, it goes last
+  source = strchr(spec, ':');
+  if (source) source = strchr(source + 1, ':');
+  if (source) source = strchr(source + 1, ':');
+  if (!source || (size_t)(source - spec) >= sizeof(buffer)) {
+    fprintf(stderr, "Invalid serial field '%s'\n", spec);
+    return EXIT_FAILURE;
+  }
+  memcpy(buffer, spec, source - spec);
+  buffer[source - spec] = 0;
+  source++;
+
+  width_name = strchr(buffer, ':');
+  *width_name++ = 0;
+  format_name = strchr(width_name, ':');
+  *format_name++ = 0;
+  if (parse_number(buffer, &offset) || offset > UINT32_MAX ||
+      parse_number(width_name, &width) || !width ||
+      width > MAX_SERIAL_WIDTH) {
+    fprintf(stderr, "Invalid serial field offset or width in '%s'\n", spec);
+    return EXIT_FAILURE;
+  }
+  field->offset = offset;
+  field->width = width;
+
+  for (i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++)
+    if (!strcasecmp(format_name, format_names[i])) break;
+  if (i == sizeof(format_names) / sizeof(format_names[0])) {
+    fprintf(stderr, "Invalid serial field format '%s'\n", format_name);
+    return EXIT_FAILURE;
+  }
+  field->format = i;
+  if ((i == SERIAL_LE || i == SERIAL_BE) && width > 8) {
+    fprintf(stderr, "A binary serial field is 8 bytes at most.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!strncmp(source, "list=", 5)) {
+    if (read_list(field, source + 5)) return EXIT_FAILURE;
+  } else if (!strncmp(source, "counter=", 8) && i != SERIAL_BYTES) {
+    field->step = 1;
+    snprintf(buffer, sizeof(buffer), "%s", source + 8);
+    step = strchr(buffer, '+');
+    if (step) *step++ = 0;
+    if (strlen(source + 8) >= sizeof(buffer) ||
+        parse_number(buffer, &field->counter) ||
+        (step && (parse_number(step, &field->step) || !field->step))) {
+      fprintf(stderr, "Invalid serial counter '%s'\n", source);
+      return EXIT_FAILURE;
+    }
+  } else {
+    fprintf(stderr, "Invalid serial field source '%s'\n", source);
+    return EXIT_FAILURE;
+  }
+  serial->count++;
+  return EXIT_SUCCESS;
+}
+
+int serial_open_log(serial_t *serial, const char *name) {
+  serial->log = fopen(name, "a");
+  if (!serial->log) {
+    fprintf(stderr, "Could not open serial log %s: %s\n", name,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Store a number in the format of a field
+static int encode_number(serial_field_t *field, uint64_t value,
+                         uint8_t *data) {
+  char digits[MAX_SERIAL_WIDTH + 1];
+  uint32_t i;
+  int n;
+
+  switch (field->format) {
+    case SERIAL_LE:
+    case SERIAL_BE:
+      if (field->width < 8 && value >> (8 * field->width)) return EXIT_FAILURE;
+      for (i = 0; i < field->width; i++) {
+        data[field->format == SERIAL_LE ? i : field->width - 1 - i] = value;
+        value >>= 8;
+      }
+      return EXIT_SUCCESS;
+    default:
+      n = snprintf(digits, sizeof(digits),
+                   field->format == SERIAL_DEC ? "%0*" PRIu64 : "%0*" PRIX64,
+                   (int)field->width, value);
+      if ((uint32_t)n > field->width) return EXIT_FAILURE;
+      memcpy(data, digits, n);
+      return EXIT_SUCCESS;
+  }
+}
+
+// Store hex digits as raw bytes, allowing ':', '-' or blanks between bytes
+static int encode_bytes(serial_field_t *field, const char *text,
+                        uint8_t *data) {
+  uint32_t count = 0;
+  unsigned int byte;
+
+  while (*text) {
+    if (*text == ':' || *text == '-' || isspace((uint8_t)*text)) {
+      text++;
+      continue;
+    }
+    if (count == field->width || !isxdigit((uint8_t)text[0]) ||
+        !isxdigit((uint8_t)text[1]) || sscanf(text, "%2x", &byte) != 1)
+      return EXIT_FAILURE;
+    data[count++] = byte;
+    text += 2;
+  }
+  return count == field->width ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Get the next line of a list, NULL when it is used up
+static char *next_line(char **next, char **end) {
+  char *line = *next, *stop;
+
+  while (*line) {
+    stop = line + strcspn(line, "\r\n");
+    *next = *stop ? stop + 1 : stop;
+    while (isspace((uint8_t)*line) && line < stop) line++;
+    *end = stop;
+    while (*end > line && isspace((uint8_t)(*end)[-1])) (*end)--;
+    if (*end > line && *line != '#') return line;
+    line = *next;
+  }
+  *next = line;
+  return NULL;
+}
+
+/*
+ Take the values of the next chip. The counters and lists only move on
+ if all the fields got a value.
+ */
+int serial_take(serial_t *serial, serial_unit_t *unit) {
+  char *next[MAX_SERIAL_FIELDS], *line, *end, text[MAX_SERIAL_TEXT];
+  serial_field_t *field;
+  uint64_t value;
+  size_t i, length;
+  int ret;
+
+  for (i = 0; i < serial->count; i++) {
+    field = &serial->field[i];
+    memset(unit->data[i], 0, MAX_SERIAL_WIDTH);
+    if (!field->list) {
+      if (encode_number(field, field->counter, unit->data[i])) {
+        fprintf(stderr, "Serial counter 0x%" PRIX64 " doesn't fit in %u "
+                "bytes.\n", field->counter, field->width);
+        return EXIT_FAILURE;
+      }
+      snprintf(unit->text[i], MAX_SERIAL_TEXT,
+               field->format == SERIAL_DEC ? "%" PRIu64 : "0x%" PRIX64,
+               field->counter);
+      continue;
+    }
+
+    next[i] = field->next;
+    line = next_line(&next[i], &end);
+    if (!line) {
+      fprintf(stderr, "Serial list %s is used up.\n", field->list_name);
+      return EXIT_FAILURE;
+    }
+    length = end - line < MAX_SERIAL_TEXT ? end - line : MAX_SERIAL_TEXT - 1;
+    memcpy(text, line, length);
+    text[length] = 0;
+    if (field->format == SERIAL_BYTES)
+      ret = encode_bytes(field, text, unit->data[i]);
+    else
+      ret = parse_number(text, &value) ||
+            encode_number(field, value, unit->data[i]);
+    if (ret) {
+      fprintf(stderr, "Invalid value '%s' in serial list %s\n", text,
+              field->list_name);
+      return EXIT_FAILURE;
+    }
+    strcpy(unit->text[i], text);
+  }
+
+  for (i = 0; i < serial->count; i++) {
+    field = &serial->field[i];
+    if (field->list)
+      field->next = next[i];
+    else
+      field->counter += field->step;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Patch the values of a chip into its image, gaps of the file included
+int serial_apply(serial_t *serial, serial_unit_t *unit, uint8_t *data,
+                 size_t size, segment_list_t *segments) {
+  serial_field_t *field;
+  size_t i;
+
+  for (i = 0; i < serial->count; i++) {
+    field = &serial->field[i];
+    if ((size_t)field->offset + field->width > size) {
+      fprintf(stderr, "Serial field at 0x%X is beyond the end of memory.\n",
+              field->offset);
+      return EXIT_FAILURE;
+    }
+    memcpy(data + field->offset, unit->data[i], field->width);
+    if (segments->count) add_segment(segments, field->offset, field->width);
+  }
+  return EXIT_SUCCESS;
+}
+
+// Take the fields from the chip, to compare the rest with the template
+void serial_mask(serial_t *serial, uint8_t *file_data, uint8_t *chip_data,
+                 size_t size) {
+  serial_field_t *field;
+  size_t i;
+
+  for (i = 0; i < serial->count; i++) {
+    field = &serial->field[i];
+    if ((size_t)field->offset + field->width <= size)
+      memcpy(file_data + field->offset, chip_data + field->offset,
+             field->width);
+  }
+}
+
+void serial_print(serial_t *serial, serial_unit_t *unit) {
+  size_t i;
+
+  fprintf(stderr, "Serial:");
+  for (i = 0; i < serial->count; i++)
+    fprintf(stderr, " 0x%04X=%s", serial->field[i].offset, unit->text[i]);
+  fprintf(stderr, "\n");
+}
+
+// Print the fields as found in a chip
+void serial_print_found(serial_t *serial, uint8_t *chip_data, size_t size) {
+  serial_field_t *field;
+  uint8_t *data;
+  uint64_t value;
+  uint32_t j;
+  size_t i;
+
+  fprintf(stderr, "Serial found:");
+  for (i = 0; i < serial->count; i++) {
+    field = &serial->field[i];
+    if ((size_t)field->offset + field->width > size) continue;
+    data = chip_data + field->offset;
+    fprintf(stderr, " 0x%04X=", field->offset);
+    switch (field->format) {
+      case SERIAL_LE:
+      case SERIAL_BE:
+        value = 0;
+        for (j = 0; j < field->width; j++)
+          value = value << 8 |
+                  data[field->format == SERIAL_BE ? j : field->width - 1 - j];
+        fprintf(stderr, "0x%" PRIX64, value);
+        break;
+      case SERIAL_BYTES:
+        for (j = 0; j < field->width; j++) fprintf(stderr, "%02X", data[j]);
+        break;
+      default:
+        for (j = 0; j < field->width; j++)
+          fputc(isprint(data[j]) ? data[j] : '.', stderr);
+        break;
+    }
+  }
+  fprintf(stderr, "\n");
+}
+
+// Record the values given to a chip, whether it was written or not
+void serial_log(serial_t *serial, serial_unit_t *unit, const char *programmer,
+                const char *device, int failed) {
+  char date[32];
+  time_t now;
+  size_t i;
+
+  if (!serial->log) return;
+  now = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+  fprintf(serial->log, "%s %s %s", date, programmer, device);
+  for (i = 0; i < serial->count; i++)
+    fprintf(serial->log, " 0x%04X=%s", serial->field[i].offset, unit->text[i]);
+  fprintf(serial->log, " %s\n", failed ? "FAILED" : "OK");
+  fflush(serial->log);
+}
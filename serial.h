@@ -0,0 +1,73 @@
+/*
+ * serial.h - Definitions and declarations for per chip serialization.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "pipeline.h"
+
+#define MAX_SERIAL_FIELDS 8
+#define MAX_SERIAL_WIDTH 64
+#define MAX_SERIAL_TEXT 160
+
+enum serial_format {
+  SERIAL_LE,
+  SERIAL_BE,
+  SERIAL_DEC,
+  SERIAL_HEX,
+  SERIAL_BYTES
+};
+
+// A field of the image given a value of its own for each chip
+typedef struct serial_field {
+  uint32_t offset;
+  uint32_t width;
+  uint8_t format;
+  uint64_t counter;  // next value, without a list
+  uint64_t step;
+  const char *list_name;
+  char *list;  // contents of the list file, NULL for a counter
+  char *next;  // next line of the list
+} serial_field_t;
+
+typedef struct serial {
+  size_t count;
+  serial_field_t field[MAX_SERIAL_FIELDS];
+  FILE *log;
+} serial_t;
+
+// The values of the fields for one chip
+typedef struct serial_unit {
+  uint8_t data[MAX_SERIAL_FIELDS][MAX_SERIAL_WIDTH];
+  char text[MAX_SERIAL_FIELDS][MAX_SERIAL_TEXT];
+} serial_unit_t;
+
+int serial_add_field(serial_t *serial, const char *spec);
+int serial_open_log(serial_t *serial, const char *name);
+int serial_take(serial_t *serial, serial_unit_t *unit);
+int serial_apply(serial_t *serial, serial_unit_t *unit, uint8_t *data,
+                 size_t size, segment_list_t *segments);
+void serial_mask(serial_t *serial, uint8_t *file_data, uint8_t *chip_data,
+                 size_t size);
+void serial_print(serial_t *serial, serial_unit_t *unit);
+void serial_print_found(serial_t *serial, uint8_t *chip_data, size_t size);
+void serial_log(serial_t *serial, serial_unit_t *unit, const char *programmer,
+                const char *device, int failed);
+
+#endif
@@ -184,12 +184,12 @@ static int write_record(FILE *file, record_t *record) {
   return EXIT_SUCCESS;
 }
 
-// Read a Motorola S-Record file
-int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size) {
+// Read a Motorola S-Record file.
+// Data records are pushed through the pipeline.
+int read_srec_file(uint8_t *buffer, pipeline_t *pipeline) {
   uint32_t line = 0;
   record_t rec;
   size_t s0 = 0;
-  size_t chip_size = *size;
 
   while (buffer) {
     // Skip empty lines
@@ -221,13 +221,8 @@ int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size) {
           case S1:
           case S2:
           case S3:
-            // If file data size is bigger than chip size
-            // update the new size
-            if (chip_size >= rec.address + rec.count)
-              // copy record data
-              memcpy(&(data[rec.address]), rec.data, rec.count);
-            else
-              *size = (rec.address + rec.count);
+            if (pipeline_put(pipeline, rec.address, rec.data, rec.count))
+              return EXIT_FAILURE;
             break;
           case S5:
           case S6:
@@ -250,43 +245,67 @@ int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size) {
   return SREC_FORMAT;
 }
 
-// Write an S-Record file
-int write_srec_file(FILE *file, uint8_t *data, size_t size) {
+// Start an S-Record file with a header record
+int srec_writer_begin(srec_writer_t *writer, FILE *file, size_t record_size) {
   record_t rec;
-  uint32_t address = 0;
-  size_t len;
-  uint8_t type;
-
   char *header = "Written by Minipro open source software";
+
+  writer->file = file;
+  writer->record_size = record_size ? record_size : ROW_SIZE;
+  writer->lines = 0;
   memcpy(rec.data, header, strlen(header));
   rec.type = S0;
   rec.count = strlen(header);
   rec.address = 0x00;
-  write_record(file, &rec);
-  size_t line = 0;
+  return write_record(file, &rec);
+}
+
+// Write a block of data as S1, S2 or S3 records depending on the address
+int srec_writer_put(void *context, uint32_t address, uint8_t *data,
+                    size_t size) {
+  srec_writer_t *writer = context;
+  record_t rec;
+  size_t len;
 
   while (size) {
     if (address < 65536)
-      type = S1;
+      rec.type = S1;
     else if (address < 16777216)
-      type = S2;
+      rec.type = S2;
     else
-      type = S3;
-    len = (size > ROW_SIZE ? ROW_SIZE : size);
-    rec.type = type;
+      rec.type = S3;
+    len = writer->record_size - address % writer->record_size;
+    if (len > size) len = size;
     rec.count = len;
     rec.address = address;
     memcpy(rec.data, data, len);
-    write_record(file, &rec);
-    data += ROW_SIZE;
+    write_record(writer->file, &rec);
+    data += len;
     size -= len;
-    address += ROW_SIZE;
-    line++;
+    address += len;
+    writer->lines++;
   }
-  // Write record count
-  rec.type = (line < 65536 ? S5 : S6);
+  return EXIT_SUCCESS;
+}
+
+// Write the record count
+int srec_writer_end(srec_writer_t *writer) {
+  record_t rec;
+  rec.type = (writer->lines < 65536 ? S5 : S6);
   rec.count = 0x00;
-  rec.address = line;
-  write_record(file, &rec);
+  rec.address = writer->lines;
+  write_record(writer->file, &rec);
+  if (ferror(writer->file)) {
+    fprintf(stderr, "Error writing the output file.\n");
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
+
+// Write an S-Record file
+int write_srec_file(FILE *file, uint8_t *data, size_t size) {
+  srec_writer_t writer;
+  if (srec_writer_begin(&writer, file, ROW_SIZE)) return EXIT_FAILURE;
+  if (srec_writer_put(&writer, 0, data, size)) return EXIT_FAILURE;
+  return srec_writer_end(&writer);
+}
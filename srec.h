@@ -20,11 +20,23 @@
 #define SREC_H_
 
 #include <stdint.h>
+#include "pipeline.h"
 
 #define SREC_FORMAT 0
 #define NOT_SREC -1
 
-int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size);
+// Record based S-Record writer
+typedef struct srec_writer {
+  FILE *file;
+  size_t record_size;
+  size_t lines;
+} srec_writer_t;
+
+int read_srec_file(uint8_t *buffer, pipeline_t *pipeline);
 int write_srec_file(FILE *file, uint8_t *data, size_t size);
+int srec_writer_begin(srec_writer_t *writer, FILE *file, size_t record_size);
+int srec_writer_put(void *context, uint32_t address, uint8_t *data,
+                    size_t size);
+int srec_writer_end(srec_writer_t *writer);
 
 #endif
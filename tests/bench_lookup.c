@@ -0,0 +1,99 @@
+/*
+ * bench_lookup.c - Device name lookup throughput over a full table.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "database.h"
+#include "minipro.h"
+
+/*
+ Every name of the device table in use, the built-in one or the database
+ file found in MINIPRO_DB_DIR, is looked up in a shuffled order until
+ MIN_LOOKUPS are done and MIN_SECONDS have passed. 'make bench' runs it
+ on a synthetic table as large as the TL866II+ one.
+ */
+#define MIN_LOOKUPS 1000000
+#define MIN_SECONDS 1.0
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(uint8_t version, const char *model) {
+  minipro_handle_t handle;
+  const char **names, *name;
+  size_t count, lookups = 0, i, j;
+  uint32_t seed = 1;
+  double start, time;
+
+  memset(&handle, 0, sizeof(handle));
+  handle.version = version;
+  names = get_device_names(&handle, &count);
+  if (!names) {
+    fprintf(stderr, "Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+  if (!count) {
+    fprintf(stderr, "%s: no devices\n", model);
+    free(names);
+    return EXIT_SUCCESS;
+  }
+  for (i = count - 1; i > 0; i--) {
+    seed = seed * 1103515245 + 12345;
+    j = (seed >> 8) % (i + 1);
+    name = names[i];
+    names[i] = names[j];
+    names[j] = name;
+  }
+
+  // The first pass checks every name and expands the devices
+  for (i = 0; i < count; i++) {
+    if (!get_device_by_name(&handle, names[i])) {
+      fprintf(stderr, "%s: %s not found\n", model, names[i]);
+      free(names);
+      return EXIT_FAILURE;
+    }
+  }
+
+  start = now();
+  do {
+    for (i = 0; i < count; i++) {
+      if (!get_device_by_name(&handle, names[i])) {
+        free(names);
+        return EXIT_FAILURE;
+      }
+    }
+    lookups += count;
+    time = now() - start;
+  } while (lookups < MIN_LOOKUPS || time < MIN_SECONDS);
+
+  fprintf(stderr, "%s: %zu devices, %zu lookups in %.2f s, %.2fM lookups/s\n",
+          model, count, lookups, time, lookups / time / 1e6);
+  free(names);
+  return EXIT_SUCCESS;
+}
+
+int main(void) {
+  if (bench(MP_TL866A, "TL866A/CS") || bench(MP_TL866IIPLUS, "TL866II+"))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/python
+
+# Write a synthetic InfoIC2Plus.dll JSON dump for the lookup benchmark,
+# with as many devices as the real table and names shaped like its ones.
+# Usage: bench_table.py [count] > devices.json
+
+from __future__ import print_function
+
+import json
+import random
+import sys
+
+prefixes = ['AT28C', 'AT29C', 'AT49F', '27C', '28F', '29F', '29LV', '24C',
+            '25LC', '93C', 'W25Q', 'MX25L', 'SST39SF', 'PIC16F', 'PIC18F',
+            'ATMEGA', 'ATTINY', 'GAL16V', 'GAL22V', 'M27C', 'AM29F', 'S29GL']
+packages = ['', '@DIP8', '@DIP28', '@DIP32', '@PLCC32', '@SOIC8', '@SOP28',
+            '@TSOP32', '@TSOP48', '@SSOP20', '@QFN8', '@TQFP44']
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 16000
+    rand = random.Random(1)
+    names = set()
+    ics = []
+    while len(ics) < count:
+        name = '{}{}{}{}'.format(rand.choice(prefixes), rand.randint(1, 9999),
+                                 rand.choice(['', 'A', 'B', 'L', '-12', '-70']),
+                                 rand.choice(packages))
+        if name in names:
+            continue
+        names.add(name)
+        ics.append({'name': name, 'chip_id': '{:X}'.format(len(ics)),
+                    'protocol_id': 0x40, 'variant': 0,
+                    'read_buffer_size': 0x100, 'write_buffer_size': 0x40,
+                    'code_memory_size': 0x2000, 'data_memory_size': 0,
+                    'data_memory2_size': 0, 'chip_id_bytes_count': 2,
+                    'opts1': 0, 'opts2': 0, 'opts3': 0, 'opts4': 0x30,
+                    'package_details': 0x1C000000})
+    json.dump([{'ics': ics}], sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
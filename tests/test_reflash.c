@@ -0,0 +1,293 @@
+/*
+ * test_reflash.c - TL866II+ firmware reflash against an emulated bootloader.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "minipro.h"
+#include "usb.h"
+
+/*
+ The usb.h functions are replaced by a TL866II+ bootloader. A status reply
+ is queued in the IN endpoint buffer when it is asked for, and is ready
+ once the block before it is flashed. Time is virtual: a transfer takes
+ XFER_US and flashing a block FLASH_US, so the windows can be compared.
+ */
+#define REQUEST_STATUS 0x39
+#define BOOTLOADER_WRITE 0x3B
+#define BOOTLOADER_ERASE 0x3C
+#define RESET 0x3F
+
+#define XFER_US 125
+#define FLASH_US 1000
+#define BLOCKS 64
+#define MAX_REPLIES 8
+
+static struct {
+  int buffers;   // status replies the IN endpoint holds
+  int fail;      // block whose status fails, -1 for none
+  int normal;    // running the firmware, after a reset
+  int detached;  // programmer_attached() polls left while resetting
+  int overflow;
+  uint8_t reply[64];  // reply of a system info or erase command
+  size_t reply_size;
+  uint64_t now, flashed;  // virtual time, end of the last block flash
+  uint64_t ready[MAX_REPLIES];
+  uint8_t status[MAX_REPLIES];
+  int replies;
+  uint32_t address;  // of the block being written
+  uint32_t size;
+  int blocks;
+  uint8_t flash[BLOCKS * 256 + 2048];
+} boot;
+
+int usb_list_devices(usb_device_t **devices) {
+  *devices = calloc(1, sizeof(usb_device_t));
+  if (!*devices) return -1;
+  if (boot.detached) {
+    boot.detached--;
+    return 0;
+  }
+  (*devices)->version = MP_TL866IIPLUS;
+  strcpy((*devices)->path, "1-1");
+  return 1;
+}
+
+void *usb_open(const char *path) {
+  (void)path;
+  return &boot;
+}
+
+void usb_get_path(void *usb_handle, char *path) {
+  (void)usb_handle;
+  strcpy(path, "1-1");
+}
+
+void usb_get_counters(void *usb_handle, usb_counters_t *counters) {
+  (void)usb_handle;
+  memset(counters, 0, sizeof(*counters));
+}
+
+int usb_close(void *usb_handle) {
+  (void)usb_handle;
+  return EXIT_SUCCESS;
+}
+
+int minipro_get_devices_count(uint8_t version) {
+  return version == MP_TL866IIPLUS;
+}
+
+int msg_send(void *handle, uint8_t *buffer, size_t size) {
+  (void)handle;
+  boot.now += XFER_US;
+  if (size == 5) {
+    // System info, the bootloader has no minor firmware version
+    memset(boot.reply, 0, sizeof(boot.reply));
+    boot.reply[4] = boot.normal;
+    boot.reply[5] = 1;
+    boot.reply[6] = MP_TL866IIPLUS;
+    boot.reply_size = sizeof(minipro_report_info_t);
+    return EXIT_SUCCESS;
+  }
+  switch (buffer[0]) {
+    case BOOTLOADER_ERASE:
+      memset(boot.flash, 0xFF, sizeof(boot.flash));
+      memset(boot.reply, 0, sizeof(boot.reply));
+      boot.reply[0] = BOOTLOADER_ERASE;
+      boot.reply_size = 8;
+      boot.blocks = 0;
+      break;
+    case BOOTLOADER_WRITE:
+      boot.size = load_int(&buffer[2], 2, MP_LITTLE_ENDIAN);
+      boot.address = load_int(&buffer[4], 4, MP_LITTLE_ENDIAN);
+      break;
+    case REQUEST_STATUS:
+      if (boot.replies == boot.buffers) {
+        boot.overflow = 1;
+        return EXIT_FAILURE;
+      }
+      boot.ready[boot.replies] = boot.flashed;
+      boot.status[boot.replies] = boot.blocks == boot.fail + 1;
+      boot.replies++;
+      break;
+    case RESET:
+      boot.normal = 1;
+      boot.detached = 1;
+      break;
+  }
+  return EXIT_SUCCESS;
+}
+
+int msg_recv(void *handle, uint8_t *buffer, size_t size) {
+  (void)handle;
+  if (boot.reply_size) {
+    memcpy(buffer, boot.reply, size < 64 ? size : 64);
+    boot.reply_size = 0;
+    return EXIT_SUCCESS;
+  }
+  if (!boot.replies) return EXIT_FAILURE;
+  if (boot.now < boot.ready[0]) boot.now = boot.ready[0];
+  boot.now += XFER_US;
+  memset(buffer, 0, size);
+  buffer[1] = boot.status[0];
+  boot.replies--;
+  memmove(boot.ready, boot.ready + 1, boot.replies * sizeof(boot.ready[0]));
+  memmove(boot.status, boot.status + 1, boot.replies);
+  return EXIT_SUCCESS;
+}
+
+// A block is flashed once it is received and the one before is done
+int write_payload(void *handle, uint8_t *buffer, size_t length) {
+  (void)handle;
+  boot.now += XFER_US * (length / 64);
+  if (length != boot.size || boot.address < 0x1000 ||
+      boot.address - 0x1000 + length > sizeof(boot.flash))
+    return EXIT_FAILURE;
+  memcpy(boot.flash + boot.address - 0x1000, buffer, length);
+  boot.flashed =
+      (boot.flashed > boot.now ? boot.flashed : boot.now) + FLASH_US;
+  boot.blocks++;
+  return EXIT_SUCCESS;
+}
+
+int read_payload(void *handle, uint8_t *buffer, size_t length) {
+  (void)handle;
+  (void)buffer;
+  (void)length;
+  return EXIT_FAILURE;
+}
+
+int msg_batch(void *handle, msg_exchange_t *exchanges, size_t count,
+              size_t depth, msg_done_cb done, void *context) {
+  (void)handle;
+  (void)exchanges;
+  (void)count;
+  (void)depth;
+  (void)done;
+  (void)context;
+  return EXIT_FAILURE;
+}
+
+/*
+ Write an UpdateII.dat with BLOCKS blocks and the last block, made the way
+ check_update_dat() undoes it: the LSB of each address is xored with a run
+ of the xor table once the block CRC is computed.
+ */
+static int write_update_dat(const char *path, uint8_t *image) {
+  size_t size = 1036 + BLOCKS * 272 + 2064, ptr, n, i, j;
+  uint8_t *dat = calloc(1, size), *table = dat + 8, x;
+  uint32_t crc, seed = 1;
+  FILE *file;
+
+  if (!dat) return EXIT_FAILURE;
+  for (i = 0; i < 1024; i++) {
+    seed = seed * 1103515245 + 12345;
+    table[i] = seed >> 16;
+  }
+  format_int(dat + 1032, BLOCKS, 4, MP_LITTLE_ENDIAN);
+  for (i = 0, ptr = 1036; i <= BLOCKS; i++, ptr += 272) {
+    n = i < BLOCKS ? 256 : 2048;
+    seed = seed * 1103515245 + 12345;
+    format_int(dat + ptr + 4, seed, 4, MP_LITTLE_ENDIAN);
+    format_int(dat + ptr + 8, 0x1000 + i * 256, 4, MP_LITTLE_ENDIAN);
+    dat[ptr + 12] = i & 0x7F;
+    for (j = 0; j < n; j++) dat[ptr + 16 + j] = image[i * 256 + j];
+    format_int(dat + ptr, crc32_update(0, dat + ptr + 4, n + 12), 4,
+               MP_LITTLE_ENDIAN);
+    for (j = 0, x = 0; j < n + 8; j++)
+      x ^= table[(load_int(dat + ptr + 4, 4, MP_LITTLE_ENDIAN) + j) & 0x3FF];
+    dat[ptr + 8] ^= x;
+  }
+  crc = crc32_update(0xFFFFFFFF, dat + 1036, size - 1036);
+  crc = crc32_update(crc, dat + 8, 1028);
+  format_int(dat + 4, ~crc, 4, MP_LITTLE_ENDIAN);
+
+  file = fopen(path, "wb");
+  if (!file || fwrite(dat, 1, size, file) != size || fclose(file)) {
+    free(dat);
+    return EXIT_FAILURE;
+  }
+  free(dat);
+  return EXIT_SUCCESS;
+}
+
+// Reflash with a window against a bootloader, returning the virtual time
+static int reflash(const char *path, int window, int buffers, int fail,
+                   uint64_t *time) {
+  minipro_handle_t *handle;
+  char value[8];
+  int ret;
+
+  memset(&boot, 0, sizeof(boot));
+  boot.buffers = buffers;
+  boot.fail = fail;
+  sprintf(value, "%d", window);
+  setenv("MINIPRO_REFLASH_WINDOW", value, 1);
+  handle = minipro_open(NULL, NULL);
+  if (!handle) return EXIT_FAILURE;
+  ungetc('y', stdin);
+  ret = minipro_firmware_update(handle, path);
+  *time = boot.now;
+  return ret;
+}
+
+int main(void) {
+  static const struct {
+    int window, buffers, fail, ret;
+  } cases[] = {{1, 1, -1, EXIT_SUCCESS}, {2, 1, -1, EXIT_SUCCESS},
+               {3, 2, -1, EXIT_SUCCESS}, {3, 1, -1, EXIT_FAILURE},
+               {2, 1, 10, EXIT_FAILURE}, {1, 1, BLOCKS, EXIT_FAILURE}};
+  uint8_t image[sizeof(boot.flash)];
+  char path[] = "/tmp/minipro-test-XXXXXX";
+  uint64_t time, serial = 0;
+  size_t i;
+  int fd, failed = 0;
+
+  for (i = 0; i < sizeof(image); i++) image[i] = i * 7 + (i >> 8);
+  fd = mkstemp(path);
+  if (fd < 0 || close(fd) || write_update_dat(path, image)) {
+    fprintf(stderr, "Can't write the test firmware file\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    int ret = reflash(path, cases[i].window, cases[i].buffers, cases[i].fail,
+                      &time);
+    int ok = ret == cases[i].ret;
+
+    // A window the bootloader can't buffer must fail, not lose a reply
+    if (cases[i].window - 1 > cases[i].buffers) ok = ok && boot.overflow;
+    if (!ret)
+      ok = ok && boot.blocks == BLOCKS + 1 &&
+           !memcmp(boot.flash, image, sizeof(image));
+    if (!ret && cases[i].window == 1) serial = time;
+    if (!ret && cases[i].window > 1) ok = ok && time < serial;
+    fprintf(stderr, "\nwindow %d, %d buffered replies", cases[i].window,
+            cases[i].buffers);
+    if (cases[i].fail >= 0)
+      fprintf(stderr, ", block %d failing", cases[i].fail + 1);
+    fprintf(stderr, ": ");
+    if (!ret) fprintf(stderr, "%.1f ms, ", time / 1000.0);
+    fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    failed |= !ok;
+  }
+  unlink(path);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
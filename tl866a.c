@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <time.h>
 
+#include "checksum.h"
 #include "database.h"
 #include "minipro.h"
 #include "tl866a.h"
@@ -238,7 +239,7 @@ int tl866a_begin_transaction(minipro_handle_t *handle) {
   if (msg_send(handle->usb_handle, msg, 48)) return EXIT_FAILURE;
   if (tl866a_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
   if (ovc) {
-    fprintf(stderr, "Overcurrent protection!\007\n");
+    minipro_log("Overcurrent protection!\007\n");
     return EXIT_FAILURE;
   }
   return EXIT_SUCCESS;
@@ -315,7 +316,7 @@ int tl866a_read_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
   } else if (type == MP_DATA) {
     type = TL866A_READ_DATA;
   } else {
-    fprintf(stderr, "Unknown type for read_block (%d)\n", type);
+    minipro_log("Unknown type for read_block (%d)\n", type);
     return EXIT_FAILURE;
   }
   uint8_t msg[64];
@@ -333,13 +334,13 @@ int tl866a_write_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
   } else if (type == MP_DATA) {
     type = TL866A_WRITE_DATA;
   } else {
-    fprintf(stderr, "Unknown type for read_block (%d)\n", type);
+    minipro_log("Unknown type for read_block (%d)\n", type);
     return EXIT_FAILURE;
   }
 
   uint8_t *msg = malloc(size + 7);
   if (!msg) {
-    fprintf(stderr, "Out of memory!");
+    minipro_log("Out of memory!");
     return EXIT_FAILURE;
   }
   msg_init(handle, type, msg, sizeof(size + 7));
@@ -392,7 +393,7 @@ int tl866a_read_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
   } else if (type == MP_FUSE_LOCK) {
     type = TL866A_READ_LOCK;
   } else {
-    fprintf(stderr, "Unknown type for read_fuses (%d)\n", type);
+    minipro_log("Unknown type for read_fuses (%d)\n", type);
     return EXIT_FAILURE;
   }
   uint8_t msg[64];
@@ -414,7 +415,7 @@ int tl866a_write_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
   } else if (type == MP_FUSE_LOCK) {
     type = TL866A_WRITE_LOCK;
   } else {
-    fprintf(stderr, "Unknown type for write_fuses (%d)\n", type);
+    minipro_log("Unknown type for write_fuses (%d)\n", type);
   }
   uint8_t msg[64];
   msg_init(handle, type, msg, sizeof(msg));
@@ -427,30 +428,28 @@ int tl866a_write_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
   return msg_send(handle->usb_handle, msg, buffer != NULL ? 64 : 10);
 }
 
-int tl866a_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                           uint8_t row, size_t size) {
-  uint8_t msg[64];
-  memset(msg, 0, sizeof(msg));
-  msg[0] = TL866A_WRITE_CODE;
+// Build the message of a jedec row
+static size_t jedec_msg(minipro_handle_t *handle, jedec_row_t *row, int write,
+                        uint8_t *msg) {
+  msg[0] = write ? TL866A_WRITE_CODE : TL866A_READ_CODE;
   msg[1] = handle->device->protocol_id;
-  msg[2] = size;
-  msg[4] = row;
-  memcpy(&msg[7], buffer, size / 8 + 1);
-  return msg_send(handle->usb_handle, msg, 64);
+  msg[2] = row->size;
+  msg[4] = row->row;
+  if (!write) return 18;
+  memcpy(&msg[7], row->buffer, row->size / 8 + 1);
+  return 64;
 }
 
-int tl866a_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                          uint8_t row, size_t size) {
-  uint8_t msg[64];
-  memset(msg, 0, sizeof(msg));
-  msg[0] = TL866A_READ_CODE;
-  msg[1] = handle->device->protocol_id;
-  msg[2] = size;
-  msg[4] = row;
-  if (msg_send(handle->usb_handle, msg, 18)) return EXIT_FAILURE;
-  if (msg_recv(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-  memcpy(buffer, msg, size / 8 + 1);
-  return EXIT_SUCCESS;
+int tl866a_write_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                            size_t count, jedec_row_cb done, void *context) {
+  return minipro_jedec_batch(handle, rows, count, 1, 64, jedec_msg, done,
+                             context);
+}
+
+int tl866a_read_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                           size_t count, jedec_row_cb done, void *context) {
+  return minipro_jedec_batch(handle, rows, count, 0, 64, jedec_msg, done,
+                             context);
 }
 
 // Unlocking the TSOP48 adapter.
@@ -458,16 +457,9 @@ int tl866a_unlock_tsop48(minipro_handle_t *handle, uint8_t *status) {
   uint8_t msg[64];
   memset(msg, 0, sizeof(msg));
   srand(time(NULL));
-  uint16_t i, crc = 0;
-  for (i = 7; i < 15; i++) {
-    msg[i] = (uint8_t)rand();
-    // Calculate the crc16
-    crc = (crc >> 8) | (crc << 8);
-    crc ^= msg[i];
-    crc ^= (crc & 0xFF) >> 4;
-    crc ^= (crc << 12);
-    crc ^= (crc & 0xFF) << 5;
-  }
+  uint16_t i, crc;
+  for (i = 7; i < 15; i++) msg[i] = (uint8_t)rand();
+  crc = crc16_update(0, &msg[7], 8);
   msg[0] = TL866A_UNLOCK_TSOP48;
   msg[15] = msg[9];
   msg[16] = msg[11];
@@ -522,21 +514,21 @@ int tl866a_hardware_check(minipro_handle_t *handle) {
       if (msg_send(handle->usb_handle, msg, 4)) {
         return EXIT_FAILURE;
       }
-      fprintf(stderr,
-              "Overcurrent protection detected while testing VPP pin driver "
-              "%u!\007\n",
-              vpp_pins[i].pin);
+      minipro_log(
+          "Overcurrent protection detected while testing VPP pin driver "
+          "%u!\007\n",
+          vpp_pins[i].pin);
       return EXIT_FAILURE;
     }
     if (!read_buffer[6 + vpp_pins[i].pin]) errors++;
-    fprintf(stderr, "VPP driver pin %u is %s\n", vpp_pins[i].pin,
-            read_buffer[6 + vpp_pins[i].pin] ? "OK" : "Bad");
+    minipro_log("VPP driver pin %u is %s\n", vpp_pins[i].pin,
+                read_buffer[6 + vpp_pins[i].pin] ? "OK" : "Bad");
     msg[0] = TL866A_RESET_PIN_DRIVERS;
     if (msg_send(handle->usb_handle, msg, 10)) {
       return EXIT_FAILURE;
     }
   }
-  fprintf(stderr, "\n");
+  minipro_log("\n");
   // Testing 24 VCC pin drivers
   for (i = 0; i < 24; i++) {
     msg[0] = TL866A_SET_LATCH;
@@ -563,21 +555,21 @@ int tl866a_hardware_check(minipro_handle_t *handle) {
       if (minipro_end_transaction(handle)) {
         return EXIT_FAILURE;
       }
-      fprintf(stderr,
-              "Overcurrent protection detected while testing VCC pin driver "
-              "%u!\007\n",
-              vcc_pins[i].pin);
+      minipro_log(
+          "Overcurrent protection detected while testing VCC pin driver "
+          "%u!\007\n",
+          vcc_pins[i].pin);
       return EXIT_FAILURE;
     }
     if (!read_buffer[6 + vcc_pins[i].pin]) errors++;
-    fprintf(stderr, "VCC driver pin %u is %s\n", vcc_pins[i].pin,
-            read_buffer[6 + vcc_pins[i].pin] ? "OK" : "Bad");
+    minipro_log("VCC driver pin %u is %s\n", vcc_pins[i].pin,
+                read_buffer[6 + vcc_pins[i].pin] ? "OK" : "Bad");
     msg[0] = TL866A_RESET_PIN_DRIVERS;
     if (msg_send(handle->usb_handle, msg, 10)) {
       return EXIT_FAILURE;
     }
   }
-  fprintf(stderr, "\n");
+  minipro_log("\n");
   // Testing 25 GND pin drivers
   for (i = 0; i < 25; i++) {
     msg[0] = TL866A_SET_LATCH;
@@ -605,22 +597,22 @@ int tl866a_hardware_check(minipro_handle_t *handle) {
       if (minipro_end_transaction(handle)) {
         return EXIT_FAILURE;
       }
-      fprintf(stderr,
-              "Overcurrent protection detected while testing GND pin driver "
-              "%u!\007\n",
-              gnd_pins[i].pin);
+      minipro_log(
+          "Overcurrent protection detected while testing GND pin driver "
+          "%u!\007\n",
+          gnd_pins[i].pin);
       return EXIT_FAILURE;
     }
     if (read_buffer[6 + gnd_pins[i].pin]) errors++;
-    fprintf(stderr, "GND driver pin %u is %s\n", gnd_pins[i].pin,
-            read_buffer[6 + gnd_pins[i].pin] ? "Bad" : "OK");
+    minipro_log("GND driver pin %u is %s\n", gnd_pins[i].pin,
+                read_buffer[6 + gnd_pins[i].pin] ? "Bad" : "OK");
     msg[0] = TL866A_RESET_PIN_DRIVERS;
     if (msg_send(handle->usb_handle, msg, 10)) {
       return EXIT_FAILURE;
     }
   }
 
-  fprintf(stderr, "\n");
+  minipro_log("\n");
   // Testing VPP overcurrent protection
   msg[0] = TL866A_SET_LATCH;
   msg[7] = 2;              // We will set two latches
@@ -640,9 +632,9 @@ int tl866a_hardware_check(minipro_handle_t *handle) {
     return EXIT_FAILURE;
   }
   if (read_buffer[1]) {
-    fprintf(stderr, "VPP overcurrent protection is OK.\n");
+    minipro_log("VPP overcurrent protection is OK.\n");
   } else {
-    fprintf(stderr, "VPP overcurrent protection failed!\007\n");
+    minipro_log("VPP overcurrent protection failed!\007\n");
     errors++;
   }
 
@@ -678,16 +670,15 @@ int tl866a_hardware_check(minipro_handle_t *handle) {
     return EXIT_FAILURE;
   }
   if (read_buffer[1]) {
-    fprintf(stderr, "VCC overcurrent protection is OK.\n");
+    minipro_log("VCC overcurrent protection is OK.\n");
   } else {
-    fprintf(stderr, "VCC overcurrent protection failed!\007\n");
+    minipro_log("VCC overcurrent protection failed!\007\n");
     errors++;
   }
   if (errors)
-    fprintf(stderr, "\nHardware test completed with %u error(s).\007\n",
-            errors);
+    minipro_log("\nHardware test completed with %u error(s).\007\n", errors);
   else
-    fprintf(stderr, "\nHardware test completed successfully!\n");
+    minipro_log("\nHardware test completed successfully!\n");
 
   // End transaction
   memset(msg, 0, sizeof(msg));
@@ -831,28 +822,28 @@ int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware) {
 
   struct stat st;
   if (stat(firmware, &st)) {
-    fprintf(stderr, "%s open error!: ", firmware);
+    minipro_log("%s open error!: ", firmware);
     perror("");
     return EXIT_FAILURE;
   }
 
   // Check the update.dat size
   if (st.st_size != TL866A_UPDATE_DAT_SIZE) {
-    fprintf(stderr, "File size error!\n");
+    minipro_log("File size error!\n");
     return EXIT_FAILURE;
   }
 
   // Open the update.dat firmware file
   FILE *file = fopen(firmware, "rb");
   if (file == NULL) {
-    fprintf(stderr, "%s open error!: ", firmware);
+    minipro_log("%s open error!: ", firmware);
     perror("");
     return EXIT_FAILURE;
   }
 
   // Read the update.dat file
   if (fread(&update_dat, sizeof(char), st.st_size, file) != st.st_size) {
-    fprintf(stderr, "File read error!\n");
+    minipro_log("File read error!\n");
     fclose(file);
     return EXIT_FAILURE;
   }
@@ -873,22 +864,22 @@ int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware) {
   }
 
   if ((update_dat.a_crc32 !=
-       ~crc32(a_firmware, sizeof(a_firmware), 0xFFFFFFFF)) ||
+       ~crc32_update(0xFFFFFFFF, a_firmware, sizeof(a_firmware))) ||
       (update_dat.cs_crc32 !=
-       ~crc32(cs_firmware, sizeof(cs_firmware), 0xFFFFFFFF))) {
-    fprintf(stderr, "%s crc error!\n", firmware);
+       ~crc32_update(0xFFFFFFFF, cs_firmware, sizeof(cs_firmware)))) {
+    minipro_log("%s crc error!\n", firmware);
     return EXIT_FAILURE;
   }
 
-  fprintf(stderr, "%s contains firmware version 3.2.%u", firmware,
-          update_dat.header[0]);
+  minipro_log("%s contains firmware version 3.2.%u", firmware,
+              update_dat.header[0]);
   if ((handle->firmware & 0xFF) > update_dat.header[0])
-    fprintf(stderr, " (older)");
+    minipro_log(" (older)");
   else if ((handle->firmware & 0xFF) < update_dat.header[0])
-    fprintf(stderr, " (newer)");
+    minipro_log(" (newer)");
 
   uint8_t version;
-  fprintf(stderr,
+  minipro_log(
       "\n\nWhich firmware version do you want to reflash? \n1) Device default "
       "(%s)\n2) "
       "%s\n3) Exit\n",
@@ -904,30 +895,30 @@ int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware) {
       version = handle->version == MP_TL866A ? MP_TL866CS : MP_TL866A;
       break;
     default:
-      fprintf(stderr, "Firmware update aborted.\n");
+      minipro_log("Firmware update aborted.\n");
       return EXIT_FAILURE;
   }
 
   // Switch to boot mode if necessary
   if (handle->status == MP_STATUS_NORMAL) {
-    fprintf(stderr, "Switching to bootloader... ");
+    minipro_log("Switching to bootloader... ");
     fflush(stderr);
     if (minipro_reset(handle)) {
-      fprintf(stderr, "failed\n");
+      minipro_log("failed\n");
       return EXIT_FAILURE;
     }
 
-    handle = minipro_open(NULL);
+    handle = minipro_open(handle->path, NULL);
     if (!handle) {
-      fprintf(stderr, "failed!\n");
+      minipro_log("failed!\n");
       return EXIT_FAILURE;
     }
 
     if (handle->status == MP_STATUS_NORMAL) {
-      fprintf(stderr, "failed!\n");
+      minipro_log("failed!\n");
       return EXIT_FAILURE;
     }
-    fprintf(stderr, "OK\n");
+    minipro_log("OK\n");
   }
 
   // Reencrypt the firmware if necessary
@@ -950,31 +941,32 @@ int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware) {
   }
 
   // Erase device
-  fprintf(stderr, "Erasing... ");
+  minipro_log("Erasing... ");
   fflush(stderr);
   memset(msg, 0, sizeof(msg));
   msg[0] = TL866A_BOOTLOADER_ERASE;
   msg[7] =
       handle->version == MP_TL866A ? update_dat.a_erase : update_dat.cs_erase;
   if (msg_send(handle->usb_handle, msg, 20)) {
-    fprintf(stderr, "\nErase failed!\n");
+    minipro_log("\nErase failed!\n");
     return EXIT_FAILURE;
   }
   memset(msg, 0, sizeof(msg));
   if (msg_recv(handle->usb_handle, msg, 32)) {
-    fprintf(stderr, "\nErase failed!\n");
+    minipro_log("\nErase failed!\n");
     return EXIT_FAILURE;
   }
   if (msg[0] != TL866A_BOOTLOADER_ERASE) {
-    fprintf(stderr, "failed\n");
+    minipro_log("failed\n");
     return EXIT_FAILURE;
   }
 
   // Reflash firmware
-  fprintf(stderr, "OK\n");
-  fprintf(stderr, "Reflashing TL866%s firmware... ",
-          version == MP_TL866A ? "A" : "CS");
-  fflush(stderr);
+  minipro_log("OK\n");
+  char status_msg[64], result[64];
+  char *model = version == MP_TL866A ? "A" : "CS";
+  sprintf(status_msg, "Reflashing TL866%s firmware... ", model);
+  sprintf(result, "Reflashing TL866%s firmware... 100%%", model);
 
   uint32_t address = TL866A_BOOTLOADER_SIZE;
   uint8_t *p_firmware = handle->version == MP_TL866A ? a_firmware : cs_firmware;
@@ -989,35 +981,32 @@ int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware) {
     memcpy(&msg[7], p_firmware + i, TL866A_FIRMWARE_BLOCK_SIZE);
 
     if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-      fprintf(stderr, "\nReflash... Failed\n");
+      minipro_log("\nReflash... Failed\n");
       return EXIT_FAILURE;
     }
     address += 64;  // next data block
-    fprintf(stderr, "\r\e[KReflashing TL866%s firmware...  %2d%%",
-            version == MP_TL866A ? "A" : "CS", i / 1935);
-    fflush(stderr);
+    minipro_progress(status_msg, i, TL866A_ENC_FIRMWARE_SIZE);
   }
-  fprintf(stderr, "\r\e[KReflashing TL866%s firmware... 100%%\n",
-          version == MP_TL866A ? "A" : "CS");
+  minipro_progress_end(status_msg, TL866A_ENC_FIRMWARE_SIZE, result);
 
   // Switching back to normal mode
-  fprintf(stderr, "Resetting device... ");
+  minipro_log("Resetting device... ");
   fflush(stderr);
   if (minipro_reset(handle)) {
-    fprintf(stderr, "failed!\n");
+    minipro_log("failed!\n");
     return EXIT_FAILURE;
   }
-  handle = minipro_open(NULL);
+  handle = minipro_open(handle->path, NULL);
   if (!handle) {
-    fprintf(stderr, "failed!\n");
+    minipro_log("failed!\n");
     return EXIT_FAILURE;
   }
-  fprintf(stderr, "OK\n");
+  minipro_log("OK\n");
   if (handle->status != MP_STATUS_NORMAL) {
-    fprintf(stderr, "Reflash... failed\n");
+    minipro_log("Reflash... failed\n");
     return EXIT_FAILURE;
   }
 
-  fprintf(stderr, "Reflash... OK\n");
+  minipro_log("Reflash... OK\n");
   return EXIT_SUCCESS;
 }
@@ -78,10 +78,10 @@ int tl866a_write_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
 int tl866a_erase(minipro_handle_t *handle);
 int tl866a_unlock_tsop48(minipro_handle_t *handle, uint8_t *status);
 int tl866a_hardware_check(minipro_handle_t *handle);
-int tl866a_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                           uint8_t row, size_t size);
-int tl866a_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                          uint8_t row, size_t size);
+int tl866a_write_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                            size_t count, jedec_row_cb done, void *context);
+int tl866a_read_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                           size_t count, jedec_row_cb done, void *context);
 int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware);
 
 #endif
@@ -23,8 +23,10 @@
 #include <unistd.h>
 #include <time.h>
 
+#include "checksum.h"
 #include "database.h"
 #include "minipro.h"
+#include "report.h"
 #include "tl866iiplus.h"
 #include "usb.h"
 
@@ -251,7 +253,7 @@ int tl866iiplus_begin_transaction(minipro_handle_t *handle) {
   if(msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
   if (tl866iiplus_get_ovc_status(handle, NULL, &ovc)) return EXIT_FAILURE;
    if (ovc) {
-     fprintf(stderr, "Overcurrent protection!\007\n");
+     minipro_log("Overcurrent protection!\007\n");
      return EXIT_FAILURE;
    }
    return EXIT_SUCCESS;
@@ -272,7 +274,7 @@ int tl866iiplus_read_block(minipro_handle_t *handle, uint8_t type,
   } else if (type == MP_DATA) {
     type = TL866IIPLUS_READ_DATA;
   } else {
-    fprintf(stderr, "Unknown type for read_block (%d)\n", type);
+    minipro_log("Unknown type for read_block (%d)\n", type);
     return EXIT_FAILURE;
   }
 
@@ -293,7 +295,7 @@ int tl866iiplus_write_block(minipro_handle_t *handle, uint8_t type,
   } else if (type == MP_DATA) {
     type = TL866IIPLUS_WRITE_DATA;
   } else {
-    fprintf(stderr, "Unknown type for write_block (%d)\n", type);
+    minipro_log("Unknown type for write_block (%d)\n", type);
     return EXIT_FAILURE;
   }
 
@@ -324,7 +326,7 @@ int tl866iiplus_read_fuses(minipro_handle_t *handle, uint8_t type,
   } else if (type == MP_FUSE_LOCK) {
     type = TL866IIPLUS_READ_LOCK;
   } else {
-    fprintf(stderr, "Unknown type for read_fuses (%d)\n", type);
+    minipro_log("Unknown type for read_fuses (%d)\n", type);
     return EXIT_FAILURE;
   }
 
@@ -351,7 +353,7 @@ int tl866iiplus_write_fuses(minipro_handle_t *handle, uint8_t type,
   } else if (type == MP_FUSE_LOCK) {
     type = TL866IIPLUS_WRITE_LOCK;
   } else {
-    fprintf(stderr, "Unknown type for write_fuses (%d)\n", type);
+    minipro_log("Unknown type for write_fuses (%d)\n", type);
   }
 
   memset(msg, 0, sizeof(msg));
@@ -475,30 +477,31 @@ int tl866iiplus_unlock_tsop48(minipro_handle_t *handle, uint8_t *status) {
   *status = msg[1];
   return EXIT_SUCCESS;
 }
-int tl866iiplus_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                                uint8_t row, size_t size) {
-  uint8_t msg[64];
-  memset(msg, 0, sizeof(msg));
-  msg[0] = TL866IIPLUS_WRITE_JEDEC;
+
+// Build the message of a jedec row
+static size_t jedec_msg(minipro_handle_t *handle, jedec_row_t *row, int write,
+                        uint8_t *msg) {
+  msg[0] = write ? TL866IIPLUS_WRITE_JEDEC : TL866IIPLUS_READ_JEDEC;
   msg[1] = handle->device->protocol_id;
-  msg[2] = size;
-  msg[4] = row;
-  memcpy(&msg[8], buffer, size / 8 + 1);
-  return msg_send(handle->usb_handle, msg, 64);
+  msg[2] = row->size;
+  msg[4] = row->row;
+  if (!write) return 8;
+  memcpy(&msg[8], row->buffer, row->size / 8 + 1);
+  return 64;
 }
 
-int tl866iiplus_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                               uint8_t row, size_t size) {
-  uint8_t msg[32];
-  memset(msg, 0, sizeof(msg));
-  msg[0] = TL866IIPLUS_READ_JEDEC;
-  msg[1] = handle->device->protocol_id;
-  msg[2] = size;
-  msg[4] = row;
-  if (msg_send(handle->usb_handle, msg, 8)) return EXIT_FAILURE;
-  if (msg_recv(handle->usb_handle, msg, 32)) return EXIT_FAILURE;
-  memcpy(buffer, msg, size / 8 + 1);
-  return EXIT_SUCCESS;
+int tl866iiplus_write_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                                 size_t count, jedec_row_cb done,
+                                 void *context) {
+  return minipro_jedec_batch(handle, rows, count, 1, 32, jedec_msg, done,
+                             context);
+}
+
+int tl866iiplus_read_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                                size_t count, jedec_row_cb done,
+                                void *context) {
+  return minipro_jedec_batch(handle, rows, count, 0, 32, jedec_msg, done,
+                             context);
 }
 
 /* Firmware updater section
@@ -528,12 +531,179 @@ The structure of each data block is as following:
 
 
 // Performing a firmware update
+/*
+ The UpdateII.dat file has a 1036 bytes header: the firmware version, the
+ file CRC, a 1024 bytes xor table and the blocks count. It is followed by
+ the 272 bytes firmware blocks and a 2064 bytes last block. Each block has
+ its CRC, a xor table pointer, the destination address, the xor table index
+ and 256 (2048 for the last block) bytes of data.
+ */
+#define UPDATE_DAT_HEADER 1036
+#define UPDATE_DAT_BLOCK 272
+
+/*
+ Firmware blocks in flight, sent but with their status not read yet. The
+ oldest status is read before the status of a new block is asked for, so
+ the bootloader must hold window - 1 replies in its endpoint buffer. The
+ window of 1 is the serial protocol of the vendor software, the one every
+ bootloader supports, and the default. MINIPRO_REFLASH_WINDOW overrides it
+ for a bootloader known to buffer more replies.
+ */
+#define TL866IIPLUS_REFLASH_WINDOW 1
+#define TL866IIPLUS_REFLASH_WINDOW_MAX 8
+
+/*
+ The LSB of each block destination address is obfuscated by xoring it with
+ a run of the xor table starting at the block xor pointer and wrapping
+ around. 'prefix' holds the running xor of two copies of the table so a
+ run is xored in one step.
+ */
+static uint8_t xor_run(uint8_t *prefix, uint32_t start, size_t length) {
+  uint8_t x = (length / 1024) & 1 ? prefix[1024] : 0;
+  start &= 0x3FF;
+  length %= 1024;
+  return x ^ prefix[start + length] ^ prefix[start];
+}
+
+// Check the file and block CRCs and deobfuscate the block addresses
+static int check_update_dat(const char *firmware, uint8_t *update_dat,
+                            size_t file_size, uint32_t *blocks_count) {
+  uint8_t prefix[2049];
+  uint32_t i, blocks, crc;
+  size_t ptr, size;
+
+  // Read the blocks count and check if correct
+  blocks = load_int(update_dat + 1032, 4, MP_LITTLE_ENDIAN);
+  if ((uint64_t)blocks * UPDATE_DAT_BLOCK + 3100 != file_size) {
+    minipro_log("%s file size error!\n", firmware);
+    return EXIT_FAILURE;
+  }
+
+  // Note the order in which the file crc is calculated: the data blocks,
+  // the last block, then the xor table and blocks count.
+  crc = crc32_update(0xFFFFFFFF, update_dat + UPDATE_DAT_HEADER,
+                     file_size - UPDATE_DAT_HEADER);
+  crc = crc32_update(crc, update_dat + 8, 1028);
+  // The computed CRC32 must match the File CRC from the offset 4
+  if (~crc != load_int(update_dat + 4, 4, MP_LITTLE_ENDIAN)) {
+    minipro_log("%s file CRC error!\n", firmware);
+    return EXIT_FAILURE;
+  }
+
+  prefix[0] = 0;
+  for (i = 0; i < 2048; i++)
+    prefix[i + 1] = prefix[i] ^ update_dat[(i & 0x3FF) + 8];
+
+  // The address is xored 264 times (2056 times for the last block), then
+  // each block crc is checked
+  ptr = UPDATE_DAT_HEADER;
+  for (i = 0; i <= blocks; i++) {
+    size = i < blocks ? 268 : 2060;
+    update_dat[ptr + 8] ^=
+        xor_run(prefix, load_int(update_dat + ptr + 4, 4, MP_LITTLE_ENDIAN),
+                size - 4);
+    if (crc32_update(0, update_dat + ptr + 4, size) !=
+        load_int(update_dat + ptr, 4, MP_LITTLE_ENDIAN)) {
+      minipro_log("%s block %u CRC error!\n", firmware, i + 1);
+      return EXIT_FAILURE;
+    }
+    ptr += UPDATE_DAT_BLOCK;
+  }
+  *blocks_count = blocks;
+  return EXIT_SUCCESS;
+}
+
+// Read the status reply of a firmware block
+static int reflash_status(minipro_handle_t *handle, uint8_t *update_dat,
+                          uint32_t block, uint32_t blocks) {
+  uint8_t msg[32];
+  memset(msg, 0, sizeof(msg));
+  if (msg_recv(handle->usb_handle, msg, sizeof(msg)) || msg[1]) {
+    minipro_log(
+        "\nReflash failed at block %u of %u (address 0x%08X)!\n", block + 1,
+        blocks + 1,
+        load_int(update_dat + UPDATE_DAT_HEADER + block * UPDATE_DAT_BLOCK + 8,
+                 4, MP_LITTLE_ENDIAN));
+    return EXIT_FAILURE;
+  }
+  minipro_progress("Reflashing... ", block, blocks + 1);
+  return EXIT_SUCCESS;
+}
+
+// Reflash window of the bootloader
+static uint32_t reflash_window(void) {
+  const char *env = getenv("MINIPRO_REFLASH_WINDOW");
+  long window;
+
+  if (!env) return TL866IIPLUS_REFLASH_WINDOW;
+  window = strtol(env, NULL, 0);
+  if (window < 1) return 1;
+  if (window > TL866IIPLUS_REFLASH_WINDOW_MAX)
+    return TL866IIPLUS_REFLASH_WINDOW_MAX;
+  return window;
+}
+
+// Read the status replies of the blocks up to 'requested', leaving the
+// 'keep' newest ones unread
+static int reflash_collect(minipro_handle_t *handle, uint8_t *update_dat,
+                           uint32_t *checked, uint32_t requested,
+                           uint32_t keep, uint32_t blocks) {
+  for (; requested - *checked > keep; (*checked)++)
+    if (reflash_status(handle, update_dat, *checked, blocks))
+      return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+// Send the firmware blocks, the last one included, with up to 'window'
+// blocks in flight
+static int reflash_blocks(minipro_handle_t *handle, uint8_t *update_dat,
+                          uint32_t blocks, uint32_t window) {
+  uint8_t msg[8];
+  uint32_t i, checked = 0;
+  size_t ptr, size;
+
+  for (i = 0; i <= blocks; i++) {
+    ptr = UPDATE_DAT_HEADER + i * UPDATE_DAT_BLOCK;
+    size = i < blocks ? 256 : 2048;
+    msg[0] = TL866IIPLUS_BOOTLOADER_WRITE;
+    msg[1] = i < blocks ? update_dat[ptr + 12] & 0x7F   // Xor table index
+                        : update_dat[ptr + 12] | 0x80;  // Last block
+    msg[2] = size & 0xFF;                                // Data Length LSB
+    msg[3] = size >> 8;                                  // Data length MSB
+    memcpy(&msg[4], &update_dat[ptr + 8], 4);            // Destination address
+
+    // Send the command to the endpoint 1 and the payload to the endpoints
+    // 2 and 3
+    if (msg_send(handle->usb_handle, msg, 8) ||
+        write_payload(handle->usb_handle, &update_dat[ptr + 16], size)) {
+      minipro_log("\nReflash failed at block %u of %u!\n", i + 1, blocks + 1);
+      return EXIT_FAILURE;
+    }
+
+    // Make room for the status of this block, ask for it, then read it
+    // at once if the window is full
+    if (reflash_collect(handle, update_dat, &checked, i,
+                        window > 1 ? window - 2 : 0, blocks))
+      return EXIT_FAILURE;
+    memset(msg, 0, sizeof(msg));
+    msg[0] = TL866IIPLUS_REQUEST_STATUS;
+    if (msg_send(handle->usb_handle, msg, 8)) {
+      minipro_log("\nReflash failed at block %u of %u!\n", i + 1, blocks + 1);
+      return EXIT_FAILURE;
+    }
+    if (reflash_collect(handle, update_dat, &checked, i + 1, window - 1,
+                        blocks))
+      return EXIT_FAILURE;
+  }
+  return reflash_collect(handle, update_dat, &checked, blocks + 1, 0, blocks);
+}
+
 int tl866iiplus_firmware_update(minipro_handle_t *handle,
                                 const char *firmware) {
-  uint8_t msg[264];
+  uint8_t msg[8];
   struct stat st;
   if (stat(firmware, &st)) {
-    fprintf(stderr, "%s open error!: ", firmware);
+    minipro_log("%s open error!: ", firmware);
     perror("");
     return EXIT_FAILURE;
   }
@@ -541,135 +711,60 @@ int tl866iiplus_firmware_update(minipro_handle_t *handle,
   off_t file_size = st.st_size;
   // Check the update.dat size
   if (file_size < 3100 || file_size > 1048576) {
-    fprintf(stderr, "%s file size error!\n", firmware);
+    minipro_log("%s file size error!\n", firmware);
     return EXIT_FAILURE;
   }
 
   // Open the update.dat firmware file
   FILE *file = fopen(firmware, "rb");
   if (file == NULL) {
-    fprintf(stderr, "%s open error!: ", firmware);
+    minipro_log("%s open error!: ", firmware);
     perror("");
     return EXIT_FAILURE;
   }
   uint8_t *update_dat = malloc(file_size);
   if (!update_dat) {
-    fprintf(stderr, "Out of memory!\n");
+    minipro_log("Out of memory!\n");
     fclose(file);
     return EXIT_FAILURE;
   }
 
   // Read the updateII.dat file
   if (fread(update_dat, sizeof(char), st.st_size, file) != st.st_size) {
-    fprintf(stderr, "%s file read error!\n", firmware);
+    minipro_log("%s file read error!\n", firmware);
     fclose(file);
     free(update_dat);
     return EXIT_FAILURE;
   }
   fclose(file);
 
-  // Read the blocks count and check if correct
-  uint32_t blocks = load_int(update_dat + 1032, 4, MP_LITTLE_ENDIAN);
-  if (blocks * 272 + 3100 != file_size) {
-    fprintf(stderr, "%s file size error!\n", firmware);
-    free(update_dat);
-    return EXIT_FAILURE;
-  }
-
-  // Compute the file CRC and compare
-  uint32_t crc = 0xFFFFFFFF;
-  // Note the order in which the crc is calculated!
-  // First the data blocks crc
-  if (blocks > 0) {
-    crc = crc32(update_dat + 1036, blocks * 272, crc);
-  }
-  // Second the last block crc
-  crc = crc32(update_dat + blocks * 272 + 1036, 2064, crc);
-  // And last the xortable+blocks_count crc
-  crc = crc32(update_dat + 8, 1028, crc);
-  // The computed CRC32 must match the File CRC from the offset 4
-  if (~crc != load_int(update_dat + 4, 4, MP_LITTLE_ENDIAN)) {
-    fprintf(stderr, "%s file CRC error!\n", firmware);
+  // Check the whole file before anything is sent to the programmer
+  uint32_t blocks;
+  if (check_update_dat(firmware, update_dat, file_size, &blocks)) {
     free(update_dat);
     return EXIT_FAILURE;
   }
 
-  /*
-   * Decrypting each data block (by deobfuscating the address)
-   */
-
-  size_t ptr = 1036;  // This is the offset of the first data block
-
-  // The updateII.dat contains a xor table of 1024 bytes length at the offset 8.
-  // This table is used to obfuscate the block address.
-  uint32_t xorptr;
-  for (uint32_t i = 0; i < blocks; i++) {
-    xorptr = load_int(update_dat + ptr + 4, 4,
-                      MP_LITTLE_ENDIAN);  // Load the xor table pointer
-
-    /*
-     * The destination address of each data block (offset 8) is obfuscated
-     * by xoring the LSB part of the address against a xortable 264 times (44*6)
-     */
-    for (uint32_t i = 0; i < 44; i++) {
-      update_dat[ptr + 8] ^= update_dat[(xorptr & 0x3FF) + 8];
-      update_dat[ptr + 8] ^= update_dat[((xorptr + 1) & 0x3FF) + 8];
-      update_dat[ptr + 8] ^= update_dat[((xorptr + 2) & 0x3FF) + 8];
-      update_dat[ptr + 8] ^= update_dat[((xorptr + 3) & 0x3FF) + 8];
-      update_dat[ptr + 8] ^= update_dat[((xorptr + 4) & 0x3FF) + 8];
-      update_dat[ptr + 8] ^= update_dat[((xorptr + 5) & 0x3FF) + 8];
-      xorptr += 6;
-    }
-    // After deobfuscating the address calculate the block crc and compare
-    if (crc32(update_dat + ptr + 4, 268, 0) !=
-        load_int(update_dat + ptr, 4, MP_LITTLE_ENDIAN)) {
-      fprintf(stderr, "%s file CRC error!\n", firmware);
-      free(update_dat);
-      return EXIT_FAILURE;
-    }
-    ptr += 272;
-  }
-
-  /*
-   * The last data block destination address is obfuscated
-   * by xoring the LSB part of the address against a xortable 2056 times (514*4)
-   */
-  xorptr = load_int(update_dat + ptr + 4, 4, MP_LITTLE_ENDIAN);
-  for (uint32_t i = 0; i < 514; i++) {
-    update_dat[ptr + 8] ^= update_dat[(xorptr & 0x3FF) + 8];
-    update_dat[ptr + 8] ^= update_dat[((xorptr + 1) & 0x3FF) + 8];
-    update_dat[ptr + 8] ^= update_dat[((xorptr + 2) & 0x3FF) + 8];
-    update_dat[ptr + 8] ^= update_dat[((xorptr + 3) & 0x3FF) + 8];
-    xorptr += 4;
-  }
-  // After deobfuscating the address calculate the block crc and compare
-  if (crc32(update_dat + ptr + 4, 2060, 0) !=
-      load_int(update_dat + ptr, 4, MP_LITTLE_ENDIAN)) {
-    fprintf(stderr, "%s file CRC error!\n", firmware);
-    free(update_dat);
-    return EXIT_FAILURE;
-  }
-
-  fprintf(stderr, "%s contains firmware version %u.%u.%u", firmware,
-          update_dat[1] >> 4, update_dat[1] & 0x0F, update_dat[0]);
+  minipro_log("%s contains firmware version %u.%u.%u", firmware,
+              update_dat[1] >> 4, update_dat[1] & 0x0F, update_dat[0]);
 
   if ((handle->firmware & 0xFF) > update_dat[0])
-    fprintf(stderr, " (older)");
+    minipro_log(" (older)");
   else if ((handle->firmware & 0xFF) < update_dat[0])
-    fprintf(stderr, " (newer)");
+    minipro_log(" (newer)");
 
-  fprintf(stderr, "\n\nDo you want to continue with firmware update? y/n:");
+  minipro_log("\n\nDo you want to continue with firmware update? y/n:");
   fflush(stderr);
   char c = getchar();
   if (c != 'Y' && c != 'y') {
     free(update_dat);
-    fprintf(stderr, "Firmware update aborted.\n");
+    minipro_log("Firmware update aborted.\n");
     return EXIT_FAILURE;
   }
 
   // Switching to boot mode if necessary
   if (handle->status == MP_STATUS_NORMAL) {
-    fprintf(stderr, "Switching to bootloader... ");
+    minipro_log("Switching to bootloader... ");
     fflush(stderr);
 
     memset(msg, 0, sizeof(msg));
@@ -680,258 +775,152 @@ int tl866iiplus_firmware_update(minipro_handle_t *handle,
       return EXIT_FAILURE;
     }
     if (minipro_reset(handle)) {
-      fprintf(stderr, "failed!\n");
+      minipro_log("failed!\n");
       free(update_dat);
       return EXIT_FAILURE;
     }
-    handle = minipro_open(NULL);
+    handle = minipro_open(handle->path, NULL);
     if (!handle) {
-      fprintf(stderr, "failed!\n");
+      minipro_log("failed!\n");
       free(update_dat);
       return EXIT_FAILURE;
     }
 
     if (handle->status == MP_STATUS_NORMAL) {
-      fprintf(stderr, "failed!\n");
+      minipro_log("failed!\n");
       free(update_dat);
       return EXIT_FAILURE;
     }
-    fprintf(stderr, "OK\n");
+    minipro_log("OK\n");
   }
 
   // Erase device
-  fprintf(stderr, "Erasing... ");
+  minipro_log("Erasing... ");
   fflush(stderr);
   memset(msg, 0, sizeof(msg));
   msg[0] = TL866IIPLUS_BOOTLOADER_ERASE;
   if (msg_send(handle->usb_handle, msg, 8)) {
-    fprintf(stderr, "\nErase failed!\n");
+    minipro_log("\nErase failed!\n");
     free(update_dat);
     return EXIT_FAILURE;
   }
   memset(msg, 0, sizeof(msg));
   if (msg_recv(handle->usb_handle, msg, 8)) {
-    fprintf(stderr, "\nErase failed!\n");
+    minipro_log("\nErase failed!\n");
     free(update_dat);
     return EXIT_FAILURE;
   }
   if (msg[0] != TL866IIPLUS_BOOTLOADER_ERASE) {
-    fprintf(stderr, "failed\n");
+    minipro_log("failed\n");
     free(update_dat);
     return EXIT_FAILURE;
   }
 
   // Reflash firmware
-  fprintf(stderr, "OK\n");
-  fprintf(stderr, "Reflashing... ");
-  fflush(stderr);
-
-  ptr = 1036;  // First firmware block
-  for (int i = 0; i < blocks; i++) {
-    msg[0] = TL866IIPLUS_BOOTLOADER_WRITE;
-    msg[1] = update_dat[ptr + 12] & 0x7F;         // Xor table index
-    msg[2] = 0;                                   // Data Length LSB
-    msg[3] = 1;                                   // Data length MSB (256 bytes)
-    memcpy(&msg[4], &update_dat[ptr + 8], 4);     // Destination address
-    memcpy(&msg[8], &update_dat[ptr + 16], 256);  // 256  bytes data
-
-    // Send the command to the endpoint 1
-    if (msg_send(handle->usb_handle, msg, 8)) {
-      fprintf(stderr, "\nReflash failed\n");
-      free(update_dat);
-      return EXIT_FAILURE;
-    }
-
-    // And the payload to the endpoints 2 and 3
-    if (write_payload(handle->usb_handle, msg + 8, 256)) {
-      fprintf(stderr, "\nReflash failed\n");
-      free(update_dat);
-      return EXIT_FAILURE;
-    }
-
-    // Check if the firmware block was successfully written
-    memset(msg, 0, sizeof(msg));
-    msg[0] = TL866IIPLUS_REQUEST_STATUS;
-    if (msg_send(handle->usb_handle, msg, 8)) {
-      fprintf(stderr, "\nReflash... Failed\n");
-      free(update_dat);
-      return EXIT_FAILURE;
-    }
-    memset(msg, 0, sizeof(msg));
-    if (msg_recv(handle->usb_handle, msg, 32)) {
-      fprintf(stderr, "\nReflash... Failed\n");
-      free(update_dat);
-      return EXIT_FAILURE;
-    }
-    if (msg[1]) {
-      fprintf(stderr, "\nReflash... Failed\n");
-      free(update_dat);
-      return EXIT_FAILURE;
-    }
-    ptr += 272;
-    fprintf(stderr, "\r\e[KReflashing... %2d%%", i * 100 / blocks);
-    fflush(stderr);
-  }
-
-  // Last firmware block
-  uint8_t block[2056];
-
-  block[0] = TL866IIPLUS_BOOTLOADER_WRITE;
-  block[1] = update_dat[ptr + 12] | 0x80;
-  block[2] = 0;
-  block[3] = 8;
-  memcpy(&block[4], &update_dat[ptr + 8], 4);
-  memcpy(&block[8], &update_dat[ptr + 16], 2048);
+  minipro_log("OK\n");
+  int ret = reflash_blocks(handle, update_dat, blocks, reflash_window());
   free(update_dat);
-
-  // Send the command to the endpoint 1
-  if (msg_send(handle->usb_handle, block, 8)) {
-    fprintf(stderr, "\nReflash failed\n");
-    return EXIT_FAILURE;
-  }
-
-  // And the payload to the endpoints 2 and 3
-  if (write_payload(handle->usb_handle, block + 8, 2048)) {
-    fprintf(stderr, "\nReflash failed\n");
-    return EXIT_FAILURE;
-  }
-
-  // Check if the firmware block was successfully written
-  memset(msg, 0, sizeof(msg));
-  msg[0] = TL866IIPLUS_REQUEST_STATUS;
-  if (msg_send(handle->usb_handle, msg, 8)) {
-    fprintf(stderr, "\nReflash failed!\n");
-    return EXIT_FAILURE;
-  }
-  memset(msg, 0, sizeof(msg));
-  if (msg_recv(handle->usb_handle, msg, 32)) {
-    fprintf(stderr, "\nReflash failed!\n");
-    return EXIT_FAILURE;
-  }
-  if (msg[1]) {
-    fprintf(stderr, "\nReflash... Failed\n");
-    return EXIT_FAILURE;
-  }
-  fprintf(stderr, "\r\e[KReflashing... 100%%\n");
+  if (ret) return EXIT_FAILURE;
+  minipro_progress_end("Reflashing... ", blocks + 1, "Reflashing... 100%");
 
   // Switching back to normal mode
-  fprintf(stderr, "Resetting device... ");
+  minipro_log("Resetting device... ");
   fflush(stderr);
   if (minipro_reset(handle)) {
-    fprintf(stderr, "failed!\n");
-    free(update_dat);
+    minipro_log("failed!\n");
     return EXIT_FAILURE;
   }
-  handle = minipro_open(NULL);
+  handle = minipro_open(handle->path, NULL);
   if (!handle) {
-    fprintf(stderr, "failed!\n");
-    free(update_dat);
+    minipro_log("failed!\n");
     return EXIT_FAILURE;
   }
-  fprintf(stderr, "OK\n");
+  minipro_log("OK\n");
   if (handle->status != MP_STATUS_NORMAL) {
-    fprintf(stderr, "Reflash... failed\n");
+    minipro_log("Reflash... failed\n");
     return EXIT_FAILURE;
   }
 
-  fprintf(stderr, "Reflash... OK\n");
+  minipro_log("Reflash... OK\n");
   return EXIT_SUCCESS;
 }
 
-int tl866iiplus_pin_test(minipro_handle_t *handle) {
-  uint8_t msg[48], pins[40];
+// Pin contact probe messages: setup, two reads and the ZIF socket reset
+#define TL866IIPLUS_CONTACT_MSGS 13
+#define TL866IIPLUS_CONTACT_DEPTH TL866IIPLUS_CONTACT_MSGS
+
+static void contact_msg(msg_exchange_t *exchange, uint8_t *msg, uint8_t command,
+                        uint8_t left, uint8_t right) {
+  memset(msg, 0, 48);
+  msg[0] = command;
+  memset(&msg[8], left, 20);
+  memset(&msg[28], right, 20);
+  exchange->command = msg;
+  exchange->command_size = 48;
+}
+
+/*
+ Probe the contact of the ZIF socket pins. The pins a device drives to
+ zero are set as outputs and the other ones are read once with the left
+ side pulled down, once with the right side pulled down, so that a pin
+ making contact with the chip reads high through its protection diodes.
+ All the messages are sent as one pipelined batch.
+ */
+int tl866iiplus_pin_contact(minipro_handle_t *handle, uint64_t *contact) {
+  uint8_t msgs[TL866IIPLUS_CONTACT_MSGS][48], pins[2][48];
+  msg_exchange_t exchanges[TL866IIPLUS_CONTACT_MSGS];
+  msg_exchange_t *exchange = exchanges;
+  uint32_t i;
 
-  // Get the chip pin mask for testing
+  // Get the chip pin map for testing
   pin_map_t *map = get_pin_map(handle->device->opts8 & 0xFF);
   if (!map) return EXIT_FAILURE;
 
-  // Set the desired output pins
-  msg[0] = TL866IIPLUS_SET_DIR;
-  memset(&msg[8], 0x01, 40);
-  if (map->zero_c) {
-    for (uint32_t i = 0; i < (map->zero_c & 0x03); i++) {
-      msg[map->zero_t[i] + 8] = 0;
-    }
-  }
-  // Set the ZIF socket pins direction
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Set output pins to logic one
-  msg[0] = TL866IIPLUS_SET_OUT;
-  memset(&msg[8], 0x01, 40);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Enable right side ZIF socket pull-up resistors
-  msg[0] = TL866IIPLUS_SET_PULLUPS;
-  memset(&msg[28], 0x00, 20);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Enable left side ZIF socket pull-down resistors
-  msg[0] = TL866IIPLUS_SET_PULLDOWNS;
-  memset(&msg[8], 0x00, 20);
-  memset(&msg[28], 0x01, 20);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Read ZIF socket pins and save the left side pins status
-  msg[0] = TL866IIPLUS_READ_PINS;
-  if (msg_send(handle->usb_handle, msg, 8)) return EXIT_FAILURE;
-  if (msg_recv(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-  memcpy(pins, &msg[8], 20);
-
-  // Enable left side ZIF socket pull-up resistors
-  msg[0] = TL866IIPLUS_SET_PULLUPS;
-  memset(&msg[8], 0x00, 20);
-  memset(&msg[28], 0x01, 20);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Enable right side ZIF socket pull-down resistors
-  msg[0] = TL866IIPLUS_SET_PULLDOWNS;
-  memset(&msg[8], 0x01, 20);
-  memset(&msg[28], 0x00, 20);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Read ZIF socket pins and save the right side pins status
-  msg[0] = TL866IIPLUS_READ_PINS;
-  if (msg_send(handle->usb_handle, msg, 8)) return EXIT_FAILURE;
-  if (msg_recv(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-  memcpy(&pins[20], &msg[28], 20);
-
-  // Set output pins to logic zero
-  msg[0] = TL866IIPLUS_SET_OUT;
-  memset(&msg[8], 0x00, 40);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Reset ZIF socket pins direction
-  msg[0] = TL866IIPLUS_SET_DIR;
-  memset(&msg[8], 0x01, 40);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Reset pull-ups
-  msg[0] = TL866IIPLUS_SET_PULLUPS;
-  memset(&msg[8], 0x01, 40);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // Reset pull-downs
-  msg[0] = TL866IIPLUS_SET_PULLDOWNS;
-  memset(&msg[8], 0x00, 40);
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
-
-  // End of transaction
-  msg[0] = TL866IIPLUS_END_TRANS;
-  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
+  memset(exchanges, 0, sizeof(exchanges));
+  memset(pins, 0, sizeof(pins));
+  // Set the desired output pins to logic one
+  contact_msg(exchange, msgs[0], TL866IIPLUS_SET_DIR, 0x01, 0x01);
+  for (i = 0; i < (map->zero_c & 0x03); i++) msgs[0][map->zero_t[i] + 8] = 0;
+  exchange++;
+  contact_msg(exchange++, msgs[1], TL866IIPLUS_SET_OUT, 0x01, 0x01);
+
+  // Right side pull-ups and left side pull-downs, read the left side
+  contact_msg(exchange++, msgs[2], TL866IIPLUS_SET_PULLUPS, 0x01, 0x00);
+  contact_msg(exchange++, msgs[3], TL866IIPLUS_SET_PULLDOWNS, 0x00, 0x01);
+  contact_msg(exchange, msgs[4], TL866IIPLUS_READ_PINS, 0x00, 0x00);
+  exchange->command_size = 8;
+  exchange->response = pins[0];
+  exchange->response_size = sizeof(pins[0]);
+  exchange->response_min = 8 + 20;  // up to the left side pins
+  exchange++;
+
+  // Left side pull-ups and right side pull-downs, read the right side
+  contact_msg(exchange++, msgs[5], TL866IIPLUS_SET_PULLUPS, 0x00, 0x01);
+  contact_msg(exchange++, msgs[6], TL866IIPLUS_SET_PULLDOWNS, 0x01, 0x00);
+  contact_msg(exchange, msgs[7], TL866IIPLUS_READ_PINS, 0x00, 0x00);
+  exchange->command_size = 8;
+  exchange->response = pins[1];
+  exchange->response_size = sizeof(pins[1]);
+  exchange->response_min = 8 + 40;  // up to the right side pins
+  exchange++;
+
+  // Reset the outputs, directions, pull-ups and pull-downs
+  contact_msg(exchange++, msgs[8], TL866IIPLUS_SET_OUT, 0x00, 0x00);
+  contact_msg(exchange++, msgs[9], TL866IIPLUS_SET_DIR, 0x01, 0x01);
+  contact_msg(exchange++, msgs[10], TL866IIPLUS_SET_PULLUPS, 0x01, 0x01);
+  contact_msg(exchange++, msgs[11], TL866IIPLUS_SET_PULLDOWNS, 0x00, 0x00);
+  contact_msg(exchange++, msgs[12], TL866IIPLUS_END_TRANS, 0x00, 0x00);
+
+  if (msg_batch(handle->usb_handle, exchanges, TL866IIPLUS_CONTACT_MSGS,
+                TL866IIPLUS_CONTACT_DEPTH, NULL, NULL))
+    return EXIT_FAILURE;
 
-  // Now check for bad pin contact
-  int ret = EXIT_SUCCESS;
-  for (uint32_t i = 0; i < 40; i++) {
-    if (map->mask[i]) {
-      if (!pins[i]) {
-        fprintf(stderr, "Bad contact on pin:%u\n", i + 1);
-        ret = EXIT_FAILURE;
-      }
-    }
+  *contact = 0;
+  for (i = 0; i < 20; i++) {
+    if (pins[0][8 + i]) *contact |= 1ULL << i;
+    if (pins[1][28 + i]) *contact |= 1ULL << (20 + i);
   }
-  if (!ret) fprintf(stderr, "Pin test passed.\n");
-  return ret;
+  return EXIT_SUCCESS;
 }
 
 static int init_zif(minipro_handle_t *handle, uint8_t pullup) {
@@ -958,126 +947,148 @@ static int init_zif(minipro_handle_t *handle, uint8_t pullup) {
   return EXIT_SUCCESS;
 }
 
-// TL866II+ hardware check
-int tl866iiplus_hardware_check(minipro_handle_t *handle) {
+enum { PIN_OK, PIN_BAD, PIN_OVERCURRENT };
+
+// A kind of pin driver and the level it forces on an idle ZIF pin
+typedef struct driver_test_s {
+  const char *name;
+  const char *key;  // JSON report key
+  uint8_t command;
+  uint8_t pullup;  // init_zif() pull-up setting
+  uint8_t level;   // expected pin level
+  zif_pins_t *pins;
+  size_t count;
+} driver_test_t;
+
+static driver_test_t driver_tests[] = {
+    {"VPP", "vpp", TL866IIPLUS_SET_VPP_PIN, 1, 1, vpp_pins,
+     sizeof(vpp_pins) / sizeof(vpp_pins[0])},
+    {"VCC", "vcc", TL866IIPLUS_SET_VCC_PIN, 1, 1, vcc_pins,
+     sizeof(vcc_pins) / sizeof(vcc_pins[0])},
+    {"GND", "gnd", TL866IIPLUS_SET_GND_PIN, 0, 0, gnd_pins,
+     sizeof(gnd_pins) / sizeof(gnd_pins[0])}};
+
+/*
+ Switch on a group of drivers (indexes in the pin table) at once and read
+ the ZIF socket back. A failing group is split in halves until the faulty
+ drivers are found, so a healthy programmer costs one read per group.
+ */
+static int test_driver_group(minipro_handle_t *handle, driver_test_t *test,
+                             uint8_t *group, size_t count, uint8_t *result) {
   uint8_t msg[48], read_buffer[48];
-  uint8_t i, errors = 0;
+  size_t i, half = count / 2;
+  int failed = 0;
 
   memset(msg, 0, sizeof(msg));
+  msg[0] = test->command;
+  for (i = 0; i < count; i++)
+    msg[test->pins[group[i]].byte] |= test->pins[group[i]].mask;
+  if (msg_send(handle->usb_handle, msg, sizeof(msg))) return EXIT_FAILURE;
+  usleep(5000);
+  msg[0] = TL866IIPLUS_READ_PINS;
+  if (msg_send(handle->usb_handle, msg, 8)) return EXIT_FAILURE;
+  if (msg_recv(handle->usb_handle, read_buffer, sizeof(read_buffer)))
+    return EXIT_FAILURE;
 
-  // Testing 21 VPP pin drivers
-
-  // Init ZIF socket, no pull-up resistors
-  if (init_zif(handle, 1)) return EXIT_FAILURE;
-
-  for (i = 0; i < 21; i++) {
-    memset(&msg[8], 0, 40);
-    msg[0] = TL866IIPLUS_SET_VPP_PIN;
-    msg[vpp_pins[i].byte] = vpp_pins[i].mask;  // set the vpp pin
-
-    if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-      minipro_close(handle);
-      return EXIT_FAILURE;
-    }
-    usleep(5000);
-    msg[0] = TL866IIPLUS_READ_PINS;
-    if (msg_send(handle->usb_handle, msg, 8)) {
-      return EXIT_FAILURE;
-    }
-    if (msg_recv(handle->usb_handle, read_buffer, sizeof(read_buffer)))
-      return EXIT_FAILURE;
-    if (read_buffer[1]) {
-      msg[0] = TL866IIPLUS_RESET_PIN_DRIVERS;
-      if (msg_send(handle->usb_handle, msg, 8)) {
-        return EXIT_FAILURE;
+  if (read_buffer[1]) {
+    // The protection latches, reset the drivers before going on
+    if (init_zif(handle, test->pullup)) return EXIT_FAILURE;
+    for (i = 0; i < count; i++) result[group[i]] = PIN_OVERCURRENT;
+    failed = 1;
+  } else {
+    for (i = 0; i < count; i++) {
+      if ((read_buffer[7 + test->pins[group[i]].pin] != 0) == test->level) {
+        result[group[i]] = PIN_OK;
+      } else {
+        result[group[i]] = PIN_BAD;
+        failed = 1;
       }
-      fprintf(stderr,
-              "Overcurrent protection detected while testing VPP pin driver "
-              "%u!\007\n",
-              vpp_pins[i].pin);
-      return EXIT_FAILURE;
     }
-    if (!read_buffer[7 + vpp_pins[i].pin]) errors++;
-    fprintf(stderr, "VPP driver pin %u is %s\n", vpp_pins[i].pin,
-            read_buffer[7 + vpp_pins[i].pin] ? "OK" : "Bad");
   }
-  fprintf(stderr, "\n");
-
-  // Testing 32 VCC pin drivers
-
-  // Init ZIF socket, no pull-up resistors
-  if (init_zif(handle, 1)) return EXIT_FAILURE;
-
-  for (i = 0; i < 32; i++) {
-    memset(&msg[8], 0, 40);
-    msg[0] = TL866IIPLUS_SET_VCC_PIN;
-    msg[vcc_pins[i].byte] = vcc_pins[i].mask;  // set the vcc pin
+  if (!failed || count == 1) return EXIT_SUCCESS;
+  if (test_driver_group(handle, test, group, half, result) ||
+      test_driver_group(handle, test, group + half, count - half, result))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
 
-    if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-      minipro_close(handle);
-      return EXIT_FAILURE;
-    }
-    usleep(5000);
-    msg[0] = TL866IIPLUS_READ_PINS;
-    if (msg_send(handle->usb_handle, msg, 8)) {
-      return EXIT_FAILURE;
-    }
-    if (msg_recv(handle->usb_handle, read_buffer, sizeof(read_buffer)))
-      return EXIT_FAILURE;
-    if (read_buffer[1]) {
-      msg[0] = TL866IIPLUS_RESET_PIN_DRIVERS;
-      if (msg_send(handle->usb_handle, msg, 8)) {
-        return EXIT_FAILURE;
-      }
-      fprintf(stderr,
-              "Overcurrent protection detected while testing VCC pin driver "
-              "%u!\007\n",
-              vcc_pins[i].pin);
+/*
+ Neighbouring ZIF pins are the likely solder bridges, and a bridged pin
+ would read the level of a working neighbour. Odd and even pins are
+ therefore tested as two separate groups.
+ */
+static int test_drivers(minipro_handle_t *handle, driver_test_t *test,
+                        uint8_t *result) {
+  uint8_t group[40];
+  size_t i, count;
+  uint8_t parity;
+
+  if (init_zif(handle, test->pullup)) return EXIT_FAILURE;
+  for (parity = 0; parity < 2; parity++) {
+    for (i = 0, count = 0; i < test->count; i++)
+      if ((test->pins[i].pin & 1) == parity) group[count++] = i;
+    if (test_driver_group(handle, test, group, count, result))
       return EXIT_FAILURE;
-    }
-    if (!read_buffer[7 + vcc_pins[i].pin]) errors++;
-    fprintf(stderr, "VCC driver pin %u is %s\n", vcc_pins[i].pin,
-            read_buffer[7 + vcc_pins[i].pin] ? "OK" : "Bad");
   }
-  fprintf(stderr, "\n");
+  return EXIT_SUCCESS;
+}
 
-  // Testing 34 GND pin drivers
+// Add the hardware check to the JSON events
+static void report_hardware_check(minipro_handle_t *handle,
+                                  uint8_t results[][40], uint8_t *ocp,
+                                  unsigned int errors) {
+  const char *status[] = {"ok", "bad", "overcurrent"};
+  FILE *file = report_line_begin();
+  size_t i, j;
+
+  if (!file) return;
+  fprintf(file, "\"phase\":\"hardware_check\",\"programmer\":");
+  report_string(file, handle->model);
+  fprintf(file, ",\"firmware\":");
+  report_string(file, handle->firmware_str);
+  fprintf(file, ",\"serial\":");
+  report_string(file, handle->serial_number);
+  fprintf(file, ",\"result\":\"%s\"", errors ? "failed" : "ok");
+  for (i = 0; i < 3; i++) {
+    fprintf(file, ",\"%s\":[", driver_tests[i].key);
+    for (j = 0; j < driver_tests[i].count; j++)
+      fprintf(file, "%s{\"pin\":%u,\"status\":\"%s\"}", j ? "," : "",
+              driver_tests[i].pins[j].pin, status[results[i][j]]);
+    fprintf(file, "]");
+  }
+  fprintf(file, ",\"vpp_overcurrent_protection\":%s",
+          ocp[0] ? "true" : "false");
+  fprintf(file, ",\"vcc_overcurrent_protection\":%s",
+          ocp[1] ? "true" : "false");
+  fprintf(file, ",\"errors\":%u", errors);
+  report_line_end();
+}
 
-  // Init ZIF socket, active pull-up resistors
-  if (init_zif(handle, 0)) return EXIT_FAILURE;
+// TL866II+ hardware check
+int tl866iiplus_hardware_check(minipro_handle_t *handle) {
+  uint8_t msg[48], read_buffer[48];
+  uint8_t results[3][40], ocp[2];
+  unsigned int errors = 0, bad;
+  size_t i, j;
 
-  for (i = 0; i < 34; i++) {
-    memset(&msg[8], 0, 40);
-    msg[0] = TL866IIPLUS_SET_GND_PIN;
-    msg[gnd_pins[i].byte] = gnd_pins[i].mask;  // set the gnd pin
+  memset(msg, 0, sizeof(msg));
 
-    if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-      minipro_close(handle);
+  // Testing the 21 VPP, 32 VCC and 34 GND pin drivers
+  for (i = 0; i < 3; i++) {
+    if (test_drivers(handle, &driver_tests[i], results[i]))
       return EXIT_FAILURE;
+    for (j = 0, bad = 0; j < driver_tests[i].count; j++) {
+      if (results[i][j] == PIN_OK) continue;
+      minipro_log("%s driver pin %u is %s\n", driver_tests[i].name,
+                  driver_tests[i].pins[j].pin,
+                  results[i][j] == PIN_BAD ? "Bad" : "overcurrent!\007");
+      bad++;
     }
-    usleep(5000);
-    msg[0] = TL866IIPLUS_READ_PINS;
-    if (msg_send(handle->usb_handle, msg, 8)) {
-      return EXIT_FAILURE;
-    }
-    if (msg_recv(handle->usb_handle, read_buffer, sizeof(read_buffer)))
-      return EXIT_FAILURE;
-    if (read_buffer[1]) {
-      msg[0] = TL866IIPLUS_RESET_PIN_DRIVERS;
-      if (msg_send(handle->usb_handle, msg, 8)) {
-        return EXIT_FAILURE;
-      }
-      fprintf(stderr,
-              "Overcurrent protection detected while testing GND pin driver "
-              "%u!\007\n",
-              gnd_pins[i].pin);
-      return EXIT_FAILURE;
-    }
-    if (read_buffer[7 + gnd_pins[i].pin]) errors++;
-    fprintf(stderr, "GND driver pin %u is %s\n", gnd_pins[i].pin,
-            read_buffer[7 + gnd_pins[i].pin] ? "Bad" : "OK");
+    minipro_log("%s pin drivers: %zu of %zu OK\n", driver_tests[i].name,
+                driver_tests[i].count - bad, driver_tests[i].count);
+    errors += bad;
   }
-  fprintf(stderr, "\n\n");
+  minipro_log("\n");
 
   // Testing VPP overcurrent protection
 
@@ -1113,10 +1124,11 @@ int tl866iiplus_hardware_check(minipro_handle_t *handle) {
   if (msg_recv(handle->usb_handle, read_buffer, sizeof(read_buffer))) {
     return EXIT_FAILURE;
   }
-  if (read_buffer[1]) {
-    fprintf(stderr, "VPP overcurrent protection is OK.\n");
+  ocp[0] = read_buffer[1] != 0;
+  if (ocp[0]) {
+    minipro_log("VPP overcurrent protection is OK.\n");
   } else {
-    fprintf(stderr, "VPP overcurrent protection failed!\007\n");
+    minipro_log("VPP overcurrent protection failed!\007\n");
     errors++;
   }
 
@@ -1162,18 +1174,19 @@ int tl866iiplus_hardware_check(minipro_handle_t *handle) {
   if (msg_recv(handle->usb_handle, read_buffer, sizeof(read_buffer))) {
     return EXIT_FAILURE;
   }
-  if (read_buffer[1]) {
-    fprintf(stderr, "VCC overcurrent protection is OK.\n");
+  ocp[1] = read_buffer[1] != 0;
+  if (ocp[1]) {
+    minipro_log("VCC overcurrent protection is OK.\n");
   } else {
-    fprintf(stderr, "VCC overcurrent protection failed!\007\n");
+    minipro_log("VCC overcurrent protection failed!\007\n");
     errors++;
   }
 
   if (errors)
-    fprintf(stderr, "\nHardware test completed with %u error(s).\007\n",
-            errors);
+    minipro_log("\nHardware test completed with %u error(s).\007\n", errors);
   else
-    fprintf(stderr, "\nHardware test completed successfully!\n");
+    minipro_log("\nHardware test completed successfully!\n");
+  report_hardware_check(handle, results, ocp, errors);
 
   // Reset pin drivers
   msg[0] = TL866IIPLUS_RESET_PIN_DRIVERS;
@@ -42,11 +42,13 @@ int tl866iiplus_write_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
                             uint8_t items_count, uint8_t *buffer);
 int tl866iiplus_erase(minipro_handle_t *handle);
 int tl866iiplus_unlock_tsop48(minipro_handle_t *handle, uint8_t *status);
-int tl866iiplus_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                                uint8_t row, size_t size);
-int tl866iiplus_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
-                               uint8_t row, size_t size);
+int tl866iiplus_write_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                                 size_t count, jedec_row_cb done,
+                                 void *context);
+int tl866iiplus_read_jedec_rows(minipro_handle_t *handle, jedec_row_t *rows,
+                                size_t count, jedec_row_cb done,
+                                void *context);
 int tl866iiplus_hardware_check(minipro_handle_t *handle);
 int tl866iiplus_firmware_update(minipro_handle_t *handle, const char *firmware);
-int tl866iiplus_pin_test(minipro_handle_t *handle);
+int tl866iiplus_pin_contact(minipro_handle_t *handle, uint64_t *contact);
 #endif
@@ -20,12 +20,42 @@
 
 #include <stdint.h>
 
-void *usb_open();
+#define USB_PATH_SIZE 256
+
+// A programmer attached to the host
+typedef struct usb_device {
+  uint8_t version;           // MP_TL866A or MP_TL866IIPLUS
+  char path[USB_PATH_SIZE];  // bus-port.port path, device path on Windows
+} usb_device_t;
+
+// Transfers done on a programmer since it was opened
+typedef struct usb_counters {
+  uint64_t transfers;  // bulk transfers submitted
+  uint64_t retries;    // transfer waits interrupted and resumed
+} usb_counters_t;
+
+int usb_list_devices(usb_device_t **devices);
+void *usb_open(const char *path);
+void usb_get_path(void *usb_handle, char *path);
+void usb_get_counters(void *usb_handle, usb_counters_t *counters);
 int usb_close(void *usb_handle);
 int minipro_get_devices_count(uint8_t version);
 
+// A command sent on the message endpoint and its optional response
+typedef struct msg_exchange {
+  uint8_t *command;
+  size_t command_size;
+  uint8_t *response;  // NULL if the command has no response
+  size_t response_size;
+  size_t response_min;  // Shorter responses are an error
+} msg_exchange_t;
+
+typedef void (*msg_done_cb)(void *context, size_t index);
+
 int msg_send(void *handle, uint8_t *buffer, size_t size);
 int msg_recv(void *handle, uint8_t *buffer, size_t size);
 int write_payload(void *handle, uint8_t *buffer, size_t length);
 int read_payload(void *handle, uint8_t *buffer, size_t length);
+int msg_batch(void *handle, msg_exchange_t *exchanges, size_t count,
+              size_t depth, msg_done_cb done, void *context);
 #endif
@@ -20,78 +20,190 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "minipro.h"
 #include "usb.h"
 
 #define MP_TL866_VID 0x04d8
 #define MP_TL866_PID 0xe11c
 #define MP_TL866II_VID 0xa466
 #define MP_TL866II_PID 0x0a53
+#define MP_TL866A 1
 #define MP_TL866IIPLUS 5
 #define MP_USBTIMEOUT 5000
 #define MP_USB_READ_TIMEOUT 360000
 
-// Open usb device
-void *usb_open() {
-  int ret = libusb_init(NULL);
+// An open programmer with its own libusb context, so that programmers
+// driven from different threads never share an event loop
+typedef struct usb_handle {
+  libusb_context *context;
+  libusb_device_handle *device;
+  usb_counters_t counters;
+} usb_handle_t;
+
+// Programmer version from the VID/PID of a device, 0 if not a programmer
+static uint8_t device_version(libusb_device *device) {
+  struct libusb_device_descriptor desc;
+  if (libusb_get_device_descriptor(device, &desc) < 0) return 0;
+  if (desc.idVendor == MP_TL866_VID && desc.idProduct == MP_TL866_PID)
+    return MP_TL866A;
+  if (desc.idVendor == MP_TL866II_VID && desc.idProduct == MP_TL866II_PID)
+    return MP_TL866IIPLUS;
+  return 0;
+}
+
+// Bus path of a device as in sysfs, e.g. 1-2.4
+static void device_path(libusb_device *device, char *path) {
+  uint8_t ports[8];
+  int count = libusb_get_port_numbers(device, ports, sizeof(ports));
+  int size = snprintf(path, USB_PATH_SIZE, "%u", libusb_get_bus_number(device));
+  for (int i = 0; i < count; i++)
+    size += snprintf(path + size, USB_PATH_SIZE - size, "%c%u", i ? '.' : '-',
+                     ports[i]);
+}
+
+// List the attached programmers, the TL866A/CS ones first
+int usb_list_devices(usb_device_t **devices) {
+  libusb_context *context;
+  libusb_device **devs;
+  uint8_t versions[] = {MP_TL866A, MP_TL866IIPLUS};
+  int i, count, found = 0;
+
+  int ret = libusb_init(&context);
   if (ret < 0) {
-    fprintf(stderr, "Error initializing libusb: %s\n", libusb_error_name(ret));
-    return NULL;
+    minipro_log("Error initializing libusb: %s\n", libusb_error_name(ret));
+    return -1;
+  }
+  count = libusb_get_device_list(context, &devs);
+  if (count < 0) {
+    libusb_exit(context);
+    return -1;
+  }
+  *devices = calloc(count ? count : 1, sizeof(usb_device_t));
+  if (!*devices) {
+    minipro_log("Out of memory!\n");
+    libusb_free_device_list(devs, 1);
+    libusb_exit(context);
+    return -1;
   }
 
-  void *usb_handle =
-      libusb_open_device_with_vid_pid(NULL, MP_TL866_VID, MP_TL866_PID);
-  if (usb_handle == NULL) {
-    // We didn't match the vid / pid of the "original" TL866 - so try the new
-    // TL866II+
-    usb_handle =
-        libusb_open_device_with_vid_pid(NULL, MP_TL866II_VID, MP_TL866II_PID);
+  for (size_t v = 0; v < sizeof(versions); v++) {
+    for (i = 0; i < count; i++) {
+      if (device_version(devs[i]) != versions[v]) continue;
+      (*devices)[found].version = versions[v];
+      device_path(devs[i], (*devices)[found].path);
+      found++;
+    }
+  }
+  libusb_free_device_list(devs, 1);
+  libusb_exit(context);
+  return found;
+}
 
-    // If we don't get that either report error in connecting
-    if (usb_handle == NULL) {
-      libusb_exit(NULL);
-      fprintf(stderr, "\nError opening device\n");
-      return NULL;
+/*
+ Open the programmer at the given bus path, or the first one not in use
+ by another process if path is NULL.
+ */
+void *usb_open(const char *path) {
+  libusb_context *context;
+  libusb_device **devs;
+  libusb_device_handle *device_handle = NULL;
+  usb_handle_t *usb_handle;
+  uint8_t versions[] = {MP_TL866A, MP_TL866IIPLUS};
+  char device[USB_PATH_SIZE];
+  int i, count;
+
+  int ret = libusb_init(&context);
+  if (ret < 0) {
+    minipro_log("Error initializing libusb: %s\n", libusb_error_name(ret));
+    return NULL;
+  }
+  count = libusb_get_device_list(context, &devs);
+  if (count < 0) count = 0;
+
+  for (size_t v = 0; v < sizeof(versions) && !device_handle; v++) {
+    for (i = 0; i < count && !device_handle; i++) {
+      if (device_version(devs[i]) != versions[v]) continue;
+      device_path(devs[i], device);
+      if (path && strcmp(path, device)) continue;
+      if (libusb_open(devs[i], &device_handle)) {
+        device_handle = NULL;
+        continue;
+      }
+      ret = libusb_claim_interface(device_handle, 0);
+      if (ret != 0) {
+        libusb_close(device_handle);
+        device_handle = NULL;
+        // Claimed by another minipro, try the next programmer
+        if (ret == LIBUSB_ERROR_BUSY && !path) continue;
+        if (ret == LIBUSB_ERROR_BUSY)
+          minipro_log("\nProgrammer %s is in use!\n", path);
+        else
+          minipro_log("\nIO error: claim_interface: %s\n",
+                      libusb_error_name(ret));
+        libusb_free_device_list(devs, 1);
+        libusb_exit(context);
+        return NULL;
+      }
     }
   }
+  if (count) libusb_free_device_list(devs, 1);
 
-  ret = libusb_claim_interface(usb_handle, 0);
-  if (ret != 0) {
-    fprintf(stderr, "\nIO error: claim_interface: %s\n",
-            libusb_error_name(ret));
-    libusb_close(usb_handle);
-    libusb_exit(NULL);
+  if (!device_handle) {
+    libusb_exit(context);
+    minipro_log("\nError opening device\n");
     return NULL;
   }
+  usb_handle = calloc(1, sizeof(usb_handle_t));
+  if (!usb_handle) {
+    minipro_log("Out of memory!\n");
+    libusb_release_interface(device_handle, 0);
+    libusb_close(device_handle);
+    libusb_exit(context);
+    return NULL;
+  }
+  usb_handle->context = context;
+  usb_handle->device = device_handle;
   return usb_handle;
 }
 
+// Bus path of an open programmer
+void usb_get_path(void *usb_handle, char *path) {
+  device_path(libusb_get_device(((usb_handle_t *)usb_handle)->device), path);
+}
+
+void usb_get_counters(void *usb_handle, usb_counters_t *counters) {
+  *counters = ((usb_handle_t *)usb_handle)->counters;
+}
+
 // Close usb device
 int usb_close(void *usb_handle) {
+  usb_handle_t *usb = usb_handle;
   int ret = EXIT_SUCCESS;
-  ret = libusb_release_interface(usb_handle, 0);
+  ret = libusb_release_interface(usb->device, 0);
   if (ret != 0 && ret != LIBUSB_ERROR_NO_DEVICE) {
-    fprintf(stderr, "\nIO error: release_interface: %s\n",
-            libusb_error_name(ret));
+    minipro_log("\nIO error: release_interface: %s\n", libusb_error_name(ret));
     ret = EXIT_FAILURE;
   }
-  libusb_close(usb_handle);
-  libusb_exit(NULL);
+  libusb_close(usb->device);
+  libusb_exit(usb->context);
+  free(usb);
   return ret;
 }
 
 // Get no. of devices connected
 int minipro_get_devices_count(uint8_t version) {
+  libusb_context *context;
   libusb_device **devs;
   int devices = 0;
 
   uint16_t PID = version == MP_TL866IIPLUS ? MP_TL866II_PID : MP_TL866_PID;
   uint16_t VID = version == MP_TL866IIPLUS ? MP_TL866II_VID : MP_TL866_VID;
 
-  if (libusb_init(NULL) < 0) return 0;
+  if (libusb_init(&context) < 0) return 0;
 
-  int count = libusb_get_device_list(NULL, &devs);
+  int count = libusb_get_device_list(context, &devs);
   if (count < 0) {
-    libusb_exit(NULL);
+    libusb_exit(context);
     return 0;
   }
 
@@ -100,7 +212,7 @@ int minipro_get_devices_count(uint8_t version) {
     int ret = libusb_get_device_descriptor(devs[i], &desc);
     if (ret < 0) {
       libusb_free_device_list(devs, 1);
-      libusb_exit(NULL);
+      libusb_exit(context);
       return 0;
     }
     if (desc.idProduct == PID && desc.idVendor == VID) {
@@ -108,7 +220,7 @@ int minipro_get_devices_count(uint8_t version) {
     }
   }
   libusb_free_device_list(devs, 1);
-  libusb_exit(NULL);
+  libusb_exit(context);
   return devices;
 }
 
@@ -122,17 +234,20 @@ static void payload_transfer_cb(struct libusb_transfer *transfer) {
 static int msg_transfer(void *handle, uint8_t *buffer, size_t size,
                         uint8_t direction, uint8_t endpoint,
                         int *bytes_transferred, uint32_t timeout) {
-  int ret = libusb_bulk_transfer(handle, (endpoint | direction), buffer, size,
+  ((usb_handle_t *)handle)->counters.transfers++;
+  int ret = libusb_bulk_transfer(((usb_handle_t *)handle)->device,
+                                 (endpoint | direction), buffer, size,
                                  bytes_transferred, timeout);
 
   if (ret != LIBUSB_SUCCESS)
-    fprintf(stderr, "\nIO error: bulk_transfer: %s\n", libusb_error_name(ret));
+    minipro_log("\nIO error: bulk_transfer: %s\n", libusb_error_name(ret));
   return ret;
 }
 
 static int payload_transfer(void *handle, uint8_t direction,
                             uint8_t *ep2_buffer, size_t ep2_length,
                             uint8_t *ep3_buffer, size_t ep3_length) {
+  usb_handle_t *usb = handle;
   struct libusb_transfer *ep2_urb;
   struct libusb_transfer *ep3_urb;
   int ret;
@@ -142,43 +257,48 @@ static int payload_transfer(void *handle, uint8_t direction,
   ep2_urb = libusb_alloc_transfer(0);
   ep3_urb = libusb_alloc_transfer(0);
   if (ep2_urb == NULL || ep3_urb == NULL) {
-    fprintf(stderr, "Out of memory!\n");
+    minipro_log("Out of memory!\n");
     return EXIT_FAILURE;
   }
 
-  libusb_fill_bulk_transfer(ep2_urb, handle, (0x02 | direction), ep2_buffer,
-                            ep2_length, payload_transfer_cb, &ep2_completed,
-                            MP_USBTIMEOUT);
-  libusb_fill_bulk_transfer(ep3_urb, handle, (0x03 | direction), ep3_buffer,
-                            ep3_length, payload_transfer_cb, &ep3_completed,
-                            MP_USBTIMEOUT);
+  libusb_fill_bulk_transfer(ep2_urb, usb->device, (0x02 | direction),
+                            ep2_buffer, ep2_length, payload_transfer_cb,
+                            &ep2_completed, MP_USBTIMEOUT);
+  libusb_fill_bulk_transfer(ep3_urb, usb->device, (0x03 | direction),
+                            ep3_buffer, ep3_length, payload_transfer_cb,
+                            &ep3_completed, MP_USBTIMEOUT);
 
+  usb->counters.transfers += 2;
   ret = libusb_submit_transfer(ep2_urb);
   if (ret < 0) {
-    fprintf(stderr, "\nIO error: submit_transfer: %s\n",
-            libusb_error_name(ret));
+    minipro_log("\nIO error: submit_transfer: %s\n", libusb_error_name(ret));
     return EXIT_FAILURE;
   }
   ret = libusb_submit_transfer(ep3_urb);
   if (ret < 0) {
-    fprintf(stderr, "\nIO error: submit_transfer: %s\n",
-            libusb_error_name(ret));
+    minipro_log("\nIO error: submit_transfer: %s\n", libusb_error_name(ret));
     return EXIT_FAILURE;
   }
 
   while (!ep2_completed) {
-    ret = libusb_handle_events_completed(NULL, &ep2_completed);
+    ret = libusb_handle_events_completed(usb->context, &ep2_completed);
     if (ret < 0) {
-      if (ret == LIBUSB_ERROR_INTERRUPTED) continue;
+      if (ret == LIBUSB_ERROR_INTERRUPTED) {
+        usb->counters.retries++;
+        continue;
+      }
       libusb_cancel_transfer(ep2_urb);
       libusb_cancel_transfer(ep3_urb);
       continue;
     }
   }
   while (!ep3_completed) {
-    ret = libusb_handle_events_completed(NULL, &ep3_completed);
+    ret = libusb_handle_events_completed(usb->context, &ep3_completed);
     if (ret < 0) {
-      if (ret == LIBUSB_ERROR_INTERRUPTED) continue;
+      if (ret == LIBUSB_ERROR_INTERRUPTED) {
+        usb->counters.retries++;
+        continue;
+      }
       libusb_cancel_transfer(ep2_urb);
       libusb_cancel_transfer(ep3_urb);
       continue;
@@ -186,8 +306,8 @@ static int payload_transfer(void *handle, uint8_t direction,
   }
 
   if (ep2_urb->status != 0 || ep3_urb->status != 0) {
-    fprintf(
-        stderr, "\nIO Error: Async transfer failed: %s\n",
+    minipro_log(
+        "\nIO Error: Async transfer failed: %s\n",
         libusb_error_name(ep2_urb->status ? ep2_urb->status : ep3_urb->status));
     libusb_free_transfer(ep2_urb);
     libusb_free_transfer(ep3_urb);
@@ -254,7 +374,7 @@ int read_payload(void *handle, uint8_t *buffer, size_t length) {
   // More than 64 bytes
   uint8_t *data = malloc(length);
   if (!data) {
-    fprintf(stderr, "\nOut of memory\n");
+    minipro_log("\nOut of memory\n");
     return EXIT_FAILURE;
   }
 
@@ -285,8 +405,8 @@ int msg_send(void *handle, uint8_t *buffer, size_t size) {
   ret = msg_transfer(handle, buffer, size, LIBUSB_ENDPOINT_OUT, 0x01,
                      &bytes_transferred, MP_USBTIMEOUT);
   if (bytes_transferred != (int)size) {
-    fprintf(stderr, "IO error: expected %zu bytes but %u bytes transferred\n",
-            size, bytes_transferred);
+    minipro_log("IO error: expected %zu bytes but %u bytes transferred\n",
+                size, bytes_transferred);
     return EXIT_FAILURE;
   }
   return ret;
@@ -297,3 +417,149 @@ int msg_recv(void *handle, uint8_t *buffer, size_t size) {
   return msg_transfer(handle, buffer, size, LIBUSB_ENDPOINT_IN, 0x01,
                       &bytes_transferred, MP_USB_READ_TIMEOUT);
 }
+
+// Transfers of a queued message exchange
+typedef struct batch_slot {
+  struct libusb_transfer *out;
+  struct libusb_transfer *in;
+  int out_done;
+  int in_done;
+} batch_slot_t;
+
+static int batch_submit(void *handle, msg_exchange_t *exchange,
+                        batch_slot_t *slot) {
+  usb_handle_t *usb = handle;
+  libusb_device_handle *device = usb->device;
+  int ret;
+
+  // Not submitted transfers count as done
+  slot->out_done = 1;
+  slot->in_done = 1;
+  slot->out = libusb_alloc_transfer(0);
+  slot->in = exchange->response ? libusb_alloc_transfer(0) : NULL;
+  if (!slot->out || (exchange->response && !slot->in)) {
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+
+  libusb_fill_bulk_transfer(slot->out, device, (0x01 | LIBUSB_ENDPOINT_OUT),
+                            exchange->command, exchange->command_size,
+                            payload_transfer_cb, &slot->out_done,
+                            MP_USBTIMEOUT);
+  slot->out_done = 0;
+  usb->counters.transfers++;
+  ret = libusb_submit_transfer(slot->out);
+  if (ret < 0) {
+    slot->out_done = 1;
+    minipro_log("\nIO error: submit_transfer: %s\n", libusb_error_name(ret));
+    return EXIT_FAILURE;
+  }
+  if (!slot->in) return EXIT_SUCCESS;
+
+  libusb_fill_bulk_transfer(slot->in, device, (0x01 | LIBUSB_ENDPOINT_IN),
+                            exchange->response, exchange->response_size,
+                            payload_transfer_cb, &slot->in_done,
+                            MP_USB_READ_TIMEOUT);
+  slot->in_done = 0;
+  usb->counters.transfers++;
+  ret = libusb_submit_transfer(slot->in);
+  if (ret < 0) {
+    slot->in_done = 1;
+    minipro_log("\nIO error: submit_transfer: %s\n", libusb_error_name(ret));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int batch_wait(usb_handle_t *usb, int *completed) {
+  int ret;
+  while (!*completed) {
+    ret = libusb_handle_events_completed(usb->context, completed);
+    if (ret == LIBUSB_ERROR_INTERRUPTED) usb->counters.retries++;
+    if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+      minipro_log("\nIO error: handle_events: %s\n", libusb_error_name(ret));
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+static void batch_free(batch_slot_t *slot) {
+  if (slot->out) libusb_free_transfer(slot->out);
+  if (slot->in) libusb_free_transfer(slot->in);
+  slot->out = slot->in = NULL;
+}
+
+/*
+ Run command/response exchanges on the message endpoint keeping up to
+ 'depth' of them in flight, instead of waiting for each response before
+ sending the next command. Exchanges complete in order and 'done' is
+ called for each one, so the caller can process it while the next ones
+ are transferred.
+ */
+int msg_batch(void *handle, msg_exchange_t *exchanges, size_t count,
+              size_t depth, msg_done_cb done, void *context) {
+  usb_handle_t *usb = handle;
+  batch_slot_t *slots;
+  size_t first = 0, next = 0;
+  int ret = EXIT_SUCCESS;
+
+  if (!count) return EXIT_SUCCESS;
+  slots = calloc(count, sizeof(batch_slot_t));
+  if (!slots) {
+    minipro_log("Out of memory!\n");
+    return EXIT_FAILURE;
+  }
+
+  while (first < count) {
+    while (next < count && next - first < (depth ? depth : 1)) {
+      ret = batch_submit(handle, &exchanges[next], &slots[next]);
+      next++;
+      if (ret) goto drain;
+    }
+
+    // Wait for the oldest exchange
+    if (batch_wait(usb, &slots[first].out_done) ||
+        batch_wait(usb, &slots[first].in_done)) {
+      ret = EXIT_FAILURE;
+      goto drain;
+    }
+    if (slots[first].out->status != LIBUSB_TRANSFER_COMPLETED ||
+        slots[first].out->actual_length != slots[first].out->length ||
+        (slots[first].in &&
+         slots[first].in->status != LIBUSB_TRANSFER_COMPLETED)) {
+      minipro_log("\nIO error: message transfer failed\n");
+      ret = EXIT_FAILURE;
+      goto drain;
+    }
+    if (slots[first].in &&
+        (size_t)slots[first].in->actual_length <
+            exchanges[first].response_min) {
+      minipro_log("\nIO error: short response, %d of %zu bytes\n",
+                  slots[first].in->actual_length,
+                  exchanges[first].response_min);
+      ret = EXIT_FAILURE;
+      goto drain;
+    }
+    batch_free(&slots[first]);
+    if (done) done(context, first);
+    first++;
+  }
+  free(slots);
+  return EXIT_SUCCESS;
+
+drain:
+  // Cancel the exchanges still in flight and wait for them
+  for (; first < next; first++) {
+    if (!slots[first].out_done) libusb_cancel_transfer(slots[first].out);
+    if (!slots[first].in_done) libusb_cancel_transfer(slots[first].in);
+  }
+  for (first = 0; first < next; first++) {
+    if (batch_wait(usb, &slots[first].out_done) ||
+        batch_wait(usb, &slots[first].in_done))
+      break;
+  }
+  for (first = 0; first < next; first++) batch_free(&slots[first]);
+  free(slots);
+  return ret;
+}
@@ -21,6 +21,7 @@
 #include <windows.h>
 #include <setupapi.h>
 #include <winusb.h>
+#include "minipro.h"
 #include "usb.h"
 
 #define TL866A_IOCTL_READ 0x222004
@@ -28,8 +29,6 @@
 #define MP_USBTIMEOUT 5000
 #define USB_ENDPOINT_OUT 0x00
 #define USB_ENDPOINT_IN 0x80
-#define MP_TL866IIPLUS 5
-#define MP_TL866A 2
 
 #define TL866A_GUID                                  \
   {                                                  \
@@ -45,7 +44,7 @@
   }
 
 // Internaly used functions prototypes
-static int search_devices(uint8_t, char **);
+static int search_devices(uint8_t, usb_device_t *, size_t);
 static int usb_write(void *, uint8_t *, size_t, uint8_t);
 static int usb_read(void *, uint8_t *, size_t, uint8_t);
 static int payload_transfer(void *, uint8_t, uint8_t *, size_t, uint8_t *,
@@ -55,68 +54,99 @@ static int payload_transfer(void *, uint8_t, uint8_t *, size_t, uint8_t *,
 typedef struct usb_handle {
   HANDLE DeviceHandle;
   WINUSB_INTERFACE_HANDLE InterfaceHandle;
+  char path[USB_PATH_SIZE];
+  usb_counters_t counters;
 } usb_handle_t;
 
-// Open usb device
-void *usb_open() {
-  char *device_path;
-
+// Open a programmer found by search_devices
+static usb_handle_t *open_device(usb_device_t *device) {
   // Alocate memory for the usb handle structure
-  usb_handle_t *handle = malloc(sizeof(usb_handle_t));
+  usb_handle_t *handle = calloc(1, sizeof(usb_handle_t));
   if (!handle) {
-    fprintf(stderr, "Out of memory!\n");
+    minipro_log("Out of memory!\n");
     return NULL;
   }
 
-  handle->DeviceHandle = INVALID_HANDLE_VALUE;
   handle->InterfaceHandle = NULL;
+  strcpy(handle->path, device->path);
 
-  // First search for TL866A/CS
-  int count = search_devices(MP_TL866A, &device_path);
-  if (count) {
+  // TL866A/CS
+  if (device->version == MP_TL866A) {
     handle->DeviceHandle = CreateFileA(
-        device_path, GENERIC_READ | GENERIC_WRITE,
+        device->path, GENERIC_READ | GENERIC_WRITE,
         FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-    free(device_path);
     if (handle->DeviceHandle == INVALID_HANDLE_VALUE) {
-      fprintf(stderr, "\nError opening device\n");
       free(handle);
       return NULL;
     }
     return handle;
   }
 
-  // Then search for TL866II+
-  count = search_devices(MP_TL866IIPLUS, &device_path);
-  if (count) {
-    handle->DeviceHandle =
-        CreateFileA(device_path, GENERIC_READ | GENERIC_WRITE,
-                    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
-                    FILE_FLAG_OVERLAPPED, NULL);
-    free(device_path);
-    if (handle->DeviceHandle == INVALID_HANDLE_VALUE) {
-      fprintf(stderr, "\nError opening device\n");
-      free(handle);
-      return NULL;
-    }
-
-    if (WinUsb_Initialize(handle->DeviceHandle, &handle->InterfaceHandle)) {
-      uint8_t value = 1;
-      WinUsb_SetPipePolicy(handle->InterfaceHandle, 0x81, AUTO_FLUSH, 1,
-                           &value);
-      WinUsb_SetPipePolicy(handle->InterfaceHandle, 0x82, AUTO_FLUSH, 1,
-                           &value);
-      WinUsb_SetPipePolicy(handle->InterfaceHandle, 0x83, AUTO_FLUSH, 1,
-                           &value);
-      return handle;
-    }
+  // TL866II+
+  handle->DeviceHandle =
+      CreateFileA(device->path, GENERIC_READ | GENERIC_WRITE,
+                  FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                  FILE_FLAG_OVERLAPPED, NULL);
+  if (handle->DeviceHandle == INVALID_HANDLE_VALUE) {
+    free(handle);
+    return NULL;
   }
 
-  fprintf(stderr, "\nError opening device\n");
+  if (WinUsb_Initialize(handle->DeviceHandle, &handle->InterfaceHandle)) {
+    uint8_t value = 1;
+    WinUsb_SetPipePolicy(handle->InterfaceHandle, 0x81, AUTO_FLUSH, 1, &value);
+    WinUsb_SetPipePolicy(handle->InterfaceHandle, 0x82, AUTO_FLUSH, 1, &value);
+    WinUsb_SetPipePolicy(handle->InterfaceHandle, 0x83, AUTO_FLUSH, 1, &value);
+    return handle;
+  }
+  CloseHandle(handle->DeviceHandle);
   free(handle);
   return NULL;
 }
 
+// List the attached programmers, the TL866A/CS ones first
+int usb_list_devices(usb_device_t **devices) {
+  size_t size = search_devices(MP_TL866A, NULL, 0) +
+                search_devices(MP_TL866IIPLUS, NULL, 0);
+  *devices = calloc(size ? size : 1, sizeof(usb_device_t));
+  if (!*devices) {
+    minipro_log("Out of memory!\n");
+    return -1;
+  }
+  int count = search_devices(MP_TL866A, *devices, size);
+  return count + search_devices(MP_TL866IIPLUS, *devices + count,
+                                size - count);
+}
+
+/*
+ Open the programmer with the given device path, or the first one not in
+ use by another process if path is NULL.
+ */
+void *usb_open(const char *path) {
+  usb_device_t *devices;
+  usb_handle_t *handle = NULL;
+  int i, count = usb_list_devices(&devices);
+
+  for (i = 0; i < count && !handle; i++) {
+    if (path && strcmp(path, devices[i].path)) continue;
+    handle = open_device(&devices[i]);
+    if (path) break;
+  }
+  if (count >= 0) free(devices);
+
+  if (!handle) minipro_log("\nError opening device\n");
+  return handle;
+}
+
+// Device path of an open programmer
+void usb_get_path(void *handle, char *path) {
+  strcpy(path, ((usb_handle_t *)handle)->path);
+}
+
+void usb_get_counters(void *handle, usb_counters_t *counters) {
+  *counters = ((usb_handle_t *)handle)->counters;
+}
+
 // Close usb device
 int usb_close(void *handle) {
   if (((usb_handle_t *)handle)->InterfaceHandle)
@@ -128,7 +158,7 @@ int usb_close(void *handle) {
 
 // Get no. of devices connected
 int minipro_get_devices_count(uint8_t version) {
-  return search_devices(version, NULL);
+  return search_devices(version, NULL, 0);
 }
 
 // synchronously message send
@@ -141,6 +171,21 @@ int msg_recv(void *handle, uint8_t *buffer, size_t size) {
   return usb_read(handle, buffer, size, USB_ENDPOINT_IN | 0x01);
 }
 
+// Message exchanges, one at a time
+int msg_batch(void *handle, msg_exchange_t *exchanges, size_t count,
+              size_t depth, msg_done_cb done, void *context) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    if (msg_send(handle, exchanges[i].command, exchanges[i].command_size))
+      return EXIT_FAILURE;
+    if (exchanges[i].response &&
+        msg_recv(handle, exchanges[i].response, exchanges[i].response_size))
+      return EXIT_FAILURE;
+    if (done) done(context, i);
+  }
+  return EXIT_SUCCESS;
+}
+
 // Write payload asynchronously
 int write_payload(void *handle, uint8_t *buffer, size_t length) {
   uint32_t ep2_length;
@@ -191,7 +236,7 @@ int read_payload(void *handle, uint8_t *buffer, size_t length) {
   // More than 64 bytes
   uint8_t *data = malloc(length);
   if (!data) {
-    fprintf(stderr, "\nOut of memory\n");
+    minipro_log("\nOut of memory\n");
     return EXIT_FAILURE;
   }
 
@@ -230,17 +275,19 @@ static int payload_transfer(void *handle, uint8_t direction,
   // Create events
   hEvent1 = CreateEvent(NULL, TRUE, FALSE, NULL);
   if (!hEvent1) {
-    fprintf(stderr, "\nIO Error: Async transfer failed.\n");
+    minipro_log("\nIO Error: Async transfer failed.\n");
     return EXIT_FAILURE;
   }
 
   hEvent2 = CreateEvent(NULL, TRUE, FALSE, NULL);
   if (!hEvent2) {
-    fprintf(stderr, "\nIO Error: Async transfer failed.\n");
+    minipro_log("\nIO Error: Async transfer failed.\n");
     CloseHandle(hEvent1);
     return EXIT_FAILURE;
   }
 
+  ((usb_handle_t *)handle)->counters.transfers += 2;
+
   // Asign events to each overlapped sructure
   ResetEvent(hEvent1);
   ResetEvent(hEvent2);
@@ -274,7 +321,7 @@ static int payload_transfer(void *handle, uint8_t direction,
   CloseHandle(hEvent2);
 
   if (ret1 || ret2) {
-    fprintf(stderr, "\nIO Error: Async transfer failed.\n");
+    minipro_log("\nIO Error: Async transfer failed.\n");
     return EXIT_FAILURE;
   }
   return EXIT_SUCCESS;
@@ -289,12 +336,13 @@ static int usb_write(void *handle, uint8_t *buffer, size_t size,
 
   // Check the device handle first
   if (((usb_handle_t *)handle)->DeviceHandle == INVALID_HANDLE_VALUE) return 0;
+  ((usb_handle_t *)handle)->counters.transfers++;
 
   // If winusb handle is set then use winusb(TL866II+)
   if (((usb_handle_t *)handle)->InterfaceHandle) {
     ret = WinUsb_WritePipe(((usb_handle_t *)handle)->InterfaceHandle, endpoint,
                            buffer, size, &bytes_written, NULL);
-    if (!ret) fprintf(stderr, "\nIO Error: USB write failed.\n");
+    if (!ret) minipro_log("\nIO Error: USB write failed.\n");
     return (ret ? EXIT_SUCCESS : EXIT_FAILURE);
   }
 
@@ -303,7 +351,7 @@ static int usb_write(void *handle, uint8_t *buffer, size_t size,
   ret = DeviceIoControl(((usb_handle_t *)handle)->DeviceHandle,
                         TL866A_IOCTL_WRITE, buffer, size, temp, 256,
                         &bytes_written, NULL);
-  if (!ret) fprintf(stderr, "\nIO Error: USB write failed.\n");
+  if (!ret) minipro_log("\nIO Error: USB write failed.\n");
   return (ret ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
@@ -316,12 +364,13 @@ static int usb_read(void *handle, uint8_t *buffer, size_t size,
 
   // Check the device handle first
   if (((usb_handle_t *)handle)->DeviceHandle == INVALID_HANDLE_VALUE) return 0;
+  ((usb_handle_t *)handle)->counters.transfers++;
 
   // If winusb handle is set then use winusb(TL866II+)
   if (((usb_handle_t *)handle)->InterfaceHandle) {
     ret = WinUsb_ReadPipe(((usb_handle_t *)handle)->InterfaceHandle, endpoint,
                           buffer, size, &bytes_read, NULL);
-    if (!ret) fprintf(stderr, "\nIO Error: USB read failed.\n");
+    if (!ret) minipro_log("\nIO Error: USB read failed.\n");
     return (ret ? EXIT_SUCCESS : EXIT_FAILURE);
   }
 
@@ -330,18 +379,18 @@ static int usb_read(void *handle, uint8_t *buffer, size_t size,
   ret =
       DeviceIoControl(((usb_handle_t *)handle)->DeviceHandle, TL866A_IOCTL_READ,
                       &tmp, sizeof(tmp), buffer, size, &bytes_read, NULL);
-  if (!ret) fprintf(stderr, "\nIO Error: USB read failed.\n");
+  if (!ret) minipro_log("\nIO Error: USB read failed.\n");
   return (ret ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
 /* This function will scan for connected devices.
- *  If the device_path is not null then this function will
- *  return here the path of the first device found.
- *  Don't forget to call free(device_path) to free the allocated memory.
+ *  If devices is not null then this function will
+ *  return there the paths of at most max devices found.
  */
-static int search_devices(uint8_t version, char **device_path) {
+static int search_devices(uint8_t version, usb_device_t *devices,
+                          size_t max) {
   uint32_t idx = 0;
-  uint32_t devices = 0;
+  uint32_t found = 0;
 
   GUID guid =
       (version == MP_TL866IIPLUS) ? (GUID)TL866IIPLUS_GUID : (GUID)TL866A_GUID;
@@ -350,7 +399,7 @@ static int search_devices(uint8_t version, char **device_path) {
                                         DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
 
   if (!handle) {
-    fprintf(stderr, "SetupDi failed!\n");
+    minipro_log("SetupDi failed!\n");
     return 0;
   }
 
@@ -378,13 +427,15 @@ static int search_devices(uint8_t version, char **device_path) {
       if (SetupDiGetDeviceInterfaceDetail(handle, &deviceinterfacedata,
                                           deviceinterfacedetaildata, datasize,
                                           &size, NULL)) {
-        if (!devices && device_path) {
-          *device_path = strdup(deviceinterfacedetaildata->DevicePath);
+        if (devices && found < max) {
+          devices[found].version = version;
+          strncpy(devices[found].path, deviceinterfacedetaildata->DevicePath,
+                  USB_PATH_SIZE - 1);
         }
-        devices++;
+        found++;
       }
       free(deviceinterfacedetaildata);
     }
   }
-  return devices;
+  return devices && found > max ? max : found;
 }